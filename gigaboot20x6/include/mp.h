@@ -0,0 +1,96 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+#include <efi.h>
+
+// EFI_MP_SERVICES_PROTOCOL, from the PI spec (volume 2, 13.4)
+
+#define EFI_MP_SERVICES_PROTOCOL_GUID \
+    {0x3fdda605, 0xa76e, 0x4f46,{0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08}}
+
+#define PROCESSOR_AS_BSP_BIT 0x00000001
+#define PROCESSOR_ENABLED_BIT 0x00000002
+#define PROCESSOR_HEALTH_STATUS_BIT 0x00000004
+
+struct _EFI_MP_SERVICES_PROTOCOL;
+
+typedef struct {
+    UINT32 Package;
+    UINT32 Core;
+    UINT32 Thread;
+} EFI_CPU_PHYSICAL_LOCATION;
+
+typedef struct {
+    UINT64 ProcessorId;
+    UINT32 StatusFlag;
+    EFI_CPU_PHYSICAL_LOCATION Location;
+} EFI_PROCESSOR_INFORMATION;
+
+// Runs on an AP, which may not call boot services
+typedef VOID (EFIAPI *EFI_AP_PROCEDURE)(IN VOID *ProcedureArgument);
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS)(
+    IN struct _EFI_MP_SERVICES_PROTOCOL *This,
+    OUT UINTN *NumberOfProcessors,
+    OUT UINTN *NumberOfEnabledProcessors);
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_GET_PROCESSOR_INFO)(
+    IN struct _EFI_MP_SERVICES_PROTOCOL *This,
+    IN UINTN ProcessorNumber,
+    OUT EFI_PROCESSOR_INFORMATION *ProcessorInfoBuffer);
+
+// With a WaitEvent this returns at once, and signals the event when
+// every AP has returned from Procedure
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_STARTUP_ALL_APS)(
+    IN struct _EFI_MP_SERVICES_PROTOCOL *This,
+    IN EFI_AP_PROCEDURE Procedure,
+    IN BOOLEAN SingleThread,
+    IN EFI_EVENT WaitEvent OPTIONAL,
+    IN UINTN TimeoutInMicroSeconds,
+    IN VOID *ProcedureArgument OPTIONAL,
+    OUT UINTN **FailedCpuList OPTIONAL);
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_STARTUP_THIS_AP)(
+    IN struct _EFI_MP_SERVICES_PROTOCOL *This,
+    IN EFI_AP_PROCEDURE Procedure,
+    IN UINTN ProcessorNumber,
+    IN EFI_EVENT WaitEvent OPTIONAL,
+    IN UINTN TimeoutInMicroseconds,
+    IN VOID *ProcedureArgument OPTIONAL,
+    OUT BOOLEAN *Finished OPTIONAL);
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_SWITCH_BSP)(
+    IN struct _EFI_MP_SERVICES_PROTOCOL *This,
+    IN UINTN ProcessorNumber,
+    IN BOOLEAN EnableOldBSP);
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_ENABLEDISABLEAP)(
+    IN struct _EFI_MP_SERVICES_PROTOCOL *This,
+    IN UINTN ProcessorNumber,
+    IN BOOLEAN EnableAP,
+    IN UINT32 *HealthFlag OPTIONAL);
+
+typedef EFI_STATUS (EFIAPI *EFI_MP_SERVICES_WHOAMI)(
+    IN struct _EFI_MP_SERVICES_PROTOCOL *This,
+    OUT UINTN *ProcessorNumber);
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL {
+    EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS GetNumberOfProcessors;
+    EFI_MP_SERVICES_GET_PROCESSOR_INFO GetProcessorInfo;
+    EFI_MP_SERVICES_STARTUP_ALL_APS StartupAllAPs;
+    EFI_MP_SERVICES_STARTUP_THIS_AP StartupThisAP;
+    EFI_MP_SERVICES_SWITCH_BSP SwitchBSP;
+    EFI_MP_SERVICES_ENABLEDISABLEAP EnableDisableAP;
+    EFI_MP_SERVICES_WHOAMI WhoAmI;
+} EFI_MP_SERVICES_PROTOCOL;
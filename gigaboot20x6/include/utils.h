@@ -28,6 +28,17 @@ EFI_STATUS CloseProtocol(EFI_HANDLE h, EFI_GUID* guid);
 
 void* LoadFile(CHAR16* filename, UINTN* size_out);
 
+// The processor's time stamp counter
+static inline UINT64 rdtsc(void) {
+    UINT32 lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((UINT64)hi << 32) | lo;
+}
+
+// How far rdtsc() advances in a millisecond, measured (with a 1ms
+// Stall) the first time it is asked
+UINT64 tsc_per_ms(void);
+
 // GUIDs
 extern EFI_GUID SimpleFileSystemProtocol;
 extern EFI_GUID FileInfoGUID;
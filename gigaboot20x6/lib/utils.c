@@ -103,6 +103,19 @@ EFI_STATUS CloseProtocol(EFI_HANDLE h, EFI_GUID* guid) {
     return gBS->CloseProtocol(h, guid, gImg, NULL);
 }
 
+UINT64 tsc_per_ms(void) {
+    static UINT64 per_ms;
+
+    if (per_ms == 0) {
+        UINT64 t = rdtsc();
+        gBS->Stall(1000);
+        if ((per_ms = rdtsc() - t) == 0) {
+            per_ms = 1;
+        }
+    }
+    return per_ms;
+}
+
 const char *efi_strerror(EFI_STATUS status)
 {
     size_t i = (~EFI_ERROR_MASK & status);
@@ -0,0 +1,754 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The AX88772 driver run against a mock of the device.
+//
+// Link: Initialize has to return without waiting for the link, and
+// the link has to come up soon after the PHY has negotiated it, polled
+// the way netifc polls.  It has to be seen to go down and come back
+// when the cable is pulled and put back, or when the device stops
+// answering for a while, and the MAC has to follow the speed and
+// duplex the PHY settles on.  Times are the mock's virtual ones.
+//
+// Transmit: every frame handed to Transmit has to come out of the bulk
+// transfers intact and in order, and every buffer has to come back from
+// GetStatus exactly once.  Then the time the bus is kept busy, per
+// frame, batching the way the driver does against one bulk transfer
+// per frame.  Those times are the mock's, not any real controller's.
+//
+// Receive: bulk in buffers, made up or captured, are replayed through
+// Receive, and every frame in them has to come out of it intact and in
+// order.  Then the processor time Receive takes per frame, against the
+// copy into a queue slot and then into the caller's buffer it used to
+// make.
+//
+// A capture (-r) is what bulk in transfers returned, each as a 32 bit
+// little endian length followed by that many bytes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "axmock.h"
+
+EFI_STATUS SN_Setup(NIC_DEVICE* pNicDevice);
+
+static char* appname;
+
+static axmock ax;
+static NIC_DEVICE* nic;
+static EFI_SIMPLE_NETWORK* snp;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define MAX_FRAME 1514
+#define NBUFS 256
+
+typedef struct {
+    uint8_t data[MAX_FRAME];
+    int busy; // with the driver
+} txbuf;
+
+static txbuf bufs[NBUFS];
+
+static uint32_t next_out; // sequence number of the next frame sent
+static uint32_t next_in;  // of the next one the mock should see
+static int bad;
+
+// The contents of frame seq
+static void fill(uint8_t* data, size_t len, uint32_t seq) {
+    for (size_t n = 0; n < len; n++) {
+        data[n] = (uint8_t)(seq * 7 + n);
+    }
+    if (len >= 18) {
+        memcpy(data + 14, &seq, 4);
+    }
+}
+
+static uint16_t lens[1 << 16]; // of each frame, by sequence number
+
+static void on_tx(void* cookie, const uint8_t* frame, size_t len) {
+    uint32_t seq = next_in++;
+    size_t want = lens[seq & 0xffff];
+    uint8_t data[MAX_FRAME];
+
+    if (bad) {
+        return;
+    }
+    fill(data, want, seq);
+    if ((len != ((want < 60) ? 60 : want)) || memcmp(frame, data, want)) {
+        printf("FAIL: frame %u came out wrong\n", seq);
+        bad = 1;
+        return;
+    }
+    for (size_t n = want; n < len; n++) {
+        if (frame[n] != 0) {
+            printf("FAIL: frame %u padded with junk\n", seq);
+            bad = 1;
+            return;
+        }
+    }
+}
+
+static txbuf* get_buf(void) {
+    for (int n = 0; n < NBUFS; n++) {
+        if (!bufs[n].busy) {
+            return &bufs[n];
+        }
+    }
+    return NULL;
+}
+
+// Take back every buffer the driver is done with
+static int reap(void) {
+    UINT32 irq;
+    VOID* done;
+    int count = 0;
+
+    for (;;) {
+        if (snp->GetStatus(snp, &irq, &done) || (done == NULL)) {
+            return count;
+        }
+        txbuf* b = (txbuf*)((uint8_t*)done - offsetof(txbuf, data));
+        if ((b < bufs) || (b >= &bufs[NBUFS]) || !b->busy) {
+            printf("FAIL: GetStatus returned %p, not a buffer being sent\n", done);
+            bad = 1;
+            return count;
+        }
+        b->busy = 0;
+        count++;
+    }
+}
+
+// Like netifc's eth_send(): wait for room if the driver says to
+static int send(size_t len) {
+    txbuf* b;
+    EFI_STATUS r;
+
+    while ((b = get_buf()) == NULL) {
+        reap();
+    }
+    fill(b->data, len, next_out);
+    lens[next_out & 0xffff] = len;
+    b->busy = 1;
+    while ((r = snp->Transmit(snp, 0, len, b->data, NULL, NULL, NULL)) == EFI_NOT_READY) {
+        reap();
+    }
+    if (r) {
+        printf("FAIL: Transmit returned %lx\n", (unsigned long)r);
+        bad = 1;
+        b->busy = 0;
+        return -1;
+    }
+    next_out++;
+    return 0;
+}
+
+// Receive frames until there are none, handing each to got (if set)
+static size_t drain(void (*got)(const uint8_t* frame, size_t len, UINT16 proto)) {
+    UINT8 frame[MAX_FRAME];
+    UINTN hsz, bsz;
+    UINT16 proto;
+    size_t count = 0;
+
+    for (;;) {
+        hsz = 0;
+        bsz = sizeof(frame);
+        if (snp->Receive(snp, &hsz, &bsz, frame, NULL, NULL, &proto) != EFI_SUCCESS) {
+            return count;
+        }
+        if (got) {
+            got(frame, bsz, proto);
+        }
+        count++;
+    }
+}
+
+// Like netifc_poll(): an empty receive is when the driver sends what
+// it has been holding
+static void poll(void) {
+    reap();
+    drain(NULL);
+    reap();
+}
+
+static int check(const char* what) {
+    poll();
+    if (next_in != next_out) {
+        printf("FAIL: %s: %u frames sent, device saw %u\n", what, next_out, next_in);
+        bad = 1;
+    }
+    if (ax.tx_errors) {
+        printf("FAIL: %s: %llu malformed bulk transfers\n", what,
+               (unsigned long long)ax.tx_errors);
+        bad = 1;
+    }
+    for (int n = 0; n < NBUFS; n++) {
+        if (bufs[n].busy) {
+            printf("FAIL: %s: buffer %d never returned\n", what, n);
+            bad = 1;
+            break;
+        }
+    }
+    return bad;
+}
+
+typedef struct {
+    const char* name;
+    size_t len;   // of each frame
+    size_t burst; // frames sent between polls
+} workload;
+
+static const workload loads[] = {
+    { "acks", 60, 4 },
+    { "acks", 60, 32 },
+    { "mixed", 590, 16 },
+    { "upload", 1514, 64 },
+};
+
+static void tx_run(const workload* w, size_t count, int batch) {
+    uint64_t t, xfers, bytes;
+
+    xfers = ax.tx_transfers;
+    t = axmock_now();
+    for (size_t n = 0; n < count;) {
+        for (size_t k = 0; (k < w->burst) && (n < count); k++, n++) {
+            send(w->len);
+            if (!batch) {
+                // as the driver did: a transfer of its own for each
+                Ax88772TxFlush(nic);
+            }
+        }
+        poll();
+    }
+    t = axmock_now() - t;
+    xfers = ax.tx_transfers - xfers;
+    bytes = count * w->len;
+    printf("tx %-8s %4zu byte frames, %3zu per burst, %s: %6.3f transfers/frame, "
+           "%6.2f us/frame, %7.2f MB/s\n",
+           w->name, w->len, w->burst, batch ? "batched" : "one each",
+           (double)xfers / count, t / 1e3 / count, bytes / (t / 1e3));
+}
+
+static void tx_tests(size_t count) {
+    uint32_t seed = 1;
+
+    // Random lengths, runts among them, in random bursts: everything
+    // comes through, however it is packed
+    for (int n = 0; n < 20000; n++) {
+        seed = seed * 1103515245 + 12345;
+        size_t len = 14 + (seed >> 8) % (MAX_FRAME - 13);
+        send(len);
+        if (((seed >> 4) % 7) == 0) {
+            poll();
+        }
+    }
+    check("random frames");
+
+    // Every frame length, alone and after others, so that frames end
+    // on a packet boundary every way they can
+    for (size_t len = 60; len <= MAX_FRAME; len++) {
+        send(len);
+        poll();
+        send(len);
+        send(len);
+        poll();
+    }
+    check("packet boundaries");
+
+    // A frame nobody pushes out goes out on its own once the deadline
+    // passes, and not before
+    uint64_t xfers = ax.tx_transfers;
+    send(100);
+    axmock_advance(TX_FLUSH_DEADLINE * 100 / 2);
+    reap();
+    if (ax.tx_transfers != xfers) {
+        printf("FAIL: a frame went before its deadline\n");
+        bad = 1;
+    }
+    axmock_advance(TX_FLUSH_DEADLINE * 100);
+    reap();
+    if (ax.tx_transfers != xfers + 1) {
+        printf("FAIL: a frame was held past its deadline\n");
+        bad = 1;
+    }
+    check("deadline");
+
+    if (bad) {
+        return;
+    }
+    printf("tx: all %u frames came through intact\n", next_out);
+
+    for (size_t n = 0; n < (sizeof(loads) / sizeof(loads[0])); n++) {
+        tx_run(&loads[n], count, 0);
+        tx_run(&loads[n], count, 1);
+    }
+    check("workloads");
+}
+
+// What bulk in transfers return, in order
+typedef struct {
+    uint8_t* data;
+    size_t len;
+} capture;
+
+static capture* caps;
+static size_t ncaps;
+static size_t next_cap;
+
+static int on_rx(void* cookie, uint8_t* data, size_t* len) {
+    capture* c;
+
+    if (next_cap == ncaps) {
+        return -1;
+    }
+    c = &caps[next_cap++];
+    if (c->len > *len) {
+        printf("FAIL: capture %zu is bigger than the driver's buffer\n", next_cap - 1);
+        bad = 1;
+        return -1;
+    }
+    memcpy(data, c->data, c->len);
+    *len = c->len;
+    return 0;
+}
+
+static void free_captures(void) {
+    for (size_t n = 0; n < ncaps; n++) {
+        free(caps[n].data);
+    }
+    free(caps);
+    caps = NULL;
+    ncaps = 0;
+    next_cap = 0;
+}
+
+static capture* add_capture(size_t len) {
+    if ((ncaps % 64) == 0) {
+        caps = realloc(caps, (ncaps + 64) * sizeof(capture));
+    }
+    if ((caps == NULL) || ((caps[ncaps].data = malloc(len ? len : 1)) == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        exit(1);
+    }
+    caps[ncaps].len = len;
+    return &caps[ncaps++];
+}
+
+// Pack count frames, of the lengths len() picks and numbered from 0,
+// into bulk in transfers the way the device does
+static size_t make_captures(size_t count, size_t (*len)(size_t n)) {
+    uint8_t buf[MAX_BULKIN_SIZE];
+    size_t off = 0;
+
+    for (size_t n = 0; n < count; n++) {
+        size_t flen = len(n);
+        uint16_t hdr[2] = { flen, ~flen };
+        if ((off + 4 + flen) > sizeof(buf)) {
+            memcpy(add_capture(off)->data, buf, off);
+            off = 0;
+        }
+        memcpy(buf + off, hdr, 4);
+        fill(buf + off + 4, flen, n);
+        lens[n & 0xffff] = flen;
+        off += 4 + ((flen + 3) & ~3);
+    }
+    if (off) {
+        memcpy(add_capture(off)->data, buf, off);
+    }
+    return count;
+}
+
+static size_t read_captures(const char* fn) {
+    FILE* fp = fopen(fn, "rb");
+    uint8_t lenb[4];
+    size_t frames = 0;
+
+    if (fp == NULL) {
+        fprintf(stderr, "%s: cannot open '%s'\n", appname, fn);
+        exit(1);
+    }
+    while (fread(lenb, 4, 1, fp) == 1) {
+        size_t len = lenb[0] | (lenb[1] << 8) | (lenb[2] << 16) | ((size_t)lenb[3] << 24);
+        capture* c;
+        if (len > MAX_BULKIN_SIZE) {
+            fprintf(stderr, "%s: '%s': a %zu byte bulk in?\n", appname, fn, len);
+            exit(1);
+        }
+        c = add_capture(len);
+        if (fread(c->data, len, 1, fp) != 1) {
+            fprintf(stderr, "%s: '%s' is cut short\n", appname, fn);
+            exit(1);
+        }
+        // count the frames the way the device lays them out
+        for (size_t off = 0; (off + 4) <= len;) {
+            size_t flen = (c->data[off] | (c->data[off + 1] << 8)) & 0x7ff;
+            off += 4 + ((flen + 3) & ~3);
+            frames++;
+        }
+    }
+    fclose(fp);
+    return frames;
+}
+
+static uint32_t rx_seq; // of the next frame Receive should return
+
+static void got_frame(const uint8_t* frame, size_t len, UINT16 proto) {
+    uint32_t seq = rx_seq++;
+    size_t want = lens[seq & 0xffff];
+    uint8_t data[MAX_FRAME];
+
+    if (bad) {
+        return;
+    }
+    fill(data, want, seq);
+    if ((len != want) || memcmp(frame, data, len) ||
+        ((len >= 14) && (proto != ((data[12] << 8) | data[13])))) {
+        printf("FAIL: received frame %u came out wrong\n", seq);
+        bad = 1;
+    }
+}
+
+static size_t rx_len_random(size_t n) {
+    return 14 + (((n * 2654435761u) >> 7) % (MAX_FRAME - 13));
+}
+
+static size_t rx_len;
+
+static size_t rx_len_fixed(size_t n) {
+    return rx_len;
+}
+
+// What Receive did before: every frame copied into a queue slot, then
+// out of it into the caller's buffer
+static size_t rx_old(const uint8_t* data, size_t len, uint8_t (*slots)[2048], uint8_t* out) {
+    size_t queued = 0;
+
+    for (size_t off = 0; (off + 4) <= len;) {
+        uint16_t hdr[2];
+        memcpy(hdr, data + off, 4);
+        size_t flen = hdr[0] & 0x7ff;
+        if ((((hdr[0] ^ hdr[1]) & 0x7ff) != 0x7ff) || ((off + 4 + flen) > len)) {
+            break;
+        }
+        memcpy(slots[queued], data + off + 4, flen);
+        lens[queued++] = flen;
+        off += 4 + ((flen + 3) & ~3);
+    }
+    for (size_t n = 0; n < queued; n++) {
+        memcpy(out, slots[n], lens[n]);
+    }
+    return queued;
+}
+
+static void rx_run(const workload* w, size_t count) {
+    static uint8_t slots[MAX_BULKIN_SIZE / 64][2048];
+    uint8_t out[MAX_FRAME];
+    uint8_t* in;
+    uint64_t t, t_old, xfers;
+    size_t frames, frames_old = 0;
+
+    if ((in = malloc(MAX_BULKIN_SIZE)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        exit(1);
+    }
+    rx_len = w->len;
+    make_captures(count, rx_len_fixed);
+    xfers = nic->RxTransfers;
+    t = now_ns();
+    frames = drain(NULL);
+    t = now_ns() - t;
+    xfers = nic->RxTransfers - xfers;
+
+    // the same copy in as the mock makes stands in for the bulk in
+    t_old = now_ns();
+    for (size_t n = 0; n < ncaps; n++) {
+        memcpy(in, caps[n].data, caps[n].len);
+        frames_old += rx_old(in, caps[n].len, slots, out);
+    }
+    t_old = now_ns() - t_old;
+    free(in);
+    free_captures();
+
+    if ((frames != count) || (frames_old != count)) {
+        printf("FAIL: %zu frames, %zu received, %zu the old way\n", count, frames, frames_old);
+        bad = 1;
+        return;
+    }
+    printf("rx %-8s %4zu byte frames: %5.1f frames/transfer, %6.1f ns/frame in place, "
+           "%6.1f ns/frame copied twice\n",
+           w->name, w->len, (double)frames / xfers, (double)t / frames, (double)t_old / frames);
+}
+
+static void rx_tests(size_t count, const char* fn) {
+    size_t frames;
+    uint64_t errors;
+
+    // Every length, packed the way the device packs them
+    rx_seq = 0;
+    frames = make_captures(20000, rx_len_random);
+    if ((drain(got_frame) != frames) || (rx_seq != frames)) {
+        printf("FAIL: %u frames received of %zu\n", rx_seq, frames);
+        bad = 1;
+    }
+    free_captures();
+
+    // A malformed header loses the rest of its transfer, and no more:
+    // the third of 100 byte frames is spoiled
+    rx_len = 100;
+    make_captures(20, rx_len_fixed);
+    caps[0].data[2 * 104 + 2] ^= 0x10;
+    errors = nic->RxErrors;
+    rx_seq = 0;
+    frames = drain(got_frame);
+    free_captures();
+    make_captures(3, rx_len_fixed);
+    rx_seq = 0;
+    frames += drain(got_frame);
+    if ((frames != 5) || (nic->RxErrors != errors + 1)) {
+        printf("FAIL: a malformed header: %zu frames, %llu errors\n", frames,
+               (unsigned long long)(nic->RxErrors - errors));
+        bad = 1;
+    }
+    free_captures();
+
+    // A frame taken by reference stays intact until the ring comes back
+    // around to its buffer
+    UINT8* held;
+    UINT8* frame;
+    UINTN held_len, len;
+    rx_len = 1000;
+    make_captures(16 * RX_RING_SIZE, rx_len_fixed);
+    rx_seq = 0;
+    if (Ax88772RxFrame(nic, &held, &held_len)) {
+        printf("FAIL: no frame received\n");
+        bad = 1;
+    } else {
+        for (size_t n = 1; n < (16 * (RX_RING_SIZE - 1)); n++) {
+            Ax88772RxFrame(nic, &frame, &len);
+        }
+        got_frame(held, held_len, (held[12] << 8) | held[13]);
+    }
+    drain(NULL);
+    free_captures();
+
+    if (fn) {
+        frames = read_captures(fn);
+        errors = nic->RxErrors;
+        size_t got = drain(NULL);
+        printf("rx: '%s': %zu frames in %zu transfers, %zu received, %llu malformed transfers\n",
+               fn, frames, ncaps, got, (unsigned long long)(nic->RxErrors - errors));
+        free_captures();
+    }
+
+    if (bad) {
+        return;
+    }
+    printf("rx: every frame came through intact\n");
+
+    for (size_t n = 0; n < (sizeof(loads) / sizeof(loads[0])); n++) {
+        if ((n == 0) || (loads[n].len != loads[n - 1].len)) {
+            rx_run(&loads[n], count);
+        }
+    }
+}
+
+// How often netifc looks at an interface waiting for link
+#define LINK_POLL_NS 10000000ULL
+
+// Look at the link every LINK_POLL_NS until it is up (or down, if up
+// is 0), for at most limit ns.  Returns how long that took, or -1.
+static int64_t link_wait(int up, uint64_t limit) {
+    uint64_t start = axmock_now();
+
+    for (;;) {
+        reap();
+        if (!snp->Mode->MediaPresent == !up) {
+            return axmock_now() - start;
+        }
+        if ((axmock_now() - start) >= limit) {
+            return -1;
+        }
+        axmock_advance(LINK_POLL_NS);
+    }
+}
+
+// Bring the interface up, and leave it up for what follows
+static void link_up(const char* what) {
+    uint64_t t = axmock_now();
+    int64_t took;
+
+    if (snp->Initialize(snp, 0, 0)) {
+        printf("FAIL: %s: Initialize failed\n", what);
+        bad = 1;
+        return;
+    }
+    t = axmock_now() - t;
+    took = link_wait(1, 10 * ax.an_ns);
+    if (took < 0) {
+        printf("FAIL: %s: the link didn't come up\n", what);
+        bad = 1;
+        return;
+    }
+    printf("link: %s: Initialize returned after %.1f ms, link %.1f ms later\n",
+           what, t / 1e6, took / 1e6);
+    if (t >= (RESET_DELAY * 100)) {
+        printf("FAIL: %s: Initialize waited on the link\n", what);
+        bad = 1;
+    }
+}
+
+// Pull the cable, and put it back after out ns
+static void link_replug(const char* what, uint64_t out) {
+    int64_t down, up;
+
+    axmock_cable(&ax, 0);
+    down = link_wait(0, 2 * LINK_CHECK_DELAY * 100);
+    axmock_advance(out);
+    axmock_cable(&ax, 1);
+    up = link_wait(1, 10 * ax.an_ns);
+    if ((down < 0) || (up < 0)) {
+        printf("FAIL: %s: the link was %s\n", what, (down < 0) ? "never lost" : "never back");
+        bad = 1;
+        return;
+    }
+    printf("link: %s: lost after %.1f ms, back %.1f ms after the cable was\n",
+           what, down / 1e6, up / 1e6);
+    if (up > (ax.an_ns + AUTONEG_POLL_DELAY * 100 + LINK_POLL_NS)) {
+        printf("FAIL: %s: the link took %.1f ms longer than the PHY\n", what,
+               (up - ax.an_ns) / 1e6);
+        bad = 1;
+    }
+}
+
+// The MAC runs at the speed and duplex the PHY negotiated
+static void link_medium(const char* what, int hi_speed) {
+    uint16_t want = MS_FD | (hi_speed ? MS_PS : 0);
+
+    if ((ax.medium & (MS_FD | MS_PS)) != want) {
+        printf("FAIL: %s: medium status %04x, not %04x\n", what, ax.medium & (MS_FD | MS_PS),
+               want);
+        bad = 1;
+    }
+}
+
+static void link_tests(void) {
+    uint64_t ctl;
+    int64_t t;
+
+    link_up("bring up");
+    link_medium("bring up", 1);
+    if (bad) {
+        return;
+    }
+
+    link_replug("cable pulled", 1000000000ULL);
+
+    ax.partner = AN_10_FDX | AN_10_HDX | AN_CSMA_CD;
+    link_replug("to a 10 Mbps port", 1000000000ULL);
+    link_medium("to a 10 Mbps port", 0);
+    ax.partner |= AN_TX_FDX | AN_TX_HDX;
+    link_replug("back to 100 Mbps", 1000000000ULL);
+    link_medium("back to 100 Mbps", 1);
+
+    // A device that stops answering is reset once it answers again
+    ax.dead = 1;
+    t = link_wait(0, 2 * LINK_CHECK_DELAY * 100);
+    axmock_advance(1000000000ULL);
+    ax.dead = 0;
+    if ((t < 0) || (link_wait(1, 10 * ax.an_ns) < 0)) {
+        printf("FAIL: device stopped answering: the link was %s\n",
+               (t < 0) ? "never lost" : "never back");
+        bad = 1;
+    } else {
+        printf("link: device stopped answering: lost after %.1f ms, back\n", t / 1e6);
+    }
+
+    // Nothing happens after Shutdown until Initialize
+    snp->Shutdown(snp);
+    ctl = ax.ctl_transfers;
+    axmock_advance(10ULL * LINK_CHECK_DELAY * 100);
+    if ((ax.ctl_transfers != ctl) || snp->Mode->MediaPresent) {
+        printf("FAIL: the link was looked after once shut down\n");
+        bad = 1;
+    }
+
+    link_up("after shutdown");
+}
+
+void usage(void) {
+    fprintf(stderr,
+            "usage:   %s [ <option> ]*\n"
+            "\n"
+            "options: -n <n>     frames to send and receive in each run (default 100000)\n"
+            "         -r <file>  replay a capture of bulk in transfers as well\n",
+            appname);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t count = 100000;
+    const char* fn = NULL;
+
+    appname = argv[0];
+    while (argc > 1) {
+        if (argc < 3)
+            usage();
+        if (!strcmp(argv[1], "-n")) {
+            count = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-r")) {
+            fn = argv[2];
+        } else {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (count < 1)
+        usage();
+
+    axmock_init(&ax);
+    ax.tx = on_tx;
+    ax.rx = on_rx;
+    if ((nic = calloc(1, sizeof(*nic))) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return 1;
+    }
+    nic->Signature = DEV_SIGNATURE;
+    nic->pUsbIo = &ax.usb;
+    nic->Flags = FLAG_TYPE_AX88772B;
+    if (SN_Setup(nic)) {
+        fprintf(stderr, "%s: SN_Setup failed\n", appname);
+        return 1;
+    }
+    snp = &nic->SimpleNetwork;
+    if (snp->Start(snp)) {
+        fprintf(stderr, "%s: Start failed\n", appname);
+        return 1;
+    }
+
+    link_tests();
+    if (!bad) {
+        tx_tests(count);
+    }
+    if (!bad) {
+        rx_tests(count, fn);
+    }
+    return bad;
+}
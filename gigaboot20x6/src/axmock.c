@@ -0,0 +1,456 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "axmock.h"
+
+// what gnu-efi's library would have provided
+EFI_BOOT_SERVICES* gBS;
+
+VOID ZeroMem(VOID* buf, UINTN len) {
+    memset(buf, 0, len);
+}
+
+VOID SetMem(VOID* buf, UINTN len, UINT8 val) {
+    memset(buf, val, len);
+}
+
+VOID CopyMem(VOID* dst, CONST VOID* src, UINTN len) {
+    memmove(dst, src, len);
+}
+
+static uint64_t now;
+static EFI_TPL tpl = TPL_APPLICATION;
+static size_t pool;
+
+#define MAX_EVENTS 16
+
+typedef struct {
+    int used;
+    UINT32 type;
+    EFI_TPL tpl;
+    EFI_EVENT_NOTIFY notify;
+    VOID* ctx;
+    uint64_t due; // 0 if the timer isn't set
+    uint64_t period;
+    int signaled;
+    int queued; // notify function still to be called
+} event;
+
+static event events[MAX_EVENTS];
+
+uint64_t axmock_now(void) {
+    return now;
+}
+
+size_t axmock_pool(void) {
+    return pool;
+}
+
+// Call the notify functions queued for a level above the current one,
+// highest level first, at that level
+static void dispatch(void) {
+    for (;;) {
+        event* ev = NULL;
+        for (int n = 0; n < MAX_EVENTS; n++) {
+            if (events[n].used && events[n].queued && (events[n].tpl > tpl) &&
+                ((ev == NULL) || (events[n].tpl > ev->tpl))) {
+                ev = &events[n];
+            }
+        }
+        if (ev == NULL) {
+            return;
+        }
+        EFI_TPL prev = tpl;
+        ev->queued = 0;
+        tpl = ev->tpl;
+        ev->notify(ev, ev->ctx);
+        tpl = prev;
+    }
+}
+
+static void signal_one(event* ev) {
+    if (ev->type & EVT_NOTIFY_SIGNAL) {
+        ev->queued = 1;
+    } else {
+        ev->signaled = 1;
+    }
+}
+
+// Signal the timers that are due by now
+static void expire(void) {
+    for (int n = 0; n < MAX_EVENTS; n++) {
+        event* ev = &events[n];
+        if (ev->used && ev->due && (ev->due <= now)) {
+            ev->due = ev->period ? (ev->due + ev->period) : 0;
+            signal_one(ev);
+        }
+    }
+}
+
+void axmock_advance(uint64_t ns) {
+    uint64_t end = now + ns;
+
+    // stop at each timer on the way, so that whatever it sets off
+    // happens when it would have
+    for (;;) {
+        uint64_t next = end;
+        for (int n = 0; n < MAX_EVENTS; n++) {
+            if (events[n].used && events[n].due && (events[n].due < next)) {
+                next = events[n].due;
+            }
+        }
+        if (next > now) {
+            now = next;
+        }
+        expire();
+        dispatch();
+        if (now >= end) {
+            return;
+        }
+    }
+}
+
+static EFI_TPL EFIAPI raise_tpl(EFI_TPL new_tpl) {
+    EFI_TPL old = tpl;
+    tpl = new_tpl;
+    return old;
+}
+
+static VOID EFIAPI restore_tpl(EFI_TPL old) {
+    tpl = old;
+    dispatch();
+}
+
+static EFI_STATUS EFIAPI allocate_pool(EFI_MEMORY_TYPE type, UINTN len, VOID** buf) {
+    size_t* p = malloc(len + 16);
+    if (p == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    *p = len;
+    pool += len;
+    *buf = (uint8_t*)p + 16;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI free_pool(VOID* buf) {
+    size_t* p = (void*)((uint8_t*)buf - 16);
+    pool -= *p;
+    free(p);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI stall(UINTN us) {
+    axmock_advance(us * 1000ULL);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI create_event(UINT32 type, EFI_TPL notify_tpl, EFI_EVENT_NOTIFY notify,
+                                      VOID* ctx, EFI_EVENT* out) {
+    for (int n = 0; n < MAX_EVENTS; n++) {
+        if (!events[n].used) {
+            memset(&events[n], 0, sizeof(events[n]));
+            events[n].used = 1;
+            events[n].type = type;
+            events[n].tpl = notify_tpl;
+            events[n].notify = notify;
+            events[n].ctx = ctx;
+            *out = &events[n];
+            return EFI_SUCCESS;
+        }
+    }
+    return EFI_OUT_OF_RESOURCES;
+}
+
+static EFI_STATUS EFIAPI close_event(EFI_EVENT e) {
+    event* ev = e;
+    ev->used = 0;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI set_timer(EFI_EVENT e, EFI_TIMER_DELAY type, UINT64 time) {
+    event* ev = e;
+    // in 100ns units
+    switch (type) {
+    case TimerCancel:
+        ev->due = 0;
+        break;
+    case TimerPeriodic:
+        ev->period = time ? (time * 100) : 100;
+        ev->due = now + ev->period;
+        break;
+    case TimerRelative:
+        ev->period = 0;
+        ev->due = now + (time ? (time * 100) : 1);
+        break;
+    default:
+        return EFI_INVALID_PARAMETER;
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI signal_event(EFI_EVENT e) {
+    signal_one(e);
+    dispatch();
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI check_event(EFI_EVENT e) {
+    event* ev = e;
+    if (ev->type & EVT_NOTIFY_SIGNAL) {
+        return EFI_INVALID_PARAMETER;
+    }
+    expire();
+    if (ev->signaled) {
+        ev->signaled = 0;
+        return EFI_SUCCESS;
+    }
+    return EFI_NOT_READY;
+}
+
+static EFI_BOOT_SERVICES bs = {
+    .RaiseTPL = raise_tpl,
+    .RestoreTPL = restore_tpl,
+    .AllocatePool = allocate_pool,
+    .FreePool = free_pool,
+    .Stall = stall,
+    .CreateEvent = create_event,
+    .CloseEvent = close_event,
+    .SetTimer = set_timer,
+    .SignalEvent = signal_event,
+    .CheckEvent = check_event,
+};
+
+// The PHY, as the driver sees it at this moment
+static uint16_t phy_read(axmock* ax, unsigned reg) {
+    if (reg == PHY_BMSR) {
+        uint16_t bmsr = BMSR_100BASETX_FDX | BMSR_100BASETX_HDX | BMSR_10BASET_FDX |
+                        BMSR_10BASET_HDX | BMSR_AUTONEG | BMSR_EXTENDED_CAPABILITY;
+        if (ax->an_done && (now >= ax->an_done)) {
+            ax->an_done = 0;
+            ax->phy[PHY_ANLPAR] = ax->cable ? (ax->partner | AN_ACK) : 0;
+        }
+        if (ax->cable && (ax->an_done == 0) && ax->phy[PHY_ANLPAR]) {
+            bmsr |= BMSR_LINKST | BMSR_AUTONEG_CMPLT;
+        }
+        return bmsr;
+    }
+    return (reg < 32) ? ax->phy[reg] : 0xffff;
+}
+
+static void phy_renegotiate(axmock* ax) {
+    ax->phy[PHY_ANLPAR] = 0;
+    ax->an_done = now + ax->an_ns;
+}
+
+static void phy_write(axmock* ax, unsigned reg, uint16_t val) {
+    if (reg >= 32) {
+        return;
+    }
+    ax->phy[reg] = val & ~(BMCR_RESET | BMCR_RESTART_AUTONEGOTIATION);
+    if ((reg == PHY_BMCR) && (val & (BMCR_RESET | BMCR_RESTART_AUTONEGOTIATION))) {
+        phy_renegotiate(ax);
+    }
+}
+
+void axmock_cable(axmock* ax, int plugged) {
+    ax->cable = plugged;
+    phy_renegotiate(ax);
+}
+
+static EFI_STATUS EFIAPI control_transfer(EFI_USB_IO_PROTOCOL* usb, EFI_USB_DEVICE_REQUEST* req,
+                                          EFI_USB_DATA_DIRECTION dir, UINT32 timeout,
+                                          VOID* data, UINTN len, UINT32* status) {
+    axmock* ax = (axmock*)usb;
+    uint16_t val;
+
+    ax->ctl_transfers++;
+    axmock_advance(ax->ctl_ns);
+    if (ax->dead) {
+        *status = EFI_USB_ERR_TIMEOUT;
+        return EFI_TIMEOUT;
+    }
+    *status = EFI_USB_NOERROR;
+    switch (req->Request) {
+    case CMD_MAC_ADDRESS_READ:
+        memcpy(data, ax->mac, (len < 6) ? len : 6);
+        break;
+    case CMD_MAC_ADDRESS_WRITE:
+        memcpy(ax->mac, data, (len < 6) ? len : 6);
+        break;
+    case CMD_PHY_REG_READ:
+        val = phy_read(ax, req->Index);
+        memcpy(data, &val, (len < 2) ? len : 2);
+        break;
+    case CMD_PHY_REG_WRITE:
+        memcpy(&val, data, 2);
+        phy_write(ax, req->Index, val);
+        break;
+    case CMD_RESET:
+        // taking the internal PHY out of reset starts it negotiating
+        if (req->Value & SRR_IPRL) {
+            phy_renegotiate(ax);
+        }
+        break;
+    case CMD_MEDIUM_STATUS_READ:
+        memcpy(data, &ax->medium, (len < 2) ? len : 2);
+        break;
+    case CMD_MEDIUM_STATUS_WRITE:
+        ax->medium = req->Value;
+        break;
+    default:
+        if (dir == EfiUsbDataIn) {
+            memset(data, 0, len);
+        }
+        break;
+    }
+    return EFI_SUCCESS;
+}
+
+// Take the frames out of what the driver sent, checking it is what the
+// device can make sense of
+static void bulk_out(axmock* ax, const uint8_t* data, size_t len) {
+    size_t off = 0;
+
+    ax->tx_transfers++;
+    ax->tx_bytes += len;
+    if ((len > 16384) || ((len % ax->max_packet) == 0)) {
+        // too big for the device, or it would wait for the rest
+        ax->tx_errors++;
+        return;
+    }
+    while (off < len) {
+        uint16_t flen, iflen;
+        if ((len - off) < 4) {
+            ax->tx_errors++;
+            return;
+        }
+        memcpy(&flen, data + off, 2);
+        memcpy(&iflen, data + off + 2, 2);
+        off += 4;
+        if ((flen == 0) && (iflen == 0xffff)) {
+            continue;
+        }
+        if (((uint16_t)~flen != iflen) || (flen < 60) || (flen > 1518) || (flen > (len - off))) {
+            ax->tx_errors++;
+            return;
+        }
+        ax->tx_frames++;
+        if (ax->tx) {
+            ax->tx(ax->cookie, data + off, flen);
+        }
+        off += flen;
+    }
+}
+
+static EFI_STATUS EFIAPI bulk_transfer(EFI_USB_IO_PROTOCOL* usb, UINT8 ep, VOID* data,
+                                       UINTN* len, UINTN timeout, UINT32* status) {
+    axmock* ax = (axmock*)usb;
+    size_t n;
+
+    if (ax->dead) {
+        axmock_advance(ax->bulk_ns);
+        *status = EFI_USB_ERR_TIMEOUT;
+        return EFI_TIMEOUT;
+    }
+    *status = EFI_USB_NOERROR;
+    if (ep == BULK_OUT_ENDPOINT) {
+        axmock_advance(ax->bulk_ns + (uint64_t)(*len * ax->byte_ns));
+        bulk_out(ax, data, *len);
+        return EFI_SUCCESS;
+    }
+    if (ep == (USB_ENDPOINT_DIR_IN | BULK_IN_ENDPOINT)) {
+        n = *len;
+        if ((ax->rx == NULL) || ax->rx(ax->cookie, data, &n)) {
+            n = 0;
+        }
+        axmock_advance(ax->bulk_ns + (uint64_t)(n * ax->byte_ns));
+        ax->rx_transfers++;
+        ax->rx_bytes += n;
+        *len = n;
+        return EFI_SUCCESS;
+    }
+    *status = EFI_USB_ERR_STALL;
+    return EFI_DEVICE_ERROR;
+}
+
+static EFI_STATUS EFIAPI get_device_descriptor(EFI_USB_IO_PROTOCOL* usb,
+                                               EFI_USB_DEVICE_DESCRIPTOR* desc) {
+    memset(desc, 0, sizeof(*desc));
+    desc->Length = sizeof(*desc);
+    desc->DescriptorType = USB_DESC_TYPE_DEVICE;
+    desc->BcdUSB = 0x0200;
+    desc->MaxPacketSize0 = 64;
+    desc->IdVendor = 0x0b95;
+    desc->IdProduct = 0x772b;
+    desc->NumConfigurations = 1;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI get_interface_descriptor(EFI_USB_IO_PROTOCOL* usb,
+                                                  EFI_USB_INTERFACE_DESCRIPTOR* desc) {
+    memset(desc, 0, sizeof(*desc));
+    desc->Length = sizeof(*desc);
+    desc->DescriptorType = USB_DESC_TYPE_INTERFACE;
+    desc->NumEndpoints = 3;
+    desc->InterfaceClass = 0xff;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI get_endpoint_descriptor(EFI_USB_IO_PROTOCOL* usb, UINT8 index,
+                                                 EFI_USB_ENDPOINT_DESCRIPTOR* desc) {
+    axmock* ax = (axmock*)usb;
+    static const UINT8 addrs[] = { USB_ENDPOINT_DIR_IN | 1,
+                                   USB_ENDPOINT_DIR_IN | BULK_IN_ENDPOINT,
+                                   BULK_OUT_ENDPOINT };
+    if (index >= 3) {
+        return EFI_NOT_FOUND;
+    }
+    memset(desc, 0, sizeof(*desc));
+    desc->Length = sizeof(*desc);
+    desc->DescriptorType = USB_DESC_TYPE_ENDPOINT;
+    desc->EndpointAddress = addrs[index];
+    desc->Attributes = index ? USB_ENDPOINT_BULK : USB_ENDPOINT_INTERRUPT;
+    desc->MaxPacketSize = index ? ax->max_packet : 8;
+    desc->Interval = index ? 0 : 11;
+    return EFI_SUCCESS;
+}
+
+void axmock_init(axmock* ax) {
+    static const uint8_t mac[6] = { 0x00, 0x0e, 0xc6, 0x88, 0x77, 0x2b };
+
+    memset(ax, 0, sizeof(*ax));
+    ax->usb.UsbControlTransfer = control_transfer;
+    ax->usb.UsbBulkTransfer = bulk_transfer;
+    ax->usb.UsbGetDeviceDescriptor = get_device_descriptor;
+    ax->usb.UsbGetInterfaceDescriptor = get_interface_descriptor;
+    ax->usb.UsbGetEndpointDescriptor = get_endpoint_descriptor;
+    memcpy(ax->mac, mac, 6);
+    ax->max_packet = 512;
+    ax->cable = 1;
+    ax->an_ns = 1500000000ULL;
+    ax->partner = AN_TX_FDX | AN_TX_HDX | AN_10_FDX | AN_10_HDX | AN_CSMA_CD;
+
+    // A transfer takes at least a microframe to be scheduled and seen
+    // to finish; high speed bulk moves about 40MB/s after overhead.
+    ax->ctl_ns = 250000;
+    ax->bulk_ns = 125000;
+    ax->byte_ns = 25.0;
+
+    phy_renegotiate(ax);
+    gBS = &bs;
+}
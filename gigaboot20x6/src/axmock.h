@@ -0,0 +1,86 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// An AX88772B behind a mock EFI_USB_IO_PROTOCOL, and the few boot
+// services its driver uses, so the driver can be run on the host.
+//
+// Time is virtual: it passes only when the driver stalls, when the
+// device is busy with a transfer, or when axmock_advance() is called,
+// and timer events are signaled (their notify functions called) as it
+// does.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Ax88772.h>
+
+typedef struct axmock_t axmock;
+struct axmock_t {
+    EFI_USB_IO_PROTOCOL usb; // first, so This is the mock too
+    uint8_t mac[6];
+    uint16_t max_packet; // of the bulk endpoints
+
+    // PHY registers, and when autonegotiation will finish (0 once it
+    // has).  With no cable the link never comes up.
+    uint16_t phy[32];
+    uint64_t an_done;
+    uint64_t an_ns; // how long autonegotiation takes
+    int cable;
+    uint16_t partner; // what the link partner advertises (AN_*)
+    uint16_t medium;  // the medium status register
+
+    // While set every transfer fails, as though the device had
+    // stopped answering
+    int dead;
+
+    // how long the bus is busy with a control transfer, with a bulk
+    // transfer, and with each byte of one
+    uint64_t ctl_ns;
+    uint64_t bulk_ns;
+    double byte_ns;
+
+    // Each frame a bulk out transfer carries is handed to tx (if set)
+    void (*tx)(void* cookie, const uint8_t* frame, size_t len);
+    // Bulk in: rx (if set) fills in the data the device returns and
+    // its length, at most *len; else (or if it returns nonzero) the
+    // device has nothing and sends a zero length packet.
+    int (*rx)(void* cookie, uint8_t* data, size_t* len);
+    void* cookie;
+
+    uint64_t ctl_transfers;
+    uint64_t tx_transfers;
+    uint64_t tx_frames;
+    uint64_t tx_bytes; // on the bus, headers and all
+    uint64_t tx_errors; // malformed transfers
+    uint64_t rx_transfers;
+    uint64_t rx_bytes;
+};
+
+// Power up the device, with the link partner plugged in, and make it
+// the one the boot services mock belongs to
+void axmock_init(axmock* ax);
+
+// Virtual nanoseconds since the program started
+uint64_t axmock_now(void);
+
+// Let ns nanoseconds of virtual time pass
+void axmock_advance(uint64_t ns);
+
+// Unplug or plug in the cable; either makes the PHY renegotiate
+void axmock_cable(axmock* ax, int plugged);
+
+// Pool bytes allocated and not yet freed
+size_t axmock_pool(void);
@@ -0,0 +1,249 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efi.h>
+#include <efilib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cache.h>
+#include <sha256.h>
+#include <utils.h>
+
+#define CACHE_DIR L"\\cache"
+
+void cache_hex(const uint8_t* digest, char* hex) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < SHA256_SIZE; i++) {
+        hex[i * 2] = digits[digest[i] >> 4];
+        hex[i * 2 + 1] = digits[digest[i] & 15];
+    }
+    hex[SHA256_SIZE * 2] = 0;
+}
+
+static int cache_unhex(const char* hex, uint8_t* digest) {
+    for (int i = 0; i < (SHA256_SIZE * 2); i++) {
+        char c = hex[i];
+        int x;
+        if ((c >= '0') && (c <= '9')) {
+            x = c - '0';
+        } else if ((c >= 'a') && (c <= 'f')) {
+            x = c - 'a' + 10;
+        } else {
+            return -1;
+        }
+        digest[i / 2] = (i & 1) ? (digest[i / 2] | x) : (x << 4);
+    }
+    return 0;
+}
+
+// Open (creating it if asked) the cache directory on the boot volume
+static EFI_FILE_HANDLE cache_dir(int create) {
+    EFI_LOADED_IMAGE* loaded;
+    EFI_FILE_IO_INTERFACE* fioi;
+    EFI_FILE_HANDLE root, dir = NULL;
+    EFI_STATUS r;
+
+    if (OpenProtocol(gImg, &LoadedImageProtocol, (void**)&loaded)) {
+        return NULL;
+    }
+    if (OpenProtocol(loaded->DeviceHandle, &SimpleFileSystemProtocol, (void**)&fioi)) {
+        goto exit1;
+    }
+    if (fioi->OpenVolume(fioi, &root)) {
+        goto exit2;
+    }
+    if (create) {
+        r = root->Open(root, &dir, CACHE_DIR,
+                       EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+                       EFI_FILE_DIRECTORY);
+    } else {
+        r = root->Open(root, &dir, CACHE_DIR, EFI_FILE_MODE_READ, 0);
+    }
+    if (r) {
+        dir = NULL;
+    }
+    root->Close(root);
+exit2:
+    CloseProtocol(loaded->DeviceHandle, &SimpleFileSystemProtocol);
+exit1:
+    CloseProtocol(gImg, &LoadedImageProtocol);
+    return dir;
+}
+
+static EFI_STATUS cache_open(EFI_FILE_HANDLE dir, EFI_FILE_HANDLE* file,
+                             const char* name, UINT64 mode) {
+    CHAR16 wname[128];
+    size_t i;
+
+    for (i = 0; name[i] && (i < 127); i++) {
+        wname[i] = name[i];
+    }
+    wname[i] = 0;
+    return dir->Open(dir, file, wname, mode, 0);
+}
+
+static EFI_STATUS cache_size(EFI_FILE_HANDLE file, size_t* size) {
+    char buf[512];
+    UINTN sz = sizeof(buf);
+    EFI_FILE_INFO* finfo = (void*)buf;
+    EFI_STATUS r;
+
+    if ((r = file->GetInfo(file, &FileInfoGUID, &sz, finfo)) == EFI_SUCCESS) {
+        *size = finfo->FileSize;
+    }
+    return r;
+}
+
+// Read the whole file (if it is no larger than max) into data
+static int cache_read(EFI_FILE_HANDLE dir, const char* name,
+                      void* data, size_t max, size_t* size) {
+    EFI_FILE_HANDLE file;
+    UINTN sz;
+    int status = -1;
+
+    if (cache_open(dir, &file, name, EFI_FILE_MODE_READ)) {
+        return -1;
+    }
+    if (cache_size(file, size) || (*size > max)) {
+        goto done;
+    }
+    sz = *size;
+    if (file->Read(file, &sz, data) || (sz != *size)) {
+        goto done;
+    }
+    status = 0;
+done:
+    file->Close(file);
+    return status;
+}
+
+// Replace the file name with the size bytes at data
+static int cache_write(EFI_FILE_HANDLE dir, const char* name, const void* data, size_t size) {
+    EFI_FILE_HANDLE file;
+    UINTN sz = size;
+
+    // Open doesn't truncate, so start over
+    if (cache_open(dir, &file, name, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE) == EFI_SUCCESS) {
+        file->Delete(file);
+    }
+    if (cache_open(dir, &file, name,
+                   EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE)) {
+        return -1;
+    }
+    if (file->Write(file, &sz, (void*)data) || (sz != size)) {
+        // don't leave a partial file behind to be found later
+        file->Delete(file);
+        return -1;
+    }
+    if (file->Close(file)) {
+        return -1;
+    }
+    return 0;
+}
+
+static void cache_remove(EFI_FILE_HANDLE dir, const char* name) {
+    EFI_FILE_HANDLE file;
+
+    if (cache_open(dir, &file, name, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE) == EFI_SUCCESS) {
+        file->Delete(file);
+    }
+}
+
+int cache_load(const char* name, void* data, size_t max, size_t* size, uint8_t* digest) {
+    EFI_FILE_HANDLE dir;
+    uint8_t actual[SHA256_SIZE];
+    char hex[SHA256_SIZE * 2 + 1];
+    size_t len;
+    int status = -1;
+
+    if ((dir = cache_dir(0)) == NULL) {
+        return -1;
+    }
+    if (cache_read(dir, name, hex, SHA256_SIZE * 2, &len) ||
+        (len != (SHA256_SIZE * 2)) || cache_unhex(hex, digest)) {
+        goto done;
+    }
+    hex[SHA256_SIZE * 2] = 0;
+    if (cache_read(dir, hex, data, max, size)) {
+        goto done;
+    }
+    sha256(data, *size, actual);
+    if (memcmp(actual, digest, SHA256_SIZE)) {
+        printf("cache: '%s' is corrupt\n", name);
+        goto done;
+    }
+    status = 0;
+done:
+    dir->Close(dir);
+    return status;
+}
+
+int cache_store(const char* name, const void* data, size_t size, const uint8_t* digest) {
+    EFI_FILE_HANDLE dir;
+    char hex[SHA256_SIZE * 2 + 1];
+    char old[SHA256_SIZE * 2 + 1];
+    size_t len;
+    int status = -1;
+
+    if ((dir = cache_dir(1)) == NULL) {
+        printf("cache: cannot open \\cache\n");
+        return -1;
+    }
+    cache_hex(digest, hex);
+    if (cache_read(dir, name, old, SHA256_SIZE * 2, &len) || (len != (SHA256_SIZE * 2))) {
+        old[0] = 0;
+    }
+    old[SHA256_SIZE * 2] = 0;
+    if (!memcmp(old, hex, sizeof(hex))) {
+        status = 0;
+        goto done;
+    }
+    // the contents go in before the name points at them
+    if (cache_write(dir, hex, data, size) ||
+        cache_write(dir, name, hex, SHA256_SIZE * 2)) {
+        printf("cache: cannot write '%s'\n", name);
+        goto done;
+    }
+    // (another name holding the same contents loses them, and so just
+    // isn't cached)
+    if (old[0]) {
+        cache_remove(dir, old);
+    }
+    printf("cache: stored '%s' (%ld bytes) as %s\n", name, size, hex);
+    status = 0;
+done:
+    dir->Close(dir);
+    return status;
+}
+
+void cache_forget(const char* name) {
+    EFI_FILE_HANDLE dir;
+    char hex[SHA256_SIZE * 2 + 1];
+    size_t len;
+
+    if ((dir = cache_dir(0)) == NULL) {
+        return;
+    }
+    // the name goes before the contents it points at
+    if ((cache_read(dir, name, hex, SHA256_SIZE * 2, &len) == 0) &&
+        (len == (SHA256_SIZE * 2))) {
+        hex[SHA256_SIZE * 2] = 0;
+        cache_remove(dir, name);
+        cache_remove(dir, hex);
+        printf("cache: forgot '%s'\n", name);
+    }
+    dir->Close(dir);
+}
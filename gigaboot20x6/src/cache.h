@@ -0,0 +1,36 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Content addressed cache of netbooted files on the volume osboot was
+// loaded from.  Every file is kept as \cache\<SHA-256 in hex>, and the
+// one last received under a name is the one \cache\<name> holds the
+// hash of.  Files are checked against their hash when loaded, so a
+// corrupt or half written one is simply not found.
+
+// Hex form of a SHA-256 digest
+void cache_hex(const uint8_t* digest, char* hex);
+
+// Load the cached file for name into data (at most max bytes), with its
+// size in *size and hash in digest.  Returns 0 on success, -1 if there
+// is none (or it is not intact).
+int cache_load(const char* name, void* data, size_t max, size_t* size, uint8_t* digest);
+
+// Make the size bytes at data (whose hash is digest) the cached file for
+// name, replacing the one before.  Returns 0 on success.
+int cache_store(const char* name, const void* data, size_t size, const uint8_t* digest);
+
+// Forget the cached file for name, if there is one
+void cache_forget(const char* name);
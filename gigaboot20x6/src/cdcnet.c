@@ -0,0 +1,1197 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// USB communications device class ethernet: ECM, one frame per bulk
+// transfer, and NCM, where a transfer carries a block (NTB) of many.
+// Laid out like the Ax88772b driver: a driver binding that puts a simple
+// network protocol on a child of each adapter's control interface, the
+// protocol itself, and the device underneath.
+//
+// Every transfer costs a trip through the host controller however little
+// it carries, so in NCM mode Transmit copies frames into the block being
+// built and it goes out once full, or once there is nothing to receive;
+// and a block read in is handed out a frame at a time before the next is
+// asked for.
+
+#include <efi.h>
+#include <efilib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils.h>
+#include <inet6.h>
+
+#include <cdcnet.h>
+
+#include <Protocol/UsbIo.h>
+
+static EFI_GUID UsbIoGuid = EFI_USB_IO_PROTOCOL_GUID;
+
+#define USB_CLASS_CDC 0x02
+#define USB_CLASS_CDC_DATA 0x0a
+#define CDC_SUBCLASS_ECM 0x06
+#define CDC_SUBCLASS_NCM 0x0d
+
+// class specific descriptors following the control interface's
+#define CS_INTERFACE 0x24
+#define CDC_UNION 0x06    // [3] control interface, [4] data interface
+#define CDC_ETHERNET 0x0f // [3] string with the MAC address
+
+#define USB_EP_IN 0x80
+#define USB_EP_TYPE 0x03
+#define USB_EP_BULK 0x02
+#define USB_EP_INTR 0x03
+
+// class requests, to the control interface
+#define CDC_SET_PACKET_FILTER 0x43
+#define NCM_GET_NTB_PARAMETERS 0x80
+#define NCM_SET_NTB_INPUT_SIZE 0x86
+
+#define CDC_FILTER_PROMISCUOUS 0x01
+#define CDC_FILTER_ALL_MULTICAST 0x02
+#define CDC_FILTER_DIRECTED 0x04
+#define CDC_FILTER_BROADCAST 0x08
+
+// notifications, on the control interface's interrupt endpoint
+#define CDC_NETWORK_CONNECTION 0x00
+
+// A block is a 16 bit transfer header (NTH16), the datagrams, and a
+// table (NDP16) of where they are, ended by a zero entry
+#define NTH16_SIG 0x484d434e  // "NCMH"
+#define NDP16_SIG 0x304d434e  // "NCM0"
+#define NDP16_SIGC 0x314d434e // "NCM1": each datagram ends in a CRC
+#define NTH16_LEN 12
+#define NDP16_LEN 8 // then 4 bytes for each datagram
+
+#define CDC_NTB_MAX 16384  // largest block either way, whatever the device allows
+#define CDC_TX_DGRAMS 64   // most datagrams in one block out
+#define CDC_RX_NDPS 8      // most tables in one block in
+#define CDC_TXDONE 256     // copied out, waiting for GetStatus to hand back
+#define CDC_LINK_POLLS 500 // without a word from the device, take the link to be up
+
+// milliseconds
+#define CDC_CTL_TIMEOUT 1000
+#define CDC_TX_TIMEOUT 1000
+#define CDC_RX_TIMEOUT 1
+#define CDC_INT_TIMEOUT 1
+
+typedef struct {
+    EFI_SIMPLE_NETWORK snp; // first, so This is the cdcnet too
+    EFI_SIMPLE_NETWORK_MODE mode;
+    EFI_HANDLE h;           // ours, with the simple network protocol on it
+    EFI_HANDLE ctl_h;       // the control interface we were started on
+    EFI_HANDLE data_h;      // and its data interface
+    EFI_USB_IO_PROTOCOL* ctl;
+    EFI_USB_IO_PROTOCOL* data;
+    EFI_DEVICE_PATH* path;
+    int ncm;
+
+    uint8_t ctl_if, data_if, data_alt;
+    uint8_t ep_int, ep_in, ep_out;
+    uint16_t maxpkt; // of ep_out
+    uint8_t mac_str;
+    unsigned link_polls;
+    int link_told;
+
+    // NCM: the largest blocks each way, and where datagrams may start
+    // in those sent out (offset % div == rem)
+    uint32_t in_max, out_max;
+    uint16_t out_div, out_rem, out_align, out_dgrams;
+    uint16_t seq;
+
+    // The last transfer in, and the next frame in it: in NCM mode the
+    // table being read and its next entry
+    uint8_t* rx_buf;
+    uint32_t rx_len;
+    uint32_t rx_ndp, rx_next, rx_end;
+    unsigned rx_ndps;
+    int rx_crc;
+    int rx_have;
+    uint32_t rx_off, rx_flen;
+
+    // NCM: the block being filled
+    uint8_t* tx_buf;
+    uint32_t tx_len;
+    unsigned tx_count;
+    uint16_t tx_dgram[CDC_TX_DGRAMS][2];
+
+    void* tx_done[CDC_TXDONE];
+    unsigned tx_done_head, tx_done_count;
+
+    uint64_t rx_frames, rx_xfers, rx_bad;
+    uint64_t tx_frames, tx_xfers, tx_lost;
+} cdcnet;
+
+#define CDC_MAX 4
+static cdcnet* devs[CDC_MAX];
+
+static uint16_t get16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static void put16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+static EFI_STATUS cdc_control(EFI_USB_IO_PROTOCOL* usb, uint8_t type, uint8_t req,
+                              uint16_t value, uint16_t index, void* data, uint16_t len) {
+    EFI_USB_DEVICE_REQUEST r = {
+        .RequestType = type,
+        .Request = req,
+        .Value = value,
+        .Index = index,
+        .Length = len,
+    };
+    EFI_USB_DATA_DIRECTION dir;
+    UINT32 status;
+
+    if (len == 0) {
+        dir = EfiUsbNoData;
+    } else if (type & USB_EP_IN) {
+        dir = EfiUsbDataIn;
+    } else {
+        dir = EfiUsbDataOut;
+    }
+    return usb->UsbControlTransfer(usb, &r, dir, CDC_CTL_TIMEOUT, data, len, &status);
+}
+
+// The whole of configuration number index, in a pool allocation
+static uint8_t* cdc_config(EFI_USB_IO_PROTOCOL* usb, uint8_t index, uint16_t* len) {
+    EFI_USB_CONFIG_DESCRIPTOR cfg;
+    uint8_t* buf;
+
+    if (cdc_control(usb, USB_DEV_GET_DESCRIPTOR_REQ_TYPE, USB_REQ_GET_DESCRIPTOR,
+                    (USB_DESC_TYPE_CONFIG << 8) | index, 0, &cfg, sizeof(cfg)) ||
+        (cfg.TotalLength < sizeof(cfg))) {
+        return NULL;
+    }
+    if (gBS->AllocatePool(EfiLoaderData, cfg.TotalLength, (void**)&buf)) {
+        return NULL;
+    }
+    if (cdc_control(usb, USB_DEV_GET_DESCRIPTOR_REQ_TYPE, USB_REQ_GET_DESCRIPTOR,
+                    (USB_DESC_TYPE_CONFIG << 8) | index, 0, buf, cfg.TotalLength)) {
+        gBS->FreePool(buf);
+        return NULL;
+    }
+    *len = cfg.TotalLength;
+    return buf;
+}
+
+// The subclass of the first CDC ethernet control interface in a
+// configuration, or 0 if it has none
+static uint8_t cdc_kind(const uint8_t* cfg, uint16_t len) {
+    for (uint16_t n = 0; (n + 2) <= len && cfg[n] >= 2; n += cfg[n]) {
+        if ((cfg[n + 1] == USB_DESC_TYPE_INTERFACE) && ((n + 9) <= len) &&
+            (cfg[n + 5] == USB_CLASS_CDC) &&
+            ((cfg[n + 6] == CDC_SUBCLASS_ECM) || (cfg[n + 6] == CDC_SUBCLASS_NCM))) {
+            return cfg[n + 6];
+        }
+    }
+    return 0;
+}
+
+// Find the data interface, its endpoints, and where the MAC address is,
+// in the configuration the control interface belongs to
+static int cdc_parse(cdcnet* dev, const uint8_t* cfg, uint16_t len) {
+    int in_ctl = 0, in_data = 0;
+
+    dev->data_if = 0xff;
+    for (uint16_t n = 0; (n + 2) <= len && cfg[n] >= 2; n += cfg[n]) {
+        const uint8_t* d = cfg + n;
+        if ((n + d[0]) > len) {
+            break;
+        }
+        switch (d[1]) {
+        case USB_DESC_TYPE_INTERFACE:
+            if (d[0] < 9) {
+                return -1;
+            }
+            in_ctl = (d[2] == dev->ctl_if) && (d[3] == 0);
+            // the first setting of it with a pair of endpoints
+            in_data = (d[2] == dev->data_if) && (d[4] >= 2) &&
+                      (d[5] == USB_CLASS_CDC_DATA) && !(dev->ep_in && dev->ep_out);
+            if (in_data) {
+                dev->data_alt = d[3];
+                dev->ep_in = dev->ep_out = 0;
+            }
+            break;
+        case CS_INTERFACE:
+            if (!in_ctl || (d[0] < 5)) {
+                break;
+            }
+            if (d[2] == CDC_UNION) {
+                dev->data_if = d[4];
+            } else if (d[2] == CDC_ETHERNET) {
+                dev->mac_str = d[3];
+            }
+            break;
+        case USB_DESC_TYPE_ENDPOINT:
+            if (d[0] < 7) {
+                break;
+            }
+            if (in_ctl && ((d[3] & USB_EP_TYPE) == USB_EP_INTR) && (d[2] & USB_EP_IN)) {
+                dev->ep_int = d[2];
+            }
+            if (in_data && ((d[3] & USB_EP_TYPE) == USB_EP_BULK)) {
+                if (d[2] & USB_EP_IN) {
+                    dev->ep_in = d[2];
+                } else {
+                    dev->ep_out = d[2];
+                    dev->maxpkt = get16(d + 4) & 0x7ff;
+                }
+            }
+            break;
+        }
+    }
+    if (!dev->ep_in || !dev->ep_out || !dev->maxpkt || !dev->mac_str) {
+        return -1;
+    }
+    return 0;
+}
+
+static int hexval(CHAR16 c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// The address is a string of twelve hex digits
+static int cdc_mac(cdcnet* dev) {
+    UINT16* langs;
+    UINT16 lsz;
+    UINT16 lang = 0x0409;
+    CHAR16* str;
+    int n, r = -1;
+
+    if ((dev->ctl->UsbGetSupportedLanguages(dev->ctl, &langs, &lsz) == EFI_SUCCESS) &&
+        (lsz >= 2)) {
+        lang = langs[0];
+    }
+    if (dev->ctl->UsbGetStringDescriptor(dev->ctl, lang, dev->mac_str, &str)) {
+        return -1;
+    }
+    for (n = 0; n < 12; n++) {
+        int v = hexval(str[n]);
+        if (v < 0) {
+            goto done;
+        }
+        dev->mode.CurrentAddress.Addr[n / 2] = (dev->mode.CurrentAddress.Addr[n / 2] << 4) | v;
+    }
+    memcpy(&dev->mode.PermanentAddress, &dev->mode.CurrentAddress, sizeof(EFI_MAC_ADDRESS));
+    r = 0;
+done:
+    gBS->FreePool(str);
+    return r;
+}
+
+// Interfaces of one device have the same device path, but for the
+// interface number in its last node
+static int cdc_sibling(EFI_DEVICE_PATH* a, EFI_DEVICE_PATH* b) {
+    UINTN len = DevicePathSize(a);
+    UINTN last = len - END_DEVICE_PATH_LENGTH - sizeof(USB_DEVICE_PATH);
+    EFI_DEVICE_PATH* node = (void*)(((uint8_t*)a) + last);
+
+    if ((len != DevicePathSize(b)) || (len < (END_DEVICE_PATH_LENGTH + sizeof(USB_DEVICE_PATH))) ||
+        (DevicePathType(node) != MESSAGING_DEVICE_PATH) ||
+        (DevicePathSubType(node) != MSG_USB_DP)) {
+        return 0;
+    }
+    return (memcmp(a, b, last + sizeof(EFI_DEVICE_PATH)) == 0) &&
+           (((USB_DEVICE_PATH*)node)->Port ==
+            ((USB_DEVICE_PATH*)(((uint8_t*)b) + last))->Port);
+}
+
+// The USB bus gives each interface a handle of its own
+static EFI_HANDLE cdc_data_handle(cdcnet* dev) {
+    EFI_DEVICE_PATH* path = DevicePathFromHandle(dev->ctl_h);
+    EFI_USB_INTERFACE_DESCRIPTOR ifc;
+    EFI_USB_IO_PROTOCOL* usb;
+    EFI_HANDLE* list;
+    EFI_HANDLE h = NULL;
+    UINTN count;
+
+    if ((path == NULL) ||
+        gBS->LocateHandleBuffer(ByProtocol, &UsbIoGuid, NULL, &count, &list)) {
+        return NULL;
+    }
+    for (UINTN i = 0; (i < count) && (h == NULL); i++) {
+        EFI_DEVICE_PATH* p;
+        if (gBS->HandleProtocol(list[i], &UsbIoGuid, (void**)&usb) ||
+            usb->UsbGetInterfaceDescriptor(usb, &ifc) ||
+            (ifc.InterfaceNumber != dev->data_if) ||
+            ((p = DevicePathFromHandle(list[i])) == NULL)) {
+            continue;
+        }
+        if (cdc_sibling(path, p)) {
+            h = list[i];
+        }
+    }
+    gBS->FreePool(list);
+    return h;
+}
+
+static EFI_STATUS cdc_set_alt(cdcnet* dev, uint8_t alt) {
+    return cdc_control(dev->data, USB_REQ_TYPE_STANDARD | USB_TARGET_INTERFACE,
+                       USB_REQ_SET_INTERFACE, alt, dev->data_if, NULL, 0);
+}
+
+static void cdc_set_filter(cdcnet* dev) {
+    UINT32 f = dev->mode.ReceiveFilterSetting;
+    uint16_t filter = CDC_FILTER_DIRECTED | CDC_FILTER_BROADCAST | CDC_FILTER_ALL_MULTICAST;
+
+    if (f & EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS) {
+        filter |= CDC_FILTER_PROMISCUOUS;
+    }
+    cdc_control(dev->ctl, USB_REQ_TYPE_CLASS | USB_TARGET_INTERFACE, CDC_SET_PACKET_FILTER,
+                filter, dev->ctl_if, NULL, 0);
+}
+
+// NTB sizes and alignment may only be changed with the data interface
+// in its setting without endpoints, so this comes before selecting the
+// one with them
+static int cdc_ncm_setup(cdcnet* dev) {
+    uint8_t p[28];
+    uint8_t in[4];
+
+    if (cdc_control(dev->ctl, USB_REQ_TYPE_CLASS | USB_TARGET_INTERFACE | USB_EP_IN,
+                    NCM_GET_NTB_PARAMETERS, 0, dev->ctl_if, p, sizeof(p))) {
+        return -1;
+    }
+    dev->in_max = get32(p + 4);
+    dev->out_max = get32(p + 16);
+    dev->out_div = get16(p + 20);
+    dev->out_rem = get16(p + 22);
+    dev->out_align = get16(p + 24);
+    dev->out_dgrams = get16(p + 26);
+
+    if (dev->in_max > CDC_NTB_MAX) {
+        dev->in_max = CDC_NTB_MAX;
+        put32(in, dev->in_max);
+        if (cdc_control(dev->ctl, USB_REQ_TYPE_CLASS | USB_TARGET_INTERFACE,
+                        NCM_SET_NTB_INPUT_SIZE, 0, dev->ctl_if, in, sizeof(in))) {
+            return -1;
+        }
+    }
+    if ((dev->out_max == 0) || (dev->out_max > CDC_NTB_MAX)) {
+        dev->out_max = CDC_NTB_MAX;
+    }
+    if (dev->out_div == 0) {
+        dev->out_div = 4;
+    }
+    dev->out_rem %= dev->out_div;
+    if ((dev->out_align < 4) || (dev->out_align & (dev->out_align - 1))) {
+        dev->out_align = 4;
+    }
+    if ((dev->out_dgrams == 0) || (dev->out_dgrams > CDC_TX_DGRAMS)) {
+        dev->out_dgrams = CDC_TX_DGRAMS;
+    }
+    printf("cdcnet: NTBs of up to %u bytes in, %u out\n", dev->in_max, dev->out_max);
+    return 0;
+}
+
+static int cdc_setup(cdcnet* dev) {
+    // back to no endpoints resets the data path
+    if (cdc_set_alt(dev, 0)) {
+        return -1;
+    }
+    dev->in_max = CDC_NTB_MAX;
+    if (dev->ncm && cdc_ncm_setup(dev)) {
+        return -1;
+    }
+    if (cdc_set_alt(dev, dev->data_alt)) {
+        return -1;
+    }
+    cdc_set_filter(dev);
+    dev->rx_len = 0;
+    dev->rx_ndp = 0;
+    dev->rx_have = 0;
+    dev->tx_len = NTH16_LEN;
+    dev->tx_count = 0;
+    dev->link_polls = 0;
+    dev->link_told = 0;
+    dev->mode.MediaPresent = FALSE;
+    return 0;
+}
+
+static EFI_STATUS cdc_bulk_out(cdcnet* dev, void* buf, UINTN len) {
+    UINT32 status;
+    EFI_STATUS r;
+
+    r = dev->data->UsbBulkTransfer(dev->data, dev->ep_out, buf, &len, CDC_TX_TIMEOUT, &status);
+    if (r == EFI_SUCCESS) {
+        dev->tx_xfers++;
+    }
+    return r;
+}
+
+// Send the block being built, if it has anything in it
+static void cdc_flush(cdcnet* dev) {
+    uint8_t* b = dev->tx_buf;
+    uint32_t ndp, len;
+
+    if (dev->tx_count == 0) {
+        return;
+    }
+    ndp = (dev->tx_len + dev->out_align - 1) & ~(dev->out_align - 1);
+    len = ndp + NDP16_LEN + (dev->tx_count + 1) * 4;
+    put32(b + ndp, NDP16_SIG);
+    put16(b + ndp + 4, len - ndp);
+    put16(b + ndp + 6, 0);
+    for (unsigned n = 0; n < dev->tx_count; n++) {
+        put16(b + ndp + NDP16_LEN + n * 4, dev->tx_dgram[n][0]);
+        put16(b + ndp + NDP16_LEN + n * 4 + 2, dev->tx_dgram[n][1]);
+    }
+    put32(b + len - 4, 0);
+    // a block ending on a packet boundary would need a zero length
+    // packet after it: a byte of padding does as well
+    if (((len % dev->maxpkt) == 0) && (len < dev->out_max)) {
+        b[len++] = 0;
+    }
+    put32(b, NTH16_SIG);
+    put16(b + 4, NTH16_LEN);
+    put16(b + 6, dev->seq++);
+    put16(b + 8, len);
+    put16(b + 10, ndp);
+    if (cdc_bulk_out(dev, b, len)) {
+        dev->tx_lost += dev->tx_count;
+    }
+    dev->tx_len = NTH16_LEN;
+    dev->tx_count = 0;
+}
+
+// Where a datagram of len bytes would start in the block being built,
+// or 0 if it doesn't fit
+static uint32_t cdc_place(cdcnet* dev, uint32_t len) {
+    uint32_t off = dev->tx_len + (dev->out_rem + dev->out_div - (dev->tx_len % dev->out_div)) % dev->out_div;
+    uint32_t ndp = (off + len + dev->out_align - 1) & ~(dev->out_align - 1);
+
+    if ((dev->tx_count == dev->out_dgrams) ||
+        ((ndp + NDP16_LEN + (dev->tx_count + 2) * 4) > dev->out_max)) {
+        return 0;
+    }
+    return off;
+}
+
+// A table at off in the block read in, checked, or 0 if there's none
+static uint32_t cdc_ndp(cdcnet* dev, uint32_t off) {
+    const uint8_t* b = dev->rx_buf;
+    uint32_t sig, len;
+
+    if ((off < NTH16_LEN) || (off & 3) || ((off + NDP16_LEN) > dev->rx_len) ||
+        (dev->rx_ndps++ == CDC_RX_NDPS)) {
+        return 0;
+    }
+    sig = get32(b + off);
+    len = get16(b + off + 4);
+    if (((sig != NDP16_SIG) && (sig != NDP16_SIGC)) || (len < NDP16_LEN) ||
+        ((off + len) > dev->rx_len)) {
+        return 0;
+    }
+    dev->rx_crc = (sig == NDP16_SIGC);
+    dev->rx_next = off + NDP16_LEN;
+    dev->rx_end = off + len;
+    return off;
+}
+
+// Find the next frame in the transfer last read in, if any is left
+static int cdc_next(cdcnet* dev) {
+    const uint8_t* b = dev->rx_buf;
+
+    if (!dev->ncm) {
+        if (dev->rx_len == 0) {
+            return -1;
+        }
+        dev->rx_off = 0;
+        dev->rx_flen = dev->rx_len;
+        dev->rx_len = 0;
+        dev->rx_have = 1;
+        return 0;
+    }
+    while (dev->rx_ndp) {
+        while ((dev->rx_next + 4) <= dev->rx_end) {
+            uint32_t off = get16(b + dev->rx_next);
+            uint32_t len = get16(b + dev->rx_next + 2);
+            dev->rx_next += 4;
+            if ((off == 0) || (len == 0)) {
+                break;
+            }
+            if (dev->rx_crc) {
+                len -= (len > 4) ? 4 : len;
+            }
+            if ((len < ETH_HDR_LEN) || (len > ETH_MTU) || ((off + len) > dev->rx_len)) {
+                dev->rx_bad++;
+                continue;
+            }
+            dev->rx_off = off;
+            dev->rx_flen = len;
+            dev->rx_have = 1;
+            return 0;
+        }
+        dev->rx_ndp = cdc_ndp(dev, get16(b + dev->rx_ndp + 6));
+    }
+    return -1;
+}
+
+// Read another transfer, and in NCM mode check its header
+static int cdc_pull(cdcnet* dev) {
+    const uint8_t* b = dev->rx_buf;
+    UINTN len = dev->in_max;
+    UINT32 status;
+    uint32_t blen;
+
+    dev->rx_len = 0;
+    dev->rx_ndp = 0;
+    if (dev->data->UsbBulkTransfer(dev->data, dev->ep_in, dev->rx_buf, &len,
+                                   CDC_RX_TIMEOUT, &status) || (len == 0)) {
+        return -1;
+    }
+    dev->rx_xfers++;
+    if (!dev->ncm) {
+        if ((len < ETH_HDR_LEN) || (len > ETH_MTU)) {
+            dev->rx_bad++;
+            return -1;
+        }
+        dev->rx_len = len;
+        return 0;
+    }
+    if ((len < NTH16_LEN) || (get32(b) != NTH16_SIG) || (get16(b + 4) != NTH16_LEN)) {
+        dev->rx_bad++;
+        return -1;
+    }
+    blen = get16(b + 8);
+    dev->rx_len = ((blen != 0) && (blen < len)) ? blen : len;
+    dev->rx_ndps = 0;
+    dev->rx_ndp = cdc_ndp(dev, get16(b + 10));
+    return dev->rx_ndp ? 0 : -1;
+}
+
+// Is a frame waiting?  If the last transfer is used up this reads
+// another, first sending anything the other end may be waiting on.
+static int cdc_rx_ready(cdcnet* dev) {
+    if (dev->rx_have || (cdc_next(dev) == 0)) {
+        return 1;
+    }
+    cdc_flush(dev);
+    return (cdc_pull(dev) == 0) && (cdc_next(dev) == 0);
+}
+
+// The device tells us with a notification, but not every one does, so
+// with no word for long enough the link is taken to be up
+static void cdc_link(cdcnet* dev) {
+    uint8_t note[16];
+    UINTN len = sizeof(note);
+    UINT32 status;
+
+    if ((dev->ep_int == 0) || (!dev->link_told && (++dev->link_polls > CDC_LINK_POLLS))) {
+        dev->mode.MediaPresent = TRUE;
+        return;
+    }
+    if ((dev->ctl->UsbSyncInterruptTransfer(dev->ctl, dev->ep_int, note, &len,
+                                            CDC_INT_TIMEOUT, &status) == EFI_SUCCESS) &&
+        (len >= 8) && (note[1] == CDC_NETWORK_CONNECTION)) {
+        dev->link_told = 1;
+        dev->mode.MediaPresent = (get16(note + 2) != 0);
+    }
+}
+
+static EFI_STATUS EFIAPI cdc_start(EFI_SIMPLE_NETWORK* snp) {
+    cdcnet* dev = (void*)snp;
+
+    if (dev->mode.State != EfiSimpleNetworkStopped) {
+        return EFI_ALREADY_STARTED;
+    }
+    dev->mode.State = EfiSimpleNetworkStarted;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI cdc_stop(EFI_SIMPLE_NETWORK* snp) {
+    cdcnet* dev = (void*)snp;
+
+    if (dev->mode.State == EfiSimpleNetworkStopped) {
+        return EFI_NOT_STARTED;
+    }
+    if (dev->mode.State == EfiSimpleNetworkInitialized) {
+        snp->Shutdown(snp);
+    }
+    dev->mode.State = EfiSimpleNetworkStopped;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI cdc_initialize(EFI_SIMPLE_NETWORK* snp, UINTN rx_extra, UINTN tx_extra) {
+    cdcnet* dev = (void*)snp;
+
+    if (dev->mode.State == EfiSimpleNetworkStopped) {
+        return EFI_NOT_STARTED;
+    }
+    if (dev->mode.State == EfiSimpleNetworkInitialized) {
+        return EFI_SUCCESS;
+    }
+    if (cdc_setup(dev)) {
+        return EFI_DEVICE_ERROR;
+    }
+    dev->mode.State = EfiSimpleNetworkInitialized;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI cdc_shutdown(EFI_SIMPLE_NETWORK* snp) {
+    cdcnet* dev = (void*)snp;
+
+    if (dev->mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    cdc_flush(dev);
+    printf("cdcnet: %ld frames in over %ld transfers, %ld out over %ld (%ld bad, %ld lost)\n",
+           dev->rx_frames, dev->rx_xfers, dev->tx_frames, dev->tx_xfers,
+           dev->rx_bad, dev->tx_lost);
+    cdc_set_alt(dev, 0);
+    dev->mode.State = EfiSimpleNetworkStarted;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI cdc_reset(EFI_SIMPLE_NETWORK* snp, BOOLEAN verify) {
+    EFI_STATUS r;
+
+    if ((r = cdc_shutdown(snp)) != EFI_SUCCESS) {
+        return r;
+    }
+    return cdc_initialize(snp, 0, 0);
+}
+
+// Multicast is always let through (the stack drops what isn't for it),
+// so only promiscuous mode changes what the device is asked for
+static EFI_STATUS EFIAPI cdc_filters(EFI_SIMPLE_NETWORK* snp, UINT32 enable, UINT32 disable,
+                                     BOOLEAN reset, UINTN count, EFI_MAC_ADDRESS* filters) {
+    cdcnet* dev = (void*)snp;
+
+    if (dev->mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    if (((enable | disable) & ~dev->mode.ReceiveFilterMask) ||
+        (count > dev->mode.MaxMCastFilterCount) || (count && (filters == NULL))) {
+        return EFI_INVALID_PARAMETER;
+    }
+    dev->mode.ReceiveFilterSetting = (dev->mode.ReceiveFilterSetting | enable) & ~disable;
+    if (reset || !(dev->mode.ReceiveFilterSetting & EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST)) {
+        dev->mode.MCastFilterCount = 0;
+    } else if (count) {
+        memcpy(dev->mode.MCastFilter, filters, count * sizeof(EFI_MAC_ADDRESS));
+        dev->mode.MCastFilterCount = count;
+    }
+    cdc_set_filter(dev);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI cdc_station(EFI_SIMPLE_NETWORK* snp, BOOLEAN reset,
+                                     EFI_MAC_ADDRESS* addr) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI cdc_stats(EFI_SIMPLE_NETWORK* snp, BOOLEAN reset,
+                                   UINTN* size, EFI_NETWORK_STATISTICS* stats) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI cdc_mcast(EFI_SIMPLE_NETWORK* snp, BOOLEAN ipv6,
+                                   EFI_IP_ADDRESS* ip, EFI_MAC_ADDRESS* mac) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI cdc_nvdata(EFI_SIMPLE_NETWORK* snp, BOOLEAN read,
+                                    UINTN off, UINTN len, VOID* buf) {
+    return EFI_UNSUPPORTED;
+}
+
+// Frames are copied out (NCM) or sent (ECM) by Transmit, so their
+// buffers are handed back one per call straight away
+static EFI_STATUS EFIAPI cdc_get_status(EFI_SIMPLE_NETWORK* snp, UINT32* irq, VOID** txbuf) {
+    cdcnet* dev = (void*)snp;
+
+    if (dev->mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    if (!dev->mode.MediaPresent) {
+        cdc_link(dev);
+    }
+    if (irq) {
+        *irq = 0;
+    }
+    if (txbuf == NULL) {
+        return EFI_SUCCESS;
+    }
+    *txbuf = NULL;
+    if (dev->tx_done_count) {
+        *txbuf = dev->tx_done[dev->tx_done_head];
+        dev->tx_done_head = (dev->tx_done_head + 1) % CDC_TXDONE;
+        dev->tx_done_count--;
+        if (irq) {
+            *irq = EFI_SIMPLE_NETWORK_TRANSMIT_INTERRUPT;
+        }
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI cdc_transmit(EFI_SIMPLE_NETWORK* snp, UINTN hsz, UINTN bsz, VOID* buf,
+                                      EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    cdcnet* dev = (void*)snp;
+    uint8_t* hdr = buf;
+    uint32_t off;
+
+    if (dev->mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    if ((bsz < ETH_HDR_LEN) || (bsz > ETH_MTU)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    if (hsz) {
+        if ((hsz != ETH_HDR_LEN) || (dst == NULL) || (proto == NULL)) {
+            return EFI_INVALID_PARAMETER;
+        }
+        memcpy(hdr, dst, 6);
+        memcpy(hdr + 6, src ? src : &dev->mode.CurrentAddress, 6);
+        hdr[12] = *proto >> 8;
+        hdr[13] = *proto;
+    }
+    if (dev->tx_done_count == CDC_TXDONE) {
+        return EFI_NOT_READY;
+    }
+    if (dev->ncm) {
+        if ((off = cdc_place(dev, bsz)) == 0) {
+            cdc_flush(dev);
+            if ((off = cdc_place(dev, bsz)) == 0) {
+                return EFI_DEVICE_ERROR;
+            }
+        }
+        memcpy(dev->tx_buf + off, buf, bsz);
+        dev->tx_dgram[dev->tx_count][0] = off;
+        dev->tx_dgram[dev->tx_count][1] = bsz;
+        dev->tx_count++;
+        dev->tx_len = off + bsz;
+    } else {
+        if (cdc_bulk_out(dev, buf, bsz)) {
+            return EFI_DEVICE_ERROR;
+        }
+        // the end of a frame filling its last packet is marked by an empty one
+        if ((bsz % dev->maxpkt) == 0) {
+            cdc_bulk_out(dev, buf, 0);
+        }
+    }
+    dev->tx_frames++;
+    dev->tx_done[(dev->tx_done_head + dev->tx_done_count) % CDC_TXDONE] = buf;
+    dev->tx_done_count++;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI cdc_receive(EFI_SIMPLE_NETWORK* snp, UINTN* hsz, UINTN* bsz, VOID* buf,
+                                     EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    cdcnet* dev = (void*)snp;
+    const uint8_t* frame;
+
+    if (dev->mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    if (!cdc_rx_ready(dev)) {
+        return EFI_NOT_READY;
+    }
+    if (*bsz < dev->rx_flen) {
+        *bsz = dev->rx_flen;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    frame = dev->rx_buf + dev->rx_off;
+    memcpy(buf, frame, dev->rx_flen);
+    *bsz = dev->rx_flen;
+    dev->rx_have = 0;
+    dev->rx_frames++;
+    if (hsz) {
+        *hsz = ETH_HDR_LEN;
+    }
+    if (dst) {
+        memset(dst, 0, sizeof(*dst));
+        memcpy(dst, frame, 6);
+    }
+    if (src) {
+        memset(src, 0, sizeof(*src));
+        memcpy(src, frame + 6, 6);
+    }
+    if (proto) {
+        *proto = (frame[12] << 8) | frame[13];
+    }
+    return EFI_SUCCESS;
+}
+
+// Polled by WaitForEvent while netifc_wait sleeps
+static VOID EFIAPI cdc_wait(EFI_EVENT ev, VOID* ctx) {
+    cdcnet* dev = ctx;
+
+    if (dev->mode.State != EfiSimpleNetworkInitialized) {
+        return;
+    }
+    if (cdc_rx_ready(dev)) {
+        gBS->SignalEvent(ev);
+    }
+}
+
+static void cdc_snp_setup(cdcnet* dev) {
+    dev->snp.Revision = EFI_SIMPLE_NETWORK_INTERFACE_REVISION;
+    dev->snp.Start = cdc_start;
+    dev->snp.Stop = cdc_stop;
+    dev->snp.Initialize = cdc_initialize;
+    dev->snp.Reset = cdc_reset;
+    dev->snp.Shutdown = cdc_shutdown;
+    dev->snp.ReceiveFilters = cdc_filters;
+    dev->snp.StationAddress = cdc_station;
+    dev->snp.Statistics = cdc_stats;
+    dev->snp.MCastIpToMac = cdc_mcast;
+    dev->snp.NvData = cdc_nvdata;
+    dev->snp.GetStatus = cdc_get_status;
+    dev->snp.Transmit = cdc_transmit;
+    dev->snp.Receive = cdc_receive;
+    dev->snp.Mode = &dev->mode;
+
+    dev->mode.State = EfiSimpleNetworkStopped;
+    dev->mode.HwAddressSize = 6;
+    dev->mode.MediaHeaderSize = ETH_HDR_LEN;
+    dev->mode.MaxPacketSize = 1500;
+    dev->mode.ReceiveFilterMask = EFI_SIMPLE_NETWORK_RECEIVE_UNICAST |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST;
+    dev->mode.MaxMCastFilterCount = MAX_MCAST_FILTER_CNT;
+    dev->mode.IfType = 1; // ethernet
+    dev->mode.MacAddressChangeable = FALSE;
+    dev->mode.MultipleTxSupported = TRUE;
+    dev->mode.MediaPresentSupported = TRUE;
+    memset(&dev->mode.BroadcastAddress, 0xff, 6);
+}
+
+static EFI_STATUS EFIAPI cdc_supported(EFI_DRIVER_BINDING* self, EFI_HANDLE ctlr,
+                                       EFI_DEVICE_PATH* path) {
+    EFI_USB_INTERFACE_DESCRIPTOR ifc;
+    EFI_USB_IO_PROTOCOL* usb;
+    EFI_STATUS r;
+
+    r = gBS->OpenProtocol(ctlr, &UsbIoGuid, (void**)&usb, self->DriverBindingHandle,
+                          ctlr, EFI_OPEN_PROTOCOL_BY_DRIVER);
+    if (r) {
+        return r;
+    }
+    r = EFI_UNSUPPORTED;
+    if ((usb->UsbGetInterfaceDescriptor(usb, &ifc) == EFI_SUCCESS) &&
+        (ifc.InterfaceClass == USB_CLASS_CDC) &&
+        ((ifc.InterfaceSubClass == CDC_SUBCLASS_ECM) ||
+         (ifc.InterfaceSubClass == CDC_SUBCLASS_NCM))) {
+        r = EFI_SUCCESS;
+    }
+    gBS->CloseProtocol(ctlr, &UsbIoGuid, self->DriverBindingHandle, ctlr);
+    return r;
+}
+
+static EFI_STATUS EFIAPI cdc_start_driver(EFI_DRIVER_BINDING* self, EFI_HANDLE ctlr,
+                                          EFI_DEVICE_PATH* path) {
+    EFI_USB_CONFIG_DESCRIPTOR cfg;
+    EFI_USB_DEVICE_DESCRIPTOR ddesc;
+    EFI_USB_INTERFACE_DESCRIPTOR ifc;
+    MAC_ADDR_DEVICE_PATH node;
+    EFI_DEVICE_PATH* parent;
+    uint8_t* buf = NULL;
+    uint16_t len = 0;
+    cdcnet* dev;
+    unsigned slot;
+    uint8_t* mac;
+
+    for (slot = 0; slot < CDC_MAX; slot++) {
+        if (devs[slot] == NULL) {
+            break;
+        }
+    }
+    if (slot == CDC_MAX) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    if (gBS->AllocatePool(EfiLoaderData, sizeof(*dev), (void**)&dev)) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    memset(dev, 0, sizeof(*dev));
+    dev->ctl_h = ctlr;
+    if (gBS->OpenProtocol(ctlr, &UsbIoGuid, (void**)&dev->ctl, self->DriverBindingHandle,
+                          ctlr, EFI_OPEN_PROTOCOL_BY_DRIVER)) {
+        gBS->FreePool(dev);
+        return EFI_DEVICE_ERROR;
+    }
+    if (dev->ctl->UsbGetInterfaceDescriptor(dev->ctl, &ifc) ||
+        dev->ctl->UsbGetConfigDescriptor(dev->ctl, &cfg) ||
+        dev->ctl->UsbGetDeviceDescriptor(dev->ctl, &ddesc)) {
+        goto fail;
+    }
+    dev->ctl_if = ifc.InterfaceNumber;
+    dev->ncm = (ifc.InterfaceSubClass == CDC_SUBCLASS_NCM);
+
+    // the one in use is known by value, but asked for by index
+    for (uint8_t n = 0; n < ddesc.NumConfigurations; n++) {
+        if ((buf = cdc_config(dev->ctl, n, &len)) == NULL) {
+            continue;
+        }
+        if (buf[5] == cfg.ConfigurationValue) {
+            break;
+        }
+        gBS->FreePool(buf);
+        buf = NULL;
+    }
+    if ((buf == NULL) || cdc_parse(dev, buf, len) || cdc_mac(dev)) {
+        printf("cdcnet: cannot make sense of %04x:%04x\n", ddesc.IdVendor, ddesc.IdProduct);
+        goto fail;
+    }
+    if (((dev->data_h = cdc_data_handle(dev)) == NULL) ||
+        gBS->OpenProtocol(dev->data_h, &UsbIoGuid, (void**)&dev->data,
+                          self->DriverBindingHandle, dev->data_h, EFI_OPEN_PROTOCOL_BY_DRIVER)) {
+        printf("cdcnet: cannot open data interface %d\n", dev->data_if);
+        goto fail;
+    }
+    if ((gBS->AllocatePool(EfiLoaderData, CDC_NTB_MAX, (void**)&dev->rx_buf) != EFI_SUCCESS) ||
+        (gBS->AllocatePool(EfiLoaderData, CDC_NTB_MAX, (void**)&dev->tx_buf) != EFI_SUCCESS)) {
+        goto fail_data;
+    }
+
+    cdc_snp_setup(dev);
+    if (gBS->CreateEvent(EVT_NOTIFY_WAIT, TPL_CALLBACK, cdc_wait, dev,
+                         &dev->snp.WaitForPacket)) {
+        goto fail_data;
+    }
+
+    // the control interface's path, and the address
+    if ((parent = DevicePathFromHandle(ctlr)) == NULL) {
+        goto fail_event;
+    }
+    memset(&node, 0, sizeof(node));
+    node.Header.Type = MESSAGING_DEVICE_PATH;
+    node.Header.SubType = MSG_MAC_ADDR_DP;
+    SetDevicePathNodeLength(&node.Header, sizeof(node));
+    memcpy(&node.MacAddress, &dev->mode.CurrentAddress, 6);
+    node.IfType = dev->mode.IfType;
+    if ((dev->path = AppendDevicePathNode(parent, (EFI_DEVICE_PATH*)&node)) == NULL) {
+        goto fail_event;
+    }
+    if (gBS->InstallMultipleProtocolInterfaces(&dev->h, &SimpleNetworkProtocol, &dev->snp,
+                                               &DevicePathProtocol, dev->path, NULL)) {
+        goto fail_path;
+    }
+    gBS->OpenProtocol(ctlr, &UsbIoGuid, (void**)&dev->ctl, self->DriverBindingHandle,
+                      dev->h, EFI_OPEN_PROTOCOL_BY_CHILD_CONTROLLER);
+    gBS->FreePool(buf);
+    devs[slot] = dev;
+
+    mac = dev->mode.CurrentAddress.Addr;
+    printf("cdcnet: %s %04x:%04x %02x:%02x:%02x:%02x:%02x:%02x\n", dev->ncm ? "NCM" : "ECM",
+           ddesc.IdVendor, ddesc.IdProduct, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return EFI_SUCCESS;
+
+fail_path:
+    gBS->FreePool(dev->path);
+fail_event:
+    gBS->CloseEvent(dev->snp.WaitForPacket);
+fail_data:
+    if (dev->rx_buf) {
+        gBS->FreePool(dev->rx_buf);
+    }
+    if (dev->tx_buf) {
+        gBS->FreePool(dev->tx_buf);
+    }
+    gBS->CloseProtocol(dev->data_h, &UsbIoGuid, self->DriverBindingHandle, dev->data_h);
+fail:
+    if (buf) {
+        gBS->FreePool(buf);
+    }
+    gBS->CloseProtocol(ctlr, &UsbIoGuid, self->DriverBindingHandle, ctlr);
+    gBS->FreePool(dev);
+    return EFI_DEVICE_ERROR;
+}
+
+// Called for our child first, then for the control interface
+static EFI_STATUS EFIAPI cdc_stop_driver(EFI_DRIVER_BINDING* self, EFI_HANDLE ctlr,
+                                         UINTN count, EFI_HANDLE* children) {
+    cdcnet* dev = NULL;
+    unsigned slot;
+
+    for (slot = 0; slot < CDC_MAX; slot++) {
+        if (devs[slot] && (devs[slot]->ctl_h == ctlr)) {
+            dev = devs[slot];
+            break;
+        }
+    }
+    if (dev == NULL) {
+        return EFI_DEVICE_ERROR;
+    }
+    if (count) {
+        if (dev->mode.State != EfiSimpleNetworkStopped) {
+            cdc_stop(&dev->snp);
+        }
+        gBS->CloseProtocol(ctlr, &UsbIoGuid, self->DriverBindingHandle, dev->h);
+        if (gBS->UninstallMultipleProtocolInterfaces(dev->h, &SimpleNetworkProtocol, &dev->snp,
+                                                     &DevicePathProtocol, dev->path, NULL)) {
+            return EFI_DEVICE_ERROR;
+        }
+        dev->h = NULL;
+        return EFI_SUCCESS;
+    }
+    gBS->CloseEvent(dev->snp.WaitForPacket);
+    gBS->CloseProtocol(dev->data_h, &UsbIoGuid, self->DriverBindingHandle, dev->data_h);
+    gBS->CloseProtocol(ctlr, &UsbIoGuid, self->DriverBindingHandle, ctlr);
+    gBS->FreePool(dev->path);
+    gBS->FreePool(dev->rx_buf);
+    gBS->FreePool(dev->tx_buf);
+    gBS->FreePool(dev);
+    devs[slot] = NULL;
+    return EFI_SUCCESS;
+}
+
+static EFI_DRIVER_BINDING cdc_driver = {
+    .Supported = cdc_supported,
+    .Start = cdc_start_driver,
+    .Stop = cdc_stop_driver,
+    .Version = 32,
+};
+
+// Nonzero if a driver has the interface at h, or has made a child (a
+// simple network protocol, say) of it
+static int cdc_driven(EFI_HANDLE h) {
+    EFI_OPEN_PROTOCOL_INFORMATION_ENTRY* info;
+    UINTN count;
+    int driven = 0;
+
+    if (gBS->OpenProtocolInformation(h, &UsbIoGuid, &info, &count)) {
+        return 1;
+    }
+    for (UINTN i = 0; i < count; i++) {
+        if (info[i].Attributes & (EFI_OPEN_PROTOCOL_BY_DRIVER | EFI_OPEN_PROTOCOL_EXCLUSIVE |
+                                  EFI_OPEN_PROTOCOL_BY_CHILD_CONTROLLER)) {
+            driven = 1;
+        }
+    }
+    gBS->FreePool(info);
+    return driven;
+}
+
+// Nonzero if a driver has any interface of the device at h (whose
+// handles go away when its configuration changes)
+static int cdc_device_driven(EFI_HANDLE h, const EFI_HANDLE* list, UINTN count) {
+    EFI_DEVICE_PATH* path = DevicePathFromHandle(h);
+    EFI_DEVICE_PATH* p;
+
+    if (path == NULL) {
+        return 1;
+    }
+    for (UINTN i = 0; i < count; i++) {
+        if (((p = DevicePathFromHandle(list[i])) != NULL) && cdc_sibling(path, p) &&
+            cdc_driven(list[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A device that comes up in some other configuration (qemu's usb-net
+// starts out as RNDIS) is moved over to the best one it has: NCM before
+// ECM.  The bus driver makes new interface handles for it.  One that
+// some other driver already has (a vendor configuration, driven by the
+// firmware's own network driver, say) is left alone.
+static void cdc_configure(EFI_HANDLE h, const EFI_HANDLE* list, UINTN count) {
+    EFI_USB_DEVICE_DESCRIPTOR ddesc;
+    EFI_USB_INTERFACE_DESCRIPTOR ifc;
+    EFI_USB_CONFIG_DESCRIPTOR cfg;
+    EFI_USB_IO_PROTOCOL* usb;
+    uint8_t best = 0, kind, value = 0;
+    uint8_t* buf;
+    uint16_t len;
+
+    // one interface of each device is enough
+    if (gBS->HandleProtocol(h, &UsbIoGuid, (void**)&usb) ||
+        usb->UsbGetInterfaceDescriptor(usb, &ifc) || (ifc.InterfaceNumber != 0) ||
+        usb->UsbGetDeviceDescriptor(usb, &ddesc) ||
+        usb->UsbGetConfigDescriptor(usb, &cfg)) {
+        return;
+    }
+    for (uint8_t n = 0; n < ddesc.NumConfigurations; n++) {
+        if ((buf = cdc_config(usb, n, &len)) == NULL) {
+            continue;
+        }
+        kind = cdc_kind(buf, len);
+        if ((kind == CDC_SUBCLASS_NCM) || ((kind == CDC_SUBCLASS_ECM) && (best == 0))) {
+            best = kind;
+            value = buf[5];
+        }
+        gBS->FreePool(buf);
+    }
+    if ((best == 0) || (value == cfg.ConfigurationValue)) {
+        return;
+    }
+    if (cdc_device_driven(h, list, count)) {
+        printf("cdcnet: %04x:%04x is in use, not switching it to %s\n", ddesc.IdVendor,
+               ddesc.IdProduct, (best == CDC_SUBCLASS_NCM) ? "NCM" : "ECM");
+        return;
+    }
+    printf("cdcnet: %04x:%04x to configuration %d (%s)\n", ddesc.IdVendor, ddesc.IdProduct,
+           value, (best == CDC_SUBCLASS_NCM) ? "NCM" : "ECM");
+    cdc_control(usb, USB_REQ_TYPE_STANDARD | USB_TARGET_DEVICE, USB_REQ_SET_CONFIG,
+                value, 0, NULL, 0);
+}
+
+EFI_STATUS cdcnet_init(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
+    EFI_HANDLE* list;
+    UINTN count, i;
+    EFI_STATUS r;
+
+    // a handle of its own: the image's may carry another driver's binding
+    cdc_driver.ImageHandle = img;
+    cdc_driver.DriverBindingHandle = NULL;
+    r = gBS->InstallProtocolInterface(&cdc_driver.DriverBindingHandle, &DriverBindingProtocol,
+                                      EFI_NATIVE_INTERFACE, &cdc_driver);
+    if (r) {
+        printf("cdcnet: cannot install driver (%s)\n", efi_strerror(r));
+        return r;
+    }
+
+    if (gBS->LocateHandleBuffer(ByProtocol, &UsbIoGuid, NULL, &count, &list)) {
+        return EFI_SUCCESS;
+    }
+    for (i = 0; i < count; i++) {
+        cdc_configure(list[i], list, count);
+    }
+    gBS->FreePool(list);
+
+    // again, for any interfaces that came and went above
+    if (gBS->LocateHandleBuffer(ByProtocol, &UsbIoGuid, NULL, &count, &list)) {
+        return EFI_SUCCESS;
+    }
+    for (i = 0; i < count; i++) {
+        gBS->ConnectController(list[i], NULL, NULL, FALSE);
+    }
+    gBS->FreePool(list);
+    return EFI_SUCCESS;
+}
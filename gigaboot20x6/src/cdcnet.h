@@ -0,0 +1,26 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// A driver for USB network adapters of the communications device class,
+// ECM or NCM.  Each one found gets a simple network protocol of its own,
+// which netifc finds and uses like any other.  In NCM mode many frames
+// share each bulk transfer, both ways.
+
+// Register the driver and connect it to every adapter present, switching
+// any that offers ECM or NCM in a configuration it isn't in over to it,
+// unless another driver has the adapter already.  Used only if the
+// netdrv file names "cdcnet" (see pcinet.h).
+EFI_STATUS cdcnet_init(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys);
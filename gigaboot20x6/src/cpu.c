@@ -0,0 +1,71 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+#if defined(__x86_64__)
+// Returns EAX of the leaf, with EBX and ECX in *b and *c
+static uint32_t cpuid(uint32_t leaf, uint32_t* b, uint32_t* c) {
+    uint32_t a, d;
+    __asm__ __volatile__("cpuid" : "=a"(a), "=b"(*b), "=c"(*c), "=d"(d) : "a"(leaf), "c"(0));
+    return a;
+}
+
+static unsigned cpu_probe(void) {
+    uint32_t b, c, lo, hi;
+    unsigned f = 0;
+    int ymm = 0;
+
+    if (cpuid(0, &b, &c) < 7) {
+        return 0;
+    }
+    cpuid(1, &b, &c);
+    if (c & (1 << 9)) {
+        f |= CPU_SSSE3;
+    }
+    if (c & (1 << 19)) {
+        f |= CPU_SSE41;
+    }
+    // OSXSAVE and AVX, then the XMM and YMM state enabled in XCR0
+    if ((c & (1 << 27)) && (c & (1 << 28))) {
+        __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        ymm = ((lo & 6) == 6);
+    }
+    cpuid(7, &b, &c);
+    if (ymm && (b & (1 << 5))) {
+        f |= CPU_AVX2;
+    }
+    if (b & (1 << 29)) {
+        f |= CPU_SHA;
+    }
+    return f;
+}
+#endif
+
+unsigned cpu_features(void) {
+#if defined(__x86_64__)
+    static unsigned features;
+    static int probed;
+
+    if (!probed) {
+        features = cpu_probe();
+        probed = 1;
+    }
+    return features;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,27 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Processor features osboot has faster code for, each usable only if
+// the processor has it and (for the AVX ones) the firmware has enabled
+// the state it needs in XCR0
+#define CPU_SSSE3 (1 << 0)
+#define CPU_SSE41 (1 << 1)
+#define CPU_AVX2 (1 << 2)
+#define CPU_SHA (1 << 3)
+
+// Those of the CPU_ features this processor has, found with CPUID the
+// first time it is asked.  None, off x86_64.
+unsigned cpu_features(void);
@@ -0,0 +1,194 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "csum.h"
+
+// Whatever the alignment of a packet, x86 reads it as is
+typedef uint32_t u32_u __attribute__((aligned(1), may_alias));
+typedef uint16_t u16_u __attribute__((aligned(1), may_alias));
+
+static uint16_t csum_fold(uint64_t sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (sum & 0xFFFF) + (sum >> 16);
+}
+
+// A 64 bit sum of 32 bit words cannot carry out for any packet we will
+// see, so the carries are all folded back in at the end.  Copies the
+// words to dst as well, if set.
+static uint64_t csum_words(uint64_t sum, uint8_t* dst, const uint8_t* p, size_t len) {
+    uint64_t odd = 0;
+
+    while (len >= 8) {
+        uint32_t w0 = *(const u32_u*)p;
+        uint32_t w1 = *(const u32_u*)(p + 4);
+        if (dst) {
+            *(u32_u*)dst = w0;
+            *(u32_u*)(dst + 4) = w1;
+            dst += 8;
+        }
+        sum += w0;
+        odd += w1;
+        p += 8;
+        len -= 8;
+    }
+    sum += csum_fold(odd);
+    while (len >= 4) {
+        uint32_t w = *(const u32_u*)p;
+        if (dst) {
+            *(u32_u*)dst = w;
+            dst += 4;
+        }
+        sum += w;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w = *(const u16_u*)p;
+        if (dst) {
+            *(u16_u*)dst = w;
+            dst += 2;
+        }
+        sum += w;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        if (dst) {
+            *dst = *p;
+        }
+        sum += *p;
+    }
+    return sum;
+}
+
+static uint16_t csum_c(const void* data, size_t len, uint16_t sum) {
+    return csum_fold(csum_words(sum, 0, data, len));
+}
+
+static uint16_t csum_copy_c(void* dst, const void* src, size_t len, uint16_t sum) {
+    return csum_fold(csum_words(sum, dst, src, len));
+}
+
+#if defined(__x86_64__)
+// The vector versions widen each 32 bit word into a 64 bit lane (which
+// lane doesn't matter to a sum) and add.
+typedef int v4si __attribute__((vector_size(16)));
+typedef long long v2di __attribute__((vector_size(16)));
+typedef int v4si_u __attribute__((vector_size(16), aligned(1)));
+typedef int v8si __attribute__((vector_size(32)));
+typedef long long v4di __attribute__((vector_size(32)));
+typedef int v8si_u __attribute__((vector_size(32), aligned(1)));
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+SSE2_TARGET static uint64_t sum_sse2(uint64_t sum, uint8_t* dst, const uint8_t* p, size_t len) {
+    const v4si zero = { 0, 0, 0, 0 };
+    v2di a = { 0, 0 }, b = { 0, 0 };
+    size_t n;
+
+    for (n = 0; (n + 16) <= len; n += 16) {
+        v4si x = *(const v4si_u*)(p + n);
+        if (dst) {
+            *(v4si_u*)(dst + n) = x;
+        }
+        a += (v2di)__builtin_ia32_punpckldq128(x, zero);
+        b += (v2di)__builtin_ia32_punpckhdq128(x, zero);
+    }
+    a += b;
+    sum += csum_fold(a[0]);
+    sum += csum_fold(a[1]);
+    return csum_words(sum, dst ? (dst + n) : 0, p + n, len - n);
+}
+
+AVX2_TARGET static uint64_t sum_avx2(uint64_t sum, uint8_t* dst, const uint8_t* p, size_t len) {
+    const v8si zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    v4di a = { 0, 0, 0, 0 }, b = { 0, 0, 0, 0 };
+    size_t n;
+
+    for (n = 0; (n + 32) <= len; n += 32) {
+        v8si x = *(const v8si_u*)(p + n);
+        if (dst) {
+            *(v8si_u*)(dst + n) = x;
+        }
+        a += (v4di)__builtin_ia32_punpckldq256(x, zero);
+        b += (v4di)__builtin_ia32_punpckhdq256(x, zero);
+    }
+    a += b;
+    sum += csum_fold(a[0]);
+    sum += csum_fold(a[1]);
+    sum += csum_fold(a[2]);
+    sum += csum_fold(a[3]);
+    return csum_words(sum, dst ? (dst + n) : 0, p + n, len - n);
+}
+
+static uint16_t csum_sse2(const void* data, size_t len, uint16_t sum) {
+    return csum_fold(sum_sse2(sum, 0, data, len));
+}
+
+static uint16_t csum_copy_sse2(void* dst, const void* src, size_t len, uint16_t sum) {
+    return csum_fold(sum_sse2(sum, dst, src, len));
+}
+
+static uint16_t csum_avx2(const void* data, size_t len, uint16_t sum) {
+    return csum_fold(sum_avx2(sum, 0, data, len));
+}
+
+static uint16_t csum_copy_avx2(void* dst, const void* src, size_t len, uint16_t sum) {
+    return csum_fold(sum_avx2(sum, dst, src, len));
+}
+#endif
+
+static uint16_t (*csum_fn)(const void* data, size_t len, uint16_t sum);
+static uint16_t (*csum_copy_fn)(void* dst, const void* src, size_t len, uint16_t sum);
+
+int csum_accel(int level) {
+    csum_fn = csum_c;
+    csum_copy_fn = csum_copy_c;
+#if defined(__x86_64__)
+    // every x86_64 has SSE2
+    if (level >= CSUM_AVX2 && (cpu_features() & CPU_AVX2)) {
+        csum_fn = csum_avx2;
+        csum_copy_fn = csum_copy_avx2;
+        return CSUM_AVX2;
+    }
+    if (level >= CSUM_SSE2) {
+        csum_fn = csum_sse2;
+        csum_copy_fn = csum_copy_sse2;
+        return CSUM_SSE2;
+    }
+#endif
+    return CSUM_PORTABLE;
+}
+
+uint16_t csum(const void* data, size_t len, uint16_t sum) {
+    if (csum_fn == 0) {
+        csum_accel(CSUM_AVX2);
+    }
+    return csum_fn(data, len, sum);
+}
+
+uint16_t csum_copy(void* dst, const void* src, size_t len, uint16_t sum) {
+    if (csum_copy_fn == 0) {
+        csum_accel(CSUM_AVX2);
+    }
+    return csum_copy_fn(dst, src, len, sum);
+}
@@ -0,0 +1,36 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Internet checksum (RFC 1071)
+//
+// The 16-bit ones' complement sum of len bytes at data, added to sum and
+// folded, but not complemented.  Words are summed as they lie in memory,
+// so the sum comes out in the byte order of the data.  An odd last byte
+// counts as if followed by a zero, so only the last piece of a sum made
+// in pieces may have an odd length.
+uint16_t csum(const void* data, size_t len, uint16_t sum);
+
+// The same, while copying the len bytes from src to dst
+uint16_t csum_copy(void* dst, const void* src, size_t len, uint16_t sum);
+
+#define CSUM_PORTABLE 0 // 32 bits at a time into a 64 bit sum
+#define CSUM_SSE2 1     // 16 bytes at a time
+#define CSUM_AVX2 2     // 32 bytes at a time
+
+// Use the best of the above, up to level, that the processor (and, for
+// AVX2, whatever set it up) supports.  Returns the level picked.  The
+// first sum picks the best there is.
+int csum_accel(int level);
@@ -0,0 +1,173 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput of the internet checksum: the 16 bits at a time loop inet6
+// used to have, against each implementation csum_accel() can pick, on
+// its own and fused with a copy (as against a checksum, then memcpy).
+// Packets are taken from a span small enough to stay in the cache, as
+// a frame just received would be.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <stdint.h>
+
+#include "csum.h"
+
+static char* appname;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// inet6.c's checksum() as it was
+static uint16_t checksum16(const void* _data, size_t len, uint16_t _sum) {
+    uint32_t sum = _sum;
+    const uint16_t* data = _data;
+    while (len > 1) {
+        sum += *data++;
+        len -= 2;
+    }
+    if (len) {
+        sum += (*data & 0xFF);
+    }
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return sum;
+}
+
+// Only 0 and 0xFFFF both mean zero; fold the one into the other
+static uint16_t canon(uint16_t sum) {
+    return (sum == 0xFFFF) ? 0 : sum;
+}
+
+void usage(void) {
+    fprintf(stderr,
+            "usage:   %s [ <option> ]*\n"
+            "\n"
+            "options: -s <n>  megabytes of packets to run through each test (default 1024)\n",
+            appname);
+    exit(1);
+}
+
+#define SPAN (1024 * 1024)
+
+// where the nth packet of len bytes is
+#define AT(p, n, len) ((p) + ((n) % (SPAN / (len))) * (len))
+
+static const char* names[] = { "portable:", "sse2:    ", "avx2:    " };
+
+int main(int argc, char** argv) {
+    static const size_t sizes[] = { 64, 576, 1452, 8192, 65536 };
+    size_t total = 1024;
+    volatile uint16_t sink = 0;
+    uint8_t* data;
+    uint8_t* copy;
+    uint64_t t;
+    int bad = 0;
+
+    appname = argv[0];
+    while (argc > 1) {
+        if (argc < 3)
+            usage();
+        if (!strcmp(argv[1], "-s")) {
+            total = atoi(argv[2]);
+        } else {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (total < 1)
+        usage();
+
+    total <<= 20;
+    if (((data = malloc(SPAN + 64)) == NULL) || ((copy = malloc(SPAN + 64)) == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return 1;
+    }
+    srand(1);
+    for (size_t n = 0; n < (SPAN + 64); n++) {
+        data[n] = rand();
+    }
+
+    // every implementation has to agree with the old loop, at any
+    // alignment and length, copying or not
+    for (int level = CSUM_PORTABLE; level <= CSUM_AVX2; level++) {
+        if (csum_accel(level) != level) {
+            continue;
+        }
+        for (size_t i = 0; i < 20000; i++) {
+            size_t off = rand() % 64;
+            size_t len = rand() % 3000;
+            uint16_t seed = rand();
+            uint16_t want = checksum16(data + off, len, seed);
+            if ((canon(csum(data + off, len, seed)) != canon(want)) ||
+                (canon(csum_copy(copy + (i % 7), data + off, len, seed)) != canon(want)) ||
+                memcmp(copy + (i % 7), data + off, len)) {
+                printf("%s MISMATCH at offset %zu length %zu\n", names[level], off, len);
+                bad = 1;
+                break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+        size_t count = total / sizes[i];
+        t = now_ns();
+        for (size_t n = 0; n < count; n++) {
+            sink += checksum16(AT(data, n, sizes[i]), sizes[i], 0);
+        }
+        t = now_ns() - t;
+        printf("16 bit:    %5zu byte packets: %8.1f MB/s\n",
+               sizes[i], (count * sizes[i]) / (t / 1e3));
+    }
+    for (int level = CSUM_PORTABLE; level <= CSUM_AVX2; level++) {
+        if (csum_accel(level) != level) {
+            printf("%s not supported by this processor\n", names[level]);
+            continue;
+        }
+        for (size_t i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+            size_t count = total / sizes[i];
+            uint64_t tc, tm, tf;
+            t = now_ns();
+            for (size_t n = 0; n < count; n++) {
+                sink += csum(AT(data, n, sizes[i]), sizes[i], 0);
+            }
+            tc = now_ns() - t;
+            t = now_ns();
+            for (size_t n = 0; n < count; n++) {
+                sink += csum(AT(data, n, sizes[i]), sizes[i], 0);
+                memcpy(AT(copy, n, sizes[i]), AT(data, n, sizes[i]), sizes[i]);
+            }
+            tm = now_ns() - t;
+            t = now_ns();
+            for (size_t n = 0; n < count; n++) {
+                sink += csum_copy(AT(copy, n, sizes[i]), AT(data, n, sizes[i]), sizes[i], 0);
+            }
+            tf = now_ns() - t;
+            printf("%s %5zu byte packets: %8.1f MB/s, with memcpy %8.1f MB/s, fused %8.1f MB/s\n",
+                   names[level], sizes[i], (count * sizes[i]) / (tc / 1e3),
+                   (count * sizes[i]) / (tm / 1e3), (count * sizes[i]) / (tf / 1e3));
+        }
+    }
+    free(data);
+    free(copy);
+    return bad;
+}
@@ -0,0 +1,37 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdint.h>
+
+#include "delta.h"
+
+uint32_t delta_weak(const uint8_t* data, size_t len) {
+    uint32_t a = 0, b = 0;
+
+    for (size_t n = 0; n < len; n++) {
+        a += data[n];
+        b += (len - n) * data[n];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+
+uint64_t delta_strong(const uint8_t* data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t n = 0; n < len; n++) {
+        h = (h ^ data[n]) * 0x100000001b3ULL;
+    }
+    return h;
+}
@@ -0,0 +1,34 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Block hashes for delta transfers, as rsync does them: a weak checksum
+// the host can slide along the new file a byte at a time, to find where
+// blocks of the device's copy turn up in it at any offset, and a strong
+// hash to confirm each candidate.
+
+// The weak checksum of len bytes is a | b << 16, where (mod 2^16) a is
+// the sum of the bytes and b the sum of each byte times (len - its index).
+uint32_t delta_weak(const uint8_t* data, size_t len);
+
+// Slide the window of len bytes whose checksum halves are a and b
+// forward by one byte, dropping out and taking in.
+#define DELTA_ROLL(a, b, out, in, len) do { \
+    (a) = ((a) - (out) + (in)) & 0xFFFF; \
+    (b) = ((b) - (len) * (out) + (a)) & 0xFFFF; \
+} while (0)
+
+// 64bit FNV-1a
+uint64_t delta_strong(const uint8_t* data, size_t len);
@@ -0,0 +1,517 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Intel 8254x (e1000) and 82574 (e1000e) ethernet, driven by polling
+// their legacy descriptor rings.  The receive ring is kept full, each
+// descriptor handed back as soon as its frame is copied out; the tail
+// registers, whose every write costs a trip to the device (or out of
+// the guest), are only moved every so many descriptors, or when the
+// rings are next looked at and found idle.
+
+#include <efi.h>
+#include <efilib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils.h>
+
+#include <pcinet.h>
+
+#define INTEL_VENDOR 0x8086
+
+static const uint16_t e1k_ids[] = {
+    0x1004, // 82543GC
+    0x100e, // 82540EM, as qemu's e1000
+    0x100f, // 82545EM
+    0x10d3, // 82574L, as qemu's e1000e
+    0x150c, // 82583V
+};
+
+#define E1K_CTRL 0x0000
+#define E1K_STATUS 0x0008
+#define E1K_ICR 0x00c0
+#define E1K_IMC 0x00d8
+#define E1K_RCTL 0x0100
+#define E1K_TCTL 0x0400
+#define E1K_TIPG 0x0410
+#define E1K_RDBAL 0x2800
+#define E1K_RDBAH 0x2804
+#define E1K_RDLEN 0x2808
+#define E1K_RDH 0x2810
+#define E1K_RDT 0x2818
+#define E1K_RDTR 0x2820
+#define E1K_RADV 0x282c
+#define E1K_TDBAL 0x3800
+#define E1K_TDBAH 0x3804
+#define E1K_TDLEN 0x3808
+#define E1K_TDH 0x3810
+#define E1K_TDT 0x3818
+#define E1K_MPC 0x4010  // missed packets: no room in the receive FIFO
+#define E1K_RNBC 0x40a0 // receive no buffers: the ring was full
+#define E1K_MTA 0x5200
+#define E1K_RAL0 0x5400
+#define E1K_RAH0 0x5404
+
+#define CTRL_ASDE (1 << 5)
+#define CTRL_SLU (1 << 6)
+#define CTRL_RST (1 << 26)
+#define STATUS_LU (1 << 1)
+#define RCTL_EN (1 << 1)
+#define RCTL_MPE (1 << 4)
+#define RCTL_BAM (1 << 15)
+#define RCTL_SECRC (1 << 26) // BSIZE left at 0: 2048 byte buffers
+#define TCTL_EN (1 << 1)
+#define TCTL_PSP (1 << 3)
+#define TCTL_CT (0x0f << 4)
+#define TCTL_COLD (0x40 << 12)
+#define TIPG_DEFAULT 0x0060200a
+#define RAH_AV (1U << 31)
+
+typedef struct {
+    uint64_t addr;
+    uint16_t len;
+    uint16_t csum;
+    volatile uint8_t status;
+    uint8_t errors;
+    uint16_t special;
+} e1k_rxd;
+
+typedef struct {
+    uint64_t addr;
+    uint16_t len;
+    uint8_t cso;
+    uint8_t cmd;
+    volatile uint8_t status;
+    uint8_t css;
+    uint16_t special;
+} e1k_txd;
+
+#define RXD_DD 0x01
+#define RXD_EOP 0x02
+#define TXD_EOP 0x01
+#define TXD_IFCS 0x02
+#define TXD_RS 0x08
+#define TXD_DD 0x01
+
+// A ring is a page of descriptors.  Every receive descriptor has its
+// own buffer, so a whole window of blocks can land between polls.
+#define E1K_RXD 256
+#define E1K_TXD 256
+#define E1K_BUF_SIZE 2048
+
+// Descriptors taken or filled before the tail is moved, at most
+#define RX_TAIL 32
+#define TX_TAIL 16
+
+typedef struct {
+    pcinet nic;
+    e1k_rxd* rxd;
+    e1k_txd* txd;
+    uint8_t* rx_bufs;
+    UINT64 rxd_dma;
+    UINT64 txd_dma;
+    UINT64 rx_dma;
+    unsigned rx_next;    // next descriptor to look at
+    unsigned rx_taken;   // since the tail was last moved
+    unsigned tx_next;    // next descriptor to fill
+    unsigned tx_clean;   // oldest the device may not be done with
+    unsigned tx_filled;  // since the tail was last moved
+    void* tx_buf[E1K_TXD];
+    void* tx_map[E1K_TXD];
+    uint64_t rx_frames;
+    uint64_t tx_frames;
+    uint64_t rx_tails;
+    uint64_t tx_tails;
+    uint64_t rx_dropped; // MPC and RNBC, which clear when read, so far
+} e1k;
+
+static uint32_t e1k_rd(e1k* dev, uint32_t reg) {
+    EFI_PCI_IO* pci = dev->nic.pci;
+    uint32_t v = 0;
+
+    pci->Mem.Read(pci, EfiPciIoWidthUint32, 0, reg, 1, &v);
+    return v;
+}
+
+static void e1k_wr(e1k* dev, uint32_t reg, uint32_t v) {
+    EFI_PCI_IO* pci = dev->nic.pci;
+
+    pci->Mem.Write(pci, EfiPciIoWidthUint32, 0, reg, 1, &v);
+}
+
+// Add what the device has dropped since last asked to rx_dropped
+static void e1k_count(e1k* dev) {
+    dev->rx_dropped += e1k_rd(dev, E1K_MPC);
+    dev->rx_dropped += e1k_rd(dev, E1K_RNBC);
+}
+
+// Clearing RCTL and TCTL stops descriptor fetches before the global
+// reset, which also reloads the address from the EEPROM (and clears the
+// statistics, so they are taken first); interrupts stay masked
+// throughout, and any raised are acknowledged
+static void e1k_reset(e1k* dev) {
+    e1k_count(dev);
+    e1k_wr(dev, E1K_IMC, 0xffffffff);
+    e1k_wr(dev, E1K_RCTL, 0);
+    e1k_wr(dev, E1K_TCTL, 0);
+    e1k_wr(dev, E1K_CTRL, e1k_rd(dev, E1K_CTRL) | CTRL_RST);
+    gBS->Stall(1000);
+    for (int n = 0; (n < 100) && (e1k_rd(dev, E1K_CTRL) & CTRL_RST); n++) {
+        gBS->Stall(100);
+    }
+    e1k_wr(dev, E1K_IMC, 0xffffffff);
+    e1k_rd(dev, E1K_ICR);
+}
+
+static void e1k_link(e1k* dev) {
+    dev->nic.mode.MediaPresent = (e1k_rd(dev, E1K_STATUS) & STATUS_LU) ? TRUE : FALSE;
+}
+
+// Hand the device what has been taken off the receive ring or put on
+// the transmit ring since it was last told
+static void e1k_flush(pcinet* nic) {
+    e1k* dev = (void*)nic;
+
+    if (dev->rx_taken) {
+        // the last descriptor taken stays empty, keeping the tail short
+        // of the head however full the ring is
+        e1k_wr(dev, E1K_RDT, (dev->rx_next + E1K_RXD - 1) % E1K_RXD);
+        dev->rx_taken = 0;
+        dev->rx_tails++;
+    }
+    if (dev->tx_filled) {
+        e1k_wr(dev, E1K_TDT, dev->tx_next);
+        dev->tx_filled = 0;
+        dev->tx_tails++;
+    }
+}
+
+static void e1k_stop(pcinet* nic) {
+    e1k_reset((void*)nic);
+}
+
+static int e1k_rx_ready(pcinet* nic) {
+    e1k* dev = (void*)nic;
+    return dev->rxd[dev->rx_next].status & RXD_DD;
+}
+
+// Reset, then load both rings: RDT one behind RDH gives the device
+// every receive descriptor but the one that keeps the ring from looking
+// empty, and TDT equal to TDH gives it no transmit descriptors
+static int e1k_setup(e1k* dev) {
+    e1k_reset(dev);
+
+    if ((dev->rxd == NULL) &&
+        (pcinet_alloc(&dev->nic, E1K_RXD * sizeof(e1k_rxd), (void**)&dev->rxd, &dev->rxd_dma) ||
+         pcinet_alloc(&dev->nic, E1K_TXD * sizeof(e1k_txd), (void**)&dev->txd, &dev->txd_dma) ||
+         pcinet_alloc(&dev->nic, E1K_RXD * E1K_BUF_SIZE, (void**)&dev->rx_bufs, &dev->rx_dma))) {
+        printf("e1000: out of memory\n");
+        dev->rxd = NULL;
+        return -1;
+    }
+    memset(dev->txd, 0, E1K_TXD * sizeof(e1k_txd));
+    for (unsigned n = 0; n < E1K_RXD; n++) {
+        memset(dev->rxd + n, 0, sizeof(e1k_rxd));
+        dev->rxd[n].addr = dev->rx_dma + (n * E1K_BUF_SIZE);
+    }
+    dev->rx_next = 0;
+    dev->rx_taken = 0;
+    dev->tx_next = 0;
+    dev->tx_clean = 0;
+    dev->tx_filled = 0;
+
+    e1k_wr(dev, E1K_CTRL, e1k_rd(dev, E1K_CTRL) | CTRL_SLU | CTRL_ASDE);
+    for (unsigned n = 0; n < 128; n++) {
+        e1k_wr(dev, E1K_MTA + (n * 4), 0);
+    }
+
+    e1k_wr(dev, E1K_RDBAL, dev->rxd_dma);
+    e1k_wr(dev, E1K_RDBAH, dev->rxd_dma >> 32);
+    e1k_wr(dev, E1K_RDLEN, E1K_RXD * sizeof(e1k_rxd));
+    e1k_wr(dev, E1K_RDH, 0);
+    e1k_wr(dev, E1K_RDT, E1K_RXD - 1);
+    e1k_wr(dev, E1K_RDTR, 0);
+    e1k_wr(dev, E1K_RADV, 0);
+    // our own address, broadcast, and all multicast (the stack drops
+    // groups it hasn't joined)
+    e1k_wr(dev, E1K_RCTL, RCTL_EN | RCTL_MPE | RCTL_BAM | RCTL_SECRC);
+
+    e1k_wr(dev, E1K_TDBAL, dev->txd_dma);
+    e1k_wr(dev, E1K_TDBAH, dev->txd_dma >> 32);
+    e1k_wr(dev, E1K_TDLEN, E1K_TXD * sizeof(e1k_txd));
+    e1k_wr(dev, E1K_TDH, 0);
+    e1k_wr(dev, E1K_TDT, 0);
+    e1k_wr(dev, E1K_TIPG, TIPG_DEFAULT);
+    e1k_wr(dev, E1K_TCTL, TCTL_EN | TCTL_PSP | TCTL_CT | TCTL_COLD);
+
+    e1k_link(dev);
+    return 0;
+}
+
+static EFI_STATUS EFIAPI e1k_initialize(EFI_SIMPLE_NETWORK* snp, UINTN rx_extra, UINTN tx_extra) {
+    e1k* dev = (void*)snp;
+
+    if (dev->nic.mode.State == EfiSimpleNetworkStopped) {
+        return EFI_NOT_STARTED;
+    }
+    if (dev->nic.mode.State == EfiSimpleNetworkInitialized) {
+        return EFI_SUCCESS;
+    }
+    if (e1k_setup(dev)) {
+        return EFI_DEVICE_ERROR;
+    }
+    dev->nic.mode.State = EfiSimpleNetworkInitialized;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI e1k_shutdown(EFI_SIMPLE_NETWORK* snp) {
+    e1k* dev = (void*)snp;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    printf("e1000: %ld frames in with %ld tail writes, %ld out with %ld tail writes\n",
+           dev->rx_frames, dev->rx_tails, dev->tx_frames, dev->tx_tails);
+    // once TCTL is cleared the device reads no more transmit buffers,
+    // so those still in the ring can be unmapped
+    e1k_reset(dev);
+    for (unsigned n = 0; n < E1K_TXD; n++) {
+        if (dev->tx_buf[n]) {
+            pcinet_unmap(&dev->nic, dev->tx_map[n]);
+            dev->tx_buf[n] = NULL;
+        }
+    }
+    dev->nic.mode.State = EfiSimpleNetworkStarted;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI e1k_reset_snp(EFI_SIMPLE_NETWORK* snp, BOOLEAN verify) {
+    EFI_STATUS r;
+
+    if ((r = e1k_shutdown(snp)) != EFI_SUCCESS) {
+        return r;
+    }
+    return e1k_initialize(snp, 0, 0);
+}
+
+// Only RxDroppedFrames is kept; the rest read as all ones
+static EFI_STATUS EFIAPI e1k_stats(EFI_SIMPLE_NETWORK* snp, BOOLEAN reset,
+                                   UINTN* size, EFI_NETWORK_STATISTICS* stats) {
+    e1k* dev = (void*)snp;
+    EFI_NETWORK_STATISTICS all;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    e1k_count(dev);
+    if (reset) {
+        dev->rx_dropped = 0;
+    }
+    if (size == NULL) {
+        return EFI_SUCCESS;
+    }
+    memset(&all, 0xff, sizeof(all));
+    all.RxDroppedFrames = dev->rx_dropped;
+    if (stats) {
+        memcpy(stats, &all, (*size < sizeof(all)) ? *size : sizeof(all));
+    }
+    if (*size < sizeof(all)) {
+        *size = sizeof(all);
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    *size = sizeof(all);
+    return EFI_SUCCESS;
+}
+
+// TXD_RS has the device set TXD_DD in a descriptor once it has sent
+// from it; the oldest such is reclaimed, and its buffer returned
+static EFI_STATUS EFIAPI e1k_get_status(EFI_SIMPLE_NETWORK* snp, UINT32* irq, VOID** txbuf) {
+    e1k* dev = (void*)snp;
+    unsigned n;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    e1k_flush(&dev->nic);
+    // once up, the link is taken to stay up: reading it costs a trip
+    if (!dev->nic.mode.MediaPresent) {
+        e1k_link(dev);
+    }
+    if (irq) {
+        *irq = 0;
+    }
+    if (txbuf == NULL) {
+        return EFI_SUCCESS;
+    }
+    *txbuf = NULL;
+    n = dev->tx_clean;
+    if ((n != dev->tx_next) && (dev->txd[n].status & TXD_DD)) {
+        pcinet_unmap(&dev->nic, dev->tx_map[n]);
+        *txbuf = dev->tx_buf[n];
+        dev->tx_buf[n] = NULL;
+        dev->tx_clean = (n + 1) % E1K_TXD;
+        if (irq) {
+            *irq = EFI_SIMPLE_NETWORK_TRANSMIT_INTERRUPT;
+        }
+    }
+    return EFI_SUCCESS;
+}
+
+// The frame goes out of the caller's buffer, which is theirs again
+// once GetStatus hands it back
+static EFI_STATUS EFIAPI e1k_transmit(EFI_SIMPLE_NETWORK* snp, UINTN hsz, UINTN bsz, VOID* buf,
+                                      EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    e1k* dev = (void*)snp;
+    unsigned n = dev->tx_next;
+    e1k_txd* d = dev->txd + n;
+    EFI_STATUS r;
+    UINT64 dma;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    if ((bsz < 14) || (bsz > (dev->nic.mode.MaxPacketSize + 14))) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    if ((r = pcinet_header(&dev->nic, hsz, bsz, buf, src, dst, proto)) != EFI_SUCCESS) {
+        return r;
+    }
+    // one descriptor is always left empty, or a full ring would look
+    // like an empty one
+    if (((n + 1) % E1K_TXD) == dev->tx_clean) {
+        e1k_flush(&dev->nic);
+        return EFI_NOT_READY;
+    }
+    if (pcinet_map(&dev->nic, buf, bsz, &dma, &dev->tx_map[n])) {
+        return EFI_DEVICE_ERROR;
+    }
+    dev->tx_buf[n] = buf;
+    d->addr = dma;
+    d->len = bsz;
+    d->cso = 0;
+    d->cmd = TXD_EOP | TXD_IFCS | TXD_RS;
+    d->status = 0;
+    d->css = 0;
+    d->special = 0;
+    dev->tx_next = (n + 1) % E1K_TXD;
+    dev->tx_frames++;
+    if (++dev->tx_filled >= TX_TAIL) {
+        e1k_flush(&dev->nic);
+    }
+    return EFI_SUCCESS;
+}
+
+// Copied from the ring into the caller's buffer, and the descriptor
+// handed back to the device with the next tail move
+static EFI_STATUS EFIAPI e1k_receive(EFI_SIMPLE_NETWORK* snp, UINTN* hsz, UINTN* bsz, VOID* buf,
+                                     EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    e1k* dev = (void*)snp;
+    e1k_rxd* d;
+    uint8_t* frame;
+    size_t len;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    for (;;) {
+        d = dev->rxd + dev->rx_next;
+        if (!(d->status & RXD_DD)) {
+            // idle: the device can have back what was taken
+            e1k_flush(&dev->nic);
+            return EFI_NOT_READY;
+        }
+        __asm__ __volatile__("" ::: "memory");
+        len = d->len;
+        // frames too long for one buffer or for the caller's, or bad
+        // ones, are dropped: left on the ring, one would stop the rest
+        if ((d->status & RXD_EOP) && !d->errors && (len >= 14) && (len <= E1K_BUF_SIZE) &&
+            (len <= *bsz)) {
+            frame = dev->rx_bufs + (dev->rx_next * E1K_BUF_SIZE);
+            memcpy(buf, frame, len);
+            pcinet_rxinfo(frame, hsz, src, dst, proto);
+            *bsz = len;
+            dev->rx_frames++;
+        } else {
+            len = 0;
+        }
+        d->status = 0;
+        dev->rx_next = (dev->rx_next + 1) % E1K_RXD;
+        if (++dev->rx_taken >= RX_TAIL) {
+            e1k_flush(&dev->nic);
+        }
+        if (len) {
+            return EFI_SUCCESS;
+        }
+    }
+}
+
+EFI_SIMPLE_NETWORK* e1000_bind(EFI_HANDLE h, uint16_t vendor, uint16_t device) {
+    uint32_t ral, rah;
+    uint8_t* mac;
+    e1k* dev;
+    size_t i;
+
+    if (vendor != INTEL_VENDOR) {
+        return NULL;
+    }
+    for (i = 0; i < (sizeof(e1k_ids) / sizeof(e1k_ids[0])); i++) {
+        if (e1k_ids[i] == device) {
+            break;
+        }
+    }
+    if (i == (sizeof(e1k_ids) / sizeof(e1k_ids[0]))) {
+        return NULL;
+    }
+    if (gBS->AllocatePool(EfiLoaderData, sizeof(*dev), (void**)&dev)) {
+        return NULL;
+    }
+    memset(dev, 0, sizeof(*dev));
+    if (pcinet_claim(&dev->nic, h, "e1000")) {
+        gBS->FreePool(dev);
+        return NULL;
+    }
+    // the address is loaded from the EEPROM at reset
+    e1k_reset(dev);
+    ral = e1k_rd(dev, E1K_RAL0);
+    rah = e1k_rd(dev, E1K_RAH0);
+    if (!(rah & RAH_AV)) {
+        printf("e1000: device %04x has no MAC address\n", device);
+        pcinet_release(&dev->nic);
+        gBS->FreePool(dev);
+        return NULL;
+    }
+    mac = dev->nic.mode.CurrentAddress.Addr;
+    mac[0] = ral;
+    mac[1] = ral >> 8;
+    mac[2] = ral >> 16;
+    mac[3] = ral >> 24;
+    mac[4] = rah;
+    mac[5] = rah >> 8;
+    memcpy(&dev->nic.mode.PermanentAddress, &dev->nic.mode.CurrentAddress,
+           sizeof(EFI_MAC_ADDRESS));
+    printf("e1000: device %04x %02x:%02x:%02x:%02x:%02x:%02x\n",
+           device, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    dev->nic.snp.Initialize = e1k_initialize;
+    dev->nic.snp.Reset = e1k_reset_snp;
+    dev->nic.snp.Shutdown = e1k_shutdown;
+    dev->nic.snp.Statistics = e1k_stats;
+    dev->nic.snp.GetStatus = e1k_get_status;
+    dev->nic.snp.Transmit = e1k_transmit;
+    dev->nic.snp.Receive = e1k_receive;
+    dev->nic.rx_ready = e1k_rx_ready;
+    dev->nic.flush = e1k_flush;
+    dev->nic.reset = e1k_stop;
+    return &dev->nic.snp;
+}
@@ -0,0 +1,210 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdint.h>
+
+#include "fec.h"
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1, generator 2.
+// gf_exp is doubled so a product never needs its exponent reduced.
+static uint8_t gf_exp[510];
+static uint8_t gf_log[256];
+
+void fec_init(void) {
+    unsigned x = 1;
+
+    for (unsigned n = 0; n < 255; n++) {
+        gf_exp[n] = x;
+        gf_exp[n + 255] = x;
+        gf_log[x] = n;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11d;
+        }
+    }
+    gf_log[0] = 0;
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if ((a == 0) || (b == 0)) {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a) {
+    return gf_exp[255 - gf_log[a]];
+}
+
+uint8_t fec_coef(unsigned p, unsigned i) {
+    return gf_inv((255 - p) ^ i);
+}
+
+// Multiplying by a constant is a byte-to-byte map, so build that map
+// once and run the block through it.
+static void gf_row(uint8_t* row, uint8_t c) {
+    unsigned l = gf_log[c];
+
+    row[0] = 0;
+    for (unsigned x = 1; x < 256; x++) {
+        row[x] = gf_exp[l + gf_log[x]];
+    }
+}
+
+void fec_muladd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len) {
+    uint8_t row[256];
+    size_t n = 0;
+
+    if (c == 0) {
+        return;
+    }
+    if (c == 1) {
+        for (; n < len; n++) {
+            dst[n] ^= src[n];
+        }
+        return;
+    }
+    gf_row(row, c);
+    for (; (n + 8) <= len; n += 8) {
+        dst[n + 0] ^= row[src[n + 0]];
+        dst[n + 1] ^= row[src[n + 1]];
+        dst[n + 2] ^= row[src[n + 2]];
+        dst[n + 3] ^= row[src[n + 3]];
+        dst[n + 4] ^= row[src[n + 4]];
+        dst[n + 5] ^= row[src[n + 5]];
+        dst[n + 6] ^= row[src[n + 6]];
+        dst[n + 7] ^= row[src[n + 7]];
+    }
+    for (; n < len; n++) {
+        dst[n] ^= row[src[n]];
+    }
+}
+
+void fec_encode(uint8_t* out, const uint8_t* const* data, size_t k,
+                unsigned p, size_t len) {
+    memset(out, 0, len);
+    for (size_t i = 0; i < k; i++) {
+        fec_muladd(out, data[i], fec_coef(p, i), len);
+    }
+}
+
+// Invert the n x n matrix a into b by Gauss-Jordan elimination
+static int gf_invert(uint8_t a[FEC_MAX_PARITY][FEC_MAX_PARITY],
+                     uint8_t b[FEC_MAX_PARITY][FEC_MAX_PARITY], size_t n) {
+    uint8_t t;
+
+    for (size_t r = 0; r < n; r++) {
+        for (size_t c = 0; c < n; c++) {
+            b[r][c] = (r == c);
+        }
+    }
+    for (size_t c = 0; c < n; c++) {
+        size_t r = c;
+        while ((r < n) && (a[r][c] == 0)) {
+            r++;
+        }
+        if (r == n) {
+            return -1;
+        }
+        if (r != c) {
+            for (size_t x = 0; x < n; x++) {
+                t = a[r][x]; a[r][x] = a[c][x]; a[c][x] = t;
+                t = b[r][x]; b[r][x] = b[c][x]; b[c][x] = t;
+            }
+        }
+        t = gf_inv(a[c][c]);
+        for (size_t x = 0; x < n; x++) {
+            a[c][x] = gf_mul(a[c][x], t);
+            b[c][x] = gf_mul(b[c][x], t);
+        }
+        for (r = 0; r < n; r++) {
+            if ((r == c) || ((t = a[r][c]) == 0)) {
+                continue;
+            }
+            for (size_t x = 0; x < n; x++) {
+                a[r][x] ^= gf_mul(a[c][x], t);
+                b[r][x] ^= gf_mul(b[c][x], t);
+            }
+        }
+    }
+    return 0;
+}
+
+// bytes of each lost block solved for at a time (on the stack)
+#define FEC_CHUNK 1024
+
+int fec_decode(uint8_t** blocks, const int* parity, size_t k, size_t len) {
+    uint8_t a[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    uint8_t b[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    unsigned lost[FEC_MAX_PARITY];
+    size_t e = 0;
+
+    for (size_t i = 0; i < k; i++) {
+        if (parity[i] < 0) {
+            continue;
+        }
+        if (e == FEC_MAX_PARITY) {
+            return -1;
+        }
+        lost[e++] = i;
+    }
+    if (e == 0) {
+        return 0;
+    }
+
+    // Take the data blocks we have out of each parity block, leaving
+    // the sum of just the lost ones (times their coefficients).
+    for (size_t j = 0; j < e; j++) {
+        unsigned p = parity[lost[j]];
+        for (size_t i = 0; i < k; i++) {
+            if (parity[i] < 0) {
+                fec_muladd(blocks[lost[j]], blocks[i], fec_coef(p, i), len);
+            }
+        }
+        for (size_t l = 0; l < e; l++) {
+            a[j][l] = fec_coef(p, lost[l]);
+        }
+    }
+    if (gf_invert(a, b, e)) {
+        return -1;
+    }
+
+    // Then solve for them.  The usual case is a single lost block,
+    // which is just a scaling.
+    if (e == 1) {
+        uint8_t row[256];
+        uint8_t* d = blocks[lost[0]];
+        gf_row(row, b[0][0]);
+        for (size_t n = 0; n < len; n++) {
+            d[n] = row[d[n]];
+        }
+        return 0;
+    }
+    for (size_t n = 0; n < len; n += FEC_CHUNK) {
+        uint8_t s[FEC_MAX_PARITY][FEC_CHUNK];
+        size_t c = ((len - n) < FEC_CHUNK) ? (len - n) : FEC_CHUNK;
+        for (size_t j = 0; j < e; j++) {
+            memcpy(s[j], blocks[lost[j]] + n, c);
+        }
+        for (size_t l = 0; l < e; l++) {
+            uint8_t* d = blocks[lost[l]] + n;
+            memset(d, 0, c);
+            for (size_t j = 0; j < e; j++) {
+                fec_muladd(d, s[j], b[l][j], c);
+            }
+        }
+    }
+    return 0;
+}
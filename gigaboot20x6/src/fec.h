@@ -0,0 +1,47 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Systematic Reed-Solomon erasure code over GF(2^8).
+//
+// A group of up to FEC_MAX_DATA data blocks is protected by up to
+// FEC_MAX_PARITY parity blocks of the same length.  Parity block p is
+// the sum over the data blocks i of C(p, i) * block i, where C is the
+// Cauchy matrix 1 / ((255 - p) ^ i).  Every square submatrix of a Cauchy
+// matrix is invertible, so any n parity blocks rebuild any n lost data
+// blocks.  Coefficients do not depend on the group size, so a short
+// group (at the end of a file) is coded as if padded with zero blocks.
+
+#define FEC_MAX_DATA 128
+#define FEC_MAX_PARITY 16
+
+// build the field tables; call once before anything else
+void fec_init(void);
+
+// coefficient of data block i in parity block p
+uint8_t fec_coef(unsigned p, unsigned i);
+
+// dst ^= c * src, over len bytes
+void fec_muladd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+
+// compute parity block p of the k data blocks (each len bytes)
+void fec_encode(uint8_t* out, const uint8_t* const* data, size_t k,
+                unsigned p, size_t len);
+
+// Rebuild the lost data blocks of a group of k, in place.  For each
+// block i, parity[i] is -1 if blocks[i] holds that data block, or the
+// index of the parity block that has been stored in its place instead.
+// Returns 0 on success, -1 if too many blocks are missing.
+int fec_decode(uint8_t** blocks, const int* parity, size_t k, size_t len);
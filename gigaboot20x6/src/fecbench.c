@@ -0,0 +1,139 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Throughput of the netboot FEC encoder (as nbserver uses it) and
+// decoder (as the device uses it, rebuilding blocks in place), for
+// every number of lost blocks a group can recover from.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <stdint.h>
+
+#include "fec.h"
+
+static char* appname;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void usage(void) {
+    fprintf(stderr,
+            "usage:   %s [ <option> ]*\n"
+            "\n"
+            "options: -k <n>  data blocks per group (default 16)\n"
+            "         -m <n>  parity blocks per group (default 2)\n"
+            "         -b <n>  block size in bytes (default 1436)\n"
+            "         -s <n>  megabytes of data to run through each test (default 256)\n",
+            appname);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t k = 16, m = 2, len = 1436, total = 256;
+    uint8_t* data[FEC_MAX_DATA];
+    uint8_t* copy[FEC_MAX_DATA];
+    uint8_t* par[FEC_MAX_PARITY];
+    int parity[FEC_MAX_DATA];
+    size_t groups;
+    uint64_t t;
+
+    appname = argv[0];
+    while (argc > 1) {
+        if (argc < 3)
+            usage();
+        if (!strcmp(argv[1], "-k")) {
+            k = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-m")) {
+            m = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-b")) {
+            len = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-s")) {
+            total = atoi(argv[2]);
+        } else {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if ((k < 1) || (k > FEC_MAX_DATA) || (m < 1) || (m > FEC_MAX_PARITY) ||
+        (m > k) || (len < 1) || (total < 1))
+        usage();
+
+    fec_init();
+    srand(1);
+    for (size_t i = 0; i < k; i++) {
+        data[i] = malloc(len);
+        copy[i] = malloc(len);
+        for (size_t n = 0; n < len; n++) {
+            data[i][n] = rand();
+        }
+    }
+    for (size_t p = 0; p < m; p++) {
+        par[p] = malloc(len);
+    }
+    groups = (total << 20) / (k * len);
+    if (groups == 0)
+        groups = 1;
+
+    printf("%zu data + %zu parity blocks of %zu bytes, %zu groups per test\n",
+           k, m, len, groups);
+
+    t = now_ns();
+    for (size_t g = 0; g < groups; g++) {
+        for (size_t p = 0; p < m; p++) {
+            fec_encode(par[p], (const uint8_t* const*)data, k, p, len);
+        }
+    }
+    t = now_ns() - t;
+    printf("encode:          %8.1f MB/s of data\n", (groups * k * len) / (t / 1e3));
+
+    // lose the first e blocks of each group (the position doesn't
+    // change the work) and rebuild them from the first e parity blocks
+    for (size_t e = 1; e <= m; e++) {
+        uint64_t busy = 0;
+        for (size_t g = 0; g < groups; g++) {
+            for (size_t i = 0; i < k; i++) {
+                if (i < e) {
+                    memcpy(copy[i], par[i], len);
+                    parity[i] = i;
+                } else {
+                    memcpy(copy[i], data[i], len);
+                    parity[i] = -1;
+                }
+            }
+            t = now_ns();
+            if (fec_decode(copy, parity, k, len)) {
+                fprintf(stderr, "%s: decode failed\n", appname);
+                return 1;
+            }
+            busy += now_ns() - t;
+        }
+        for (size_t i = 0; i < e; i++) {
+            if (memcmp(copy[i], data[i], len)) {
+                fprintf(stderr, "%s: block %zu rebuilt wrong with %zu lost\n",
+                        appname, i, e);
+                return 1;
+            }
+        }
+        printf("decode %2zu lost:  %8.1f MB/s of data, %6.2f us per group\n",
+               e, (groups * k * len) / (busy / 1e3), busy / 1e3 / groups);
+    }
+    return 0;
+}
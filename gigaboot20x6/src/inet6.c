@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <csum.h>
 #include <inet6.h>
 
 #if 1
@@ -86,36 +87,94 @@ void multicast_from_ip6(mac_addr* _mac, const ip6_addr* _ip6) {
     mac[5] = ip[15];
 }
 
-// ip6 stack configuration
-mac_addr ll_mac_addr;
-ip6_addr ll_ip6_addr;
-mac_addr snm_mac_addr;
-ip6_addr snm_ip6_addr;
-
-// cache for the last source addresses we've seen
-static mac_addr rx_mac_addr;
-static ip6_addr rx_ip6_addr;
-
-void ip6_init(void* macaddr) {
+// ip6 stack configuration, per interface
+typedef struct {
+    mac_addr ll_mac_addr;
+    ip6_addr ll_ip6_addr;
+    mac_addr snm_mac_addr;
+    ip6_addr snm_ip6_addr;
+    // cache for the last source addresses we've seen
+    mac_addr rx_mac_addr;
+    ip6_addr rx_ip6_addr;
+} ip6_ifc;
+
+static ip6_ifc ifcs[IP6_MAX_IFC];
+static unsigned ifc_count = 0;
+static ip6_ifc* ifc = ifcs; // the one being received from or sent on
+
+// multicast groups joined beyond the all-nodes and solicited-node ones
+#define MAX_GROUPS 4
+static ip6_addr groups[MAX_GROUPS];
+static unsigned group_count = 0;
+
+int ip6_init(void* macaddr) {
     char tmp[IP6TOAMAX];
     mac_addr all;
 
+    if (ifc_count == IP6_MAX_IFC) {
+        return -1;
+    }
+    ifc = ifcs + ifc_count;
+
     // save our ethernet MAC and synthesize link layer addresses
-    memcpy(&ll_mac_addr, macaddr, 6);
-    ll6addr_from_mac(&ll_ip6_addr, &ll_mac_addr);
-    snmaddr_from_mac(&snm_ip6_addr, &ll_mac_addr);
-    multicast_from_ip6(&snm_mac_addr, &snm_ip6_addr);
+    memcpy(&ifc->ll_mac_addr, macaddr, 6);
+    ll6addr_from_mac(&ifc->ll_ip6_addr, &ifc->ll_mac_addr);
+    snmaddr_from_mac(&ifc->snm_ip6_addr, &ifc->ll_mac_addr);
+    multicast_from_ip6(&ifc->snm_mac_addr, &ifc->snm_ip6_addr);
 
-    eth_add_mcast_filter(&snm_mac_addr);
+    eth_add_mcast_filter(&ifc->snm_mac_addr);
 
     multicast_from_ip6(&all, &ip6_ll_all_nodes);
     eth_add_mcast_filter(&all);
 
     printf("macaddr: %02x:%02x:%02x:%02x:%02x:%02x\n",
-           ll_mac_addr.x[0], ll_mac_addr.x[1], ll_mac_addr.x[2],
-           ll_mac_addr.x[3], ll_mac_addr.x[4], ll_mac_addr.x[5]);
-    printf("ip6addr: %s\n", ip6toa(tmp, &ll_ip6_addr));
-    printf("snmaddr: %s\n", ip6toa(tmp, &snm_ip6_addr));
+           ifc->ll_mac_addr.x[0], ifc->ll_mac_addr.x[1], ifc->ll_mac_addr.x[2],
+           ifc->ll_mac_addr.x[3], ifc->ll_mac_addr.x[4], ifc->ll_mac_addr.x[5]);
+    printf("ip6addr: %s\n", ip6toa(tmp, &ifc->ll_ip6_addr));
+    printf("snmaddr: %s\n", ip6toa(tmp, &ifc->snm_ip6_addr));
+    return ifc_count++;
+}
+
+void ip6_select(int n) {
+    if ((n >= 0) && ((unsigned)n < ifc_count)) {
+        ifc = ifcs + n;
+    }
+}
+
+int ip6_join_group(const ip6_addr* group) {
+    mac_addr mac;
+
+    if (group->x[0] != 0xFF) {
+        return -1;
+    }
+    for (unsigned n = 0; n < group_count; n++) {
+        if (!memcmp(groups + n, group, IP6_ADDR_LEN)) {
+            return 0;
+        }
+    }
+    if (group_count == MAX_GROUPS) {
+        return -1;
+    }
+    multicast_from_ip6(&mac, group);
+    if (eth_add_mcast_filter(&mac)) {
+        return -1;
+    }
+    memcpy(groups + group_count, group, IP6_ADDR_LEN);
+    group_count++;
+    return 0;
+}
+
+static int ip6_for_us(const uint8_t* dst) {
+    if (!memcmp(&ifc->ll_ip6_addr, dst, IP6_ADDR_LEN) ||
+        !memcmp(&ifc->snm_ip6_addr, dst, IP6_ADDR_LEN)) {
+        return 1;
+    }
+    for (unsigned n = 0; n < group_count; n++) {
+        if (!memcmp(groups + n, dst, IP6_ADDR_LEN)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 static int resolve_ip6(mac_addr* _mac, const ip6_addr* _ip) {
@@ -129,8 +188,8 @@ static int resolve_ip6(mac_addr* _mac, const ip6_addr* _ip) {
 
     // Trying to send to the IP that we last received a packet from?
     // Assume their mac address has not changed
-    if (memcmp(_ip, &rx_ip6_addr, sizeof(rx_ip6_addr)) == 0) {
-        memcpy(_mac, &rx_mac_addr, sizeof(rx_mac_addr));
+    if (memcmp(_ip, &ifc->rx_ip6_addr, sizeof(ifc->rx_ip6_addr)) == 0) {
+        memcpy(_mac, &ifc->rx_mac_addr, sizeof(ifc->rx_mac_addr));
         return 0;
     }
 
@@ -138,22 +197,6 @@ static int resolve_ip6(mac_addr* _mac, const ip6_addr* _ip) {
     return -1;
 }
 
-static uint16_t checksum(const void* _data, size_t len, uint16_t _sum) {
-    uint32_t sum = _sum;
-    const uint16_t* data = _data;
-    while (len > 1) {
-        sum += *data++;
-        len -= 2;
-    }
-    if (len) {
-        sum += (*data & 0xFF);
-    }
-    while (sum > 0xFFFF) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-    return sum;
-}
-
 typedef struct {
     uint8_t eth[16];
     ip6_hdr ip6;
@@ -167,14 +210,7 @@ typedef struct {
     uint8_t data[0];
 } udp_pkt;
 
-static unsigned ip6_checksum(ip6_hdr* ip, unsigned type, size_t length) {
-    uint16_t sum;
-
-    // length and protocol field for pseudo-header
-    sum = checksum(&ip->length, 2, htons(type));
-    // src/dst for pseudo-header + payload
-    sum = checksum(ip->src, 32 + length, sum);
-
+static unsigned ip6_checksum_final(uint16_t sum) {
     // 0 is illegal, so 0xffff remains 0xffff
     if (sum != 0xffff) {
         return ~sum;
@@ -183,6 +219,17 @@ static unsigned ip6_checksum(ip6_hdr* ip, unsigned type, size_t length) {
     }
 }
 
+static unsigned ip6_checksum(ip6_hdr* ip, unsigned type, size_t length) {
+    uint16_t sum;
+
+    // length and protocol field for pseudo-header
+    sum = csum(&ip->length, 2, htons(type));
+    // src/dst for pseudo-header + payload
+    sum = csum(ip->src, 32 + length, sum);
+
+    return ip6_checksum_final(sum);
+}
+
 static int ip6_setup(ip6_pkt* p, const ip6_addr* daddr, size_t length, uint8_t type) {
     mac_addr dmac;
 
@@ -191,7 +238,7 @@ static int ip6_setup(ip6_pkt* p, const ip6_addr* daddr, size_t length, uint8_t t
 
     // ethernet header
     memcpy(p->eth + 2, &dmac, ETH_ADDR_LEN);
-    memcpy(p->eth + 8, &ll_mac_addr, ETH_ADDR_LEN);
+    memcpy(p->eth + 8, &ifc->ll_mac_addr, ETH_ADDR_LEN);
     p->eth[14] = (ETH_IP6 >> 8) & 0xFF;
     p->eth[15] = ETH_IP6 & 0xFF;
 
@@ -200,7 +247,7 @@ static int ip6_setup(ip6_pkt* p, const ip6_addr* daddr, size_t length, uint8_t t
     p->ip6.length = htons(length);
     p->ip6.next_header = type;
     p->ip6.hop_limit = 255;
-    memcpy(p->ip6.src, &ll_ip6_addr, sizeof(ip6_addr));
+    memcpy(p->ip6.src, &ifc->ll_ip6_addr, sizeof(ip6_addr));
     memcpy(p->ip6.dst, daddr, sizeof(ip6_addr));
 
     return 0;
@@ -211,6 +258,7 @@ static int ip6_setup(ip6_pkt* p, const ip6_addr* daddr, size_t length, uint8_t t
 int udp6_send(const void* data, size_t dlen, const ip6_addr* daddr, uint16_t dport, uint16_t sport) {
     size_t length = dlen + UDP_HDR_LEN;
     udp_pkt* p = eth_get_buffer(ETH_MTU + 2);
+    uint16_t sum;
 
     if (p == 0)
         return -1;
@@ -225,8 +273,11 @@ int udp6_send(const void* data, size_t dlen, const ip6_addr* daddr, uint16_t dpo
     p->udp.length = htons(length);
     p->udp.checksum = 0;
 
-    memcpy(p->data, data, dlen);
-    p->udp.checksum = ip6_checksum(&p->ip6, HDR_UDP, length);
+    // the payload is summed as it is copied in
+    sum = csum(&p->ip6.length, 2, htons(HDR_UDP));
+    sum = csum(p->ip6.src, 32 + UDP_HDR_LEN, sum);
+    sum = csum_copy(p->data, data, dlen, sum);
+    p->udp.checksum = ip6_checksum_final(sum);
     return eth_send(p->eth + 2, ETH_HDR_LEN + IP6_HDR_LEN + length);
 
 fail:
@@ -260,6 +311,9 @@ fail:
 
 void _udp6_recv(ip6_hdr* ip, void* _data, size_t len) {
     udp_hdr* udp = _data;
+    uint8_t* data = (uint8_t*)_data + UDP_HDR_LEN;
+    uint8_t* place = 0;
+    size_t skip = 0;
     uint16_t sum, n;
 
     if (len < UDP_HDR_LEN)
@@ -269,21 +323,150 @@ void _udp6_recv(ip6_hdr* ip, void* _data, size_t len) {
     if (udp->checksum == 0xFFFF)
         udp->checksum = 0;
 
-    sum = checksum(&ip->length, 2, htons(HDR_UDP));
-    sum = checksum(ip->src, 32 + len, sum);
-    if (sum != 0xFFFF)
-        BAD("Checksum Incorrect");
-
     n = ntohs(udp->length);
     if (n < UDP_HDR_LEN)
         BAD("Bogus Header Len");
     if (n > len)
         BAD("Packet Too Short");
+
+    // A payload with a place to go (as for a reassembled one) is summed
+    // as it is copied there, so it is only read the once
+    if (n == len) {
+        place = udp6_place(data, len - UDP_HDR_LEN, len - UDP_HDR_LEN, &skip,
+                           (void*)ip->dst, ntohs(udp->dst_port));
+        if (skip > (len - UDP_HDR_LEN)) {
+            place = 0;
+        }
+    }
+
+    sum = csum(&ip->length, 2, htons(HDR_UDP));
+    if (place) {
+        sum = csum(ip->src, 32 + UDP_HDR_LEN + skip, sum);
+        sum = csum_copy(place, data + skip, len - UDP_HDR_LEN - skip, sum);
+    } else {
+        sum = csum(ip->src, 32 + len, sum);
+    }
+    if (sum != 0xFFFF)
+        BAD("Checksum Incorrect");
+
     len = n - UDP_HDR_LEN;
+    if (place) {
+        udp6_placed(data, skip, len,
+                    (void*)ip->dst, ntohs(udp->dst_port),
+                    (void*)ip->src, ntohs(udp->src_port));
+    } else {
+        udp6_recv(data, len,
+                  (void*)ip->dst, ntohs(udp->dst_port),
+                  (void*)ip->src, ntohs(udp->src_port));
+    }
+}
+
+// reassembly state for the one fragmented UDP packet in progress
+static struct {
+    uint32_t id;
+    uint8_t src[IP6_ADDR_LEN];
+    uint8_t dst[IP6_ADDR_LEN];
+    size_t next;    // offset of the next fragment expected, 0 if idle
+    size_t len;     // length of the UDP packet, header included
+    size_t skip;    // payload bytes kept in reasm_buf when placing
+    uint8_t* place; // where the payload past skip goes, or NULL
+    uint16_t sum;
+} reasm;
 
-    udp6_recv((uint8_t*)_data + UDP_HDR_LEN, len,
-              (void*)ip->dst, ntohs(udp->dst_port),
-              (void*)ip->src, ntohs(udp->src_port));
+static uint8_t reasm_buf[UDP_HDR_LEN + UDP6_MAX_FRAG_PAYLOAD];
+
+// Copy a fragment into place, adding it to the checksum as it goes
+static void frag_copy(size_t off, const uint8_t* data, size_t len) {
+    size_t keep = reasm.place ? (UDP_HDR_LEN + reasm.skip) : reasm.len;
+    size_t n;
+
+    if (off < keep) {
+        n = ((keep - off) < len) ? (keep - off) : len;
+        reasm.sum = csum_copy(reasm_buf + off, data, n, reasm.sum);
+        off += n;
+        data += n;
+        len -= n;
+    }
+    if (len) {
+        reasm.sum = csum_copy(reasm.place + (off - keep), data, len, reasm.sum);
+    }
+}
+
+void _ip6_frag_recv(ip6_hdr* ip, void* _data, size_t len) {
+    ip6_frag_hdr* frag = _data;
+    uint8_t* data = (uint8_t*)_data + IP6_FRAG_HDR_LEN;
+    udp_hdr* udp;
+    uint16_t ulen;
+    size_t off;
+    int more;
+
+    if (len < IP6_FRAG_HDR_LEN)
+        BAD("Bogus Fragment Len");
+    len -= IP6_FRAG_HDR_LEN;
+    off = ntohs(frag->offset) & ~7;
+    more = ntohs(frag->offset) & IP6_FRAG_MORE;
+    if (more && (len & 7))
+        BAD("Bogus Fragment Len");
+
+    if (off == 0) {
+        udp = (void*)data;
+        if (frag->next_header != HDR_UDP)
+            BAD("Unhandled Fragment");
+        if (len < UDP_HDR_LEN)
+            BAD("Bogus Header Len");
+        if (udp->checksum == 0)
+            BAD("Checksum Invalid");
+        if (udp->checksum == 0xFFFF)
+            udp->checksum = 0;
+        ulen = ntohs(udp->length);
+        if ((ulen < len) || (ulen > sizeof(reasm_buf)))
+            BAD("Bogus Header Len");
+
+        reasm.id = frag->id;
+        memcpy(reasm.src, ip->src, IP6_ADDR_LEN);
+        memcpy(reasm.dst, ip->dst, IP6_ADDR_LEN);
+        reasm.len = ulen;
+        reasm.skip = 0;
+        reasm.place = udp6_place(data + UDP_HDR_LEN, len - UDP_HDR_LEN,
+                                 ulen - UDP_HDR_LEN, &reasm.skip,
+                                 (void*)ip->dst, ntohs(udp->dst_port));
+        if (reasm.skip > (len - UDP_HDR_LEN)) {
+            reasm.place = 0;
+        }
+
+        // length and protocol field for pseudo-header, then src/dst
+        ulen = htons(ulen);
+        reasm.sum = csum(&ulen, 2, htons(HDR_UDP));
+        reasm.sum = csum(ip->src, 32, reasm.sum);
+    } else if ((reasm.next == 0) || (off != reasm.next) || (frag->id != reasm.id) ||
+               memcmp(ip->src, reasm.src, IP6_ADDR_LEN)) {
+        reasm.next = 0;
+        BAD("Fragment Out Of Order");
+    }
+    if (((off + len) > reasm.len) || (!more && ((off + len) != reasm.len))) {
+        reasm.next = 0;
+        BAD("Bogus Fragment Len");
+    }
+
+    frag_copy(off, data, len);
+    reasm.next = off + len;
+    if (more)
+        return;
+
+    reasm.next = 0;
+    if (reasm.sum != 0xFFFF)
+        BAD("Checksum Incorrect");
+
+    udp = (void*)reasm_buf;
+    if (reasm.place) {
+        udp6_placed(reasm_buf + UDP_HDR_LEN, reasm.skip, reasm.len - UDP_HDR_LEN,
+                    (void*)reasm.dst, ntohs(udp->dst_port),
+                    (void*)reasm.src, ntohs(udp->src_port));
+    } else {
+        udp6_recv(reasm_buf + UDP_HDR_LEN, reasm.len - UDP_HDR_LEN,
+                  (void*)reasm.dst, ntohs(udp->dst_port),
+                  (void*)reasm.src, ntohs(udp->src_port));
+    }
 }
 
 void icmp6_recv(ip6_hdr* ip, void* _data, size_t len) {
@@ -295,8 +478,8 @@ void icmp6_recv(ip6_hdr* ip, void* _data, size_t len) {
     if (icmp->checksum == 0xFFFF)
         icmp->checksum = 0;
 
-    sum = checksum(&ip->length, 2, htons(HDR_ICMP6));
-    sum = checksum(ip->src, 32 + len, sum);
+    sum = csum(&ip->length, 2, htons(HDR_ICMP6));
+    sum = csum(ip->src, 32 + len, sum);
     if (sum != 0xFFFF)
         BAD("Checksum Incorrect");
 
@@ -311,17 +494,17 @@ void icmp6_recv(ip6_hdr* ip, void* _data, size_t len) {
             BAD("Bogus NDP Message");
         if (ndp->code != 0)
             BAD("Bogus NDP Code");
-        if (memcmp(ndp->target, &ll_ip6_addr, IP6_ADDR_LEN))
+        if (memcmp(ndp->target, &ifc->ll_ip6_addr, IP6_ADDR_LEN))
             BAD("NDP Not For Me");
 
         msg.hdr.type = ICMP6_NDP_N_ADVERTISE;
         msg.hdr.code = 0;
         msg.hdr.checksum = 0;
         msg.hdr.flags = 0x60; // (S)olicited and (O)verride flags
-        memcpy(msg.hdr.target, &ll_ip6_addr, IP6_ADDR_LEN);
+        memcpy(msg.hdr.target, &ifc->ll_ip6_addr, IP6_ADDR_LEN);
         msg.opt[0] = NDP_N_TGT_LL_ADDR;
         msg.opt[1] = 1;
-        memcpy(msg.opt + 2, &ll_mac_addr, ETH_ADDR_LEN);
+        memcpy(msg.opt + 2, &ifc->ll_mac_addr, ETH_ADDR_LEN);
 
         icmp6_send(&msg, sizeof(msg), (void*)ip->src);
         return;
@@ -366,14 +549,13 @@ void eth_recv(void* _data, size_t len) {
     len = n;
 
     // require that we are the destination
-    if (memcmp(&ll_ip6_addr, ip->dst, IP6_ADDR_LEN) &&
-        memcmp(&snm_ip6_addr, ip->dst, IP6_ADDR_LEN)) {
+    if (!ip6_for_us(ip->dst)) {
         return;
     }
 
     // stash the sender's info to simplify replies
-    memcpy(&rx_mac_addr, (uint8_t*)_data + 6, ETH_ADDR_LEN);
-    memcpy(&rx_ip6_addr, ip->src, IP6_ADDR_LEN);
+    memcpy(&ifc->rx_mac_addr, (uint8_t*)_data + 6, ETH_ADDR_LEN);
+    memcpy(&ifc->rx_ip6_addr, ip->src, IP6_ADDR_LEN);
 
     if (ip->next_header == HDR_ICMP6) {
         icmp6_recv(ip, data, len);
@@ -385,6 +567,11 @@ void eth_recv(void* _data, size_t len) {
         return;
     }
 
+    if (ip->next_header == HDR_FRAGMENT) {
+        _ip6_frag_recv(ip, data, len);
+        return;
+    }
+
     BAD("Unhandled IP6");
 }
 
@@ -20,6 +20,7 @@ typedef struct ip6_hdr_t ip6_hdr;
 typedef struct udp_hdr_t udp_hdr;
 typedef struct icmp6_hdr_t icmp6_hdr;
 typedef struct ndp_n_hdr_t ndp_n_hdr;
+typedef struct ip6_frag_hdr_t ip6_frag_hdr;
 
 #define ETH_ADDR_LEN 6
 #define ETH_HDR_LEN 14
@@ -65,6 +66,19 @@ struct ip6_hdr_t {
     uint8_t dst[IP6_ADDR_LEN];
 } __attribute__((packed));
 
+struct ip6_frag_hdr_t {
+    uint8_t next_header;
+    uint8_t reserved;
+    uint16_t offset; // offset in 8 byte units << 3 | more fragments flag
+    uint32_t id;
+} __attribute__((packed));
+
+#define IP6_FRAG_HDR_LEN 8
+#define IP6_FRAG_MORE 1
+
+// Largest UDP payload that will be reassembled from IPv6 fragments
+#define UDP6_MAX_FRAG_PAYLOAD (32 * 1024 + 256)
+
 struct udp_hdr_t {
     uint16_t src_port;
     uint16_t dst_port;
@@ -127,9 +141,22 @@ char* ip6toa(char* _out, void* ip6addr);
 #define IP6TOAMAX 40
 
 // provided by inet6.c
-void ip6_init(void* macaddr);
+
+// Add an interface with the given MAC (and so link local address),
+// returning its number, or -1 if there are already IP6_MAX_IFC.  It
+// becomes the one selected.
+#define IP6_MAX_IFC 4
+int ip6_init(void* macaddr);
+
+// Select interface n: eth_recv() takes frames as received on it, and
+// everything sent until the next ip6_select() goes out on it.
+void ip6_select(int n);
+
 void eth_recv(void* data, size_t len);
 
+// start accepting packets sent to a (link local) multicast group
+int ip6_join_group(const ip6_addr* group);
+
 // provided by interface driver
 void* eth_get_buffer(size_t len);
 void eth_put_buffer(void* ptr);
@@ -146,6 +173,32 @@ void udp6_recv(void* data, size_t len,
                const ip6_addr* daddr, uint16_t dport,
                const ip6_addr* saddr, uint16_t sport);
 
+// implement to have UDP packets copied (or reassembled) in place
+//
+// udp6_place() is called when a packet or the first fragment of one
+// arrives, with the start of the payload (avail bytes of it) and the
+// payload's full length.  It may return a buffer for payload bytes from
+// *skip onward to be copied or reassembled directly into (checksummed
+// on the way), or NULL to have the packet passed to udp6_recv() as
+// usual.  Once the packet is complete and its checksum verified,
+// udp6_placed() is called with the first *skip bytes of the payload.
+void* udp6_place(const void* data, size_t avail, size_t len, size_t* skip,
+                 const ip6_addr* daddr, uint16_t dport);
+void udp6_placed(void* data, size_t skip, size_t len,
+                 const ip6_addr* daddr, uint16_t dport,
+                 const ip6_addr* saddr, uint16_t sport);
+
+// implement to have unfragmented UDP packets received in place
+//
+// udp6_land() is called by the interface driver before it receives
+// each frame.  It may return a buffer of ETH_MTU bytes to receive the
+// frame into, laid out so that the payload of the UDP packet expected
+// next lands where it belongs, or NULL for the driver to use its own.
+// Whatever the frame turns out to be, it goes to eth_recv() as usual,
+// and then udp6_landed() is called to put back what else it overwrote.
+void* udp6_land(void);
+void udp6_landed(void);
+
 // NOTES
 //
 // This is an extremely minimal IPv6 stack, supporting just enough
@@ -157,9 +210,14 @@ void udp6_recv(void* data, size_t len,
 //
 // It responds to PINGs.
 //
+// Besides its own addresses it only accepts packets sent to the few
+// multicast groups joined with ip6_join_group().
+//
 // It can only transmit to multicast addresses or to the address it
 // last received a packet from (general usecase is to reply to a UDP
-// packet from the UDP callback, which this supports)
+// packet from the UDP callback, which this supports).  With several
+// interfaces, that is tracked per interface, and a reply from the
+// callback goes out on the interface the packet came in on.
 //
 // It does not currently do duplicate address detection, which is
 // probably the most severe bug.
@@ -167,6 +225,10 @@ void udp6_recv(void* data, size_t len,
 // It does not support any IPv6 options and will drop packets with
 // options.
 //
+// It reassembles fragmented UDP packets, one at a time, and only if
+// the fragments arrive in order (as they do from a sender on the same
+// link).  Anything else drops the partial packet.
+//
 // It expects the network stack to provide transmit buffer allocation
 // and free functionality.  It will allocate a single transmit buffer
 // from udp6_send() or icmp6_send() to fill out and either pass to the
@@ -0,0 +1,191 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdint.h>
+
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // a block always ends with this many literals
+#define LZ4_MFLIMIT 12      // and no match starts this close to its end
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12
+
+static uint32_t lz4_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned lz4_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t* lz4_putlen(uint8_t* op, size_t n) {
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+// Append a sequence of nlit literals and (unless mlen is 0) a match.
+// Returns the new output position, or 0 if it doesn't fit.
+static uint8_t* lz4_emit(uint8_t* op, uint8_t* oend, const uint8_t* lit, size_t nlit,
+                         size_t off, size_t mlen) {
+    uint8_t* token;
+
+    // op may already be at oend, with no room even for the token
+    if ((op >= oend) || ((size_t)(oend - op) < (1 + nlit + nlit / 255 + 1 + 2 + mlen / 255 + 1))) {
+        return 0;
+    }
+    token = op++;
+    if (nlit >= 15) {
+        *token = 15 << 4;
+        op = lz4_putlen(op, nlit - 15);
+    } else {
+        *token = nlit << 4;
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen == 0) {
+        return op;
+    }
+    *op++ = off;
+    *op++ = off >> 8;
+    mlen -= LZ4_MIN_MATCH;
+    if (mlen >= 15) {
+        *token |= 15;
+        op = lz4_putlen(op, mlen - 15);
+    } else {
+        *token |= mlen;
+    }
+    return op;
+}
+
+// Greedy single-probe matcher, stepping faster through data that
+// doesn't compress (as the reference LZ4 does).
+size_t lz4_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t max) {
+    uint32_t table[1 << LZ4_HASH_BITS];
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + max;
+    unsigned misses = 0;
+
+    if (max == 0) {
+        return 0;
+    }
+    if (len > LZ4_MFLIMIT) {
+        const uint8_t* mlimit = end - LZ4_MFLIMIT;
+        const uint8_t* matchlimit = end - LZ4_LAST_LITERALS;
+
+        memset(table, 0, sizeof(table));
+        while (ip < mlimit) {
+            uint32_t v = lz4_read32(ip);
+            unsigned h = lz4_hash(v);
+            const uint8_t* ref = src + table[h];
+            const uint8_t* mp;
+
+            table[h] = ip - src;
+            if ((ref >= ip) || ((ip - ref) > LZ4_MAX_OFFSET) || (lz4_read32(ref) != v)) {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+            mp = ip + LZ4_MIN_MATCH;
+            ref += LZ4_MIN_MATCH;
+            while ((mp < matchlimit) && (*mp == *ref)) {
+                mp++;
+                ref++;
+            }
+            op = lz4_emit(op, oend, anchor, ip - anchor, mp - ref, mp - ip);
+            if (op == 0) {
+                return 0;
+            }
+            ip = anchor = mp;
+        }
+    }
+    op = lz4_emit(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+static int lz4_getlen(const uint8_t** ip, const uint8_t* iend, size_t* n) {
+    unsigned b;
+
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz4_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t max) {
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + max;
+
+    for (;;) {
+        const uint8_t* m;
+        unsigned token;
+        size_t n, off;
+
+        if (ip >= iend) {
+            return -1;
+        }
+        token = *ip++;
+        n = token >> 4;
+        if ((n == 15) && lz4_getlen(&ip, iend, &n)) {
+            return -1;
+        }
+        if ((n > (size_t)(iend - ip)) || (n > (size_t)(oend - op))) {
+            return -1;
+        }
+        memcpy(op, ip, n);
+        op += n;
+        ip += n;
+        if (ip == iend) {
+            return op - dst;
+        }
+
+        if ((iend - ip) < 2) {
+            return -1;
+        }
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((off == 0) || (off > (size_t)(op - dst))) {
+            return -1;
+        }
+        n = token & 15;
+        if ((n == 15) && lz4_getlen(&ip, iend, &n)) {
+            return -1;
+        }
+        n += LZ4_MIN_MATCH;
+        if (n > (size_t)(oend - op)) {
+            return -1;
+        }
+        // matches may overlap their own output, so copy forward bytewise
+        m = op - off;
+        while (n--) {
+            *op++ = *m++;
+        }
+    }
+}
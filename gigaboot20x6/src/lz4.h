@@ -0,0 +1,30 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// LZ4 block format (no frame header or checksums): a series of
+// sequences, each a token byte (literal count << 4 | match length - 4,
+// 15 meaning more length bytes follow), the literals, then a two byte
+// little endian match offset.  The last sequence is literals only.
+// Blocks are independent: matches never reach outside their block.
+
+// Compress len bytes of src into dst (at most max bytes).  Returns the
+// compressed size, or 0 if it would not fit.
+size_t lz4_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t max);
+
+// Decompress the len byte block in src into dst (at most max bytes).
+// Returns the decompressed size, or -1 if the block is malformed or
+// would overrun either buffer.
+int lz4_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t max);
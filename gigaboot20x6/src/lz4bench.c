@@ -0,0 +1,166 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The LZ4 block codec netboot and mkzimage use.  First every size of
+// block, random (which doesn't compress), repetitive and in between,
+// has to come back intact, and compressing it into a buffer of any
+// size short of that, as nbserver and mkzimage do with one byte short
+// of the input, must fail or fit without writing a byte past the end.
+// Then the throughput of both ways on blocks of the size given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <stdint.h>
+
+#include "lz4.h"
+
+#define GUARD 64 // bytes after each output buffer that must be left alone
+
+static char* appname;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// len bytes in runs of up to 300, each either random (noise times in
+// eight) or a copy of what came before it
+static void fill(uint8_t* data, size_t len, unsigned noise) {
+    size_t n = 0;
+
+    while (n < len) {
+        size_t run = 1 + rand() % 300;
+        size_t from = n ? (rand() % n) : 0;
+        int random = (n == 0) || ((unsigned)(rand() % 8) < noise);
+        for (; run && (n < len); run--, n++) {
+            data[n] = random ? rand() : data[from++];
+        }
+    }
+}
+
+// Compress len bytes into max, then back.  Returns nonzero if that
+// goes wrong.
+static int roundtrip(const uint8_t* src, size_t len, size_t max, uint8_t* dst, uint8_t* back) {
+    size_t clen;
+
+    memset(dst + max, 0xa5, GUARD);
+    clen = lz4_compress(src, len, dst, max);
+    for (size_t n = 0; n < GUARD; n++) {
+        if (dst[max + n] != 0xa5) {
+            printf("FAIL: %zu bytes into %zu: wrote past the end\n", len, max);
+            return -1;
+        }
+    }
+    if (clen == 0) {
+        return 0;
+    }
+    if ((clen > max) || (lz4_decompress(dst, clen, back, len) != (int)len) ||
+        memcmp(src, back, len)) {
+        printf("FAIL: %zu bytes into %zu: didn't come back\n", len, max);
+        return -1;
+    }
+    return 0;
+}
+
+void usage(void) {
+    fprintf(stderr,
+            "usage:   %s [ <option> ]*\n"
+            "\n"
+            "options: -b <n>  block size in bytes (default 65536)\n"
+            "         -s <n>  megabytes of data to run through each test (default 256)\n",
+            appname);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t len = 65536, total = 256;
+    uint8_t *src, *dst, *back;
+    size_t blocks, clen;
+    uint64_t t;
+    int bad = 0;
+
+    appname = argv[0];
+    while (argc > 1) {
+        if (argc < 3)
+            usage();
+        if (!strcmp(argv[1], "-b")) {
+            len = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-s")) {
+            total = atoi(argv[2]);
+        } else {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if ((len < 1) || (total < 1))
+        usage();
+
+    srand(1);
+    src = malloc(len > 4096 ? len : 4096);
+    dst = malloc((len > 4096 ? len : 4096) + GUARD);
+    back = malloc(len > 4096 ? len : 4096);
+    if ((src == NULL) || (dst == NULL) || (back == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return 1;
+    }
+
+    for (unsigned noise = 0; (noise <= 8) && !bad; noise++) {
+        for (size_t n = 1; (n <= 4096) && !bad; n++) {
+            fill(src, n, noise);
+            bad |= roundtrip(src, n, n - 1, dst, back);
+            bad |= roundtrip(src, n, n + n / 255 + 16, dst, back);
+        }
+        // and every size of buffer, so that some sequence ends right
+        // at the end of it
+        for (size_t n = 1; (n <= 300) && !bad; n++) {
+            fill(src, n, noise);
+            for (size_t max = 0; (max <= n) && !bad; max++) {
+                bad |= roundtrip(src, n, max, dst, back);
+            }
+        }
+    }
+    if (bad) {
+        return 1;
+    }
+    printf("every block came back, and none overran its buffer\n");
+
+    blocks = (total * 1024 * 1024 + len - 1) / len;
+    for (unsigned noise = 8; noise >= 1; noise /= 2) {
+        fill(src, len, noise);
+        clen = lz4_compress(src, len, dst, len);
+        t = now_ns();
+        for (size_t n = 0; n < blocks; n++) {
+            lz4_compress(src, len, dst, len);
+        }
+        t = now_ns() - t;
+        printf("%3u%% random: %5.1f%% of the size, compress %7.1f MB/s",
+               noise * 100 / 8, clen ? (100.0 * clen / len) : 100.0, (blocks * len) / (t / 1e3));
+        if (clen == 0) {
+            printf(", stored\n");
+            continue;
+        }
+        t = now_ns();
+        for (size_t n = 0; n < blocks; n++) {
+            lz4_decompress(dst, clen, back, len);
+        }
+        t = now_ns() - t;
+        printf(", decompress %7.1f MB/s\n", (blocks * len) / (t / 1e3));
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Make a chunked compressed image (see zimage.h) of a ramdisk, which
+// osboot expands on all processors at once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stdint.h>
+
+#include "lz4.h"
+#include "zimage.h"
+
+static char* appname;
+
+void usage(void) {
+    fprintf(stderr,
+            "usage:   %s [ <option> ]* <infile> <outfile>\n"
+            "\n"
+            "options: -c <n>  compress n byte chunks (%d-%d, default %d)\n",
+            appname, ZIMAGE_CHUNK_MIN, ZIMAGE_CHUNK_MAX, 128 * 1024);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    size_t chunksize = 128 * 1024;
+    const char* in = NULL;
+    const char* out = NULL;
+    uint8_t* data = NULL;
+    uint8_t* zdata = NULL;
+    uint32_t* zlen = NULL;
+    zimage_hdr hdr;
+    size_t size = 0, pos = 0;
+    FILE* fp;
+    long sz;
+    int status = 1;
+
+    appname = argv[0];
+    while (argc > 1) {
+        if (argv[1][0] != '-') {
+            if (out != NULL)
+                usage();
+            if (in == NULL) {
+                in = argv[1];
+            } else {
+                out = argv[1];
+            }
+        } else if (!strcmp(argv[1], "-c")) {
+            if (argc < 3)
+                usage();
+            chunksize = atoi(argv[2]);
+            if ((chunksize < ZIMAGE_CHUNK_MIN) || (chunksize > ZIMAGE_CHUNK_MAX))
+                usage();
+            argc--;
+            argv++;
+        } else {
+            usage();
+        }
+        argc--;
+        argv++;
+    }
+    if (out == NULL) {
+        usage();
+    }
+
+    if ((fp = fopen(in, "rb")) == NULL) {
+        fprintf(stderr, "%s: cannot open '%s'\n", appname, in);
+        return 1;
+    }
+    if ((fseek(fp, 0, SEEK_END) < 0) || ((sz = ftell(fp)) < 0) ||
+        (fseek(fp, 0, SEEK_SET) < 0)) {
+        fprintf(stderr, "%s: cannot size '%s'\n", appname, in);
+        fclose(fp);
+        return 1;
+    }
+    size = sz;
+    if ((uint64_t)size >> 32) {
+        fprintf(stderr, "%s: '%s' is too large\n", appname, in);
+        fclose(fp);
+        return 1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = ZIMAGE_MAGIC;
+    hdr.chunksize = chunksize;
+    hdr.count = (size + chunksize - 1) / chunksize;
+    hdr.size = size;
+    data = malloc(size ? size : 1);
+    zdata = malloc(size ? size : 1);
+    zlen = calloc(hdr.count + 1, sizeof(uint32_t));
+    if ((data == NULL) || (zdata == NULL) || (zlen == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        fclose(fp);
+        goto done;
+    }
+    if (fread(data, 1, size, fp) != size) {
+        fprintf(stderr, "%s: error: reading '%s'\n", appname, in);
+        fclose(fp);
+        goto done;
+    }
+    fclose(fp);
+
+    // a chunk that doesn't shrink is stored as is
+    for (uint32_t n = 0; n < hdr.count; n++) {
+        size_t off = (size_t)n * chunksize;
+        size_t len = ((size - off) < chunksize) ? (size - off) : chunksize;
+        size_t z = lz4_compress(data + off, len, zdata + pos, len - 1);
+        if (z == 0) {
+            memcpy(zdata + pos, data + off, len);
+            z = len;
+        }
+        zlen[n] = z;
+        pos += z;
+    }
+
+    if ((fp = fopen(out, "wb")) == NULL) {
+        fprintf(stderr, "%s: cannot create '%s'\n", appname, out);
+        goto done;
+    }
+    if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) ||
+        (fwrite(zlen, sizeof(uint32_t), hdr.count, fp) != hdr.count) ||
+        (fwrite(zdata, 1, pos, fp) != pos) || fclose(fp)) {
+        fprintf(stderr, "%s: error: writing '%s'\n", appname, out);
+        goto done;
+    }
+    pos += sizeof(hdr) + hdr.count * sizeof(uint32_t);
+    printf("%s: %zu bytes -> %zu bytes (%.1f%%) in %u chunks of %zu\n",
+           out, size, pos, size ? (pos * 100.0 / size) : 100.0, hdr.count, chunksize);
+    status = 0;
+done:
+    free(data);
+    free(zdata);
+    free(zlen);
+    return status;
+}
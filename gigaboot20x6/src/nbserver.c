@@ -15,155 +15,1776 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <errno.h>
 #include <stdint.h>
 
+#include "delta.h"
+#include "fec.h"
+#include "lz4.h"
 #include "netboot.h"
+#include "sha256.h"
 
 static uint32_t cookie = 1;
 static char* appname;
 
-static int io(int s, nbmsg* msg, size_t len, nbmsg* ack) {
-    int retries = 5;
+// NB_DATA blocks kept in flight when the device supports it (0 = off)
+static int window = 16;
+
+// NB_DATA payload size; over NB_BLOCK_MTU, the kernel sends each block
+// as IPv6 fragments and the device reassembles them in place
+static int blocksize = NB_BLOCK_MTU;
+
+// Devices to gather into one multicast session (1 = unicast only)
+static int group_max = 1;
+
+// NB_PARITY blocks to send per group of NB_DATA blocks (parity 0 = off)
+static nbfecopts fec;
+
+// Offer devices LZ4 compressed blocks
+static int compress = 0;
+
+// Offer devices to send only what changed since the file they last got
+static int delta = 0;
+
+// Offer devices the Merkle tree of the file, to check each block with
+static int merkle = 1;
+
+// Stripe windowed transfers across every path to a device that has
+// several interfaces (see NB_ADVERTISE)
+static int stripe = 1;
+
+static void* load_file(const char* fn, size_t* size) {
+    FILE* fp;
+    void* data = NULL;
+    long sz;
+
+    if ((fp = fopen(fn, "rb")) == NULL) {
+        fprintf(stderr, "%s: cannot open '%s'\n", appname, fn);
+        return NULL;
+    }
+    if ((fseek(fp, 0, SEEK_END) < 0) || ((sz = ftell(fp)) < 0) ||
+        (fseek(fp, 0, SEEK_SET) < 0)) {
+        fprintf(stderr, "%s: cannot size '%s'\n", appname, fn);
+        goto done;
+    }
+    if ((data = malloc(sz ? sz : 1)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        goto done;
+    }
+    if (fread(data, 1, sz, fp) != sz) {
+        fprintf(stderr, "%s: error: reading '%s'\n", appname, fn);
+        free(data);
+        data = NULL;
+        goto done;
+    }
+    *size = sz;
+done:
+    fclose(fp);
+    return data;
+}
+
+// Retransmit timeout bounds, and how long a device may stay silent
+// before the transfer is abandoned (microseconds)
+#define RTO_INIT 250000
+#define RTO_MIN 2000
+#define RTO_MAX 1000000
+#define DEVICE_TIMEOUT 2000000
+
+// Congestion window (blocks) a windowed transfer starts with
+#define CWND_INIT 4
+
+#define SENT_RING 4096
+
+// Paths (a socket connected to each of the device's addresses) that a
+// transfer may be striped across, and how long to listen for the
+// beacons of the rest after the first
+#define PATHS_MAX 4
+#define PATHS_GATHER 1200000
+
+// Per-device link state, learned over the course of a transfer
+typedef struct {
+    int s[PATHS_MAX];
+    int paths;
+    int path;          // what the next message is sent over
+    int from;          // what the last answer came over
+    size_t pwire[PATHS_MAX]; // bytes sent over each
+    uint64_t heard;    // when the device last answered
+    uint64_t srtt;     // smoothed round trip time, 0 until sampled
+    uint64_t rttvar;   // round trip time variation
+    uint64_t rto;      // retransmit timeout
+    uint64_t timeout;  // receive timeout the socket is set to
+    uint32_t cwnd;     // congestion window (blocks)
+    uint32_t acked;    // blocks acked toward growing cwnd by one
+    uint32_t ssthresh; // cwnd past which it grows linearly
+    size_t recover;    // cwnd is not cut again until acked past here
+    size_t retransmits;
+    size_t timeouts;
+    size_t wire;       // bytes sent
+    struct {
+        uint32_t cookie;
+        uint64_t when;
+    } sent[SENT_RING]; // send times of recent messages, by cookie
+} nbdev;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int dev_send(nbdev* dev, nbmsg* msg, size_t len) {
+    int r;
+
+    for (;;) {
+        r = write(dev->s[dev->path], msg, len);
+        if (r >= 0) {
+            break;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            fprintf(stderr, "\n%s: socket write error %d\n", appname, errno);
+            return -1;
+        }
+    }
+    dev->sent[msg->cookie % SENT_RING].cookie = msg->cookie;
+    dev->sent[msg->cookie % SENT_RING].when = now_us();
+    dev->wire += len;
+    dev->pwire[dev->path] += len;
+    return 0;
+}
+
+// Update the round trip estimate from an ack to message c, and the
+// retransmit timeout from that (SRTT + 4 * RTTVAR, as TCP does)
+static void dev_sample(nbdev* dev, uint32_t c) {
+    uint64_t rtt, err;
+
+    if (dev->sent[c % SENT_RING].cookie != c) {
+        return;
+    }
+    dev->sent[c % SENT_RING].cookie = 0;
+    rtt = now_us() - dev->sent[c % SENT_RING].when;
+    if (rtt == 0) {
+        rtt = 1;
+    }
+    if (dev->srtt == 0) {
+        dev->srtt = rtt;
+        dev->rttvar = rtt / 2;
+    } else {
+        err = (rtt > dev->srtt) ? (rtt - dev->srtt) : (dev->srtt - rtt);
+        dev->rttvar = (3 * dev->rttvar + err) / 4;
+        dev->srtt = (7 * dev->srtt + rtt) / 8;
+    }
+    dev->rto = dev->srtt + 4 * dev->rttvar;
+    if (dev->rto < RTO_MIN) {
+        dev->rto = RTO_MIN;
+    } else if (dev->rto > RTO_MAX) {
+        dev->rto = RTO_MAX;
+    }
+}
+
+// Read an answer from whichever path has one first, waiting up to the
+// retransmit timeout, and note which path that was
+static int dev_read(nbdev* dev, nbmsg* ack) {
+    struct pollfd pfd[PATHS_MAX];
+    int r;
+
+    for (int i = 0; i < dev->paths; i++) {
+        pfd[i].fd = dev->s[i];
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+    r = poll(pfd, dev->paths, (dev->rto + 999) / 1000);
+    if (r <= 0) {
+        if (r == 0) {
+            errno = EAGAIN;
+        }
+        return -1;
+    }
+    // take the paths in turn, so a busy one can't starve the rest
+    for (int i = 1; i <= dev->paths; i++) {
+        int p = (dev->from + i) % dev->paths;
+        if (pfd[p].revents) {
+            dev->from = p;
+            return read(dev->s[p], ack, 2048);
+        }
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+// Wait up to the retransmit timeout for an ack.  Returns its length, 0
+// on a timeout (backing the timeout off), or -1 on error.
+static int dev_recv(nbdev* dev, nbmsg* ack) {
+    struct timeval tv;
+    int r;
+
+    if ((dev->paths == 1) && (dev->timeout != dev->rto)) {
+        tv.tv_sec = dev->rto / 1000000;
+        tv.tv_usec = dev->rto % 1000000;
+        setsockopt(dev->s[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        dev->timeout = dev->rto;
+    }
+    for (;;) {
+        r = (dev->paths == 1) ? read(dev->s[0], ack, 2048) : dev_read(dev, ack);
+        if (r < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                dev->timeouts++;
+                dev->rto *= 2;
+                if (dev->rto > RTO_MAX) {
+                    dev->rto = RTO_MAX;
+                }
+                return 0;
+            }
+            fprintf(stderr, "\n%s: socket read error %d\n", appname, errno);
+            return -1;
+        }
+        if (r < sizeof(nbmsg)) {
+            fprintf(stderr, "Z");
+            continue;
+        }
+        if (ack->magic != NB_MAGIC) {
+            fprintf(stderr, "?");
+            continue;
+        }
+        dev->heard = now_us();
+        dev_sample(dev, ack->cookie);
+        return r;
+    }
+}
+
+static int dev_silent(nbdev* dev) {
+    if ((now_us() - dev->heard) < DEVICE_TIMEOUT) {
+        fprintf(stderr, "T");
+        return 0;
+    }
+    fprintf(stderr, "\n%s: timed out\n", appname);
+    return 1;
+}
+
+// Send msg until answered.  Returns the answer's length, or -1 on error.
+static int io_ack(nbdev* dev, nbmsg* msg, size_t len, nbmsg* ack) {
+    int r;
+
+    msg->magic = NB_MAGIC;
+    msg->cookie = cookie++;
+
+    if (dev_send(dev, msg, len)) {
+        return -1;
+    }
+    for (;;) {
+        r = dev_recv(dev, ack);
+        if (r < 0) {
+            return -1;
+        }
+        if (r == 0) {
+            if (dev_silent(dev)) {
+                return -1;
+            }
+            if (dev_send(dev, msg, len)) {
+                return -1;
+            }
+            // an ack could answer either copy, so don't time this one
+            dev->sent[msg->cookie % SENT_RING].cookie = 0;
+            dev->retransmits++;
+            continue;
+        }
+        if (ack->cookie != msg->cookie) {
+            fprintf(stderr, "C");
+            continue;
+        }
+        // the ack to NB_SEND_FILE carries the options the device accepted
+        if ((ack->arg != msg->arg) && (msg->cmd != NB_SEND_FILE) && !(ack->cmd & NB_ERROR)) {
+            fprintf(stderr, "A");
+            continue;
+        }
+        return r;
+    }
+}
+
+// As io_ack(), but anything other than NB_ACK is an error
+static int io(nbdev* dev, nbmsg* msg, size_t len, nbmsg* ack) {
+    if (io_ack(dev, msg, len, ack) < 0) {
+        return -1;
+    }
+    if (ack->cmd != NB_ACK) {
+        fprintf(stderr, "\n%s: device error %08x\n", appname, ack->cmd);
+        return -1;
+    }
+    return 0;
+}
+
+// The file being served, kept between transfers until it changes on
+// disk, and its blocks LZ4 compressed for one blocksize (built the first
+// time a device agrees to NB_FILE_LZ4).  A block that doesn't shrink
+// has zlen 0 and is sent as plain NB_DATA.  Likewise the Merkle tree
+// leaves (see nbmerkleopts) for one blocksize.
+typedef struct {
+    char* fn;
+    time_t mtime;
+    uint8_t* data;
+    size_t size;
+    uint8_t digest[SHA256_SIZE];
+    char hex[SHA256_SIZE * 2 + 1];
+    size_t zblocksize; // 0 until compressed
+    uint8_t* zdata;
+    uint32_t* zoff;
+    uint32_t* zlen;
+    size_t mblocksize; // 0 until hashed
+    uint8_t* leaves;
+    uint8_t root[SHA256_SIZE];
+} nbimage;
+
+static nbimage image;
+
+static void image_free(nbimage* img) {
+    free(img->fn);
+    free(img->data);
+    free(img->zdata);
+    free(img->zoff);
+    free(img->zlen);
+    free(img->leaves);
+    memset(img, 0, sizeof(*img));
+}
+
+static nbimage* image_load(const char* fn) {
+    struct stat st;
+
+    if (stat(fn, &st) < 0) {
+        fprintf(stderr, "%s: cannot open '%s'\n", appname, fn);
+        return NULL;
+    }
+    if (image.data && !strcmp(image.fn, fn) &&
+        (image.mtime == st.st_mtime) && (image.size == (size_t)st.st_size)) {
+        return &image;
+    }
+    image_free(&image);
+    if ((image.data = load_file(fn, &image.size)) == NULL) {
+        return NULL;
+    }
+    if ((image.fn = strdup(fn)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        image_free(&image);
+        return NULL;
+    }
+    image.mtime = st.st_mtime;
+    sha256(image.data, image.size, image.digest);
+    for (int i = 0; i < SHA256_SIZE; i++) {
+        sprintf(image.hex + i * 2, "%02x", image.digest[i]);
+    }
+    return &image;
+}
+
+static int image_compress(nbimage* img, size_t blocksize) {
+    size_t blocks = (img->size + blocksize - 1) / blocksize;
+    size_t pos = 0, wire = 0;
+    uint64_t t;
+
+    if (img->zblocksize == blocksize) {
+        return 0;
+    }
+    free(img->zdata);
+    free(img->zoff);
+    free(img->zlen);
+    img->zblocksize = 0;
+    // every kept block is smaller than the original
+    img->zdata = malloc(img->size ? img->size : 1);
+    img->zoff = calloc(blocks + 1, sizeof(uint32_t));
+    img->zlen = calloc(blocks + 1, sizeof(uint32_t));
+    if ((img->zdata == NULL) || (img->zoff == NULL) || (img->zlen == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return -1;
+    }
+    t = now_us();
+    for (size_t b = 0; b < blocks; b++) {
+        size_t off = b * blocksize;
+        size_t n = ((img->size - off) < blocksize) ? (img->size - off) : blocksize;
+        size_t z = lz4_compress(img->data + off, n, img->zdata + pos, n - 1);
+        if (z) {
+            img->zoff[b] = pos;
+            img->zlen[b] = z;
+            pos += z;
+            wire += z;
+        } else {
+            wire += n;
+        }
+    }
+    img->zblocksize = blocksize;
+    fprintf(stderr, "%s: compressed '%s' to %zu bytes (%.1f%%) in %.3fs\n",
+            appname, img->fn, wire, img->size ? (wire * 100.0 / img->size) : 100.0,
+            (now_us() - t) / 1e6);
+    return 0;
+}
+
+static int image_merkle(nbimage* img, size_t blocksize) {
+    size_t blocks = (img->size + blocksize - 1) / blocksize;
+
+    if (img->mblocksize == blocksize) {
+        return 0;
+    }
+    free(img->leaves);
+    img->mblocksize = 0;
+    if ((img->leaves = malloc((blocks + 1) * SHA256_SIZE)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return -1;
+    }
+    for (size_t b = 0; b < blocks; b++) {
+        size_t off = b * blocksize;
+        size_t n = ((img->size - off) < blocksize) ? (img->size - off) : blocksize;
+        merkle_leaf(img->data + off, n, img->leaves + b * SHA256_SIZE);
+    }
+    merkle_root(img->leaves, blocks, img->root);
+    img->mblocksize = blocksize;
+    return 0;
+}
+
+// Build the message carrying the block at off: NB_DATA_LZ4 if the
+// device agreed to it and the block compressed, else NB_DATA.  Returns
+// its length.
+static size_t make_block(nbmsg* msg, const nbimage* img, size_t off,
+                         const nbfileopts* opts, uint32_t flags) {
+    size_t b = off / opts->blocksize;
+    size_t n = img->size - off;
+
+    if (n > opts->blocksize) {
+        n = opts->blocksize;
+    }
+    msg->arg = off;
+    if ((flags & NB_FILE_LZ4) && (img->zblocksize == opts->blocksize) && img->zlen[b]) {
+        msg->cmd = NB_DATA_LZ4;
+        memcpy(msg->data, img->zdata + img->zoff[b], img->zlen[b]);
+        return sizeof(nbmsg) + img->zlen[b];
+    }
+    msg->cmd = NB_DATA;
+    memcpy(msg->data, img->data + off, n);
+    return sizeof(nbmsg) + n;
+}
+
+// Send the block at off, over the path it is striped to (which it is
+// always resent over too, so each path's blocks stay in order)
+static int send_block(nbdev* dev, nbmsg* msg, const nbimage* img, size_t off,
+                      const nbfileopts* opts, uint32_t flags, uint32_t* cookies) {
+    size_t len = make_block(msg, img, off, opts, flags);
     int r;
 
-    msg->magic = NB_MAGIC;
-    msg->cookie = cookie++;
+    msg->cookie = cookie++;
+    dev->path = (off / opts->blocksize) % dev->paths;
+    r = dev_send(dev, msg, len);
+    dev->path = 0;
+    if (r) {
+        return -1;
+    }
+    if (cookies[off / opts->blocksize]) {
+        dev->retransmits++;
+    }
+    cookies[off / opts->blocksize] = msg->cookie;
+    return 0;
+}
+
+// Build parity block index of group into msg, returning its length.
+// A short final block is coded as if zero padded to blocksize.
+static size_t make_parity(nbmsg* msg, const nbimage* img, const nbfileopts* opts,
+                          size_t group, unsigned index) {
+    static uint8_t pad[NB_BLOCK_MAX];
+    const uint8_t* blocks[NB_FEC_DATA_MAX];
+    const uint8_t* data = img->data;
+    size_t size = img->size;
+    size_t first = group * fec.data;
+    size_t count = (size - first * opts->blocksize + opts->blocksize - 1) / opts->blocksize;
+
+    if (count > fec.data) {
+        count = fec.data;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t off = (first + i) * opts->blocksize;
+        if ((size - off) < opts->blocksize) {
+            memset(pad, 0, opts->blocksize);
+            memcpy(pad, data + off, size - off);
+            blocks[i] = pad;
+        } else {
+            blocks[i] = data + off;
+        }
+    }
+    msg->cookie = cookie++;
+    msg->cmd = NB_PARITY;
+    msg->arg = (group << 8) | index;
+    fec_encode(msg->data, blocks, count, index, opts->blocksize);
+    return sizeof(nbmsg) + opts->blocksize;
+}
+
+// Nonzero if the block ending at offset next completes an FEC group
+static int group_end(size_t next, size_t size, const nbfileopts* opts) {
+    return (((next / opts->blocksize) % fec.data) == 0) || (next >= size);
+}
+
+// Nonzero if the device lacks any block of group, and so needs its
+// parity, wherever in the group that block is
+static int group_missing(size_t group, size_t size, const nbfileopts* opts,
+                         const uint8_t* have) {
+    size_t first = group * fec.data;
+    size_t blocks = (size + opts->blocksize - 1) / opts->blocksize;
+
+    if (have == NULL) {
+        return 1;
+    }
+    for (size_t n = first; (n < blocks) && (n < (first + fec.data)); n++) {
+        if (!have[n]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Resend the blocks an NB_NAK reports missing, except those whose last
+// transmission went out after the NB_DATA that prompted the NAK: those
+// are still in flight and the device just hasn't seen them yet.  Nor
+// can blocks striped to another path than the NAK came back over be
+// known lost (it may just be slower); that path's own NAKs cover them.
+// Returns the number of blocks resent.
+static int repair(nbdev* dev, nbmsg* msg, nbmsg* ack, size_t acklen,
+                  const nbimage* img, const nbfileopts* opts, uint32_t flags,
+                  uint32_t* cookies, size_t next) {
+    nbrange* range = (void*)ack->data;
+    size_t count = (acklen - sizeof(nbmsg)) / sizeof(nbrange);
+    uint32_t prompt = ack->cookie;
+    int resent = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t off = range[i].offset;
+        size_t end = off + range[i].length;
+        if ((off % opts->blocksize) || (end > next)) {
+            continue;
+        }
+        for (; off < end; off += opts->blocksize) {
+            if ((cookies[off / opts->blocksize] > prompt) ||
+                (((off / opts->blocksize) % dev->paths) != (size_t)dev->from)) {
+                continue;
+            }
+            if (send_block(dev, msg, img, off, opts, flags, cookies)) {
+                return -1;
+            }
+            resent++;
+        }
+    }
+    if (resent) {
+        fprintf(stderr, "R");
+    }
+    return resent;
+}
+
+// Additive increase: one block per round trip once past ssthresh,
+// doubling every round trip before that
+static void dev_grow(nbdev* dev, uint32_t blocks, uint32_t max) {
+    if (dev->cwnd < dev->ssthresh) {
+        dev->cwnd += blocks;
+    } else {
+        dev->acked += blocks;
+        while (dev->acked >= dev->cwnd) {
+            dev->acked -= dev->cwnd;
+            dev->cwnd++;
+        }
+    }
+    if (dev->cwnd > max) {
+        dev->cwnd = max;
+    }
+}
+
+// Multiplicative decrease, at most once per window of data
+static void dev_shrink(nbdev* dev, size_t base, size_t next) {
+    if (base < dev->recover) {
+        return;
+    }
+    dev->ssthresh = (dev->cwnd > 4) ? (dev->cwnd / 2) : 2;
+    dev->cwnd = dev->ssthresh;
+    dev->acked = 0;
+    dev->recover = next;
+}
+
+// Keep up to a congestion window of blocks in flight (never more than
+// the device allows), sliding forward as the device's cumulative acks
+// come back and filling the holes it reports in NB_NAKs.  On a timeout,
+// resend everything from the last acked offset (go-back-N).  With FEC,
+// each group of blocks is followed by its parity blocks.  Blocks marked
+// in have (if any) are already on the device and are skipped, as is the
+// parity of a group made up of nothing else.
+static int xfer_window(nbdev* dev, nbmsg* msg, nbmsg* ack, const nbimage* img,
+                       const nbfileopts* opts, uint32_t flags, const uint8_t* have) {
+    size_t size = img->size;
+    size_t base = 0, next = 0, count = 0;
+    uint32_t* cookies;
+    int r, status = -1;
+
+    if ((cookies = calloc(size / opts->blocksize + 1, sizeof(uint32_t))) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return -1;
+    }
+    dev->cwnd = (opts->window < CWND_INIT) ? opts->window : CWND_INIT;
+    dev->ssthresh = opts->window;
+    dev->acked = 0;
+    dev->recover = 0;
+
+    msg->magic = NB_MAGIC;
+    for (;;) {
+        while (have && (base < size) && have[base / opts->blocksize]) {
+            base += opts->blocksize;
+        }
+        if (base > size) {
+            base = size;
+        }
+        if (next < base) {
+            next = base;
+        }
+        if (base == size) {
+            break;
+        }
+        while ((next < size) && (next < (base + (size_t)dev->cwnd * opts->blocksize))) {
+            size_t group;
+            if (!(have && have[next / opts->blocksize]) &&
+                send_block(dev, msg, img, next, opts, flags, cookies)) {
+                goto done;
+            }
+            next += opts->blocksize;
+            if (!(flags & NB_FILE_FEC) || !group_end(next, size, opts)) {
+                continue;
+            }
+            group = (next / opts->blocksize - 1) / fec.data;
+            if (!group_missing(group, size, opts, have)) {
+                continue;
+            }
+            for (unsigned p = 0; p < fec.parity; p++) {
+                size_t len = make_parity(msg, img, opts, group, p);
+                dev->path = (group + p) % dev->paths;
+                r = dev_send(dev, msg, len);
+                dev->path = 0;
+                if (r) {
+                    goto done;
+                }
+            }
+        }
+        r = dev_recv(dev, ack);
+        if (r < 0) {
+            goto done;
+        }
+        if (r == 0) {
+            if (dev_silent(dev)) {
+                goto done;
+            }
+            dev_shrink(dev, base, next);
+            dev->cwnd = 1;
+            next = base;
+            continue;
+        }
+        if (ack->cmd == NB_NAK) {
+            r = repair(dev, msg, ack, r, img, opts, flags, cookies, next);
+            if (r < 0) {
+                goto done;
+            }
+            if (r > 0) {
+                dev_shrink(dev, base, next);
+            }
+        } else if (ack->cmd != NB_ACK) {
+            fprintf(stderr, "\n%s: device error %08x\n", appname, ack->cmd);
+            goto done;
+        }
+        if ((ack->arg <= base) || (ack->arg > size)) {
+            continue;
+        }
+        count += ack->arg - base;
+        while (count >= (32 * 1024)) {
+            count -= 32 * 1024;
+            fprintf(stderr, "#");
+        }
+        dev_grow(dev, (ack->arg - base + opts->blocksize - 1) / opts->blocksize,
+                 opts->window);
+        base = ack->arg;
+    }
+    status = 0;
+done:
+    free(cookies);
+    return status;
+}
+
+static int dev_path(nbdev* dev, struct sockaddr_in6* addr);
+
+static nbdev* dev_open(struct sockaddr_in6* addr) {
+    nbdev* dev;
+
+    if ((dev = calloc(1, sizeof(nbdev))) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return NULL;
+    }
+    dev->rto = RTO_INIT;
+    dev->heard = now_us();
+    if (dev_path(dev, addr)) {
+        free(dev);
+        return NULL;
+    }
+    return dev;
+}
+
+// Add a path to the device, through another of its addresses
+static int dev_path(nbdev* dev, struct sockaddr_in6* addr) {
+    char tmp[INET6_ADDRSTRLEN];
+    int s;
+
+    if (dev->paths == PATHS_MAX) {
+        return -1;
+    }
+    if ((s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        fprintf(stderr, "%s: cannot create socket %d\n", appname, errno);
+        return -1;
+    }
+    if (connect(s, (void*)addr, sizeof(*addr)) < 0) {
+        fprintf(stderr, "%s: cannot connect to [%s]%d\n", appname,
+                inet_ntop(AF_INET6, &addr->sin6_addr, tmp, sizeof(tmp)),
+                ntohs(addr->sin6_port));
+        close(s);
+        return -1;
+    }
+    dev->s[dev->paths++] = s;
+    return 0;
+}
+
+static void dev_close(nbdev* dev) {
+    if (dev) {
+        for (int i = 0; i < dev->paths; i++) {
+            close(dev->s[i]);
+        }
+        free(dev);
+    }
+}
+
+// Offer the device the file with the given NB_SEND_FILE options (and
+// the group to join, for NB_FILE_MCAST).  On success the options the
+// device agreed to are in ack->arg and, if windowed, *opts.
+static int send_file(nbdev* dev, nbmsg* msg, nbmsg* ack, nbimage* img,
+                     uint32_t flags, const struct in6_addr* group, nbfileopts* opts) {
+    size_t len;
+    int r;
+
+    // the tree of an empty file has no root
+    if ((flags & NB_FILE_MERKLE) && ((img->size == 0) || image_merkle(img, blocksize))) {
+        flags &= ~NB_FILE_MERKLE;
+    }
+    msg->cmd = NB_SEND_FILE;
+    msg->arg = flags;
+    strcpy((void*)msg->data, "kernel.bin");
+    len = sizeof(nbmsg) + sizeof("kernel.bin");
+    if (flags & NB_FILE_WINDOW) {
+        opts->size = img->size;
+        opts->blocksize = blocksize;
+        opts->window = window;
+        memcpy(msg->data + sizeof("kernel.bin"), opts, sizeof(*opts));
+        len += sizeof(*opts);
+    }
+    if (flags & NB_FILE_MCAST) {
+        memcpy((uint8_t*)msg + len, group, sizeof(nbmcastopts));
+        len += sizeof(nbmcastopts);
+    }
+    if (flags & NB_FILE_FEC) {
+        memcpy((uint8_t*)msg + len, &fec, sizeof(fec));
+        len += sizeof(fec);
+    }
+    if (flags & NB_FILE_MERKLE) {
+        memcpy((uint8_t*)msg + len, img->root, sizeof(nbmerkleopts));
+        len += sizeof(nbmerkleopts);
+    }
+    if ((r = io_ack(dev, msg, len, ack)) < 0) {
+        return -1;
+    }
+    if (ack->cmd != NB_ACK) {
+        fprintf(stderr, "\n%s: device error %08x\n", appname, ack->cmd);
+        return -1;
+    }
+    if (ack->arg & NB_FILE_WINDOW) {
+        // an ack too short to say what the device agreed to gets the
+        // transfer nothing it negotiates: stop-and-wait works with any
+        if (((size_t)r - sizeof(nbmsg)) < sizeof(*opts)) {
+            fprintf(stderr, "%s: short NB_SEND_FILE ack, not windowing\n", appname);
+            ack->arg = 0;
+            return 0;
+        }
+        memcpy(opts, ack->data, sizeof(*opts));
+    }
+    return 0;
+}
+
+// NB_SEND_FILE options to ask for, for a transfer to one device
+static uint32_t file_flags(void) {
+    if (window == 0) {
+        return 0;
+    }
+    return NB_FILE_WINDOW | (fec.parity ? NB_FILE_FEC : 0) | (compress ? NB_FILE_LZ4 : 0) |
+           (delta ? NB_FILE_DELTA : 0) | (merkle ? NB_FILE_MERKLE : 0);
+}
+
+// Send the leaves of the Merkle tree (NB_LEAVES), which the device
+// checks against the root it was given before it takes any blocks.  If
+// they don't match (one was damaged on the way), it starts over.
+static int send_leaves(nbdev* dev, nbmsg* msg, nbmsg* ack, const nbimage* img) {
+    size_t blocks = (img->size + img->mblocksize - 1) / img->mblocksize;
+    size_t per = NB_BLOCK_MTU / SHA256_SIZE;
+
+    for (int tries = 0; tries < 3; tries++) {
+        for (size_t b = 0; b < blocks; b += per) {
+            size_t n = ((blocks - b) < per) ? (blocks - b) : per;
+            msg->cmd = NB_LEAVES;
+            msg->arg = b;
+            memcpy(msg->data, img->leaves + b * SHA256_SIZE, n * SHA256_SIZE);
+            if (io_ack(dev, msg, sizeof(nbmsg) + n * SHA256_SIZE, ack) < 0) {
+                return -1;
+            }
+            if (ack->cmd == NB_ERROR_BAD_FILE) {
+                break;
+            }
+            if (ack->cmd != NB_ACK) {
+                fprintf(stderr, "\n%s: device error %08x\n", appname, ack->cmd);
+                return -1;
+            }
+            if ((b + n) == blocks) {
+                return 0;
+            }
+        }
+        fprintf(stderr, "V");
+    }
+    fprintf(stderr, "\n%s: device cannot check the Merkle tree\n", appname);
+    return -1;
+}
+
+// Fetch the hashes of the device's base (NB_HASHES) into a new array,
+// with their blocksize and the base's size in *info.  Returns NULL on
+// error.
+static nbhash* delta_hashes(nbdev* dev, nbmsg* msg, nbmsg* ack, nbhashes* info) {
+    nbhashes* h = (void*)ack->data;
+    nbhash* hash = NULL;
+    size_t total = 0, n = 0;
+    int r;
+
+    memset(info, 0, sizeof(*info));
+    msg->cmd = NB_HASHES;
+    for (;;) {
+        msg->arg = n;
+        if ((r = io_ack(dev, msg, sizeof(nbmsg), ack)) < 0) {
+            goto fail;
+        }
+        if ((ack->cmd != NB_ACK) ||
+            (r < (sizeof(nbmsg) + sizeof(nbhashes))) || (h->count > NB_HASH_MAX) ||
+            (r < (sizeof(nbmsg) + sizeof(nbhashes) + h->count * sizeof(nbhash))) ||
+            (h->blocksize == 0) || (h->size == 0)) {
+            fprintf(stderr, "\n%s: bad hashes from device\n", appname);
+            goto fail;
+        }
+        if (hash == NULL) {
+            *info = *h;
+            total = (h->size + h->blocksize - 1) / h->blocksize;
+            if ((hash = calloc(total, sizeof(nbhash))) == NULL) {
+                fprintf(stderr, "%s: out of memory\n", appname);
+                return NULL;
+            }
+        }
+        if ((h->blocksize != info->blocksize) || (h->size != info->size) ||
+            (h->count == 0) || (h->count > (total - n))) {
+            fprintf(stderr, "\n%s: bad hashes from device\n", appname);
+            goto fail;
+        }
+        memcpy(hash + n, h + 1, h->count * sizeof(nbhash));
+        n += h->count;
+        if (n == total) {
+            return hash;
+        }
+    }
+fail:
+    free(hash);
+    return NULL;
+}
+
+typedef struct {
+    nbcopy* op;
+    size_t count;
+    size_t max;
+} nbcopies;
+
+// The device's base has length bytes at from that the file has at to:
+// copy the whole blocks of the file among them, marking them in have
+static int delta_run(nbcopies* c, const nbfileopts* opts, uint8_t* have,
+                     size_t from, size_t to, size_t length) {
+    size_t bs = opts->blocksize;
+    size_t start = (to + bs - 1) / bs * bs;
+    size_t end = to + length;
+
+    if (end != opts->size) {
+        end = end / bs * bs;
+    }
+    if (start >= end) {
+        return 0;
+    }
+    if (c->count == c->max) {
+        nbcopy* op = realloc(c->op, (c->max * 2 + 64) * sizeof(nbcopy));
+        if (op == NULL) {
+            fprintf(stderr, "%s: out of memory\n", appname);
+            return -1;
+        }
+        c->op = op;
+        c->max = c->max * 2 + 64;
+    }
+    c->op[c->count].from = from + (start - to);
+    c->op[c->count].to = start;
+    c->op[c->count].length = end - start;
+    c->count++;
+    for (size_t b = start / bs; (b * bs) < end; b++) {
+        have[b] = 1;
+    }
+    return 0;
+}
+
+// Look for the blocks of the device's base anywhere in the file, sliding
+// the weak checksum along it a byte at a time and confirming each hit
+// with the strong hash, and have the device copy (NB_COPY) every run of
+// whole transfer blocks they cover.  Returns which blocks the device
+// now has (one byte per block), or NULL on error.
+static uint8_t* delta_copy(nbdev* dev, nbmsg* msg, nbmsg* ack,
+                           const nbimage* img, const nbfileopts* opts) {
+    const uint8_t* data = img->data;
+    size_t size = img->size;
+    nbhashes info;
+    nbhash* hash = NULL;
+    int32_t* head = NULL;
+    int32_t* chain = NULL;
+    uint8_t* have = NULL;
+    nbcopies c = { NULL, 0, 0 };
+    size_t B, full, last, mask = 1;
+    size_t pos = 0, from = 0, to = 0, length = 0, copied = 0;
+    uint32_t a = 0, b = 0;
+    uint64_t t = now_us();
+    int rolling = 0, ok = 0;
+
+    if ((hash = delta_hashes(dev, msg, ack, &info)) == NULL) {
+        return NULL;
+    }
+    B = info.blocksize;
+    full = info.size / B;
+    last = (info.size + B - 1) / B - 1;
+    while (mask < (full * 2)) {
+        mask <<= 1;
+    }
+    head = malloc(mask * sizeof(int32_t));
+    chain = malloc((full + 1) * sizeof(int32_t));
+    have = calloc(size / opts->blocksize + 1, 1);
+    if ((head == NULL) || (chain == NULL) || (have == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        goto done;
+    }
+    mask--;
+    memset(head, 0xFF, (mask + 1) * sizeof(int32_t));
+    // earlier blocks are found first
+    for (size_t j = full; j-- > 0;) {
+        chain[j] = head[hash[j].weak & mask];
+        head[hash[j].weak & mask] = j;
+    }
+
+    while ((pos + B) <= size) {
+        uint32_t w;
+        uint64_t strong = 0;
+        int32_t j;
+
+        if (!rolling) {
+            w = delta_weak(data + pos, B);
+            a = w & 0xFFFF;
+            b = w >> 16;
+            rolling = 1;
+        }
+        w = a | (b << 16);
+        for (j = head[w & mask]; j >= 0; j = chain[j]) {
+            if (hash[j].weak != w) {
+                continue;
+            }
+            if (strong == 0) {
+                strong = delta_strong(data + pos, B);
+            }
+            if (hash[j].strong == strong) {
+                break;
+            }
+        }
+        if (j < 0) {
+            if ((pos + B) < size) {
+                DELTA_ROLL(a, b, data[pos], data[pos + B], B);
+            }
+            pos++;
+            continue;
+        }
+        // extend the run if this block follows on from it in both
+        if (length && ((from + length) == ((size_t)j * B)) && ((to + length) == pos)) {
+            length += B;
+        } else {
+            if (length && delta_run(&c, opts, have, from, to, length)) {
+                goto done;
+            }
+            from = (size_t)j * B;
+            to = pos;
+            length = B;
+        }
+        pos += B;
+        rolling = 0;
+    }
+    // the base's short last block can only be the file's end
+    if ((last == full) && ((size - pos) >= (info.size - full * B))) {
+        size_t n = info.size - full * B;
+        if ((hash[last].weak == delta_weak(data + size - n, n)) &&
+            (hash[last].strong == delta_strong(data + size - n, n))) {
+            if (length && ((from + length) == (full * B)) && ((to + length) == (size - n))) {
+                length += n;
+            } else {
+                if (length && delta_run(&c, opts, have, from, to, length)) {
+                    goto done;
+                }
+                from = full * B;
+                to = size - n;
+                length = n;
+            }
+        }
+    }
+    if (length && delta_run(&c, opts, have, from, to, length)) {
+        goto done;
+    }
+
+    msg->cmd = NB_COPY;
+    msg->arg = 0;
+    for (size_t i = 0; i < c.count;) {
+        size_t n = c.count - i;
+        if (n > (NB_BLOCK_MTU / sizeof(nbcopy))) {
+            n = NB_BLOCK_MTU / sizeof(nbcopy);
+        }
+        memcpy(msg->data, c.op + i, n * sizeof(nbcopy));
+        if (io(dev, msg, sizeof(nbmsg) + n * sizeof(nbcopy), ack)) {
+            goto done;
+        }
+        for (size_t k = i; k < (i + n); k++) {
+            copied += c.op[k].length;
+        }
+        i += n;
+    }
+    fprintf(stderr, "%s: delta: %zu of %zu bytes copied from the device's last file "
+            "(%zu hashes of %zu bytes, %zu copies) in %.3fs\n", appname, copied, size,
+            last + 1, B, c.count, (now_us() - t) / 1e6);
+    ok = 1;
+done:
+    free(hash);
+    free(head);
+    free(chain);
+    free(c.op);
+    if (!ok) {
+        free(have);
+        return NULL;
+    }
+    return have;
+}
+
+// Send the whole file to a single device, in a windowed transfer if
+// it agreed to one (per ack) or else a block at a time.  With a delta,
+// the blocks it could copy from its last file aren't sent.
+static int send_data(nbdev* dev, nbmsg* msg, nbmsg* ack,
+                     nbimage* img, const nbfileopts* opts) {
+    const uint8_t* data = img->data;
+    size_t size = img->size;
+    uint32_t flags = ack->arg;
+    uint8_t* have = NULL;
+    size_t len, off;
+    int r;
+    int count = 0;
+
+    if (flags & NB_FILE_WINDOW) {
+        // without the compressed blocks, everything goes as NB_DATA
+        if (flags & NB_FILE_LZ4) {
+            image_compress(img, opts->blocksize);
+        }
+        if ((flags & NB_FILE_MERKLE) && send_leaves(dev, msg, ack, img)) {
+            return -1;
+        }
+        if ((flags & NB_FILE_DELTA) && ((have = delta_copy(dev, msg, ack, img, opts)) == NULL)) {
+            return -1;
+        }
+        r = xfer_window(dev, msg, ack, img, opts, flags, have);
+        free(have);
+        return r;
+    }
+
+    // a device without windowed transfers cannot reassemble fragments
+    len = (blocksize > NB_BLOCK_MTU) ? NB_BLOCK_MTU : blocksize;
+    msg->cmd = NB_DATA;
+    for (off = 0; off < size; off += r) {
+        r = (size - off) > len ? len : (size - off);
+        memcpy(msg->data, data + off, r);
+        count += r;
+        if (count >= (32 * 1024)) {
+            count = 0;
+            fprintf(stderr, "#");
+        }
+        msg->arg = off;
+        if (io(dev, msg, sizeof(nbmsg) + r, ack)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Have the device check the file it got against its SHA-256, so it only
+// keeps (caches) what arrived intact.  A device that predates NB_VERIFY
+// is taken at its word.
+static int verify(nbdev* dev, nbmsg* msg, nbmsg* ack, const nbimage* img) {
+    msg->cmd = NB_VERIFY;
+    msg->arg = 0;
+    memcpy(msg->data, img->digest, SHA256_SIZE);
+    if (io_ack(dev, msg, sizeof(nbmsg) + SHA256_SIZE, ack) < 0) {
+        return -1;
+    }
+    if (ack->cmd == NB_ERROR_BAD_FILE) {
+        fprintf(stderr, "\n%s: device reports '%s' corrupt\n", appname, img->fn);
+        return -1;
+    }
+    return 0;
+}
+
+static void boot(nbdev* dev, nbmsg* msg, nbmsg* ack) {
+    msg->cmd = NB_BOOT;
+    msg->arg = 0;
+    if (io(dev, msg, sizeof(nbmsg), ack)) {
+        fprintf(stderr, "\n%s: failed to send boot command\n", appname);
+    } else {
+        fprintf(stderr, "%s: sent boot command\n", appname);
+    }
+}
+
+// The value of key in a beacon (NUL terminated keys and values), or NULL
+static const char* beacon_value(const nbmsg* msg, size_t len, const char* key) {
+    const char* p = (const char*)msg->data;
+    const char* end = p + (len - sizeof(nbmsg));
+
+    while ((p < end) && *p) {
+        const char* value = memchr(p, 0, end - p);
+        const char* next;
+        if (value == NULL) {
+            break;
+        }
+        value++;
+        if ((next = memchr(value, 0, end - value)) == NULL) {
+            break;
+        }
+        if (!strcmp(p, key)) {
+            return value;
+        }
+        p = next + 1;
+    }
+    return NULL;
+}
+
+// If the device advertises that it has the file cached already, tell it
+// to boot that instead of sending the file again.  Returns nonzero if so.
+static int boot_cached(struct sockaddr_in6* addr, const nbmsg* beacon, size_t len,
+                       const char* fn) {
+    char msgbuf[sizeof(nbmsg) + 64];
+    char ackbuf[2048];
+    const char* hash = beacon_value(beacon, len, "kernel.bin.sha256");
+    nbimage* img;
+    nbdev* dev;
+
+    if ((hash == NULL) || ((img = image_load(fn)) == NULL) || strcmp(hash, img->hex)) {
+        return 0;
+    }
+    fprintf(stderr, "%s: device has '%s' cached\n", appname, fn);
+    if ((dev = dev_open(addr)) == NULL) {
+        return 0;
+    }
+    boot(dev, (void*)msgbuf, (void*)ackbuf);
+    dev_close(dev);
+    return 1;
+}
+
+// Send the file to the device at addrs (count of them, one per path it
+// has, the transfer striped across them)
+static void xfer(struct sockaddr_in6* addrs, int count, const char* fn) {
+    char msgbuf[sizeof(nbmsg) + NB_BLOCK_MAX];
+    char ackbuf[2048];
+    nbmsg* msg = (void*)msgbuf;
+    nbmsg* ack = (void*)ackbuf;
+    nbfileopts opts;
+    nbdev* dev = NULL;
+    nbimage* img;
+    uint64_t start;
+    size_t size, wire;
+
+    if ((img = image_load(fn)) == NULL) {
+        return;
+    }
+    size = img->size;
+    if ((dev = dev_open(addrs)) == NULL) {
+        goto done;
+    }
+    for (int i = 1; i < count; i++) {
+        dev_path(dev, addrs + i);
+    }
+    if (send_file(dev, msg, ack, img, file_flags(), NULL, &opts)) {
+        fprintf(stderr, "%s: failed to start transfer\n", appname);
+        goto done;
+    }
+
+    start = now_us();
+    wire = dev->wire;
+    if (send_data(dev, msg, ack, img, &opts)) {
+        fprintf(stderr, "\n%s: error: sending '%s'\n", appname, fn);
+        goto done;
+    }
+    start = now_us() - start;
+    fprintf(stderr, "\n%s: sent %zu bytes (%zu on the wire) in %.3fs (%.2f MB/s), "
+            "%zu retransmits, %zu timeouts\n", appname, size, dev->wire - wire,
+            start / 1e6, start ? (size / (double)start) : 0.0, dev->retransmits,
+            dev->timeouts);
+    fprintf(stderr, "%s: rtt %.3fms (+/- %.3fms), rto %.3fms, window %u\n",
+            appname, dev->srtt / 1e3, dev->rttvar / 1e3, dev->rto / 1e3, dev->cwnd);
+    for (int i = 0; (dev->paths > 1) && (i < dev->paths); i++) {
+        fprintf(stderr, "%s: path %d: %zu bytes on the wire\n", appname, i, dev->pwire[i]);
+    }
+    if (verify(dev, msg, ack, img)) {
+        goto done;
+    }
+    boot(dev, msg, ack);
+done:
+    dev_close(dev);
+}
+
+// Multicast sessions: the group NB_DATA is sent to, how long to wait
+// for more beacons after the first, and how fast to stream (bytes per
+// second, adjusted once per epoch: down by a quarter if devices report
+// more than an eighth of the blocks sent in it lost, else up by an
+// eighth, so a little random loss across many devices doesn't throttle
+// the stream but an overrun does)
+#define MCAST_GROUP "ff02::4e42"
+#define MCAST_MAX 64
+#define MCAST_GATHER 10000000
+#define MCAST_RATE_INIT (16 * 1000 * 1000)
+#define MCAST_RATE_MIN (1000 * 1000)
+#define MCAST_RATE_MAX (1000 * 1000 * 1000)
+#define MCAST_EPOCH 10000
+#define MCAST_BURST 8
+
+#define MEMBER_UNICAST 0 // declined the session, served on its own after
+#define MEMBER_ACTIVE 1
+#define MEMBER_DONE 2
+#define MEMBER_FAILED 3
+
+typedef struct {
+    struct sockaddr_in6 addr;
+    nbdev* dev;
+    int state;
+    uint64_t polled;   // when last sent NB_STATUS
+    uint64_t progress; // when its write pointer last advanced
+    size_t offset;     // its write pointer
+} nbmember;
+
+static nbmember* member_find(nbmember* mb, int count, struct sockaddr_in6* addr) {
+    for (int i = 0; i < count; i++) {
+        if (!memcmp(&mb[i].addr.sin6_addr, &addr->sin6_addr, sizeof(addr->sin6_addr))) {
+            return mb + i;
+        }
+    }
+    return NULL;
+}
 
+static int group_send(int g, struct sockaddr_in6* addr, nbmsg* msg, size_t len) {
     for (;;) {
-        r = write(s, msg, len);
-        if (r < 0) {
-            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-                continue;
-            }
+        if (sendto(g, msg, len, 0, (void*)addr, sizeof(*addr)) >= 0) {
+            return 0;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != ENOBUFS)) {
             fprintf(stderr, "\n%s: socket write error %d\n", appname, errno);
             return -1;
         }
-    again:
-        r = read(s, ack, 2048);
-        if (r < 0) {
-            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-                retries--;
-                if (retries > 0) {
-                    fprintf(stderr, "T");
-                    continue;
+    }
+}
+
+// Stream the file to every active member at once, multicasting each
+// block (and with FEC, each group's parity) to the group and later the
+// union of the blocks members report missing.  Once all is sent, poll
+// each member with NB_STATUS until it has the whole file, or has been
+// silent for too long.
+static int xfer_group(int g, struct sockaddr_in6* group, nbmember* mb, int count,
+                      nbmsg* msg, nbmsg* ack, const nbimage* img, const nbfileopts* opts,
+                      uint32_t flags, size_t* repaired, size_t* wire) {
+    size_t size = img->size;
+    size_t blocks = (size + opts->blocksize - 1) / opts->blocksize;
+    size_t next = 0, needed = 0, scan = 0, pgroup = 0;
+    unsigned pending = 0; // parity blocks of pgroup still to send
+    uint64_t rate = MCAST_RATE_INIT, credit = 0, now, last, epoch, tail = 0;
+    uint32_t* cookies;
+    uint8_t* need;
+    size_t sent = 0, lost = 0;
+    int active = 0, status = -1;
+    size_t bytes = 0;
+
+    cookies = calloc(blocks + 1, sizeof(uint32_t));
+    need = calloc(blocks + 1, 1);
+    if ((cookies == NULL) || (need == NULL)) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        goto done;
+    }
+    for (int i = 0; i < count; i++) {
+        if (mb[i].state == MEMBER_ACTIVE) {
+            active++;
+        }
+    }
+
+    msg->magic = NB_MAGIC;
+    last = epoch = now_us();
+    while (active) {
+        struct pollfd pfd;
+        uint64_t wait;
+
+        now = now_us();
+        credit += (now - last) * rate / 1000000;
+        if (credit > (MCAST_BURST * opts->blocksize)) {
+            credit = MCAST_BURST * opts->blocksize;
+        }
+        last = now;
+        if ((now - epoch) >= MCAST_EPOCH) {
+            if ((lost * 8) > sent) {
+                rate -= rate / 4;
+                if (rate < MCAST_RATE_MIN) {
+                    rate = MCAST_RATE_MIN;
                 }
-                fprintf(stderr, "\n%s: timed out\n", appname);
-            } else {
-                fprintf(stderr, "\n%s: socket read error %d\n", appname, errno);
+            } else if (sent && (rate < MCAST_RATE_MAX)) {
+                rate += rate / 8;
             }
-            return -1;
+            sent = lost = 0;
+            epoch = now;
         }
-        if (r < sizeof(nbmsg)) {
-            fprintf(stderr, "Z");
-            goto again;
-        }
-        if (ack->magic != NB_MAGIC) {
-            fprintf(stderr, "?");
-            goto again;
+
+        if (needed || pending || (next < blocks)) {
+            if (credit >= opts->blocksize) {
+                size_t b, n;
+                if (!needed && pending) {
+                    n = make_parity(msg, img, opts, pgroup, fec.parity - pending);
+                    if (group_send(g, group, msg, n)) {
+                        goto done;
+                    }
+                    *wire += n;
+                    pending--;
+                    credit -= opts->blocksize;
+                    continue;
+                }
+                if (needed) {
+                    while (!need[scan]) {
+                        scan++;
+                    }
+                    b = scan;
+                    need[b] = 0;
+                    needed--;
+                    (*repaired)++;
+                } else {
+                    b = next++;
+                    if ((flags & NB_FILE_FEC) && group_end(next * opts->blocksize, size, opts)) {
+                        pgroup = b / fec.data;
+                        pending = fec.parity;
+                    }
+                }
+                n = make_block(msg, img, b * opts->blocksize, opts, flags);
+                msg->cookie = cookie++;
+                if (group_send(g, group, msg, n)) {
+                    goto done;
+                }
+                *wire += n;
+                cookies[b] = msg->cookie;
+                // pace by what goes on the wire
+                credit -= n - sizeof(nbmsg);
+                sent++;
+                bytes += n - sizeof(nbmsg);
+                while (bytes >= (32 * 1024)) {
+                    bytes -= 32 * 1024;
+                    fprintf(stderr, "#");
+                }
+                continue;
+            }
+            wait = (opts->blocksize - credit) * 1000000 / rate;
+        } else {
+            // everything has been sent once: find out who still misses what
+            if (tail == 0) {
+                tail = now;
+                for (int i = 0; i < count; i++) {
+                    mb[i].dev->heard = now;
+                    mb[i].progress = now;
+                }
+            }
+            wait = RTO_MAX;
+            for (int i = 0; i < count; i++) {
+                nbdev* dev = mb[i].dev;
+                if (mb[i].state != MEMBER_ACTIVE) {
+                    continue;
+                }
+                if ((now - dev->heard) >= DEVICE_TIMEOUT) {
+                    fprintf(stderr, "\n%s: device %d timed out\n", appname, i);
+                    mb[i].state = MEMBER_FAILED;
+                    active--;
+                    continue;
+                }
+                if ((now - mb[i].progress) >= DEVICE_TIMEOUT) {
+                    // answering, but the group's traffic isn't reaching it
+                    fprintf(stderr, "\n%s: device %d stalled, falling back to unicast\n",
+                            appname, i);
+                    mb[i].state = MEMBER_UNICAST;
+                    active--;
+                    continue;
+                }
+                if ((now - mb[i].polled) >= dev->rto) {
+                    nbmsg poll;
+                    if (mb[i].polled && (dev->heard < mb[i].polled)) {
+                        dev->timeouts++;
+                        dev->rto = (dev->rto * 2 > RTO_MAX) ? RTO_MAX : dev->rto * 2;
+                    }
+                    poll.magic = NB_MAGIC;
+                    poll.cookie = cookie++;
+                    poll.cmd = NB_STATUS;
+                    poll.arg = 0;
+                    if (group_send(g, &mb[i].addr, &poll, sizeof(poll))) {
+                        goto done;
+                    }
+                    dev->sent[poll.cookie % SENT_RING].cookie = poll.cookie;
+                    dev->sent[poll.cookie % SENT_RING].when = now;
+                    mb[i].polled = now;
+                }
+                if ((mb[i].polled + dev->rto - now) < wait) {
+                    wait = mb[i].polled + dev->rto - now;
+                }
+            }
+            if (active == 0) {
+                break;
+            }
         }
-        if (ack->cookie != msg->cookie) {
-            fprintf(stderr, "C");
-            goto again;
+
+        pfd.fd = g;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, (wait + 999) / 1000) <= 0) {
+            continue;
         }
-        if (ack->arg != msg->arg) {
-            fprintf(stderr, "A");
-            goto again;
+        for (;;) {
+            struct sockaddr_in6 ra;
+            socklen_t rlen = sizeof(ra);
+            nbmember* m;
+            nbrange* range = (void*)ack->data;
+            size_t ranges;
+            int r = recvfrom(g, ack, 2048, MSG_DONTWAIT, (void*)&ra, &rlen);
+            if (r < 0) {
+                break;
+            }
+            if ((r < sizeof(nbmsg)) || (ack->magic != NB_MAGIC)) {
+                continue;
+            }
+            if (((m = member_find(mb, count, &ra)) == NULL) || (m->state != MEMBER_ACTIVE)) {
+                continue;
+            }
+            m->dev->heard = now_us();
+            dev_sample(m->dev, ack->cookie);
+            if (ack->arg > m->offset) {
+                m->offset = ack->arg;
+                m->progress = m->dev->heard;
+            }
+            if (ack->cmd == NB_ACK) {
+                if (ack->arg == size) {
+                    m->state = MEMBER_DONE;
+                    active--;
+                }
+                continue;
+            }
+            if (ack->cmd != NB_NAK) {
+                fprintf(stderr, "\n%s: device error %08x\n", appname, ack->cmd);
+                m->state = MEMBER_FAILED;
+                active--;
+                continue;
+            }
+            // queue the reported holes, except blocks sent again since
+            // the message that prompted the report
+            ranges = (r - sizeof(nbmsg)) / sizeof(nbrange);
+            for (size_t i = 0; i < ranges; i++) {
+                size_t b = range[i].offset / opts->blocksize;
+                size_t end = (range[i].offset + range[i].length + opts->blocksize - 1) /
+                             opts->blocksize;
+                if (range[i].offset % opts->blocksize) {
+                    continue;
+                }
+                for (; (b < end) && (b < next); b++) {
+                    if (need[b] || (cookies[b] > ack->cookie)) {
+                        continue;
+                    }
+                    need[b] = 1;
+                    needed++;
+                    if (b < scan) {
+                        scan = b;
+                    }
+                    lost++;
+                }
+            }
         }
-        if (ack->cmd == NB_ACK)
-            return 0;
-        fprintf(stderr, "?");
-        goto again;
     }
+    status = 0;
+done:
+    free(cookies);
+    free(need);
+    return status;
 }
 
-static void xfer(struct sockaddr_in6* addr, const char* fn) {
-    char msgbuf[2048];
+// Boot a rack at once: offer every device the file in a multicast
+// session, stream it to all that join, then serve any that declined one
+// at a time and boot everyone who got the whole image.
+static void xfer_mcast(struct sockaddr_in6* addrs, int count, const char* fn) {
+    char msgbuf[sizeof(nbmsg) + NB_BLOCK_MAX];
     char ackbuf[2048];
-    char tmp[INET6_ADDRSTRLEN];
-    struct timeval tv;
     nbmsg* msg = (void*)msgbuf;
     nbmsg* ack = (void*)ackbuf;
-    FILE* fp;
-    int s, r;
-    int count = 0;
+    nbmember mb[MCAST_MAX];
+    nbfileopts opts, agreed;
+    uint32_t agreed_flags = 0;
+    struct sockaddr_in6 group;
+    unsigned ifindex;
+    size_t size, repaired = 0, wire = 0;
+    nbimage* img;
+    uint64_t start;
+    int g = -1, joined = 0, done = 0;
 
-    if ((fp = fopen(fn, "rb")) == NULL) {
+    if ((img = image_load(fn)) == NULL) {
         return;
     }
-    if ((s = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
-        fprintf(stderr, "%s: cannot create socket %d\n", appname, errno);
+    size = img->size;
+    memset(mb, 0, sizeof(mb));
+    memset(&agreed, 0, sizeof(agreed));
+    memset(&group, 0, sizeof(group));
+    group.sin6_family = AF_INET6;
+    group.sin6_port = htons(NB_SERVER_PORT);
+    group.sin6_scope_id = ifindex = addrs[0].sin6_scope_id;
+    inet_pton(AF_INET6, MCAST_GROUP, &group.sin6_addr);
+    if (((g = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) ||
+        setsockopt(g, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex))) {
+        fprintf(stderr, "%s: cannot create multicast socket %d\n", appname, errno);
         goto done;
     }
-    tv.tv_sec = 0;
-    tv.tv_usec = 250 * 1000;
-    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    if (connect(s, (void*)addr, sizeof(*addr)) < 0) {
-        fprintf(stderr, "%s: cannot connect to [%s]%d\n", appname,
-                inet_ntop(AF_INET6, &addr->sin6_addr, tmp, sizeof(tmp)),
-                ntohs(addr->sin6_port));
-        goto done;
+
+    for (int i = 0; i < count; i++) {
+        mb[i].addr = addrs[i];
+        mb[i].state = MEMBER_FAILED;
+        if ((mb[i].dev = dev_open(addrs + i)) == NULL) {
+            continue;
+        }
+        if (send_file(mb[i].dev, msg, ack, img,
+                      (file_flags() & ~NB_FILE_DELTA) | NB_FILE_WINDOW | NB_FILE_MCAST,
+                      &group.sin6_addr, &opts)) {
+            fprintf(stderr, "%s: device %d: failed to start transfer\n", appname, i);
+            continue;
+        }
+        mb[i].state = MEMBER_UNICAST;
+        if (!(ack->arg & NB_FILE_MCAST)) {
+            continue;
+        }
+        // everyone in the group has to take the same blocks
+        if (joined && ((opts.blocksize != agreed.blocksize) ||
+                       ((ack->arg & (NB_FILE_FEC | NB_FILE_LZ4)) != agreed_flags))) {
+            continue;
+        }
+        agreed = opts;
+        agreed_flags = ack->arg & (NB_FILE_FEC | NB_FILE_LZ4);
+        // each device checks its blocks on its own, so this one needn't agree
+        if ((ack->arg & NB_FILE_MERKLE) && send_leaves(mb[i].dev, msg, ack, img)) {
+            fprintf(stderr, "%s: device %d: failed to send Merkle tree\n", appname, i);
+            mb[i].state = MEMBER_FAILED;
+            continue;
+        }
+        mb[i].state = MEMBER_ACTIVE;
+        joined++;
     }
+    fprintf(stderr, "%s: %d of %d devices joined [%s]\n", appname, joined, count, MCAST_GROUP);
 
-    msg->cmd = NB_SEND_FILE;
-    msg->arg = 0;
-    strcpy((void*)msg->data, "kernel.bin");
-    if (io(s, msg, sizeof(nbmsg) + sizeof("kernel.bin"), ack)) {
-        fprintf(stderr, "%s: failed to start transfer\n", appname);
-        goto done;
+    if (joined && (agreed_flags & NB_FILE_LZ4)) {
+        image_compress(img, agreed.blocksize);
+    }
+    start = now_us();
+    if (joined) {
+        if (xfer_group(g, &group, mb, count, msg, ack, img, &agreed,
+                       agreed_flags, &repaired, &wire)) {
+            fprintf(stderr, "\n%s: error: sending '%s'\n", appname, fn);
+            goto done;
+        }
+        start = now_us() - start;
+        fprintf(stderr, "\n%s: sent %zu bytes (%zu on the wire) to %d devices in %.3fs "
+                "(%.2f MB/s), %zu blocks repaired\n", appname, size, wire, joined,
+                start / 1e6, start ? (size / (double)start) : 0.0, repaired);
+    }
+    for (int i = 0; i < count; i++) {
+        if (mb[i].state != MEMBER_UNICAST) {
+            continue;
+        }
+        fprintf(stderr, "%s: device %d: sending '%s'...\n", appname, i, fn);
+        if (send_file(mb[i].dev, msg, ack, img, file_flags(),
+                      NULL, &opts) ||
+            send_data(mb[i].dev, msg, ack, img, &opts)) {
+            fprintf(stderr, "\n%s: device %d: error: sending '%s'\n", appname, i, fn);
+            mb[i].state = MEMBER_FAILED;
+            continue;
+        }
+        mb[i].state = MEMBER_DONE;
+    }
+    for (int i = 0; i < count; i++) {
+        if ((mb[i].state == MEMBER_DONE) && (verify(mb[i].dev, msg, ack, img) == 0)) {
+            boot(mb[i].dev, msg, ack);
+            done++;
+        }
+    }
+    fprintf(stderr, "%s: %d of %d devices booted\n", appname, done, count);
+done:
+    for (int i = 0; i < count; i++) {
+        dev_close(mb[i].dev);
     }
+    if (g >= 0)
+        close(g);
+}
 
-    msg->cmd = NB_DATA;
-    msg->arg = 0;
-    do {
-        r = fread(msg->data, 1, 1024, fp);
-        if (r == 0) {
-            if (ferror(fp)) {
-                fprintf(stderr, "\n%s: error: reading '%s'\n", appname, fn);
-                goto done;
-            }
+// Collect the beacons of up to group_max devices (starting with the one
+// just heard from, whose "node" is node, if it has one), waiting at most
+// MCAST_GATHER for the rest.  A device that beacons over several paths
+// is known by its "node", and counted once; one without is known by
+// its address.
+static int gather(int s, struct sockaddr_in6* addrs, const char* node) {
+    char tmp[INET6_ADDRSTRLEN];
+    char nodes[MCAST_MAX][64]; // "" for a device without one
+    uint64_t until = now_us() + MCAST_GATHER;
+    int count = 1;
+
+    snprintf(nodes[0], sizeof(nodes[0]), "%s", node ? node : "");
+
+    while (count < group_max) {
+        struct sockaddr_in6 ra;
+        socklen_t rlen = sizeof(ra);
+        struct pollfd pfd;
+        char buf[4096];
+        nbmsg* msg = (void*)buf;
+        const char* value;
+        uint64_t now = now_us();
+        int r, i;
+
+        if (now >= until) {
             break;
         }
-        count += r;
-        if (count >= (32 * 1024)) {
-            count = 0;
-            fprintf(stderr, "#");
+        pfd.fd = s;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, (until - now + 999) / 1000) <= 0) {
+            continue;
         }
-        if (io(s, msg, sizeof(nbmsg) + r, ack)) {
-            fprintf(stderr, "\n%s: error: sending '%s'\n", appname, fn);
-            goto done;
+        r = recvfrom(s, buf, sizeof(buf), 0, (void*)&ra, &rlen);
+        if ((r < (int)sizeof(nbmsg)) || (msg->magic != NB_MAGIC) || (msg->cmd != NB_ADVERTISE)) {
+            continue;
+        }
+        if ((ra.sin6_addr.s6_addr[0] != 0xFE) || (ra.sin6_addr.s6_addr[1] != 0x80)) {
+            continue;
+        }
+        if ((value = beacon_value(msg, r, "node")) == NULL) {
+            value = "";
+        }
+        for (i = 0; i < count; i++) {
+            if (*value && nodes[i][0]) {
+                if (!strncmp(nodes[i], value, sizeof(nodes[i]) - 1)) {
+                    break;
+                }
+            } else if (!memcmp(&addrs[i].sin6_addr, &ra.sin6_addr, sizeof(ra.sin6_addr))) {
+                break;
+            }
+        }
+        if (i < count) {
+            continue;
         }
-        msg->arg += r;
-    } while (r != 0);
+        fprintf(stderr, "%s: got beacon from [%s]%d\n", appname,
+                inet_ntop(AF_INET6, &ra.sin6_addr, tmp, sizeof(tmp)),
+                ntohs(ra.sin6_port));
+        snprintf(nodes[count], sizeof(nodes[count]), "%s", value);
+        addrs[count++] = ra;
+    }
+    return count;
+}
 
-    msg->cmd = NB_BOOT;
-    msg->arg = 0;
-    if (io(s, msg, sizeof(nbmsg), ack)) {
-        fprintf(stderr, "\n%s: failed to send boot command\n", appname);
-    } else {
-        fprintf(stderr, "\n%s: sent boot command\n", appname);
+// Collect the beacons the device just heard from sends over its other
+// paths (with the same "node"), up to paths of them in all, waiting at
+// most PATHS_GATHER for them
+static int gather_paths(int s, struct sockaddr_in6* addrs, const char* node, int paths) {
+    char tmp[INET6_ADDRSTRLEN];
+    uint64_t until = now_us() + PATHS_GATHER;
+    int count = 1;
+
+    if (paths > PATHS_MAX) {
+        paths = PATHS_MAX;
     }
-done:
-    if (s >= 0)
-        close(s);
-    if (fp != NULL)
-        fclose(fp);
+    while (count < paths) {
+        struct sockaddr_in6 ra;
+        socklen_t rlen = sizeof(ra);
+        struct pollfd pfd;
+        char buf[4096];
+        nbmsg* msg = (void*)buf;
+        const char* value;
+        uint64_t now = now_us();
+        int r, i;
+
+        if (now >= until) {
+            break;
+        }
+        pfd.fd = s;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, (until - now + 999) / 1000) <= 0) {
+            continue;
+        }
+        r = recvfrom(s, buf, sizeof(buf), 0, (void*)&ra, &rlen);
+        if ((r < (int)sizeof(nbmsg)) || (msg->magic != NB_MAGIC) || (msg->cmd != NB_ADVERTISE)) {
+            continue;
+        }
+        if ((ra.sin6_addr.s6_addr[0] != 0xFE) || (ra.sin6_addr.s6_addr[1] != 0x80)) {
+            continue;
+        }
+        if (((value = beacon_value(msg, r, "node")) == NULL) || strcmp(value, node)) {
+            continue;
+        }
+        for (i = 0; i < count; i++) {
+            if (!memcmp(&addrs[i].sin6_addr, &ra.sin6_addr, sizeof(ra.sin6_addr))) {
+                break;
+            }
+        }
+        if (i < count) {
+            continue;
+        }
+        fprintf(stderr, "%s: another path, through [%s]%d\n", appname,
+                inet_ntop(AF_INET6, &ra.sin6_addr, tmp, sizeof(tmp)),
+                ntohs(ra.sin6_port));
+        addrs[count++] = ra;
+    }
+    return count;
 }
 
 void usage(void) {
     fprintf(stderr,
             "usage:   %s [ <option> ]* <filename>\n"
             "\n"
-            "options: -1  only boot once, then exit\n",
-            appname);
+            "options: -1      only boot once, then exit\n"
+            "         -w <n>  keep up to n blocks in flight (0 = stop-and-wait)\n"
+            "         -b <n>  send n byte blocks (%d-%d, default %d)\n"
+            "         -m <n>  multicast to up to n devices at once (2-%d)\n"
+            "         -f <m>/<k>  send m FEC parity blocks after every k blocks\n"
+            "                 (m 1-%d, k 1-%d)\n"
+            "         -z      send LZ4 compressed blocks\n"
+            "         -d      send only what changed since the device's last file\n"
+            "         -V      don't have the device check each block as it lands\n"
+            "         -P      send over only the path the device's beacon came from\n",
+            appname, NB_BLOCK_MIN, NB_BLOCK_MAX, NB_BLOCK_MTU, MCAST_MAX,
+            NB_FEC_PARITY_MAX, NB_FEC_DATA_MAX);
     exit(1);
 }
 
@@ -184,6 +1805,7 @@ int main(int argc, char** argv) {
     int once = 0;
 
     appname = argv[0];
+    fec_init();
 
     while (argc > 1) {
         if (argv[1][0] != '-') {
@@ -192,6 +1814,48 @@ int main(int argc, char** argv) {
             fn = argv[1];
         } else if (!strcmp(argv[1], "-1")) {
             once = 1;
+        } else if (!strcmp(argv[1], "-w")) {
+            if (argc < 3)
+                usage();
+            window = atoi(argv[2]);
+            if ((window < 0) || (window > NB_WINDOW_MAX))
+                usage();
+            argc--;
+            argv++;
+        } else if (!strcmp(argv[1], "-b")) {
+            if (argc < 3)
+                usage();
+            blocksize = atoi(argv[2]);
+            if ((blocksize < NB_BLOCK_MIN) || (blocksize > NB_BLOCK_MAX))
+                usage();
+            argc--;
+            argv++;
+        } else if (!strcmp(argv[1], "-f")) {
+            unsigned m, k;
+            if ((argc < 3) || (sscanf(argv[2], "%u/%u", &m, &k) != 2))
+                usage();
+            if ((m < 1) || (m > NB_FEC_PARITY_MAX) || (k < 1) || (k > NB_FEC_DATA_MAX))
+                usage();
+            fec.parity = m;
+            fec.data = k;
+            argc--;
+            argv++;
+        } else if (!strcmp(argv[1], "-z")) {
+            compress = 1;
+        } else if (!strcmp(argv[1], "-d")) {
+            delta = 1;
+        } else if (!strcmp(argv[1], "-V")) {
+            merkle = 0;
+        } else if (!strcmp(argv[1], "-P")) {
+            stripe = 0;
+        } else if (!strcmp(argv[1], "-m")) {
+            if (argc < 3)
+                usage();
+            group_max = atoi(argv[2]);
+            if ((group_max < 2) || (group_max > MCAST_MAX))
+                usage();
+            argc--;
+            argv++;
         } else {
             usage();
         }
@@ -201,6 +1865,14 @@ int main(int argc, char** argv) {
     if (fn == NULL) {
         usage();
     }
+    // compress ahead of the first transfer (which will check it is still
+    // the same file)
+    if (compress && window && image_load(fn)) {
+        image_compress(&image, blocksize);
+    }
+    if (merkle && window && image_load(fn) && image.size) {
+        image_merkle(&image, blocksize);
+    }
 
     memset(&addr, 0, sizeof(addr));
     addr.sin6_family = AF_INET6;
@@ -246,8 +1918,29 @@ int main(int argc, char** argv) {
         fprintf(stderr, "%s: got beacon from [%s]%d\n", appname,
                 inet_ntop(AF_INET6, &ra.sin6_addr, tmp, sizeof(tmp)),
                 ntohs(ra.sin6_port));
-        fprintf(stderr, "%s: sending '%s'...\n", appname, fn);
-        xfer(&ra, fn);
+        if (group_max > 1) {
+            struct sockaddr_in6 addrs[MCAST_MAX];
+            int count;
+            addrs[0] = ra;
+            count = gather(s, addrs, beacon_value(msg, r, "node"));
+            fprintf(stderr, "%s: sending '%s' to %d devices...\n", appname, fn, count);
+            xfer_mcast(addrs, count, fn);
+        } else if (!boot_cached(&ra, msg, r, fn)) {
+            struct sockaddr_in6 addrs[PATHS_MAX];
+            const char* node = beacon_value(msg, r, "node");
+            const char* paths = beacon_value(msg, r, "paths");
+            int count = 1;
+            addrs[0] = ra;
+            if (stripe && window && node && paths && (atoi(paths) > 1)) {
+                count = gather_paths(s, addrs, node, atoi(paths));
+            }
+            if (count > 1) {
+                fprintf(stderr, "%s: sending '%s' over %d paths...\n", appname, fn, count);
+            } else {
+                fprintf(stderr, "%s: sending '%s'...\n", appname, fn);
+            }
+            xfer(addrs, count, fn);
+        }
         if (once) {
             break;
         }
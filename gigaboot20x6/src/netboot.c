@@ -15,9 +15,13 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <delta.h>
+#include <fec.h>
 #include <inet6.h>
+#include <lz4.h>
 #include <netboot.h>
 #include <netifc.h>
+#include <sha256.h>
 
 static uint32_t last_cookie = 0;
 static uint32_t last_cmd = 0;
@@ -31,34 +35,540 @@ static int nb_active = 0;
 // item being downloaded
 static nbfile* item;
 
-void udp6_recv(void* data, size_t len,
-               const ip6_addr* daddr, uint16_t dport,
-               const ip6_addr* saddr, uint16_t sport) {
-    nbmsg* msg = data;
-    nbmsg ack;
+// windowed transfer state for item (nb_window == 0 for stop-and-wait)
+static nbfileopts nb_opts;
+static uint32_t nb_window = 0;
+static uint32_t nb_highest = 0; // one past the highest block received
+static int nb_mcast = 0; // NB_DATA may arrive through a multicast group
+static nbfecopts nb_fec; // nb_fec.parity == 0 if not using FEC
+static uint32_t nb_closed = 0; // FEC groups below this are past rebuilding
+static int nb_lz4 = 0; // blocks may arrive as NB_DATA_LZ4
+static uint32_t nb_hashblock = 0; // base bytes per hash, 0 if not a delta
+static int nb_merkle = 0; // NB_MERKLE_*
+static uint8_t nb_root[SHA256_SIZE];
+static uint32_t nb_leaves_next = 0; // next leaf hash to arrive
+static uint32_t nb_rejected = 0; // blocks that didn't match their leaf
 
-    if (dport != NB_SERVER_PORT)
+#define NB_MERKLE_OFF 0
+#define NB_MERKLE_LEAVES 1 // receiving the leaf hashes; blocks are refused
+#define NB_MERKLE_ON 2     // leaves match the root; every block is checked
+
+// A delta's base is hashed in blocks of at least NB_DELTA_BLOCK_MIN,
+// as large as it takes to need no more than NB_DELTA_HASHES of them
+#define NB_DELTA_BLOCK_MIN 4096
+#define NB_DELTA_HASHES 4096
+
+// FEC groups that have parity blocks parked in the slots of their
+// missing data blocks, waiting for enough of them to rebuild the rest
+#define NB_FEC_GROUPS 8
+#define NB_FEC_NONE 0xFFFFFFFF
+static struct {
+    uint32_t group;
+    uint32_t held; // parity blocks parked
+    uint8_t parity[NB_FEC_DATA_MAX]; // 1 + index of the one in each slot
+} nb_fecgrp[NB_FEC_GROUPS];
+
+#define NB_BIT_SET(bm, n) ((bm)[(n) >> 3] & (1 << ((n) & 7)))
+
+// A windowed block that fits in one frame is received in place: the
+// frame is laid out to put its payload in the slot of the block that
+// is expected next, with what its headers (and the rest of the frame,
+// past a short last block) overwrite kept here until it is handled.
+// That is only worth doing in the middle of a stream of blocks: for a
+// frame that turns out to be something else, or no frame at all, it
+// is all put back for nothing.
+#define NB_LAND_HDR (ETH_HDR_LEN + IP6_HDR_LEN + UDP_HDR_LEN + sizeof(nbmsg))
+static struct {
+    int streaming;  // the last message was a windowed block of item
+    uint8_t* frame; // 0 unless a frame is being received in place
+    uint8_t* slot;
+    size_t len; // of the block expected
+    uint8_t head[NB_LAND_HDR];
+    uint8_t tail[ETH_MTU - NB_LAND_HDR];
+} nb_land;
+
+// anything else that lands is moved here before it is looked at
+static uint8_t nb_bounce[ETH_MTU];
+
+// Must be called before the filename is NUL terminated in place, as
+// the options follow it and end at the last byte of the message.
+static uint32_t nb_send_file_opts(nbmsg* msg, size_t len, nbfileopts* opts,
+                                  nbmcastopts* mcast, nbfecopts* fec,
+                                  nbmerkleopts* merkle) {
+    uint32_t flags = msg->arg & (NB_FILE_WINDOW | NB_FILE_MCAST | NB_FILE_FEC |
+                                 NB_FILE_LZ4 | NB_FILE_DELTA | NB_FILE_MERKLE);
+    size_t namelen = 0;
+    size_t pos;
+
+    while ((namelen < len) && msg->data[namelen]) {
+        namelen++;
+    }
+    namelen++;
+    if (!(flags & NB_FILE_WINDOW) || (namelen > len) ||
+        ((len - namelen) < sizeof(nbfileopts))) {
+        return 0;
+    }
+    memcpy(opts, msg->data + namelen, sizeof(nbfileopts));
+    if ((opts->blocksize < NB_BLOCK_MIN) || (opts->window == 0)) {
+        return 0;
+    }
+    // the host appends the options in flag order, whether or not we
+    // turn out to support them
+    pos = namelen + sizeof(nbfileopts);
+    if (msg->arg & NB_FILE_MCAST) {
+        if ((len - pos) < sizeof(nbmcastopts)) {
+            flags &= ~NB_FILE_MCAST;
+        } else {
+            memcpy(mcast, msg->data + pos, sizeof(nbmcastopts));
+        }
+        pos += sizeof(nbmcastopts);
+    }
+    if (msg->arg & NB_FILE_FEC) {
+        if ((pos > len) || ((len - pos) < sizeof(nbfecopts))) {
+            flags &= ~NB_FILE_FEC;
+        } else {
+            memcpy(fec, msg->data + pos, sizeof(nbfecopts));
+            if ((fec->data == 0) || (fec->data > NB_FEC_DATA_MAX) ||
+                (fec->parity == 0) || (fec->parity > NB_FEC_PARITY_MAX)) {
+                flags &= ~NB_FILE_FEC;
+            }
+        }
+        pos += sizeof(nbfecopts);
+    }
+    if (msg->arg & NB_FILE_MERKLE) {
+        if ((pos > len) || ((len - pos) < sizeof(nbmerkleopts))) {
+            flags &= ~NB_FILE_MERKLE;
+        } else {
+            memcpy(merkle, msg->data + pos, sizeof(nbmerkleopts));
+        }
+    }
+    if (opts->blocksize > NB_BLOCK_MAX) {
+        // the leaves were hashed for the host's blocksize
+        opts->blocksize = NB_BLOCK_MAX;
+        flags &= ~NB_FILE_MERKLE;
+    }
+    if (opts->window > NB_WINDOW_MAX) {
+        opts->window = NB_WINDOW_MAX;
+    }
+    return flags;
+}
+
+// Returns the block number of a windowed NB_DATA at off, or -1 if it
+// is malformed or already received.
+static int nb_block(uint32_t off, size_t len) {
+    uint32_t n;
+
+    if ((off < item->offset) || (off % nb_opts.blocksize))
+        return -1;
+    if ((off + len) > nb_opts.size)
+        return -1;
+    if ((len != nb_opts.blocksize) && ((off + len) != nb_opts.size))
+        return -1;
+    n = off / nb_opts.blocksize;
+    if (NB_BIT_SET(item->bitmap, n))
+        return -1;
+    return n;
+}
+
+static uint32_t nb_blocks(void) {
+    return (nb_opts.size + nb_opts.blocksize - 1) / nb_opts.blocksize;
+}
+
+static size_t nb_block_len(uint32_t n) {
+    size_t len = nb_opts.size - n * nb_opts.blocksize;
+
+    return (len > nb_opts.blocksize) ? nb_opts.blocksize : len;
+}
+
+// With NB_FILE_MERKLE, returns nonzero if block n (the len bytes at
+// data) is not what its leaf says, in which case it is reported missing
+// in the next NB_NAK.
+static int nb_bad_block(uint32_t n, const uint8_t* data, size_t len) {
+    uint8_t hash[SHA256_SIZE];
+
+    if (nb_merkle == NB_MERKLE_OFF) {
+        return 0;
+    }
+    if (nb_merkle == NB_MERKLE_ON) {
+        merkle_leaf(data, len, hash);
+        if (!memcmp(hash, item->leaves + n * SHA256_SIZE, SHA256_SIZE)) {
+            return 0;
+        }
+    }
+    nb_rejected++;
+    if (n >= nb_highest) {
+        nb_highest = n + 1;
+    }
+    return 1;
+}
+
+static void nb_got_block(uint32_t n) {
+    item->bitmap[n >> 3] |= 1 << (n & 7);
+    if (n >= nb_highest) {
+        nb_highest = n + 1;
+    }
+}
+
+// Advance the write pointer over any completed run of blocks
+static void nb_advance(void) {
+    uint32_t n = item->offset / nb_opts.blocksize;
+    size_t offset = item->offset;
+
+    while ((n < nb_highest) && NB_BIT_SET(item->bitmap, n)) {
+        n++;
+    }
+    item->offset = n * nb_opts.blocksize;
+    if (item->offset > nb_opts.size) {
+        item->offset = nb_opts.size;
+    }
+    if ((item->offset != offset) && item->advance) {
+        item->advance(item);
+    }
+}
+
+static int nb_fec_find(uint32_t group, int alloc) {
+    int x = -1;
+
+    for (int i = 0; i < NB_FEC_GROUPS; i++) {
+        if (nb_fecgrp[i].group == group) {
+            return i;
+        }
+        // reuse a free entry, else the oldest group
+        if ((x < 0) || (nb_fecgrp[i].group == NB_FEC_NONE) ||
+            ((nb_fecgrp[x].group != NB_FEC_NONE) &&
+             (nb_fecgrp[i].group < nb_fecgrp[x].group))) {
+            x = i;
+        }
+    }
+    if (!alloc) {
+        return -1;
+    }
+    nb_fecgrp[x].group = group;
+    nb_fecgrp[x].held = 0;
+    memset(nb_fecgrp[x].parity, 0, sizeof(nb_fecgrp[x].parity));
+    return x;
+}
+
+// Nonzero if block n's slot is holding a parity block
+static int nb_fec_parked(uint32_t n) {
+    int x;
+
+    if (nb_fec.parity == 0) {
+        return 0;
+    }
+    if ((x = nb_fec_find(n / nb_fec.data, 0)) < 0) {
+        return 0;
+    }
+    return nb_fecgrp[x].parity[n % nb_fec.data];
+}
+
+// Once as many parity blocks are parked as data blocks are missing
+// (which is when every missing block's slot holds one), decode the
+// group in place.
+static void nb_fec_rebuild(int x) {
+    uint8_t* blocks[NB_FEC_DATA_MAX];
+    int parity[NB_FEC_DATA_MAX];
+    uint32_t first = nb_fecgrp[x].group * nb_fec.data;
+    uint32_t count = nb_blocks() - first;
+    uint32_t missing = 0;
+
+    if (count > nb_fec.data) {
+        count = nb_fec.data;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        blocks[i] = item->data + (first + i) * nb_opts.blocksize;
+        parity[i] = -1;
+        if (!NB_BIT_SET(item->bitmap, first + i)) {
+            if (nb_fecgrp[x].parity[i] == 0) {
+                return;
+            }
+            parity[i] = nb_fecgrp[x].parity[i] - 1;
+            missing++;
+        }
+    }
+    if (missing && fec_decode(blocks, parity, count, nb_opts.blocksize)) {
         return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if ((parity[i] >= 0) && nb_bad_block(first + i, blocks[i], nb_block_len(first + i))) {
+            continue;
+        }
+        nb_got_block(first + i);
+    }
+    nb_fecgrp[x].group = NB_FEC_NONE;
+}
 
-    if (len < sizeof(nbmsg))
+// Forget any parity block parked in block n's slot, which has been
+// written over.  Returns the group's entry, or -1 if it has none.
+static int nb_fec_unpark(uint32_t n) {
+    int x;
+
+    if ((x = nb_fec_find(n / nb_fec.data, 0)) < 0) {
+        return -1;
+    }
+    if (nb_fecgrp[x].parity[n % nb_fec.data]) {
+        nb_fecgrp[x].parity[n % nb_fec.data] = 0;
+        nb_fecgrp[x].held--;
+    }
+    return x;
+}
+
+// Block n has arrived.  Groups before its own are closed, and if its
+// slot was holding a parity block, that one is gone.
+static void nb_fec_data(uint32_t n) {
+    uint32_t group = n / nb_fec.data;
+    int x;
+
+    if (group > nb_closed) {
+        nb_closed = group;
+    }
+    // a final block shorter than blocksize is coded zero padded
+    if ((n == (nb_blocks() - 1)) && (nb_opts.size % nb_opts.blocksize)) {
+        memset(item->data + nb_opts.size, 0,
+               nb_opts.blocksize - (nb_opts.size % nb_opts.blocksize));
+    }
+    if ((x = nb_fec_unpark(n)) < 0) {
+        return;
+    }
+    nb_fec_rebuild(x);
+}
+
+// Park an NB_PARITY block in the slot of one of its group's missing
+// blocks, and rebuild the group if that makes enough.
+static void nb_recv_parity(nbmsg* msg, const uint8_t* payload, size_t len) {
+    uint32_t group = msg->arg >> 8;
+    uint32_t index = msg->arg & 0xFF;
+    uint32_t first = group * nb_fec.data;
+    uint32_t count, i, slot = NB_FEC_DATA_MAX;
+    int x;
+
+    if ((index >= nb_fec.parity) || (len != nb_opts.blocksize) ||
+        (first >= nb_blocks())) {
+        return;
+    }
+    if ((group + (index == (nb_fec.parity - 1u))) > nb_closed) {
+        nb_closed = group + (index == (nb_fec.parity - 1u));
+    }
+    count = nb_blocks() - first;
+    if (count > nb_fec.data) {
+        count = nb_fec.data;
+    }
+    for (i = 0; i < count; i++) {
+        if (!NB_BIT_SET(item->bitmap, first + i)) {
+            break;
+        }
+    }
+    if (i == count) {
+        return;
+    }
+    x = nb_fec_find(group, 1);
+    for (i = 0; i < count; i++) {
+        if (nb_fecgrp[x].parity[i] == (index + 1)) {
+            return;
+        }
+        if ((slot == NB_FEC_DATA_MAX) && !nb_fecgrp[x].parity[i] &&
+            !NB_BIT_SET(item->bitmap, first + i)) {
+            slot = i;
+        }
+    }
+    if (slot == NB_FEC_DATA_MAX) {
+        return;
+    }
+    memcpy(item->data + (first + slot) * nb_opts.blocksize, payload, len);
+    nb_fecgrp[x].parity[slot] = index + 1;
+    nb_fecgrp[x].held++;
+    nb_fec_rebuild(x);
+    nb_advance();
+}
+
+// Block n is in place in item
+static void nb_placed(uint32_t n) {
+    nb_got_block(n);
+    if (nb_fec.parity) {
+        nb_fec_data(n);
+    }
+    nb_advance();
+}
+
+// Place a windowed NB_DATA block directly into item, in whatever order
+// it arrives, and advance the write pointer over any completed run.
+// The payload may already be in place, if it was reassembled there.
+static void nb_recv_block(nbmsg* msg, const uint8_t* payload, size_t len) {
+    int n;
+
+    if ((n = nb_block(msg->arg, len)) < 0)
         return;
-    len -= sizeof(nbmsg);
+    if (nb_bad_block(n, payload, len))
+        return;
+    if (payload != (item->data + msg->arg)) {
+        memcpy(item->data + msg->arg, payload, len);
+    }
+    nb_placed(n);
+}
+
+// Decompress an NB_DATA_LZ4 block straight into its place in item
+static void nb_recv_lz4(nbmsg* msg, const uint8_t* payload, size_t len) {
+    uint32_t off = msg->arg;
+    size_t want;
+    int n;
+
+    if (off >= nb_opts.size)
+        return;
+    want = nb_opts.size - off;
+    if (want > nb_opts.blocksize)
+        want = nb_opts.blocksize;
+    if ((n = nb_block(off, want)) < 0)
+        return;
+    if ((lz4_decompress(payload, len, item->data + off, want) != (int)want) ||
+        nb_bad_block(n, item->data + off, want)) {
+        // the slot now holds garbage, not any parity parked there
+        if (nb_fec.parity) {
+            nb_fec_unpark(n);
+        }
+        return;
+    }
+    nb_placed(n);
+}
+
+// Fill in the hashes of the base from block first on (NB_HASHES)
+static size_t nb_hashes(nbhashes* hdr, nbhash* hash, uint32_t first) {
+    uint32_t total = (item->base_size + nb_hashblock - 1) / nb_hashblock;
+
+    hdr->blocksize = nb_hashblock;
+    hdr->size = item->base_size;
+    hdr->count = 0;
+    hdr->reserved = 0;
+    for (uint32_t n = first; (n < total) && (hdr->count < NB_HASH_MAX); n++) {
+        size_t off = (size_t)n * nb_hashblock;
+        size_t len = item->base_size - off;
+        if (len > nb_hashblock) {
+            len = nb_hashblock;
+        }
+        hash[hdr->count].weak = delta_weak(item->base + off, len);
+        hash[hdr->count].reserved = 0;
+        hash[hdr->count].strong = delta_strong(item->base + off, len);
+        hdr->count++;
+    }
+    return sizeof(nbhashes) + hdr->count * sizeof(nbhash);
+}
+
+// Copy a run of whole blocks from the base into item (NB_COPY), except
+// any that have already arrived
+static void nb_recv_copy(const nbcopy* op) {
+    uint32_t end = op->to + op->length;
+
+    if ((op->length == 0) || (op->to % nb_opts.blocksize) ||
+        (end < op->to) || (end > nb_opts.size))
+        return;
+    if ((op->length % nb_opts.blocksize) && (end != nb_opts.size))
+        return;
+    if ((op->from > item->base_size) || (op->length > (item->base_size - op->from)))
+        return;
+    for (uint32_t off = op->to; off < end; off += nb_opts.blocksize) {
+        uint32_t n = off / nb_opts.blocksize;
+        size_t len = end - off;
+        if (len > nb_opts.blocksize) {
+            len = nb_opts.blocksize;
+        }
+        if (NB_BIT_SET(item->bitmap, n) ||
+            nb_bad_block(n, item->base + op->from + (off - op->to), len)) {
+            continue;
+        }
+        memcpy(item->data + off, item->base + op->from + (off - op->to), len);
+        nb_placed(n);
+    }
+}
+
+// Blocks below this may be reported missing: all received so far, or
+// with FEC, those in groups that can no longer be rebuilt
+static uint32_t nb_report_end(void) {
+    uint32_t end;
+
+    if (nb_fec.parity == 0) {
+        return nb_highest;
+    }
+    end = nb_closed * nb_fec.data;
+    return (end < nb_blocks()) ? end : nb_blocks();
+}
+
+// Nonzero if any block in [n, end) is missing
+static int nb_hole(uint32_t n, uint32_t end) {
+    for (; n < end; n++) {
+        if (!NB_BIT_SET(item->bitmap, n)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Fill in the holes between the write pointer and block end (one past
+// the highest received so far, or the whole file), returning how many
+// ranges there are.
+static size_t nb_missing(nbrange* range, size_t max, uint32_t end) {
+    uint32_t n = item->offset / nb_opts.blocksize;
+    size_t count = 0;
+
+    while ((n < end) && (count < max)) {
+        if (NB_BIT_SET(item->bitmap, n)) {
+            n++;
+            continue;
+        }
+        range[count].offset = n * nb_opts.blocksize;
+        while ((n < end) && !NB_BIT_SET(item->bitmap, n)) {
+            n++;
+        }
+        range[count].length = n * nb_opts.blocksize - range[count].offset;
+        if ((range[count].offset + range[count].length) > nb_opts.size) {
+            range[count].length = nb_opts.size - range[count].offset;
+        }
+        count++;
+    }
+    return count;
+}
+
+static void nb_recv(nbmsg* msg, const uint8_t* payload, size_t len,
+                    const ip6_addr* saddr, uint16_t sport) {
+    struct {
+        nbmsg hdr;
+        union {
+            nbfileopts opts;
+            nbrange missing[NB_NAK_MAX];
+            struct {
+                nbhashes hdr;
+                nbhash hash[NB_HASH_MAX];
+            } hashes;
+        } u;
+    } reply;
+    nbmsg* ack = &reply.hdr;
+    size_t acklen = sizeof(nbmsg);
+    nbmcastopts mcast;
+    nbfecopts fec;
+    nbmerkleopts merkle;
+    uint32_t flags;
 
     //printf("netboot: MSG %08x %08x %08x %08x datalen %d\n",
     //	msg->magic, msg->cookie, msg->cmd, msg->arg, len);
 
-    if ((last_cookie == msg->cookie) &&
-        (last_cmd == msg->cmd) && (last_arg = msg->arg)) {
+    nb_land.streaming = (msg->magic == NB_MAGIC) && (msg->cmd == NB_DATA) &&
+                        item && nb_window;
+
+    // (NB_HASHES is just answered again, as its ack carries the hashes)
+    if ((last_cookie == msg->cookie) && (msg->cmd != NB_HASHES) &&
+        (last_cmd == msg->cmd) && (last_arg == msg->arg)) {
         // host must have missed the ack. resend
-        ack.magic = NB_MAGIC;
-        ack.cookie = last_cookie;
-        ack.cmd = last_ack_cmd;
-        ack.arg = last_ack_arg;
+        ack->magic = NB_MAGIC;
+        ack->cookie = last_cookie;
+        ack->cmd = last_ack_cmd;
+        ack->arg = last_ack_arg;
+        if ((last_cmd == NB_SEND_FILE) && nb_window) {
+            reply.u.opts = nb_opts;
+            acklen += sizeof(nbfileopts);
+        }
         goto transmit;
     }
 
-    ack.cmd = NB_ACK;
-    ack.arg = 0;
+    ack->cmd = NB_ACK;
+    ack->arg = 0;
 
     switch (msg->cmd) {
     case NB_COMMAND:
@@ -69,78 +579,414 @@ void udp6_recv(void* data, size_t len,
     case NB_SEND_FILE:
         if (len == 0)
             return;
+        nb_window = 0;
+        nb_highest = 0;
+        nb_mcast = 0;
+        nb_fec.parity = 0;
+        nb_closed = 0;
+        nb_lz4 = 0;
+        nb_hashblock = 0;
+        nb_merkle = NB_MERKLE_OFF;
+        nb_rejected = 0;
+        if ((flags = nb_send_file_opts(msg, len, &nb_opts, &mcast, &fec, &merkle))) {
+            nb_window = nb_opts.window;
+        }
         msg->data[len - 1] = 0;
-        for (int i = 0; i < (len - 1); i++) {
-            if ((msg->data[i] < ' ') || (msg->data[i] > 127)) {
-                msg->data[i] = '.';
+        for (char* p = (char*) msg->data; *p; p++) {
+            if ((*p < ' ') || (*p > 127)) {
+                *p = '.';
             }
         }
         item = netboot_get_buffer((const char*) msg->data);
         if (item) {
             item->offset = 0;
+            item->verified = 0;
             printf("netboot: Receive File '%s'...\n", (char*) msg->data);
         } else {
             printf("netboot: Rejected File '%s'...\n", (char*) msg->data);
-            ack.cmd = NB_ERROR_BAD_FILE;
+            ack->cmd = NB_ERROR_BAD_FILE;
+            nb_window = 0;
+        }
+        if (nb_window && (item->bitmap == 0)) {
+            nb_window = 0;
+        }
+        if (nb_window) {
+            if (nb_opts.size > item->size) {
+                ack->cmd = NB_ERROR_TOO_LARGE;
+                item = 0;
+                nb_window = 0;
+            } else {
+                uint32_t blocks = (nb_opts.size + nb_opts.blocksize - 1) / nb_opts.blocksize;
+                memset(item->bitmap, 0, (blocks + 7) / 8);
+                ack->arg = NB_FILE_WINDOW;
+                reply.u.opts = nb_opts;
+                acklen += sizeof(nbfileopts);
+                if ((flags & NB_FILE_MCAST) &&
+                    (ip6_join_group((const ip6_addr*) mcast.group) == 0)) {
+                    ack->arg |= NB_FILE_MCAST;
+                    nb_mcast = 1;
+                }
+                // parity is parked in the slots of missing blocks, so
+                // the last one needs room for a whole block
+                if ((flags & NB_FILE_FEC) &&
+                    ((blocks * nb_opts.blocksize) <= item->size)) {
+                    ack->arg |= NB_FILE_FEC;
+                    nb_fec = fec;
+                    for (int i = 0; i < NB_FEC_GROUPS; i++) {
+                        nb_fecgrp[i].group = NB_FEC_NONE;
+                    }
+                }
+                if (flags & NB_FILE_LZ4) {
+                    ack->arg |= NB_FILE_LZ4;
+                    nb_lz4 = 1;
+                }
+                if ((flags & NB_FILE_DELTA) && item->base && item->base_size &&
+                    !(item->base_size >> 32)) {
+                    ack->arg |= NB_FILE_DELTA;
+                    nb_hashblock = NB_DELTA_BLOCK_MIN;
+                    while ((item->base_size / nb_hashblock) >= NB_DELTA_HASHES) {
+                        nb_hashblock *= 2;
+                    }
+                }
+                if ((flags & NB_FILE_MERKLE) && item->leaves && nb_opts.size) {
+                    ack->arg |= NB_FILE_MERKLE;
+                    nb_merkle = NB_MERKLE_LEAVES;
+                    nb_leaves_next = 0;
+                    memcpy(nb_root, merkle.root, sizeof(nb_root));
+                }
+            }
         }
         break;
+    case NB_PARITY:
+    case NB_DATA_LZ4:
     case NB_DATA:
         if (item == 0)
             return;
+        if (nb_window) {
+            uint32_t end = nb_report_end();
+            size_t count;
+            if (msg->cmd == NB_DATA) {
+                nb_recv_block(msg, payload, len);
+            } else if (msg->cmd == NB_DATA_LZ4) {
+                if (nb_lz4) {
+                    nb_recv_lz4(msg, payload, len);
+                }
+            } else if (nb_fec.parity) {
+                nb_recv_parity(msg, payload, len);
+            }
+            if (nb_mcast && !nb_hole(end, nb_report_end())) {
+                // nothing new is missing; stay quiet so a whole
+                // group of devices doesn't answer every block
+                nb_active = 1;
+                return;
+            }
+            ack->arg = item->offset;
+            count = nb_missing(reply.u.missing, NB_NAK_MAX, nb_report_end());
+            if (count) {
+                ack->cmd = NB_NAK;
+                acklen += count * sizeof(nbrange);
+            }
+            break;
+        }
+        if (msg->cmd != NB_DATA)
+            return;
         if (msg->arg != item->offset)
             return;
-        ack.arg = msg->arg;
+        ack->arg = msg->arg;
         if ((item->offset + len) > item->size) {
-            ack.cmd = NB_ERROR_TOO_LARGE;
+            ack->cmd = NB_ERROR_TOO_LARGE;
         } else {
             memcpy(item->data + item->offset, msg->data, len);
             item->offset += len;
-            ack.cmd = NB_ACK;
+            ack->cmd = NB_ACK;
+            if (item->advance) {
+                item->advance(item);
+            }
+        }
+        break;
+    case NB_HASHES:
+        if ((item == 0) || (nb_hashblock == 0))
+            return;
+        ack->arg = msg->arg;
+        acklen += nb_hashes(&reply.u.hashes.hdr, reply.u.hashes.hash, msg->arg);
+        break;
+    case NB_COPY:
+        if ((item == 0) || (nb_hashblock == 0))
+            return;
+        for (size_t i = 0; i < (len / sizeof(nbcopy)); i++) {
+            nb_recv_copy((const nbcopy*)payload + i);
+        }
+        break;
+    case NB_LEAVES: {
+        uint8_t root[SHA256_SIZE];
+        if ((item == 0) || (nb_merkle != NB_MERKLE_LEAVES))
+            return;
+        ack->arg = msg->arg;
+        if ((msg->arg != nb_leaves_next) || (len == 0) || (len % SHA256_SIZE) ||
+            ((len / SHA256_SIZE) > (nb_blocks() - nb_leaves_next))) {
+            ack->cmd = NB_ERROR_BAD_PARAM;
+            break;
+        }
+        memcpy(item->leaves + msg->arg * SHA256_SIZE, payload, len);
+        nb_leaves_next += len / SHA256_SIZE;
+        if (nb_leaves_next < nb_blocks()) {
+            break;
+        }
+        merkle_root(item->leaves, nb_blocks(), root);
+        if (memcmp(root, nb_root, sizeof(root))) {
+            // every block will be refused
+            printf("netboot: Merkle tree does not match its root\n");
+            ack->cmd = NB_ERROR_BAD_FILE;
+            nb_leaves_next = 0;
+            break;
+        }
+        nb_merkle = NB_MERKLE_ON;
+        break;
+    }
+    case NB_VERIFY: {
+        uint8_t digest[SHA256_SIZE];
+        if ((item == 0) || (len != SHA256_SIZE))
+            return;
+        if (nb_window && (item->offset != nb_opts.size)) {
+            printf("netboot: File is incomplete\n");
+            ack->cmd = NB_ERROR_BAD_FILE;
+            break;
+        }
+        if (nb_rejected) {
+            printf("netboot: %d blocks failed verification and were resent\n", nb_rejected);
+        }
+        // even with a Merkle tree, which had every block checked as it
+        // arrived, the whole file is hashed: the host's digest is only
+        // known good once it matches, and it is kept to cache the file by
+        sha256(item->data, item->offset, digest);
+        if (memcmp(digest, payload, len)) {
+            printf("netboot: File is corrupt\n");
+            ack->cmd = NB_ERROR_BAD_FILE;
+            break;
+        }
+        memcpy(item->digest, digest, sizeof(digest));
+        item->verified = 1;
+        break;
+    }
+    case NB_STATUS: {
+        size_t count;
+        if ((item == 0) || (nb_window == 0))
+            return;
+        ack->arg = item->offset;
+        count = nb_missing(reply.u.missing, NB_NAK_MAX, nb_blocks());
+        if (count) {
+            ack->cmd = NB_NAK;
+            acklen += count * sizeof(nbrange);
         }
         break;
+    }
     case NB_BOOT:
         nb_boot_now = 1;
         printf("netboot: Boot Kernel...\n");
         break;
     default:
-        ack.cmd = NB_ERROR_BAD_CMD;
-        ack.arg = 0;
+        ack->cmd = NB_ERROR_BAD_CMD;
+        ack->arg = 0;
     }
 
     last_cookie = msg->cookie;
     last_cmd = msg->cmd;
     last_arg = msg->arg;
-    last_ack_cmd = ack.cmd;
-    last_ack_arg = ack.arg;
+    last_ack_cmd = ack->cmd;
+    last_ack_arg = ack->arg;
 
-    ack.cookie = msg->cookie;
-    ack.magic = NB_MAGIC;
+    ack->cookie = msg->cookie;
+    ack->magic = NB_MAGIC;
 transmit:
     nb_active = 1;
-    udp6_send(&ack, sizeof(ack), saddr, sport, NB_SERVER_PORT);
+    udp6_send(ack, acklen, saddr, sport, NB_SERVER_PORT);
+}
+
+static void nb_unland(void) {
+    if (nb_land.frame) {
+        memcpy(nb_land.frame, nb_land.head, NB_LAND_HDR);
+        memcpy(nb_land.slot + nb_land.len, nb_land.tail,
+               sizeof(nb_land.tail) - nb_land.len);
+        nb_land.frame = 0;
+    }
+}
+
+void* udp6_land(void) {
+    uint32_t n = nb_highest;
+    uint8_t* slot;
+
+    // a compressed block needs expanding anyway
+    if (!nb_land.streaming || (item == 0) || (nb_window == 0) || nb_lz4 ||
+        (nb_opts.blocksize > NB_BLOCK_MTU))
+        return 0;
+    if ((n >= nb_blocks()) || NB_BIT_SET(item->bitmap, n) || nb_fec_parked(n))
+        return 0;
+    // the whole frame has to fall within item
+    slot = item->data + n * nb_opts.blocksize;
+    if (((size_t)(slot - item->data) < NB_LAND_HDR) ||
+        ((size_t)(slot - item->data) + sizeof(nb_land.tail) > item->size))
+        return 0;
+    nb_land.frame = slot - NB_LAND_HDR;
+    nb_land.slot = slot;
+    nb_land.len = nb_block_len(n);
+    memcpy(nb_land.head, nb_land.frame, NB_LAND_HDR);
+    memcpy(nb_land.tail, slot + nb_land.len, sizeof(nb_land.tail) - nb_land.len);
+    return nb_land.frame;
+}
+
+void udp6_landed(void) {
+    nb_unland();
+}
+
+void udp6_recv(void* data, size_t len,
+               const ip6_addr* daddr, uint16_t dport,
+               const ip6_addr* saddr, uint16_t sport) {
+    nbmsg* msg = data;
+    ip6_addr src;
+    nbmsg hdr;
+
+    if (dport != NB_SERVER_PORT)
+        return;
+
+    if (len < sizeof(nbmsg))
+        return;
+
+    // traffic for a multicast session this device is no longer part of
+    if ((daddr->x[0] == 0xFF) && !nb_mcast)
+        return;
+
+    // The addresses and message header of a frame received in place are
+    // among what gets put back, so keep them first.  The block expected
+    // is then already where it belongs; anything else is moved aside.
+    if (nb_land.frame) {
+        uint8_t* slot = nb_land.slot;
+        src = *saddr;
+        saddr = &src;
+        if ((msg->data == slot) && (msg->magic == NB_MAGIC) && (msg->cmd == NB_DATA) &&
+            (msg->arg == (uint32_t)(slot - item->data)) &&
+            (len == (sizeof(nbmsg) + nb_land.len))) {
+            hdr = *msg;
+            nb_unland();
+            nb_recv(&hdr, slot, len - sizeof(nbmsg), saddr, sport);
+            return;
+        }
+        if (((uint8_t*)data >= nb_land.frame) && ((uint8_t*)data < (nb_land.frame + ETH_MTU))) {
+            memcpy(nb_bounce, data, len);
+            msg = (void*)nb_bounce;
+        }
+        nb_unland();
+    }
+
+    nb_recv(msg, msg->data, len - sizeof(nbmsg), saddr, sport);
 }
 
-static char advertise_data[] =
-    "version\00.1\0"
-    "serialno\0unknown\0"
-    "board\0unknown\0";
+// Have the stack copy a windowed NB_DATA block (or reassemble a large
+// one, which arrives as IPv6 fragments) straight into item, checking
+// it on the way, unless it is one we already have (whose ack the host
+// may have missed), in which case it comes back through udp6_recv().
+void* udp6_place(const void* data, size_t avail, size_t len, size_t* skip,
+                 const ip6_addr* daddr, uint16_t dport) {
+    const nbmsg* msg = data;
 
+    // the fragment would be reassembled out of the slot it sits in
+    if (nb_land.frame)
+        return 0;
+    if ((dport != NB_SERVER_PORT) || (avail < sizeof(nbmsg)))
+        return 0;
+    if ((daddr->x[0] == 0xFF) && !nb_mcast)
+        return 0;
+    if ((msg->magic != NB_MAGIC) || (msg->cmd != NB_DATA))
+        return 0;
+    if ((item == 0) || (nb_window == 0))
+        return 0;
+    if (nb_block(msg->arg, len - sizeof(nbmsg)) < 0)
+        return 0;
+    // a failed reassembly must not clobber a parked parity block
+    if (nb_fec_parked(msg->arg / nb_opts.blocksize))
+        return 0;
+    *skip = sizeof(nbmsg);
+    return item->data + msg->arg;
+}
+
+void udp6_placed(void* data, size_t skip, size_t len,
+                 const ip6_addr* daddr, uint16_t dport,
+                 const ip6_addr* saddr, uint16_t sport) {
+    nbmsg* msg = data;
+
+    if ((item == 0) || (nb_window == 0))
+        return;
+    if ((daddr->x[0] == 0xFF) && !nb_mcast)
+        return;
+
+    nb_recv(msg, item->data + msg->arg, len - sizeof(nbmsg), saddr, sport);
+}
+
+// NUL terminated keys and values, ending with an empty key
+#define ADVERTISE_DATA \
+    "version\00.1\0" \
+    "serialno\0unknown\0" \
+    "board\0unknown\0"
+
+static char advertise_data[512] = ADVERTISE_DATA;
+static size_t advertise_len = sizeof(ADVERTISE_DATA);
+
+int netboot_advertise(const char* key, const char* value) {
+    size_t klen = strlen(key) + 1;
+    size_t vlen = strlen(value) + 1;
+
+    if ((advertise_len + klen + vlen) > sizeof(advertise_data)) {
+        return -1;
+    }
+    memcpy(advertise_data + advertise_len - 1, key, klen);
+    memcpy(advertise_data + advertise_len - 1 + klen, value, vlen);
+    advertise_len += klen + vlen;
+    advertise_data[advertise_len - 1] = 0;
+    return 0;
+}
+
+// Append a key and value to an advertisement, returning their length
+static size_t advertise_key(char* out, const char* key, const char* value) {
+    size_t klen = strlen(key) + 1;
+    size_t vlen = strlen(value) + 1;
+    memcpy(out, key, klen);
+    memcpy(out + klen, value, vlen);
+    return klen + vlen;
+}
+
+// Advertise on every interface, naming the device (by its first MAC)
+// and how many paths it has, so a server can find all of them
 static void advertise(void) {
-    uint8_t buffer[256];
+    uint8_t buffer[sizeof(nbmsg) + sizeof(advertise_data) + 64];
     nbmsg* msg = (void*)buffer;
+    const uint8_t* mac = netifc_macaddr(0);
+    char* data = (char*)msg->data;
+    size_t len = advertise_len - 1;
+    char tmp[16];
     msg->magic = NB_MAGIC;
     msg->cookie = 0;
     msg->cmd = NB_ADVERTISE;
     msg->arg = 0;
-    memcpy(msg->data, advertise_data, sizeof(advertise_data));
-    udp6_send(buffer, sizeof(nbmsg) + sizeof(advertise_data),
-              &ip6_ll_all_nodes, NB_ADVERT_PORT, NB_SERVER_PORT);
+    memcpy(data, advertise_data, len);
+    if (mac) {
+        sprintf(tmp, "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        len += advertise_key(data + len, "node", tmp);
+    }
+    sprintf(tmp, "%d", netifc_count());
+    len += advertise_key(data + len, "paths", tmp);
+    data[len++] = 0;
+    for (int n = 0; n < netifc_count(); n++) {
+        netifc_select(n);
+        udp6_send(buffer, sizeof(nbmsg) + len,
+                  &ip6_ll_all_nodes, NB_ADVERT_PORT, NB_SERVER_PORT);
+    }
+    netifc_select(0);
 }
 
 #define FAST_TICK 100
 #define SLOW_TICK 1000
 
 int netboot_init(void) {
+    fec_init();
     if (netifc_open()) {
         printf("netboot: Failed to open network interface\n");
         return -1;
@@ -192,6 +1038,15 @@ int netboot_poll(void) {
     }
 }
 
+void netboot_wait(void) {
+    // nb_active lasts until a tick goes by without a message, so a
+    // transfer in progress keeps being polled flat out
+    if (nb_active || !netifc_active()) {
+        return;
+    }
+    netifc_wait();
+}
+
 void netboot_close(void) {
     netifc_close();
 }
@@ -20,12 +20,27 @@
 #define NB_ADVERT_PORT 33331
 
 #define NB_COMMAND 1   // arg=0, data=command
-#define NB_SEND_FILE 2 // arg=0, data=filename
-#define NB_DATA 3      // arg=blocknum, data=data
+#define NB_SEND_FILE 2 // arg=options, data=filename[, nbfileopts]
+#define NB_DATA 3      // arg=offset, data=data
 #define NB_BOOT 4      // arg=0
+#define NB_STATUS 5    // arg=0, acked like NB_DATA (multicast sessions)
+#define NB_PARITY 6    // arg=group << 8 | index, data=parity block (FEC)
+#define NB_DATA_LZ4 7  // arg=offset, data=LZ4 block of the data
+#define NB_HASHES 8    // arg=first hash, acked with nbhashes of the base (delta)
+#define NB_COPY 9      // arg=0, data=nbcopy[] from the base into the file (delta)
+#define NB_VERIFY 10   // arg=0, data=SHA-256 of the whole file
+#define NB_LEAVES 11   // arg=first block, data=Merkle leaf hashes (NB_FILE_MERKLE)
 
 #define NB_ACK 0
+#define NB_NAK 0x10 // arg=write pointer, data=nbrange[] still missing
 
+// Sent (data=NUL terminated keys and values) on every interface the
+// device has, with the same "node" (its first MAC) on each and "paths"
+// the number of them.  A windowed transfer may be striped across those
+// paths: every message is answered over the interface it came in on,
+// and blocks of the file may arrive over any of them.  Paths need not
+// keep pace, so a NAK only shows a block lost if it was sent over the
+// same path as the block that prompted it.
 #define NB_ADVERTISE 0x77777777
 
 #define NB_ERROR 0x80000000
@@ -34,6 +49,44 @@
 #define NB_ERROR_TOO_LARGE 0x80000003
 #define NB_ERROR_BAD_FILE 0x80000004
 
+// NB_SEND_FILE options (arg). The device acks with the subset it
+// agrees to, so a device that predates an option acks with it clear.
+#define NB_FILE_WINDOW 0x00000001 // windowed transfer, cumulative acks
+#define NB_FILE_MCAST 0x00000002  // windowed, NB_DATA multicast to a group
+#define NB_FILE_FEC 0x00000004    // windowed, NB_PARITY after each group
+#define NB_FILE_LZ4 0x00000008    // windowed, blocks may come as NB_DATA_LZ4
+#define NB_FILE_DELTA 0x00000010  // windowed, against what the device already has
+#define NB_FILE_MERKLE 0x00000020 // windowed, every block checked as it lands
+
+// The most NB_DATA blocks a device will let the host keep in flight
+#define NB_WINDOW_MAX 256
+
+// Smallest blocksize a windowed transfer may use, which sizes the
+// received-block bitmap of an nbfile
+#define NB_BLOCK_MIN 512
+
+// Largest blocksize a device accepts; anything over NB_BLOCK_MTU
+// arrives as IPv6 fragments
+#define NB_BLOCK_MAX (32 * 1024)
+
+// NB_DATA payload that fills a 1500 byte ethernet frame
+// (1500 - IPv6 header - UDP header - nbmsg)
+#define NB_BLOCK_MTU 1436
+#define NB_BITMAP_SIZE(sz) (((((sz) + NB_BLOCK_MIN - 1) / NB_BLOCK_MIN) + 7) / 8)
+
+// Room for the Merkle leaf hash of every block of a file
+#define NB_LEAVES_SIZE(sz) ((((sz) + NB_BLOCK_MIN - 1) / NB_BLOCK_MIN) * 32)
+
+// The most missing ranges reported by one NB_NAK
+#define NB_NAK_MAX 32
+
+// Largest FEC groups a device accepts (see fec.h)
+#define NB_FEC_DATA_MAX 64
+#define NB_FEC_PARITY_MAX 16
+
+// The most hashes in one ack to NB_HASHES
+#define NB_HASH_MAX 64
+
 typedef struct nbmsg_t {
     uint32_t magic;
     uint32_t cookie;
@@ -42,16 +95,150 @@ typedef struct nbmsg_t {
     uint8_t data[0];
 } nbmsg;
 
+// Follows the filename's NUL in NB_SEND_FILE when options are requested.
+// The ack to NB_SEND_FILE carries it back with the values the device
+// will accept (blocksize and window may be reduced, never increased).
+//
+// In a windowed transfer every NB_DATA except the last is exactly
+// blocksize bytes at a blocksize-aligned offset.  The host may send any
+// block within window blocks of the last ack, in any order, and every
+// ack carries the offset up to which the file is complete.
+//
+// When blocks past the write pointer have arrived but some before them
+// have not, the device answers with NB_NAK instead of NB_ACK, listing
+// (up to NB_NAK_MAX of) the missing ranges below the highest block it
+// has seen.  Its cookie is that of the NB_DATA which prompted it, so the
+// host can tell which of its retransmissions are still in flight.
+typedef struct nbfileopts_t {
+    uint32_t size;      // total file size in bytes
+    uint32_t blocksize; // payload bytes per NB_DATA
+    uint32_t window;    // NB_DATA blocks allowed in flight
+} nbfileopts;
+
+// Follows nbfileopts when NB_FILE_MCAST is requested.
+//
+// A device that manages to join the group acks with NB_FILE_MCAST set
+// and then accepts NB_DATA for the file sent to the group address, so
+// one host can stream an image to many devices at once.  It does not
+// ack those blocks; it only answers (with NB_NAK, to the sender) when a
+// block arrives past a gap that was not there before.  Once the host has
+// sent every block it polls each device with NB_STATUS, which is acked
+// like the last block of a file: NB_ACK if complete, otherwise NB_NAK
+// listing the missing ranges up to the end of the file.  The host
+// multicasts the union of the repairs until every device is complete.
+typedef struct nbmcastopts_t {
+    uint8_t group[16]; // link local (ff02::/16) IPv6 multicast address
+} nbmcastopts;
+
+// Follows nbfileopts (and nbmcastopts, if any) when NB_FILE_FEC is
+// requested.
+//
+// The file's blocks are taken in groups of data (the last group may be
+// shorter), and after the last block of each group the host sends its
+// parity NB_PARITY blocks: blocksize bytes each, the Reed-Solomon code
+// of the group (the last block zero padded) as computed by fec.c.  From
+// any mix of data and parity blocks that is as many as the group has
+// data blocks, the device rebuilds the rest without asking.  It only
+// reports holes (in NB_NAK) in groups it can no longer rebuild: those
+// it has seen the final parity block of, or anything from a later
+// group after.
+typedef struct nbfecopts_t {
+    uint16_t data;   // NB_DATA blocks per group
+    uint16_t parity; // NB_PARITY blocks per group
+} nbfecopts;
+
+// NB_FILE_LZ4 has no options of its own.  Once agreed, the host may
+// send any block as NB_DATA_LZ4 instead of NB_DATA: the same block (and
+// offset), compressed on its own in the LZ4 block format (see lz4.h).
+// It does so for blocks that shrink, and they are acked like NB_DATA.
+// A block that does not decompress to exactly its length is dropped,
+// and so repaired like a lost one.
+
+// NB_FILE_DELTA has no options of its own.  A device agrees to it if it
+// still holds an earlier file received into the same buffer (its base),
+// so the host only needs to send what changed.  Once agreed, and before
+// any NB_DATA, the host asks for the hashes of the base's blocks with
+// NB_HASHES (the base is cut into blocks of a size the device chooses,
+// the last may be shorter) and looks for those blocks anywhere in the
+// new file, as rsync does (see delta.h).  It then sends NB_COPY for the
+// runs of whole transfer blocks it found: each nbcopy has the device
+// copy length bytes from offset from of the base to offset to of the
+// file, where to is blocksize aligned and length is a multiple of
+// blocksize (or ends the file).  The blocks copied count as received,
+// and the rest are sent as usual.
+typedef struct nbhash_t {
+    uint32_t weak;
+    uint32_t reserved;
+    uint64_t strong;
+} nbhash;
+
+typedef struct nbhashes_t {
+    uint32_t blocksize; // base bytes per hash
+    uint32_t size;      // base bytes
+    uint32_t count;     // hashes in this ack, from the first asked for
+    uint32_t reserved;
+} nbhashes; // followed by count nbhash
+
+typedef struct nbcopy_t {
+    uint32_t from;
+    uint32_t to;
+    uint32_t length;
+} nbcopy;
+
+// Follows nbfileopts (and the options of any earlier flags) when
+// NB_FILE_MERKLE is requested.
+//
+// The root of the Merkle tree (see sha256.h) whose leaves are the file's
+// blocks.  Once agreed, and before any NB_DATA, the host sends the leaf
+// hashes in order with NB_LEAVES, as many per message as fit in
+// NB_BLOCK_MTU bytes.  The device acks the last with NB_ERROR_BAD_FILE
+// if they don't make the root, and then wants them again from the
+// first.  Once they do, it checks every block against
+// its leaf before taking it, and drops (and so has resent at once, in
+// its next NB_NAK) any that doesn't match.
+typedef struct nbmerkleopts_t {
+    uint8_t root[32];
+} nbmerkleopts;
+
+typedef struct nbrange_t {
+    uint32_t offset;
+    uint32_t length;
+} nbrange;
+
 typedef struct nbfile_t {
     uint8_t* data;
     size_t size; // max size of buffer
     size_t offset; // write pointer
+    uint8_t* bitmap; // NB_BITMAP_SIZE(size) bytes, or NULL if not windowed
+    // If set, called each time the write pointer advances, to process
+    // the data before it while the rest is still arriving (expanding it
+    // into a buffer of its own, making data just a staging area)
+    void (*advance)(struct nbfile_t* file);
+    // If set, an earlier file of base_size bytes (apart from data) that
+    // a delta transfer may copy blocks from
+    const uint8_t* base;
+    size_t base_size;
+    // Set, with the file's SHA-256, once the host has confirmed with
+    // NB_VERIFY that all of it arrived intact.  A device that finds it
+    // does not match acks NB_VERIFY with NB_ERROR_BAD_FILE.
+    int verified;
+    uint8_t digest[32];
+    // If set, NB_LEAVES_SIZE(size) bytes to keep the leaf hashes of
+    // a transfer with NB_FILE_MERKLE in
+    uint8_t* leaves;
 } nbfile;
 
 int netboot_init(void);
 int netboot_poll(void);
 void netboot_close(void);
 
+// Sleep until the network needs looking at again, unless a transfer
+// is in progress.  Call between netboot_poll()s when idle.
+void netboot_wait(void);
+
+// Add a key/value pair to the device's advertisement (before netboot_init)
+int netboot_advertise(const char* key, const char* value);
+
 // Ask for a buffer suitable to put the file /name/ in
 // Return NULL to indicate /name/ is not wanted.
 nbfile* netboot_get_buffer(const char* name);
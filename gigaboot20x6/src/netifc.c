@@ -21,18 +21,56 @@
 
 #include <inet6.h>
 #include <netifc.h>
-
+#include <pcinet.h>
+
+// Every interface with link is used, each with its own link local
+// address.  snp is the one selected: frames received are taken as
+// having come in on it, and eth_send() transmits on it.
+#define MAX_IFCS IP6_MAX_IFC
+static struct {
+    EFI_SIMPLE_NETWORK* snp;
+    unsigned tx_pending; // transmit buffers the driver has yet to hand back
+    uint64_t rx_dropped; // by the driver, as of netifc_open
+    int rx_stats;        // nonzero if the driver counts drops
+} ifcs[MAX_IFCS];
+static int ifc_count;
+static int ifc_cur;
 static EFI_SIMPLE_NETWORK* snp;
 
-#define MAX_FILTER 8
+// what receiving has cost, from the driver up through netboot
+static uint64_t rx_frames;
+static uint64_t rx_bytes;
+static uint64_t rx_cycles;
+
+// Frames taken off the ring per poll.  A poll that hits the budget
+// leaves the rest for the next one, so the caller still gets a turn.
+#ifndef NETIFC_RX_BUDGET
+#define NETIFC_RX_BUDGET 32
+#endif
+static uint64_t rx_polls;     // polls that found at least one frame
+static uint64_t rx_full;      // polls that stopped at the budget
+static uint64_t rx_most;      // most frames in one poll
+
+// transmit buffers the drivers have yet to hand back, all told
+static unsigned tx_pending;
+
+#define MAX_FILTER 16
 static EFI_MAC_ADDRESS mcast_filters[MAX_FILTER];
 static unsigned mcast_filter_count = 0;
 
+// The transmit pool starts at NUM_BUFFER_PAGES and grows, a step at a
+// time, whenever it runs dry with nothing left for the driver to hand
+// back.  Past MAX_BUFFER_PAGES, senders wait for the driver instead.
 #define NUM_BUFFER_PAGES 8
+#define MAX_BUFFER_PAGES 64
 #define ETH_BUFFER_SIZE 1516
 #define ETH_HEADER_SIZE 16
 #define ETH_BUFFER_MAGIC 0x424201020304A7A7UL
 
+// longest a sender waits for a buffer, or for room to transmit
+#define TX_WAIT_US 100000
+#define TX_WAIT_STEP_US 10
+
 typedef struct eth_buffer_t eth_buffer;
 struct eth_buffer_t {
     uint64_t magic;
@@ -40,20 +78,93 @@ struct eth_buffer_t {
     uint8_t data[0];
 };
 
-static EFI_PHYSICAL_ADDRESS eth_buffers_base = 0;
 static eth_buffer* eth_buffers = NULL;
 
+static unsigned tx_pages;    // pages in the pool
+static unsigned tx_free;     // buffers on eth_buffers
+static unsigned tx_most;     // most buffers out of the pool at once
+static uint64_t tx_waits;    // times a sender had to wait
+static uint64_t tx_failed;   // sends given up on
+
+// Add pages to the transmit pool
+static int eth_grow_buffers(unsigned pages) {
+    EFI_PHYSICAL_ADDRESS base;
+    uint8_t* ptr;
+
+    if ((tx_pages + pages) > MAX_BUFFER_PAGES) {
+        return -1;
+    }
+    if (gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, pages, &base)) {
+        return -1;
+    }
+    ptr = (void*)base;
+    for (unsigned n = 0; n < (pages * 2); n++) {
+        eth_buffer* buf = (void*)ptr;
+        buf->magic = ETH_BUFFER_MAGIC;
+        buf->next = eth_buffers;
+        eth_buffers = buf;
+        tx_free++;
+        ptr += 2048;
+    }
+    tx_pages += pages;
+    return 0;
+}
+
+// Take back every buffer the drivers have finished transmitting
+static void eth_reap(void) {
+    UINT32 irq;
+    VOID* txdone;
+
+    for (int n = 0; n < ifc_count; n++) {
+        while (ifcs[n].tx_pending) {
+            if (ifcs[n].snp->GetStatus(ifcs[n].snp, &irq, &txdone) || (txdone == NULL)) {
+                break;
+            }
+            eth_put_buffer(txdone);
+            ifcs[n].tx_pending--;
+            tx_pending--;
+        }
+    }
+}
+
+// Wait a moment for the driver to finish transmitting something.
+// Returns nonzero once waiting any longer is pointless.
+static int eth_wait(unsigned* us) {
+    if ((tx_pending == 0) || (*us >= TX_WAIT_US)) {
+        return -1;
+    }
+    gBS->Stall(TX_WAIT_STEP_US);
+    *us += TX_WAIT_STEP_US;
+    eth_reap();
+    return 0;
+}
+
 void* eth_get_buffer(size_t sz) {
     eth_buffer* buf;
+    unsigned us = 0;
+
     if (sz > ETH_BUFFER_SIZE) {
         return NULL;
     }
     if (eth_buffers == NULL) {
+        eth_reap();
+    }
+    if ((eth_buffers == NULL) && eth_grow_buffers(NUM_BUFFER_PAGES)) {
+        tx_waits++;
+        while ((eth_buffers == NULL) && (eth_wait(&us) == 0))
+            ;
+    }
+    if (eth_buffers == NULL) {
+        tx_failed++;
         return NULL;
     }
     buf = eth_buffers;
     eth_buffers = buf->next;
     buf->next = NULL;
+    tx_free--;
+    if (((tx_pages * 2) - tx_free) > tx_most) {
+        tx_most = (tx_pages * 2) - tx_free;
+    }
     return buf->data;
 }
 
@@ -67,15 +178,29 @@ void eth_put_buffer(void* data) {
     }
     buf->next = eth_buffers;
     eth_buffers = buf;
+    tx_free++;
 }
 
 int eth_send(void* data, size_t len) {
     EFI_STATUS r;
+    unsigned us = 0;
 
-    if ((r = snp->Transmit(snp, 0, len, (void*)data, NULL, NULL, NULL))) {
+    // a driver with its queue full says so: wait for room, not drop
+    while ((r = snp->Transmit(snp, 0, len, (void*)data, NULL, NULL, NULL)) == EFI_NOT_READY) {
+        if (us == 0) {
+            tx_waits++;
+        }
+        if (eth_wait(&us)) {
+            break;
+        }
+    }
+    if (r) {
         eth_put_buffer(data);
+        tx_failed++;
         return -1;
     } else {
+        ifcs[ifc_cur].tx_pending++;
+        tx_pending++;
         return 0;
     }
 }
@@ -95,17 +220,52 @@ void eth_dump_status(void) {
            snp->Mode->MediaPresentSupported, snp->Mode->MediaPresent);
 }
 
+static int netifc_set_filters(void);
+static int filters_installed = 0;
+
+void netifc_select(int n) {
+    if ((n >= 0) && (n < ifc_count)) {
+        ifc_cur = n;
+        snp = ifcs[n].snp;
+        ip6_select(n);
+    }
+}
+
+int netifc_count(void) {
+    return ifc_count;
+}
+
+const void* netifc_macaddr(int n) {
+    return ((n >= 0) && (n < ifc_count)) ? ifcs[n].snp->Mode->CurrentAddress.Addr : NULL;
+}
+
 int eth_add_mcast_filter(const mac_addr* addr) {
+    for (unsigned n = 0; n < mcast_filter_count; n++) {
+        if (!memcmp(mcast_filters + n, addr, ETH_ADDR_LEN))
+            return 0;
+    }
+    // an interface with fewer filters than this falls back to
+    // receiving all multicast (see netifc_set_filters)
     if (mcast_filter_count >= MAX_FILTER)
         return -1;
-    if (mcast_filter_count >= snp->Mode->MaxMCastFilterCount)
-        return -1;
     memcpy(mcast_filters + mcast_filter_count, addr, ETH_ADDR_LEN);
     mcast_filter_count++;
+    // groups joined after netifc_open() (eg, a netboot multicast
+    // session) need the receive filters reprogrammed
+    if (filters_installed && netifc_set_filters()) {
+        // not joined after all: leave the list (and, as far as it
+        // goes, the interfaces) as they were
+        mcast_filter_count--;
+        netifc_set_filters();
+        return -1;
+    }
     return 0;
 }
 
 static EFI_EVENT net_timer = NULL;
+static int net_timer_fired; // seen (and so reset) by netifc_wait
+static int rx_busy;         // the last poll found frames
+static uint64_t rx_waits;   // times netifc_wait slept
 
 #define TIMER_MS(n) (((uint64_t)(n)) * 10000UL)
 
@@ -120,114 +280,365 @@ int netifc_timer_expired(void) {
     if (net_timer == 0) {
         return 0;
     }
-    if (gBS->CheckEvent(net_timer) == EFI_SUCCESS) {
+    if (net_timer_fired || (gBS->CheckEvent(net_timer) == EFI_SUCCESS)) {
+        net_timer_fired = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void netifc_wait(void) {
+    EFI_EVENT events[1 + MAX_IFCS];
+    UINTN count = 0, which;
+
+    // frames may still be waiting beyond the last poll's budget
+    if ((ifc_count == 0) || (net_timer == NULL) || rx_busy) {
+        return;
+    }
+    events[count++] = net_timer;
+    for (int n = 0; n < ifc_count; n++) {
+        if (ifcs[n].snp->WaitForPacket) {
+            events[count++] = ifcs[n].snp->WaitForPacket;
+        }
+    }
+    // waiting resets whichever event it returns for, so the timer
+    // firing has to be remembered for netifc_timer_expired
+    if (gBS->WaitForEvent(count, events, &which) == EFI_SUCCESS) {
+        rx_waits++;
+        if (which == 0) {
+            net_timer_fired = 1;
+        }
+    }
+}
+
+// Every interface is brought up at once, then watched until the first
+// has link.  Autonegotiation runs on all of them in parallel, so one
+// cabled NIC among several costs no more than it would alone.  The
+// others are used too once they have link, or released if they don't
+// get it in LINK_WAIT_MS.
+#define MAX_NICS 32
+#define LINK_POLL_MS 10
+#define LINK_WAIT_MS 5000
+
+#define NIC_FAILED 0
+#define NIC_WAITING 1
+#define NIC_LINKED 2
+#define NIC_IN_USE 3
+
+static struct {
+    EFI_HANDLE h;
+    EFI_SIMPLE_NETWORK* snp;
+    uint64_t start; // tsc when brought up
+    uint64_t ms;    // to link, or waited without
+    int state;
+    int native;     // driven by one of ours (see pcinet.h), h is the PCI device
+} nics[MAX_NICS];
+static size_t nic_count;
+static int natives_bound;
+static uint64_t nic_watched; // tsc when still waiting ones were last checked
+
+// Look at the link again.  Returns nonzero if it is up.
+static int nic_check(size_t i) {
+    uint32_t int_sts;
+    void* tx_buf;
+
+    if (nics[i].state != NIC_WAITING) {
+        return (nics[i].state >= NIC_LINKED);
+    }
+    nics[i].ms = (rdtsc() - nics[i].start) / tsc_per_ms();
+    /* Prod the driver to cache its current status. We don't need the status or buffer,
+     * but some drivers appear to require the OPTIONAL parameters. */
+    if (EFI_ERROR(nics[i].snp->GetStatus(nics[i].snp, &int_sts, &tx_buf))) {
+        nics[i].state = NIC_FAILED;
+        return 0;
+    }
+    if (nics[i].snp->Mode->MediaPresent) {
+        nics[i].state = NIC_LINKED;
         return 1;
     }
     return 0;
 }
 
-/* Search the available network interfaces via SimpleNetworkProtocol handles
- * and find the first valid one with a Link detected */
-EFI_SIMPLE_NETWORK *netifc_find_available(void) {
+// Start a NIC just found.  Returns nonzero if it already has link.
+static int nic_start(size_t n) {
+    EFI_SIMPLE_NETWORK* cur_snp = nics[n].snp;
+    EFI_STATUS ret;
+
+    ret = cur_snp->Start(cur_snp);
+    if (EFI_ERROR(ret) && (ret != EFI_ALREADY_STARTED)) {
+        printf("net%zu: Failed to start (%s)\n", n, efi_strerror(ret));
+        return -1;
+    }
+
+    /* Additional buffer allocations shouldn't be needed */
+    ret = cur_snp->Initialize(cur_snp, 0, 0);
+    if (EFI_ERROR(ret)) {
+        printf("net%zu: Failed to initialize (%s)\n", n, efi_strerror(ret));
+        return -1;
+    }
+    nics[n].start = rdtsc();
+    nics[n].state = NIC_WAITING;
+    return nic_check(n);
+}
+
+// Take over the PCI devices our own drivers know, before the firmware's
+// drivers for them are seen as interfaces below
+static void nic_native(void) {
+    EFI_HANDLE* list;
+    UINTN count;
+
+    natives_bound = 1;
+    if (gBS->LocateHandleBuffer(ByProtocol, &PciIoProtocol, NULL, &count, &list)) {
+        return;
+    }
+    for (UINTN i = 0; (i < count) && (nic_count < MAX_NICS); i++) {
+        size_t n = nic_count;
+        if ((nics[n].snp = pcinet_bind(list[i])) == NULL) {
+            continue;
+        }
+        CHAR16 *path = HandleToString(list[i]);
+        Print(L"net%u: %s (native)\n", n, path);
+        nics[n].h = list[i];
+        nics[n].native = 1;
+        nics[n].state = NIC_FAILED;
+        nic_count++;
+        if (nic_start(n) < 0) {
+            // back to the firmware's driver, to be found again below
+            nics[n].snp->Stop(nics[n].snp);
+            pcinet_release((pcinet*)nics[n].snp);
+            nics[n].snp = NULL;
+        }
+    }
+    gBS->FreePool(list);
+}
+
+int netifc_probe(void) {
     EFI_BOOT_SERVICES* bs = gSys->BootServices;
     EFI_STATUS ret;
     EFI_SIMPLE_NETWORK *cur_snp = NULL;
-    EFI_HANDLE h[32];
-    size_t nic_cnt = 0;
+    EFI_HANDLE h[MAX_NICS];
     size_t sz = sizeof(h);
-    uint32_t int_sts;
-    void *tx_buf;
+    int linked = 0;
+
+    // measured now, before any link is timed
+    tsc_per_ms();
+
+    if (!natives_bound) {
+        nic_native();
+    }
+    for (size_t n = 0; n < nic_count; n++) {
+        if (nics[n].native) {
+            linked |= nic_check(n);
+        }
+    }
 
     /* Get the handles of all devices that provide SimpleNetworkProtocol interfaces */
     ret = bs->LocateHandle(ByProtocol, &SimpleNetworkProtocol, NULL, &sz, h);
     if (ret != EFI_SUCCESS) {
+        if (linked) {
+            return linked;
+        }
         printf("Failed to locate network interfaces (%s)\n", efi_strerror(ret));
-        return NULL;
+        return 0;
     }
 
-    nic_cnt = sz / sizeof(EFI_HANDLE);
-    printf("Found %zu network interface%c\n", nic_cnt, (nic_cnt == 1) ? ' ' : 's');
-    for (size_t i = 0; i < nic_cnt; i++) {
+    /* Start any we have not seen yet, without waiting for link on each */
+    for (size_t i = 0; i < (sz / sizeof(EFI_HANDLE)); i++) {
+        size_t n;
+        for (n = 0; n < nic_count; n++) {
+            if (nics[n].h == h[i]) {
+                break;
+            }
+        }
+        if (n < nic_count) {
+            linked |= nic_check(n);
+            continue;
+        }
+        if (nic_count == MAX_NICS) {
+            break;
+        }
         CHAR16 *path = HandleToString(h[i]);
-        Print(L"%u: %s\n", i, path);
-    }
+        Print(L"net%u: %s\n", n, path);
+        nics[n].h = h[i];
+        nics[n].state = NIC_FAILED;
+        nic_count++;
 
-    /* Iterate over our SNP list until we find one with an established link */
-    for (size_t i = 0; i < nic_cnt; i++) {
-        printf("net%zu: ", i);
         ret = bs->OpenProtocol(h[i], &SimpleNetworkProtocol, (void**)&cur_snp, gImg, NULL,
                 EFI_OPEN_PROTOCOL_EXCLUSIVE);
         if (ret) {
-            printf("Failed to open (%s)\n", efi_strerror(ret));
+            printf("net%zu: Failed to open (%s)\n", n, efi_strerror(ret));
             continue;
         }
+        nics[n].snp = cur_snp;
 
-        ret = cur_snp->Start(cur_snp);
-        if (EFI_ERROR(ret)) {
-            printf("Failed to start (%s)", efi_strerror(ret));
-            goto link_fail;
+        int r = nic_start(n);
+        if (r < 0) {
+            bs->CloseProtocol(h[i], &SimpleNetworkProtocol, gImg, NULL);
+            nics[n].snp = NULL;
+            continue;
         }
+        linked |= r;
+    }
+    return linked;
+}
 
-        /* Additional buffer allocations shouldn't be needed */
-        ret = cur_snp->Initialize(cur_snp, 0, 0);
-        if (EFI_ERROR(ret)) {
-            printf("Failed to initialize (%s)\n", efi_strerror(ret));
-            goto link_fail;
-        }
+static void nic_release(size_t i) {
+    nics[i].snp->Shutdown(nics[i].snp);
+    nics[i].snp->Stop(nics[i].snp);
+    if (!nics[i].native) {
+        gBS->CloseProtocol(nics[i].h, &SimpleNetworkProtocol, gImg, NULL);
+    }
+    nics[i].snp = NULL;
+    nics[i].state = NIC_FAILED;
+}
 
-        /* Prod the driver to cache its current status. We don't need the status or buffer,
-         * but some drivers appear to require the OPTIONAL parameters. */
-        ret = cur_snp->GetStatus(cur_snp, &int_sts, &tx_buf);
-        if (EFI_ERROR(ret)) {
-            printf("Failed to read status (%s)\n", efi_strerror(ret));
-            goto link_fail;
-        }
+// Frames the driver has dropped for want of room, if it keeps count
+static int netifc_dropped(EFI_SIMPLE_NETWORK* nic, uint64_t* dropped) {
+    EFI_NETWORK_STATISTICS stats;
+    UINTN size = sizeof(stats);
+
+    memset(&stats, 0, sizeof(stats));
+    // a counter the driver doesn't keep reads as all ones
+    if ((nic->Statistics(nic, FALSE, &size, &stats) != EFI_SUCCESS) ||
+        (stats.RxDroppedFrames == (UINT64)-1)) {
+        return -1;
+    }
+    *dropped = stats.RxDroppedFrames;
+    return 0;
+}
 
-        /* With status cached, do we have a Link detected on the netifc? */
-        if (!cur_snp->Mode->MediaPresent) {
-            printf("No link detected\n");
-            goto link_fail;
+// Start using an interface that has link
+static void nic_use(size_t i) {
+    int n = ifc_count;
+
+    if ((n == MAX_IFCS) || (ip6_init(nics[i].snp->Mode->CurrentAddress.Addr) != n)) {
+        printf("net%zu: no room for another interface\n", i);
+        nic_release(i);
+        return;
+    }
+    nics[i].state = NIC_IN_USE;
+    ifcs[n].snp = nics[i].snp;
+    ifcs[n].tx_pending = 0;
+    ifcs[n].rx_stats = (netifc_dropped(ifcs[n].snp, &ifcs[n].rx_dropped) == 0);
+    ifc_count++;
+    if (filters_installed) {
+        netifc_set_filters();
+    }
+    netifc_select(0);
+}
+
+// Take on any interface that has got link since last time, and give
+// up on those that have waited too long
+static void nic_watch(void) {
+    uint64_t now = rdtsc();
+
+    if ((now - nic_watched) < (LINK_POLL_MS * tsc_per_ms())) {
+        return;
+    }
+    nic_watched = now;
+    for (size_t i = 0; i < nic_count; i++) {
+        if (nics[i].state != NIC_WAITING) {
+            continue;
+        }
+        if (nic_check(i)) {
+            printf("net%zu: link after %ld ms, using it too\n", i, nics[i].ms);
+            nic_use(i);
+        } else if (nics[i].state == NIC_FAILED) {
+            nic_release(i);
+        } else if (nics[i].ms >= LINK_WAIT_MS) {
+            printf("net%zu: no link after %ld ms\n", i, nics[i].ms);
+            nic_release(i);
         }
+    }
+}
+
+/* Bring up every network interface and wait for the first to get a
+ * link, then use every one that has it.  Returns how many that is. */
+static int netifc_find_available(void) {
+    EFI_BOOT_SERVICES* bs = gSys->BootServices;
+    EFI_EVENT tick;
+    UINTN which;
+    size_t chosen = MAX_NICS;
 
-        printf("Link detected!\n");
-        return cur_snp;
+    netifc_probe();
+    printf("Found %zu network interface%c\n", nic_count, (nic_count == 1) ? ' ' : 's');
 
-link_fail:
-        bs->CloseProtocol(h[i], &SimpleNetworkProtocol, gImg, NULL);
-        cur_snp = NULL;
+    if (bs->CreateEvent(EVT_TIMER, 0, NULL, NULL, &tick) ||
+        bs->SetTimer(tick, TimerPeriodic, TIMER_MS(LINK_POLL_MS))) {
+        tick = NULL;
+    }
+    for (;;) {
+        int waiting = 0;
+        // give up once each has had LINK_WAIT_MS from its own start
+        for (size_t i = 0; (i < nic_count) && (chosen == MAX_NICS); i++) {
+            if (nic_check(i)) {
+                chosen = i;
+            }
+            waiting |= (nics[i].state == NIC_WAITING) && (nics[i].ms < LINK_WAIT_MS);
+        }
+        if ((chosen != MAX_NICS) || !waiting || (tick == NULL)) {
+            break;
+        }
+        bs->WaitForEvent(1, &tick, &which);
+    }
+    if (tick) {
+        bs->CloseEvent(tick);
     }
 
-    return NULL;
+    // the rest that are still waiting are looked at again by netifc_poll
+    for (size_t i = 0; i < nic_count; i++) {
+        nic_check(i);
+        switch (nics[i].state) {
+        case NIC_LINKED:
+            printf("net%zu: link after %ld ms, using it\n", i, nics[i].ms);
+            nic_use(i);
+            break;
+        case NIC_WAITING:
+            if (chosen == MAX_NICS) {
+                printf("net%zu: no link after %ld ms\n", i, nics[i].ms);
+                nic_release(i);
+            }
+            break;
+        default:
+            printf("net%zu: unusable\n", i);
+            if (nics[i].snp) {
+                nic_release(i);
+            }
+            break;
+        }
+    }
+    nic_watched = rdtsc();
+    return ifc_count;
 }
 
 int netifc_open(void) {
     EFI_BOOT_SERVICES* bs = gSys->BootServices;
-    EFI_STATUS ret;
-    int j;
 
     bs->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &net_timer);
 
-    snp = netifc_find_available();
-    if (!snp) {
-        printf("Failed to find a usable network interface\n");
+    if (eth_grow_buffers(NUM_BUFFER_PAGES)) {
+        printf("Failed to allocate net buffers\n");
         return -1;
     }
 
-    if (bs->AllocatePages(AllocateAnyPages, EfiLoaderData, NUM_BUFFER_PAGES, &eth_buffers_base)) {
-        printf("Failed to allocate net buffers\n");
+    if (netifc_find_available() == 0) {
+        printf("Failed to find a usable network interface\n");
         return -1;
     }
 
-    uint8_t* ptr = (void*)eth_buffers_base;
-    for (ret = 0; ret < (NUM_BUFFER_PAGES * 2); ret++) {
-        eth_buffer* buf = (void*)ptr;
-        buf->magic = ETH_BUFFER_MAGIC;
-        eth_put_buffer(buf);
-        ptr += 2048;
-    }
+    if (netifc_set_filters())
+        return -1;
+    filters_installed = 1;
+    return 0;
+}
 
-    ip6_init(snp->Mode->CurrentAddress.Addr);
+static int netifc_set_filters_on(void) {
+    EFI_STATUS ret;
+    unsigned j;
 
+    if (mcast_filter_count > snp->Mode->MaxMCastFilterCount) {
+        goto force_promisc;
+    }
     ret = snp->ReceiveFilters(snp,
                             EFI_SIMPLE_NETWORK_RECEIVE_UNICAST |
                                 EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST,
@@ -274,43 +685,117 @@ force_promisc:
     return 0;
 }
 
+static int netifc_set_filters(void) {
+    int cur = ifc_cur;
+    int ret = 0;
+
+    for (int n = 0; n < ifc_count; n++) {
+        netifc_select(n);
+        if (netifc_set_filters_on()) {
+            ret = -1;
+        }
+    }
+    netifc_select(cur);
+    return ret;
+}
+
 void netifc_close(void) {
+    uint64_t dropped, total = 0;
+    int stats = 0;
+
+    if (rx_bytes) {
+        printf("netifc: received %ld frames, %ld bytes at %ld.%02ld cycles per byte\n",
+               rx_frames, rx_bytes, rx_cycles / rx_bytes, (rx_cycles * 100 / rx_bytes) % 100);
+        printf("netifc: %ld.%02ld frames per busy poll, at most %ld, %ld polls at the budget of %d\n",
+               rx_frames / rx_polls, (rx_frames * 100 / rx_polls) % 100,
+               rx_most, rx_full, NETIFC_RX_BUDGET);
+    }
+    for (int n = 0; n < ifc_count; n++) {
+        if (ifcs[n].rx_stats && (netifc_dropped(ifcs[n].snp, &dropped) == 0)) {
+            total += dropped - ifcs[n].rx_dropped;
+            stats = 1;
+        }
+    }
+    if (stats) {
+        printf("netifc: %ld frames dropped by the driver\n", total);
+    }
+    printf("netifc: idle for %ld waits\n", rx_waits);
+    printf("netifc: sent from a pool of %d buffers, at most %d in use, %ld waits, %ld failed\n",
+           tx_pages * 2, tx_most, tx_waits, tx_failed);
     gBS->SetTimer(net_timer, TimerCancel, 0);
     gBS->CloseEvent(net_timer);
-    snp->Shutdown(snp);
-    snp->Stop(snp);
+    for (int n = 0; n < ifc_count; n++) {
+        ifcs[n].snp->Shutdown(ifcs[n].snp);
+        ifcs[n].snp->Stop(ifcs[n].snp);
+    }
+    for (size_t i = 0; i < nic_count; i++) {
+        if (nics[i].state == NIC_WAITING) {
+            nic_release(i);
+        }
+    }
 }
 
 int netifc_active(void) {
-    return (snp != 0);
+    return (ifc_count != 0);
 }
 
 void netifc_poll(void) {
-    UINT8 data[1514];
+    UINT8 data[ETH_MTU];
+    UINT8* frame;
     EFI_STATUS r;
     UINTN hsz, bsz;
-    UINT32 irq;
-    VOID* txdone;
-
-    if ((r = snp->GetStatus(snp, &irq, &txdone))) {
-        return;
-    }
-
-    if (txdone) {
-        eth_put_buffer(txdone);
-    }
-
-    hsz = 0;
-    bsz = sizeof(data);
-    r = snp->Receive(snp, &hsz, &bsz, data, NULL, NULL, NULL);
-    if (r != EFI_SUCCESS) {
-        return;
-    }
+    uint64_t t;
+    unsigned n, total = 0;
+
+    // Only transmit completions need GetStatus: Receive polls the ring
+    // itself.
+    eth_reap();
+    nic_watch();
+
+    for (int k = 0; k < ifc_count; k++) {
+        netifc_select(k);
+        for (n = 0; n < NETIFC_RX_BUDGET; n++) {
+            // straight into place, if the stack knows what is coming:
+            // not for the first of a poll, which is as likely as not
+            // to find nothing there
+            if ((n == 0) || ((frame = udp6_land()) == NULL)) {
+                frame = data;
+            }
+            t = rdtsc();
+            hsz = 0;
+            bsz = ETH_MTU;
+            r = snp->Receive(snp, &hsz, &bsz, frame, NULL, NULL, NULL);
+            if (r != EFI_SUCCESS) {
+                if (frame != data) {
+                    udp6_landed();
+                }
+                break;
+            }
 #if TRACE
-    printf("RX %02x:%02x:%02x:%02x:%02x:%02x < %02x:%02x:%02x:%02x:%02x:%02x %02x%02x %d\n",
-            data[0], data[1], data[2], data[3], data[4], data[5],
-            data[6], data[7], data[8], data[9], data[10], data[11],
-            data[12], data[13], (int)(bsz - hsz));
+            printf("RX %02x:%02x:%02x:%02x:%02x:%02x < %02x:%02x:%02x:%02x:%02x:%02x %02x%02x %d\n",
+                    frame[0], frame[1], frame[2], frame[3], frame[4], frame[5],
+                    frame[6], frame[7], frame[8], frame[9], frame[10], frame[11],
+                    frame[12], frame[13], (int)(bsz - hsz));
 #endif
-    eth_recv(data, bsz);
+            eth_recv(frame, bsz);
+            rx_frames++;
+            rx_bytes += bsz;
+            rx_cycles += rdtsc() - t;
+            if (frame != data) {
+                udp6_landed();
+            }
+        }
+        if (n > rx_most) {
+            rx_most = n;
+        }
+        if (n == NETIFC_RX_BUDGET) {
+            rx_full++;
+        }
+        total += n;
+    }
+    netifc_select(0);
+    rx_busy = (total != 0);
+    if (total) {
+        rx_polls++;
+    }
 }
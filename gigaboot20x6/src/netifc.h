@@ -14,6 +14,11 @@
 
 #pragma once
 
+// Bring up every network interface not yet seen, without waiting for
+// any of them.  Returns nonzero if one already has link.  netifc_open()
+// does this itself; calling it early gives autonegotiation a head start.
+int netifc_probe(void);
+
 // setup networking
 int netifc_open(void);
 
@@ -23,6 +28,18 @@ void netifc_poll(void);
 // return nonzero if interface exists
 int netifc_active(void);
 
+// Interfaces in use, each with its own link local address.  More may
+// be added as they get link.
+int netifc_count(void);
+
+// Select interface n to send on (see ip6_select()).  netifc_poll()
+// leaves interface 0 selected, after selecting each one in turn while
+// handling what it received.
+void netifc_select(int n);
+
+// MAC address of interface n, or NULL
+const void* netifc_macaddr(int n);
+
 // shut down networking
 void netifc_close(void);
 
@@ -31,3 +48,7 @@ void netifc_set_timer(uint32_t ms);
 
 // returns true once the timer has expired
 int netifc_timer_expired(void);
+
+// sleep until a frame arrives or the timer expires (at once if the
+// last netifc_poll() found frames)
+void netifc_wait(void);
@@ -18,7 +18,13 @@
 #include <string.h>
 
 #include <utils.h>
+#include <cache.h>
 #include <netboot.h>
+#include <netifc.h>
+#include <pcinet.h>
+#include <cdcnet.h>
+#include <sha256.h>
+#include <zimage.h>
 
 #define E820_IGNORE 0
 #define E820_RAM 1
@@ -399,28 +405,293 @@ static nbfile nbkernel;
 static nbfile nbramdisk;
 static nbfile nbcmdline;
 
+static uint8_t kbitmap[NB_BITMAP_SIZE(KBUFSIZE)];
+static uint8_t rbitmap[NB_BITMAP_SIZE(RBUFSIZE)];
+
+// Each file's buffer has a spare of the same size (if there was room
+// for one), and they trade places every time the file is sent, so what
+// was received last stays intact as the base of a delta transfer.
+static uint8_t* kspare;
+static uint8_t* rspare;
+
+// A chunked compressed ramdisk (see zimage.h) is expanded into a buffer
+// of its own a chunk at a time as it arrives.  If that falls through,
+// it is expanded on every processor once all of it is in, which is
+// usually while the kernel is still on its way.
+static uint8_t* xramdisk;
+static size_t xramdisk_pages;
+static size_t xramdisk_size;
+static zstream rstream;
+static unsigned rgen; // ramdisk transfers started
+static unsigned xgen; // the one xramdisk is (being) expanded from
+static int xresult;   // zimage_step() result for it
+
+static void nb_swap(nbfile* file, uint8_t** spare) {
+    uint8_t* prev = file->data;
+
+    if (*spare == NULL) {
+        return;
+    }
+    file->data = *spare;
+    file->base = prev;
+    file->base_size = file->offset;
+    *spare = prev;
+}
+
+// How long to wait at power on for a server to offer something newer
+// than what is in the cache, before booting that
+#define CACHE_WAIT_MS 2000
+
+static EFI_EVENT cache_wait;
+
+static void cache_wait_cancel(void) {
+    if (cache_wait) {
+        gBS->CloseEvent(cache_wait);
+        cache_wait = NULL;
+    }
+}
+
+static char cmdline[4096];
+static uint8_t cbitmap[NB_BITMAP_SIZE(sizeof(cmdline))];
+
+// Netbooted files kept in the cache, and the keys the device advertises
+// their hashes under, so a server can tell it to boot what it has.
+// They are cached as a set, to be booted together.
+static struct {
+    const char* name;
+    const char* key;
+    nbfile* file;
+    int restored; // put in file from the cache, and the cache not yet forgotten
+    int stale;    // restored, but part of a set since replaced; not to be booted
+} cached[] = {
+    { "kernel.bin", "kernel.bin.sha256", &nbkernel, 0, 0 },
+    { "ramdisk.bin", "ramdisk.bin.sha256", &nbramdisk, 0, 0 },
+    { "cmdline", "cmdline.sha256", &nbcmdline, 0, 0 },
+};
+#define NUM_CACHED (sizeof(cached) / sizeof(cached[0]))
+
+// file is arriving over the network, so the set it was cached with is
+// no longer one: the cache forgets all of it (at once, in case the
+// transfer never finishes), and the rest of what was restored is not to
+// be booted, though it stays in place as the base of a delta transfer
+// until it is sent too
+static void cache_invalidate(nbfile* file) {
+    for (unsigned i = 0; i < NUM_CACHED; i++) {
+        if (cached[i].file == file) {
+            cached[i].stale = 0;
+        } else if (cached[i].restored) {
+            cached[i].stale = 1;
+            cached[i].file->verified = 0;
+        }
+        if (cached[i].restored) {
+            cache_forget(cached[i].name);
+            cached[i].restored = 0;
+        }
+    }
+}
+
+// Empty the buffers of the files cache_invalidate() found stale
+static void cache_drop_stale(void) {
+    for (unsigned i = 0; i < NUM_CACHED; i++) {
+        if (!cached[i].stale) {
+            continue;
+        }
+        printf("Not booting the cached '%s', which went with other files\n", cached[i].name);
+        cached[i].file->offset = 0;
+        cached[i].stale = 0;
+        if (cached[i].file == &nbramdisk) {
+            // nor what was expanded from it
+            rgen++;
+            zstream_init(&rstream);
+        } else if (cached[i].file == &nbcmdline) {
+            cmdline[0] = 0;
+        }
+    }
+}
+
 nbfile* netboot_get_buffer(const char* name) {
+    // a server is there, and sending something
+    cache_wait_cancel();
+
     // we know these are in a buffer large enough
     // that this is safe (todo: implement strcmp)
     if (!memcmp(name, "kernel.bin", 11)) {
+        cache_invalidate(&nbkernel);
+        nb_swap(&nbkernel, &kspare);
         return &nbkernel;
     }
     if (!memcmp(name, "ramdisk.bin", 11)) {
+        cache_invalidate(&nbramdisk);
+        rgen++;
+        zstream_init(&rstream);
+        nb_swap(&nbramdisk, &rspare);
         return &nbramdisk;
     }
     if (!memcmp(name, "cmdline", 7)) {
+        cache_invalidate(&nbcmdline);
         return &nbcmdline;
     }
     return NULL;
 }
 
-static char cmdline[4096];
+static int xramdisk_alloc(EFI_BOOT_SERVICES* bs, size_t size) {
+    EFI_PHYSICAL_ADDRESS mem;
+    size_t pages = (size + 4095) / 4096;
+
+    if (pages <= xramdisk_pages) {
+        return 0;
+    }
+    if (xramdisk) {
+        bs->FreePages((EFI_PHYSICAL_ADDRESS)xramdisk, xramdisk_pages);
+        xramdisk = NULL;
+        xramdisk_pages = 0;
+    }
+    // the kernel takes a 32bit ramdisk address
+    mem = 0xFFFFFFFF;
+    if (bs->AllocatePages(AllocateMaxAddress, EfiLoaderData, pages, &mem)) {
+        printf("Failed to allocate ramdisk buffer (%ld bytes)\n", size);
+        return -1;
+    }
+    xramdisk = (void*) mem;
+    xramdisk_pages = pages;
+    return 0;
+}
+
+// nbramdisk.advance: expand a chunked ramdisk as it arrives
+static void ramdisk_advance(nbfile* file) {
+    // xramdisk may not be reallocated under the APs
+    if (zimage_busy()) {
+        return;
+    }
+    if ((zstream_feed(&rstream, file->data, file->offset) != ZSTREAM_DATA) ||
+        rstream.dst) {
+        return;
+    }
+    if (xramdisk_alloc(gBS, rstream.size)) {
+        rstream.state = ZSTREAM_ERROR;
+        return;
+    }
+    xramdisk_size = rstream.size;
+    rstream.dst = xramdisk;
+    zstream_feed(&rstream, file->data, file->offset);
+}
+
+// Start expanding a netbooted chunked ramdisk that wasn't expanded as it
+// arrived, once all of it is here, or expand some more of the one in
+// progress
+static void ramdisk_poll(EFI_BOOT_SERVICES* bs) {
+    size_t zlen, size;
+    int r;
+
+    if (zimage_busy()) {
+        if ((r = zimage_step()) != 0) {
+            xresult = r;
+        }
+        return;
+    }
+    if ((xgen == rgen) || (rstream.state == ZSTREAM_DONE) ||
+        zimage_info(nbramdisk.data, nbramdisk.offset, &zlen, &size) ||
+        (zlen == 0) || (nbramdisk.offset < zlen)) {
+        return;
+    }
+    xgen = rgen;
+    xresult = -1;
+    xramdisk_size = size;
+    if ((xramdisk_alloc(bs, size) == 0) &&
+        (zimage_start(nbramdisk.data, zlen, xramdisk) == 0)) {
+        xresult = 0;
+    }
+}
+
+// Find the ramdisk to boot with: the expanded one if a chunked ramdisk
+// was received (waiting, while still serving the network, for it to be
+// done), else what was received as is.  Returns -1 if it was chunked
+// but could not be expanded.
+static int ramdisk_ready(EFI_BOOT_SERVICES* bs, void** ramdisk, size_t* rsz) {
+    for (;;) {
+        ramdisk_poll(bs);
+        if (!zimage_busy()) {
+            break;
+        }
+        netboot_poll();
+    }
+    *ramdisk = nbramdisk.data;
+    *rsz = nbramdisk.offset;
+    if (rstream.state == ZSTREAM_DONE) {
+        *ramdisk = xramdisk;
+        *rsz = rstream.size;
+        return 0;
+    }
+    if ((xgen == 0) || (xgen != rgen)) {
+        return 0;
+    }
+    if (xresult != 1) {
+        printf("Failed to expand ramdisk\n");
+        return -1;
+    }
+    *ramdisk = xramdisk;
+    *rsz = xramdisk_size;
+    return 0;
+}
+
+// Put whatever the cache holds in the netboot buffers, as if it had
+// just been received, and start the clock on booting it
+static void cache_restore(EFI_BOOT_SERVICES* bs) {
+    char hex[SHA256_SIZE * 2 + 1];
+    int count = 0;
+
+    for (unsigned i = 0; i < NUM_CACHED; i++) {
+        nbfile* file = cached[i].file;
+        if (cache_load(cached[i].name, file->data, file->size,
+                       &file->offset, file->digest)) {
+            file->offset = 0;
+            continue;
+        }
+        file->verified = 1;
+        cached[i].restored = 1;
+        cache_hex(file->digest, hex);
+        netboot_advertise(cached[i].key, hex);
+        printf("Cached '%s' is %s (%ld bytes)\n", cached[i].name, hex, file->offset);
+        if (file == &nbramdisk) {
+            // expand it (if chunked) while we wait
+            rgen++;
+        }
+        count++;
+    }
+    if ((nbkernel.offset == 0) || (bs->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL,
+                                                   &cache_wait) != EFI_SUCCESS)) {
+        cache_wait = NULL;
+        return;
+    }
+    bs->SetTimer(cache_wait, TimerRelative, CACHE_WAIT_MS * 10000ULL);
+}
+
+// Nonzero once nobody has offered anything newer in time
+static int cache_expired(EFI_BOOT_SERVICES* bs) {
+    if ((cache_wait == NULL) || (bs->CheckEvent(cache_wait) != EFI_SUCCESS)) {
+        return 0;
+    }
+    cache_wait_cancel();
+    return 1;
+}
+
+// Keep the files the server has vouched for
+static void cache_save(void) {
+    for (unsigned i = 0; i < NUM_CACHED; i++) {
+        nbfile* file = cached[i].file;
+        if (file->verified && file->offset) {
+            cache_store(cached[i].name, file->data, file->offset, file->digest);
+        }
+    }
+}
 
 int try_local_boot(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
     UINTN ksz, rsz, csz;
+    size_t zlen, size;
     void* kernel;
     void* ramdisk;
     void* cmdline;
+    int r;
     
     if ((kernel = LoadFile(L"magenta.bin", &ksz)) == NULL) {
         printf("Failed to load 'magenta.bin' from boot media\n\n");
@@ -428,6 +699,20 @@ int try_local_boot(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
     }
     
     ramdisk = LoadFile(L"ramdisk.bin", &rsz);
+    if (ramdisk && (zimage_info(ramdisk, rsz, &zlen, &size) == 0)) {
+        if (xramdisk_alloc(sys->BootServices, size) ||
+            zimage_start(ramdisk, rsz, xramdisk)) {
+            printf("Failed to expand 'ramdisk.bin' from boot media\n\n");
+            return 0;
+        }
+        while ((r = zimage_step()) == 0)
+            ;
+        if (r < 0) {
+            return 0;
+        }
+        ramdisk = xramdisk;
+        rsz = size;
+    }
     cmdline = LoadFile(L"cmdline", &csz);
 
     boot_kernel(img, sys, kernel, ksz, ramdisk, rsz, cmdline, csz);
@@ -446,8 +731,26 @@ EFI_STATUS efi_main(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
     bs->LocateProtocol(&GraphicsOutputProtocol, NULL, (void**)&gop);
     printf("Framebuffer base is at %lx\n\n", gop->Mode->FrameBufferBase);
 
+    // the native network drivers (and the USB CDC one, which may switch
+    // a device's configuration) are used only if a "netdrv" file names
+    // them (see pcinet.h); otherwise the firmware's drive every device
+    UINTN nsz;
+    int cdcnet = 0;
+    char* netdrv = LoadFile(L"netdrv", &nsz);
+    if (netdrv) {
+        pcinet_select(netdrv, nsz);
+        cdcnet = netdrv_named(netdrv, nsz, "cdcnet");
+        bs->FreePool(netdrv);
+    }
+
+    // only bind the USB ethernet drivers if no native interface has link
     extern EFI_STATUS EFIAPI ax88772_init ( IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE * pSystemTable);
-    ax88772_init(img, sys);
+    if (!netifc_probe()) {
+        if (cdcnet) {
+            cdcnet_init(img, sys);
+        }
+        ax88772_init(img, sys);
+    }
     if (try_local_boot(img, sys) < 0) {
         goto fail;
     }
@@ -459,6 +762,7 @@ EFI_STATUS efi_main(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
     }
     nbkernel.data = (void*) mem;
     nbkernel.size = KBUFSIZE;
+    nbkernel.bitmap = kbitmap;
 
     mem = 0xFFFFFFFF;
     if (bs->AllocatePages(AllocateMaxAddress, EfiLoaderData, RBUFSIZE / 4096, &mem)) {
@@ -467,11 +771,38 @@ EFI_STATUS efi_main(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
     }
     nbramdisk.data = (void*) mem;
     nbramdisk.size = RBUFSIZE;
+    nbramdisk.bitmap = rbitmap;
+    nbramdisk.advance = ramdisk_advance;
+
+    // without a spare, a file is always sent whole
+    mem = 0xFFFFFFFF;
+    if (bs->AllocatePages(AllocateMaxAddress, EfiLoaderData, KBUFSIZE / 4096, &mem) == EFI_SUCCESS) {
+        kspare = (void*) mem;
+    }
+    mem = 0xFFFFFFFF;
+    if (bs->AllocatePages(AllocateMaxAddress, EfiLoaderData, RBUFSIZE / 4096, &mem) == EFI_SUCCESS) {
+        rspare = (void*) mem;
+    }
+
+    // without room for the leaves, blocks go unchecked until NB_VERIFY
+    mem = 0xFFFFFFFF;
+    if (bs->AllocatePages(AllocateMaxAddress, EfiLoaderData,
+                          (NB_LEAVES_SIZE(KBUFSIZE) + 4095) / 4096, &mem) == EFI_SUCCESS) {
+        nbkernel.leaves = (void*) mem;
+    }
+    mem = 0xFFFFFFFF;
+    if (bs->AllocatePages(AllocateMaxAddress, EfiLoaderData,
+                          (NB_LEAVES_SIZE(RBUFSIZE) + 4095) / 4096, &mem) == EFI_SUCCESS) {
+        nbramdisk.leaves = (void*) mem;
+    }
 
     nbcmdline.data = (void*) cmdline;
     nbcmdline.size = sizeof(cmdline);
+    nbcmdline.bitmap = cbitmap;
     cmdline[0] = 0;
 
+    cache_restore(bs);
+
     if (netboot_init()) {
         printf("Failed to initialize NetBoot\n");
         goto fail;
@@ -479,13 +810,24 @@ EFI_STATUS efi_main(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
     printf("\nNetBoot Server Started...\n\n");
     for (;;) {
         int n = netboot_poll();
+        ramdisk_poll(bs);
+        if ((n < 1) && cache_expired(bs)) {
+            printf("No netboot server answered, booting from the cache\n");
+            n = 1;
+        }
         if (n < 1) {
+            // idle: give the processor back until a frame or tick
+            if (!zimage_busy()) {
+                netboot_wait();
+            }
             continue;
         }
+        cache_drop_stale();
         if (nbkernel.offset < 32768) {
             // too small to be a kernel
             continue;
         }
+        cache_save();
         uint8_t* x = nbkernel.data;
         if ((x[0] == 'M') && (x[1] == 'Z') && (x[0x80] == 'P') && (x[0x81] == 'E')) {
             UINTN exitdatasize;
@@ -506,13 +848,18 @@ EFI_STATUS efi_main(EFI_HANDLE img, EFI_SYSTEM_TABLE* sys) {
             continue;
         }
 
+        void* ramdisk;
+        size_t rsz;
+        if (ramdisk_ready(bs, &ramdisk, &rsz)) {
+            continue;
+        }
+
         // make sure network traffic is not in flight, etc
         netboot_close();
 
         // maybe it's a kernel image?
         boot_kernel(img, sys, (void*) nbkernel.data, nbkernel.offset,
-                    (void*) nbramdisk.data, nbramdisk.offset,
-                    cmdline, sizeof(cmdline));
+                    ramdisk, rsz, cmdline, sizeof(cmdline));
         goto fail;
     }
 
@@ -0,0 +1,327 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efi.h>
+#include <efilib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils.h>
+
+#include <pcinet.h>
+
+#define ETH_HDR_LEN 14
+
+static struct {
+    const char* name;
+    EFI_SIMPLE_NETWORK* (*bind)(EFI_HANDLE h, uint16_t vendor, uint16_t device);
+    int on;
+} drivers[] = {
+    { "virtio", virtio_net_bind, 0 },
+    { "e1000", e1000_bind, 0 },
+};
+#define NUM_DRIVERS (sizeof(drivers) / sizeof(drivers[0]))
+
+static int isword(char c) {
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+           ((c >= '0') && (c <= '9'));
+}
+
+int netdrv_named(const char* names, size_t len, const char* name) {
+    size_t n = strlen(name);
+
+    for (size_t off = 0; (off + n) <= len; off++) {
+        if (!memcmp(names + off, name, n) &&
+            ((off == 0) || !isword(names[off - 1])) &&
+            (((off + n) == len) || !isword(names[off + n]))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void pcinet_select(const char* names, size_t len) {
+    for (size_t i = 0; i < NUM_DRIVERS; i++) {
+        drivers[i].on = netdrv_named(names, len, drivers[i].name);
+        printf("pcinet: %s driver %s\n", drivers[i].name, drivers[i].on ? "on" : "off");
+    }
+}
+
+EFI_SIMPLE_NETWORK* pcinet_bind(EFI_HANDLE h) {
+    EFI_SIMPLE_NETWORK* snp = NULL;
+    EFI_PCI_IO* pci;
+    uint16_t id[2];
+
+    if (gBS->OpenProtocol(h, &PciIoProtocol, (void**)&pci, gImg, NULL,
+                          EFI_OPEN_PROTOCOL_GET_PROTOCOL)) {
+        return NULL;
+    }
+    if (pci->Pci.Read(pci, EfiPciIoWidthUint16, 0, 2, id)) {
+        return NULL;
+    }
+    for (size_t i = 0; (i < NUM_DRIVERS) && (snp == NULL); i++) {
+        if (drivers[i].on) {
+            snp = drivers[i].bind(h, id[0], id[1]);
+        }
+    }
+    return snp;
+}
+
+static EFI_STATUS EFIAPI pcinet_start(EFI_SIMPLE_NETWORK* snp) {
+    pcinet* nic = (void*)snp;
+
+    if (nic->mode.State != EfiSimpleNetworkStopped) {
+        return EFI_ALREADY_STARTED;
+    }
+    nic->mode.State = EfiSimpleNetworkStarted;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI pcinet_stop(EFI_SIMPLE_NETWORK* snp) {
+    pcinet* nic = (void*)snp;
+
+    if (nic->mode.State == EfiSimpleNetworkStopped) {
+        return EFI_NOT_STARTED;
+    }
+    if (nic->mode.State == EfiSimpleNetworkInitialized) {
+        snp->Shutdown(snp);
+    }
+    nic->mode.State = EfiSimpleNetworkStopped;
+    return EFI_SUCCESS;
+}
+
+// The devices are left receiving every multicast frame, if not
+// everything (the stack drops what isn't for it), so this only keeps
+// the books netifc checks.
+static EFI_STATUS EFIAPI pcinet_filters(EFI_SIMPLE_NETWORK* snp, UINT32 enable, UINT32 disable,
+                                        BOOLEAN reset, UINTN count, EFI_MAC_ADDRESS* filters) {
+    pcinet* nic = (void*)snp;
+
+    if (nic->mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    if (((enable | disable) & ~nic->mode.ReceiveFilterMask) ||
+        (count > nic->mode.MaxMCastFilterCount) || (count && (filters == NULL))) {
+        return EFI_INVALID_PARAMETER;
+    }
+    nic->mode.ReceiveFilterSetting = (nic->mode.ReceiveFilterSetting | enable) & ~disable;
+    if (reset || !(nic->mode.ReceiveFilterSetting & EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST)) {
+        nic->mode.MCastFilterCount = 0;
+    } else if (count) {
+        memcpy(nic->mode.MCastFilter, filters, count * sizeof(EFI_MAC_ADDRESS));
+        nic->mode.MCastFilterCount = count;
+    }
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI pcinet_station(EFI_SIMPLE_NETWORK* snp, BOOLEAN reset,
+                                        EFI_MAC_ADDRESS* addr) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI pcinet_stats(EFI_SIMPLE_NETWORK* snp, BOOLEAN reset,
+                                      UINTN* size, EFI_NETWORK_STATISTICS* stats) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI pcinet_mcast(EFI_SIMPLE_NETWORK* snp, BOOLEAN ipv6,
+                                      EFI_IP_ADDRESS* ip, EFI_MAC_ADDRESS* mac) {
+    return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI pcinet_nvdata(EFI_SIMPLE_NETWORK* snp, BOOLEAN read,
+                                       UINTN off, UINTN len, VOID* buf) {
+    return EFI_UNSUPPORTED;
+}
+
+// Polled by WaitForEvent while netifc_wait sleeps: as good a time as
+// any to tell the device about frames queued since.
+static VOID EFIAPI pcinet_wait(EFI_EVENT ev, VOID* ctx) {
+    pcinet* nic = ctx;
+
+    if (nic->mode.State != EfiSimpleNetworkInitialized) {
+        return;
+    }
+    nic->flush(nic);
+    if (nic->rx_ready(nic)) {
+        gBS->SignalEvent(ev);
+    }
+}
+
+// The kernel gets the device as it would from the firmware: quiet, and
+// not writing into memory that is no longer ours
+static VOID EFIAPI pcinet_exit(EFI_EVENT ev, VOID* ctx) {
+    pcinet* nic = ctx;
+
+    if (nic->reset) {
+        nic->reset(nic);
+    }
+}
+
+int pcinet_claim(pcinet* nic, EFI_HANDLE h, const char* name) {
+    EFI_STATUS r;
+    UINT64 supports, want;
+
+    // the firmware's driver is disconnected to let us have it
+    r = gBS->OpenProtocol(h, &PciIoProtocol, (void**)&nic->pci, gImg, NULL,
+                          EFI_OPEN_PROTOCOL_EXCLUSIVE);
+    if (r) {
+        printf("%s: cannot take the device over (%s)\n", name, efi_strerror(r));
+        return -1;
+    }
+    nic->h = h;
+    nic->name = name;
+    if (nic->pci->Attributes(nic->pci, EfiPciIoAttributeOperationGet, 0, &nic->attrs) ||
+        nic->pci->Attributes(nic->pci, EfiPciIoAttributeOperationSupported, 0, &supports)) {
+        goto fail;
+    }
+    // 64 bit addressing lets transmit buffers anywhere be used in place
+    want = supports & (EFI_PCI_IO_ATTRIBUTE_IO | EFI_PCI_IO_ATTRIBUTE_MEMORY |
+                       EFI_PCI_IO_ATTRIBUTE_BUS_MASTER | EFI_PCI_IO_ATTRIBUTE_DUAL_ADDRESS_CYCLE);
+    if (nic->pci->Attributes(nic->pci, EfiPciIoAttributeOperationEnable, want, NULL)) {
+        goto fail;
+    }
+    if (gBS->CreateEvent(EVT_NOTIFY_WAIT, TPL_NOTIFY, pcinet_wait, nic,
+                         &nic->snp.WaitForPacket)) {
+        nic->pci->Attributes(nic->pci, EfiPciIoAttributeOperationSet, nic->attrs, NULL);
+        goto fail;
+    }
+    if (gBS->CreateEvent(EVT_SIGNAL_EXIT_BOOT_SERVICES, TPL_NOTIFY, pcinet_exit, nic,
+                         &nic->exit_ev)) {
+        gBS->CloseEvent(nic->snp.WaitForPacket);
+        nic->pci->Attributes(nic->pci, EfiPciIoAttributeOperationSet, nic->attrs, NULL);
+        goto fail;
+    }
+
+    nic->snp.Revision = EFI_SIMPLE_NETWORK_INTERFACE_REVISION;
+    nic->snp.Start = pcinet_start;
+    nic->snp.Stop = pcinet_stop;
+    nic->snp.ReceiveFilters = pcinet_filters;
+    nic->snp.StationAddress = pcinet_station;
+    nic->snp.Statistics = pcinet_stats;
+    nic->snp.MCastIpToMac = pcinet_mcast;
+    nic->snp.NvData = pcinet_nvdata;
+    nic->snp.Mode = &nic->mode;
+
+    nic->mode.State = EfiSimpleNetworkStopped;
+    nic->mode.HwAddressSize = 6;
+    nic->mode.MediaHeaderSize = ETH_HDR_LEN;
+    nic->mode.MaxPacketSize = 1500;
+    nic->mode.NvRamSize = 0;
+    nic->mode.NvRamAccessSize = 0;
+    nic->mode.ReceiveFilterMask = EFI_SIMPLE_NETWORK_RECEIVE_UNICAST |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_BROADCAST |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS |
+                                  EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST;
+    nic->mode.ReceiveFilterSetting = 0;
+    nic->mode.MaxMCastFilterCount = MAX_MCAST_FILTER_CNT;
+    nic->mode.MCastFilterCount = 0;
+    nic->mode.IfType = 1; // ethernet
+    nic->mode.MacAddressChangeable = FALSE;
+    nic->mode.MultipleTxSupported = TRUE;
+    nic->mode.MediaPresentSupported = TRUE;
+    nic->mode.MediaPresent = FALSE;
+    memset(&nic->mode.BroadcastAddress, 0xff, 6);
+    return 0;
+
+fail:
+    printf("%s: cannot set the device up\n", name);
+    gBS->CloseProtocol(h, &PciIoProtocol, gImg, NULL);
+    gBS->ConnectController(h, NULL, NULL, TRUE);
+    return -1;
+}
+
+void pcinet_release(pcinet* nic) {
+    gBS->CloseEvent(nic->exit_ev);
+    gBS->CloseEvent(nic->snp.WaitForPacket);
+    nic->pci->Attributes(nic->pci, EfiPciIoAttributeOperationSet, nic->attrs, NULL);
+    gBS->CloseProtocol(nic->h, &PciIoProtocol, gImg, NULL);
+    gBS->ConnectController(nic->h, NULL, NULL, TRUE);
+}
+
+int pcinet_alloc(pcinet* nic, size_t len, void** host, UINT64* dma) {
+    UINTN pages = (len + 4095) / 4096;
+    UINTN sz = pages * 4096;
+    EFI_PHYSICAL_ADDRESS addr;
+    void* map;
+
+    if (nic->pci->AllocateBuffer(nic->pci, AllocateAnyPages, EfiBootServicesData,
+                                 pages, host, 0)) {
+        return -1;
+    }
+    // never unmapped or freed: boot services going away takes it back
+    if (nic->pci->Map(nic->pci, EfiPciIoOperationBusMasterCommonBuffer, *host, &sz,
+                      &addr, &map) || (sz != (pages * 4096))) {
+        nic->pci->FreeBuffer(nic->pci, pages, *host);
+        return -1;
+    }
+    memset(*host, 0, pages * 4096);
+    *dma = addr;
+    return 0;
+}
+
+int pcinet_map(pcinet* nic, void* buf, size_t len, UINT64* dma, void** map) {
+    UINTN sz = len;
+    EFI_PHYSICAL_ADDRESS addr;
+
+    if (nic->pci->Map(nic->pci, EfiPciIoOperationBusMasterRead, buf, &sz, &addr, map)) {
+        return -1;
+    }
+    if (sz != len) {
+        nic->pci->Unmap(nic->pci, *map);
+        return -1;
+    }
+    *dma = addr;
+    return 0;
+}
+
+void pcinet_unmap(pcinet* nic, void* map) {
+    nic->pci->Unmap(nic->pci, map);
+}
+
+EFI_STATUS pcinet_header(pcinet* nic, UINTN hsz, UINTN bsz, void* buf,
+                         EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    uint8_t* hdr = buf;
+
+    if (hsz == 0) {
+        return EFI_SUCCESS;
+    }
+    if ((hsz != ETH_HDR_LEN) || (bsz < hsz) || (dst == NULL) || (proto == NULL)) {
+        return EFI_INVALID_PARAMETER;
+    }
+    memcpy(hdr, dst, 6);
+    memcpy(hdr + 6, src ? src : &nic->mode.CurrentAddress, 6);
+    hdr[12] = *proto >> 8;
+    hdr[13] = *proto;
+    return EFI_SUCCESS;
+}
+
+void pcinet_rxinfo(const uint8_t* frame, UINTN* hsz,
+                   EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    if (hsz) {
+        *hsz = ETH_HDR_LEN;
+    }
+    if (dst) {
+        memset(dst, 0, sizeof(*dst));
+        memcpy(dst, frame, 6);
+    }
+    if (src) {
+        memset(src, 0, sizeof(*src));
+        memcpy(src, frame + 6, 6);
+    }
+    if (proto) {
+        *proto = (frame[12] << 8) | frame[13];
+    }
+}
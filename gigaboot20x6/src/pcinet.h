@@ -0,0 +1,84 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Native drivers for PCI network devices the firmware would otherwise
+// drive.  A device one of them takes over is presented to netifc as a
+// simple network protocol of its own, used just as the firmware's would
+// be, but Receive takes frames straight off a ring kept full of buffers,
+// and Transmit queues the caller's buffer and returns at once.
+
+typedef struct pcinet_t pcinet;
+struct pcinet_t {
+    EFI_SIMPLE_NETWORK snp; // first, so This is the pcinet too
+    EFI_SIMPLE_NETWORK_MODE mode;
+    EFI_HANDLE h;
+    EFI_PCI_IO* pci;
+    UINT64 attrs; // as found, put back on release
+    const char* name;
+    EFI_EVENT exit_ev; // signalled by ExitBootServices
+
+    // Is a frame waiting?  Polled by the WaitForPacket event.
+    int (*rx_ready)(pcinet* nic);
+    // Tell the device about anything queued and not yet told
+    void (*flush)(pcinet* nic);
+    // Stop the device and all its DMA.  Also called when the boot
+    // services exit (whether or not netifc closed the interface), so
+    // it may do nothing but touch the device's registers and stall.
+    void (*reset)(pcinet* nic);
+};
+
+// Nonzero if the len bytes at names (the netdrv file: words separated
+// by anything but letters and digits) name the driver name
+int netdrv_named(const char* names, size_t len, const char* name);
+
+// Use only the drivers named in the len bytes at names.  None are used
+// unless this is called, naming them, before netifc_probe().
+void pcinet_select(const char* names, size_t len);
+
+// If one of the drivers selected knows the PCI device at h, take it
+// from the firmware and return the simple network protocol that now
+// drives it, else NULL.
+EFI_SIMPLE_NETWORK* pcinet_bind(EFI_HANDLE h);
+
+// For the drivers: open the device at h exclusively (disconnecting the
+// firmware's driver), enable it to master the bus, arrange for reset
+// to be called at ExitBootServices, and fill in the parts of the
+// protocol they all share.  Returns 0 on success.
+int pcinet_claim(pcinet* nic, EFI_HANDLE h, const char* name);
+
+// Give the device back to the firmware
+void pcinet_release(pcinet* nic);
+
+// Memory both the processor and the device use (rings, receive
+// buffers), zeroed.  Returns 0 with its device address in *dma.
+int pcinet_alloc(pcinet* nic, size_t len, void** host, UINT64* dma);
+
+// Make len bytes at buf readable by the device until pcinet_unmap().
+// Returns 0 with its device address in *dma.
+int pcinet_map(pcinet* nic, void* buf, size_t len, UINT64* dma, void** map);
+void pcinet_unmap(pcinet* nic, void* map);
+
+// Fill in the media header of a frame Transmit is asked to build
+EFI_STATUS pcinet_header(pcinet* nic, UINTN hsz, UINTN bsz, void* buf,
+                         EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto);
+
+// Answer what Receive is asked about a frame, besides its length
+void pcinet_rxinfo(const uint8_t* frame, UINTN* hsz,
+                   EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto);
+
+// The drivers, each of which returns NULL for a device it doesn't know
+EFI_SIMPLE_NETWORK* virtio_net_bind(EFI_HANDLE h, uint16_t vendor, uint16_t device);
+EFI_SIMPLE_NETWORK* e1000_bind(EFI_HANDLE h, uint16_t vendor, uint16_t device);
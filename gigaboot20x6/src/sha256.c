@@ -0,0 +1,245 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "sha256.h"
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Hash count 64 byte blocks into h
+static void sha256_blocks_c(uint32_t h[8], const uint8_t* p, size_t count) {
+    uint32_t w[64];
+
+    while (count--) {
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+
+        for (int i = 0; i < 16; i++) {
+            w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) |
+                   ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = k + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+                          K[i] + w[i];
+            uint32_t t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += k;
+        p += 64;
+    }
+}
+
+#if defined(__x86_64__)
+// The same with the SHA extensions, four rounds at a time.  This is the
+// usual arrangement of the state: ABEF and CDGH in two registers.
+// Written with the compiler's builtins, as osboot has no intrinsics
+// headers.
+typedef int v4si __attribute__((vector_size(16)));
+typedef long long v2di __attribute__((vector_size(16)));
+typedef short v8hi __attribute__((vector_size(16)));
+typedef char v16qi __attribute__((vector_size(16)));
+
+#define SHA_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#define SHA_FEATURES (CPU_SHA | CPU_SSE41 | CPU_SSSE3)
+
+SHA_TARGET static inline v4si load128(const void* p) {
+    v4si x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+SHA_TARGET static void sha256_blocks_ni(uint32_t h[8], const uint8_t* p, size_t count) {
+    const v16qi bswap = { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 };
+    v4si state0, state1, tmp, msg, w[4];
+
+    tmp = __builtin_ia32_pshufd(load128(h), 0xB1);     // CDAB
+    state1 = __builtin_ia32_pshufd(load128(h + 4), 0x1B); // EFGH
+    state0 = (v4si)__builtin_ia32_palignr128((v2di)tmp, (v2di)state1, 64); // ABEF
+    state1 = (v4si)__builtin_ia32_pblendw128((v8hi)state1, (v8hi)tmp, 0xF0); // CDGH
+
+    while (count--) {
+        v4si abef = state0, cdgh = state1;
+
+        for (int g = 0; g < 16; g++) {
+            if (g < 4) {
+                w[g] = (v4si)__builtin_ia32_pshufb128((v16qi)load128(p + g * 16), bswap);
+            } else {
+                // w[t] = s1(w[t-2]) + w[t-7] + s0(w[t-15]) + w[t-16]
+                v4si t7 = (v4si)__builtin_ia32_palignr128((v2di)w[(g - 1) & 3],
+                                                          (v2di)w[(g - 2) & 3], 32);
+                w[g & 3] = __builtin_ia32_sha256msg2(
+                    __builtin_ia32_sha256msg1(w[g & 3], w[(g - 3) & 3]) + t7, w[(g - 1) & 3]);
+            }
+            msg = w[g & 3] + load128(K + g * 4);
+            state1 = __builtin_ia32_sha256rnds2(state1, state0, msg);
+            msg = __builtin_ia32_pshufd(msg, 0x0E);
+            state0 = __builtin_ia32_sha256rnds2(state0, state1, msg);
+        }
+        state0 += abef;
+        state1 += cdgh;
+        p += 64;
+    }
+
+    tmp = __builtin_ia32_pshufd(state0, 0x1B);    // FEBA
+    state1 = __builtin_ia32_pshufd(state1, 0xB1); // DCHG
+    state0 = (v4si)__builtin_ia32_pblendw128((v8hi)tmp, (v8hi)state1, 0xF0); // DCBA
+    state1 = (v4si)__builtin_ia32_palignr128((v2di)state1, (v2di)tmp, 64);   // HGFE
+    memcpy(h, &state0, 16);
+    memcpy(h + 4, &state1, 16);
+}
+#endif
+
+static void (*sha256_blocks)(uint32_t h[8], const uint8_t* p, size_t count);
+
+int sha256_accel(int enable) {
+    sha256_blocks = sha256_blocks_c;
+#if defined(__x86_64__)
+    if (enable && ((cpu_features() & SHA_FEATURES) == SHA_FEATURES)) {
+        sha256_blocks = sha256_blocks_ni;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+void sha256_init(sha256_ctx* ctx) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    if (sha256_blocks == 0) {
+        sha256_accel(1);
+    }
+    memcpy(ctx->h, iv, sizeof(iv));
+    ctx->len = 0;
+}
+
+void sha256_update(sha256_ctx* ctx, const void* data, size_t len) {
+    const uint8_t* p = data;
+    size_t used = ctx->len % 64;
+
+    ctx->len += len;
+    if (used) {
+        size_t n = 64 - used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->buf + used, p, n);
+        p += n;
+        len -= n;
+        if ((used + n) < 64) {
+            return;
+        }
+        sha256_blocks(ctx->h, ctx->buf, 1);
+    }
+    sha256_blocks(ctx->h, p, len / 64);
+    memcpy(ctx->buf, p + (len & ~(size_t)63), len % 64);
+}
+
+void sha256_final(sha256_ctx* ctx, uint8_t digest[SHA256_SIZE]) {
+    uint64_t bits = ctx->len * 8;
+    size_t used = ctx->len % 64;
+
+    ctx->buf[used++] = 0x80;
+    if (used > 56) {
+        memset(ctx->buf + used, 0, 64 - used);
+        sha256_blocks(ctx->h, ctx->buf, 1);
+        used = 0;
+    }
+    memset(ctx->buf + used, 0, 56 - used);
+    for (int i = 0; i < 8; i++) {
+        ctx->buf[56 + i] = bits >> (56 - i * 8);
+    }
+    sha256_blocks(ctx->h, ctx->buf, 1);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = ctx->h[i] >> 24;
+        digest[i * 4 + 1] = ctx->h[i] >> 16;
+        digest[i * 4 + 2] = ctx->h[i] >> 8;
+        digest[i * 4 + 3] = ctx->h[i];
+    }
+}
+
+void sha256(const void* data, size_t len, uint8_t digest[SHA256_SIZE]) {
+    sha256_ctx ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, digest);
+}
+
+void merkle_leaf(const void* data, size_t len, uint8_t hash[SHA256_SIZE]) {
+    static const uint8_t prefix = 0;
+    sha256_ctx ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, 1);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, hash);
+}
+
+void merkle_root(const uint8_t* leaves, size_t count, uint8_t root[SHA256_SIZE]) {
+    static const uint8_t prefix = 1;
+    uint8_t left[SHA256_SIZE], right[SHA256_SIZE];
+    sha256_ctx ctx;
+    size_t k = 1;
+
+    if (count == 1) {
+        memcpy(root, leaves, SHA256_SIZE);
+        return;
+    }
+    while ((k * 2) < count) {
+        k *= 2;
+    }
+    merkle_root(leaves, k, left);
+    merkle_root(leaves + k * SHA256_SIZE, count - k, right);
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, 1);
+    sha256_update(&ctx, left, SHA256_SIZE);
+    sha256_update(&ctx, right, SHA256_SIZE);
+    sha256_final(&ctx, root);
+}
@@ -0,0 +1,45 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// SHA-256 (FIPS 180-4)
+
+#define SHA256_SIZE 32
+
+typedef struct sha256_ctx_t {
+    uint32_t h[8];
+    uint64_t len;     // bytes hashed so far
+    uint8_t buf[64];  // partial block
+} sha256_ctx;
+
+// Use the SHA extensions if enable is set and the processor has them,
+// else the portable code.  Returns nonzero if they are in use.  The
+// first sha256_init() picks them when available.
+int sha256_accel(int enable);
+
+void sha256_init(sha256_ctx* ctx);
+void sha256_update(sha256_ctx* ctx, const void* data, size_t len);
+void sha256_final(sha256_ctx* ctx, uint8_t digest[SHA256_SIZE]);
+
+// The digest of len bytes at data, in one go
+void sha256(const void* data, size_t len, uint8_t digest[SHA256_SIZE]);
+
+// Merkle tree hashes as RFC 6962 defines them: a leaf is the SHA-256 of
+// 0x00 and its data, a node that of 0x01 and its two children, and a
+// tree of n > 1 leaves splits at the largest power of two below n.
+void merkle_leaf(const void* data, size_t len, uint8_t hash[SHA256_SIZE]);
+
+// Root of the tree over count (at least one) leaf hashes
+void merkle_root(const uint8_t* leaves, size_t count, uint8_t root[SHA256_SIZE]);
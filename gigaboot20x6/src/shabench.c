@@ -0,0 +1,206 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// SHA-256, portable and with the SHA extensions.  First both have to
+// give the FIPS 180-2 digests of its examples, and the same digests as
+// each other for messages of every length up to a few blocks, whether
+// hashed at once or fed in pieces.  Then the throughput of both over
+// messages of a few sizes, and of the Merkle leaf hashes a device
+// checks every netboot block against.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <stdint.h>
+
+#include "sha256.h"
+
+static char* appname;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// FIPS 180-2, appendix B
+static const struct {
+    const char* msg;
+    size_t repeat;
+    const char* hex;
+} vectors[] = {
+    { "abc", 1,
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { "a", 1000000,
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+};
+
+static void hex(const uint8_t* digest, char* out) {
+    for (int i = 0; i < SHA256_SIZE; i++) {
+        sprintf(out + i * 2, "%02x", digest[i]);
+    }
+}
+
+// Returns nonzero if the implementation sha256_accel() last chose gets
+// any of the FIPS examples wrong
+static int check_vectors(const char* impl) {
+    char out[SHA256_SIZE * 2 + 1];
+    uint8_t digest[SHA256_SIZE];
+    sha256_ctx ctx;
+    int bad = 0;
+
+    for (size_t i = 0; i < (sizeof(vectors) / sizeof(vectors[0])); i++) {
+        sha256_init(&ctx);
+        for (size_t n = 0; n < vectors[i].repeat; n++) {
+            sha256_update(&ctx, vectors[i].msg, strlen(vectors[i].msg));
+        }
+        sha256_final(&ctx, digest);
+        hex(digest, out);
+        if (strcmp(out, vectors[i].hex)) {
+            printf("FAIL: %s: example %zu hashes to %s\n", impl, i + 1, out);
+            bad = 1;
+        }
+    }
+    return bad;
+}
+
+// Returns nonzero if the SHA extensions and the portable code disagree
+// about any message of up to len bytes at data, or its Merkle leaf
+static int check_same(const uint8_t* data, size_t len) {
+    uint8_t ni[SHA256_SIZE], c[SHA256_SIZE];
+    sha256_ctx ctx;
+
+    for (size_t n = 0; n <= len; n++) {
+        sha256_accel(1);
+        sha256(data, n, ni);
+        sha256_accel(0);
+        sha256(data, n, c);
+        if (memcmp(ni, c, SHA256_SIZE)) {
+            printf("FAIL: %zu byte message hashes differently\n", n);
+            return 1;
+        }
+        // in pieces of every size, so that some straddle block boundaries
+        sha256_accel(1);
+        sha256_init(&ctx);
+        for (size_t off = 0; off < n; off += (n % 67) + 1) {
+            size_t piece = n - off;
+            if (piece > (n % 67) + 1) {
+                piece = (n % 67) + 1;
+            }
+            sha256_update(&ctx, data + off, piece);
+        }
+        sha256_final(&ctx, ni);
+        if (memcmp(ni, c, SHA256_SIZE)) {
+            printf("FAIL: %zu byte message hashes differently in pieces\n", n);
+            return 1;
+        }
+        merkle_leaf(data, n, ni);
+        sha256_accel(0);
+        merkle_leaf(data, n, c);
+        if (memcmp(ni, c, SHA256_SIZE)) {
+            printf("FAIL: %zu byte block has a different Merkle leaf\n", n);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void usage(void) {
+    fprintf(stderr,
+            "usage:   %s [ <option> ]*\n"
+            "\n"
+            "options: -b <n>  netboot block size in bytes (default 1436)\n"
+            "         -s <n>  megabytes of data to run through each test (default 256)\n",
+            appname);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    static const size_t sizes[] = { 64, 1024, 8192, 1024 * 1024 };
+    size_t len = 1436, total = 256;
+    uint8_t digest[SHA256_SIZE];
+    uint8_t* data;
+    uint64_t t;
+
+    appname = argv[0];
+    while (argc > 1) {
+        if (argc < 3)
+            usage();
+        if (!strcmp(argv[1], "-b")) {
+            len = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-s")) {
+            total = atoi(argv[2]);
+        } else {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if ((len < 1) || (total < 1))
+        usage();
+
+    total <<= 20;
+    if ((data = malloc(total)) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return 1;
+    }
+    srand(1);
+    for (size_t n = 0; n < total; n++) {
+        data[n] = rand();
+    }
+
+    sha256_accel(0);
+    if (check_vectors("portable")) {
+        return 1;
+    }
+    if (sha256_accel(1)) {
+        if (check_vectors("sha-ni") || check_same(data, (total < 1024) ? total : 1024)) {
+            return 1;
+        }
+        printf("sha-ni and portable agree, with each other and with FIPS 180-2\n");
+    } else {
+        printf("portable matches FIPS 180-2\n");
+    }
+
+    for (int accel = 0; accel < 2; accel++) {
+        if (sha256_accel(accel) != accel) {
+            printf("sha-ni:   not supported by this processor\n");
+            break;
+        }
+        for (size_t i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+            size_t count = total / sizes[i];
+            t = now_ns();
+            for (size_t n = 0; n < count; n++) {
+                sha256(data + n * sizes[i], sizes[i], digest);
+            }
+            t = now_ns() - t;
+            printf("%s %7zu byte messages: %8.1f MB/s\n",
+                   accel ? "sha-ni:  " : "portable:", sizes[i], (count * sizes[i]) / (t / 1e3));
+        }
+        t = now_ns();
+        for (size_t off = 0; off < total; off += len) {
+            merkle_leaf(data + off, ((total - off) < len) ? (total - off) : len, digest);
+        }
+        t = now_ns() - t;
+        printf("%s %7zu byte blocks:   %8.1f MB/s as Merkle leaves, %.2f us per block\n",
+               accel ? "sha-ni:  " : "portable:", len, total / (t / 1e3),
+               t / 1e3 / ((total + len - 1) / len));
+    }
+    free(data);
+    return 0;
+}
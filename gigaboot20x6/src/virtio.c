@@ -0,0 +1,699 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Virtio network devices, legacy or virtio 1.0 ("modern") PCI, driven by
+// polling their two queues: receive (0) and transmit (1).  Every frame
+// takes a pair of descriptors, the virtio header and then the frame, so
+// each pair is set up once and only its head goes on the available ring.
+// The device is told about new buffers only every so many, or when the
+// rings are next looked at and found idle, rather than for every frame:
+// each time costs a trip out of the guest.
+
+#include <efi.h>
+#include <efilib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils.h>
+
+#include <pcinet.h>
+
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_NET_LEGACY 0x1000 // or transitional
+#define VIRTIO_NET_MODERN 0x1041
+
+#define VS_ACKNOWLEDGE 0x01
+#define VS_DRIVER 0x02
+#define VS_DRIVER_OK 0x04
+#define VS_FEATURES_OK 0x08
+
+#define VF_NET_MAC (1ULL << 5)
+#define VF_NET_STATUS (1ULL << 16)
+#define VF_VERSION_1 (1ULL << 32)
+
+#define VNET_S_LINK_UP 1
+
+// legacy registers, in I/O BAR 0
+#define VL_HOST_FEATURES 0x00
+#define VL_GUEST_FEATURES 0x04
+#define VL_QUEUE_PFN 0x08
+#define VL_QUEUE_NUM 0x0c
+#define VL_QUEUE_SEL 0x0e
+#define VL_QUEUE_NOTIFY 0x10
+#define VL_STATUS 0x12
+#define VL_CONFIG 0x14 // with MSI-X off, as the firmware leaves it
+
+// modern common configuration
+#define VM_DFSELECT 0x00
+#define VM_DF 0x04
+#define VM_GFSELECT 0x08
+#define VM_GF 0x0c
+#define VM_STATUS 0x14
+#define VM_QUEUE_SEL 0x16
+#define VM_QUEUE_SIZE 0x18
+#define VM_QUEUE_ENABLE 0x1c
+#define VM_QUEUE_NOFF 0x1e
+#define VM_QUEUE_DESC 0x20
+#define VM_QUEUE_AVAIL 0x28
+#define VM_QUEUE_USED 0x30
+
+// modern capabilities (PCI vendor specific ones)
+#define PCI_CAP_VENDOR 0x09
+#define VCAP_COMMON 1
+#define VCAP_NOTIFY 2
+#define VCAP_DEVICE 4
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc;
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2
+
+typedef struct {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[0];
+} vring_avail;
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} vring_used_elem;
+
+typedef struct {
+    volatile uint16_t flags;
+    volatile uint16_t idx;
+    vring_used_elem ring[0];
+} vring_used;
+
+#define VRING_USED_F_NO_NOTIFY 1
+
+// A legacy device's queues can't be made smaller than it says, but a
+// modern one's are cut down to VQ_SIZE.  Either way only so many
+// buffers are posted: enough to cover a window or two of blocks.
+#define VQ_MAX 1024
+#define VQ_SIZE 512
+#define VNET_RX_SLOTS 256
+#define VNET_TX_SLOTS 128
+#define VNET_BUF_SIZE 2048
+#define VNET_BUF_DATA 16 // frame offset in a receive buffer, after the header
+
+// Buffers made available before the device is told, at most
+#define RX_KICK 32
+#define TX_KICK 16
+
+typedef struct {
+    vring_desc* desc;
+    vring_avail* avail;
+    vring_used* used;
+    uint16_t size;       // descriptors, a power of two
+    uint16_t index;      // queue number
+    uint16_t avail_idx;  // next available ring entry
+    uint16_t used_idx;   // next used ring entry to look at
+    unsigned unkicked;   // made available since the device was last told
+    uint64_t notify;     // where to tell it, modern only
+    UINT64 dma;          // device address of the rings
+    uint64_t kicks;
+} vqueue;
+
+typedef struct {
+    pcinet nic;
+    int modern;
+    uint8_t common_bar, notify_bar, device_bar;
+    uint32_t common, notify, device, notify_mult;
+    uint64_t features;
+    uint32_t hdr_len;
+    vqueue rx, tx;
+    unsigned rx_slots;
+    unsigned tx_slots;
+    uint8_t* rx_bufs;
+    UINT64 rx_dma;
+    void* tx_hdr_mem; // a zeroed header per transmit slot
+    UINT64 tx_hdrs;
+    void* tx_buf[VNET_TX_SLOTS];
+    void* tx_map[VNET_TX_SLOTS];
+    uint16_t tx_free[VNET_TX_SLOTS];
+    unsigned tx_nfree;
+    uint64_t rx_frames;
+    uint64_t tx_frames;
+} vnet;
+
+#define wmb() __asm__ __volatile__("" ::: "memory")
+#define rmb() __asm__ __volatile__("" ::: "memory")
+#define mb() __asm__ __volatile__("mfence" ::: "memory")
+
+// Common configuration: a legacy device's I/O BAR, or a modern one's
+// capability.
+static uint32_t vnet_rd(vnet* dev, uint32_t reg, EFI_PCI_IO_PROTOCOL_WIDTH w) {
+    EFI_PCI_IO* pci = dev->nic.pci;
+    uint32_t v = 0;
+
+    if (dev->modern) {
+        pci->Mem.Read(pci, w, dev->common_bar, dev->common + reg, 1, &v);
+    } else {
+        pci->Io.Read(pci, w, 0, reg, 1, &v);
+    }
+    return v;
+}
+
+static void vnet_wr(vnet* dev, uint32_t reg, EFI_PCI_IO_PROTOCOL_WIDTH w, uint32_t v) {
+    EFI_PCI_IO* pci = dev->nic.pci;
+
+    if (dev->modern) {
+        pci->Mem.Write(pci, w, dev->common_bar, dev->common + reg, 1, &v);
+    } else {
+        pci->Io.Write(pci, w, 0, reg, 1, &v);
+    }
+}
+
+// Device specific configuration (the MAC address and link status)
+static void vnet_config(vnet* dev, uint32_t off, size_t len, void* data) {
+    EFI_PCI_IO* pci = dev->nic.pci;
+
+    if (dev->modern) {
+        pci->Mem.Read(pci, EfiPciIoWidthUint8, dev->device_bar, dev->device + off, len, data);
+    } else {
+        pci->Io.Read(pci, EfiPciIoWidthUint8, 0, VL_CONFIG + off, len, data);
+    }
+}
+
+static void vnet_set_status(vnet* dev, uint8_t status) {
+    vnet_wr(dev, dev->modern ? VM_STATUS : VL_STATUS, EfiPciIoWidthUint8, status);
+}
+
+static uint8_t vnet_status(vnet* dev) {
+    return vnet_rd(dev, dev->modern ? VM_STATUS : VL_STATUS, EfiPciIoWidthUint8);
+}
+
+// Stop the device, and with it all DMA
+static void vnet_reset(vnet* dev) {
+    vnet_set_status(dev, 0);
+    for (int n = 0; (n < 1000) && vnet_status(dev); n++) {
+        gBS->Stall(10);
+    }
+}
+
+static uint64_t vnet_features(vnet* dev) {
+    uint64_t f;
+
+    if (!dev->modern) {
+        return vnet_rd(dev, VL_HOST_FEATURES, EfiPciIoWidthUint32);
+    }
+    vnet_wr(dev, VM_DFSELECT, EfiPciIoWidthUint32, 0);
+    f = vnet_rd(dev, VM_DF, EfiPciIoWidthUint32);
+    vnet_wr(dev, VM_DFSELECT, EfiPciIoWidthUint32, 1);
+    return f | ((uint64_t)vnet_rd(dev, VM_DF, EfiPciIoWidthUint32) << 32);
+}
+
+// Find the modern device's configuration structures.  Returns 0 if
+// it has them all.
+static int vnet_caps(vnet* dev) {
+    EFI_PCI_IO* pci = dev->nic.pci;
+    uint16_t status = 0;
+    uint8_t ptr = 0;
+    uint8_t cap[20];
+    int found = 0;
+
+    if (pci->Pci.Read(pci, EfiPciIoWidthUint16, 0x06, 1, &status) || !(status & 0x10) ||
+        pci->Pci.Read(pci, EfiPciIoWidthUint8, 0x34, 1, &ptr)) {
+        return -1;
+    }
+    for (int n = 0; (ptr >= 0x40) && (n < 48); n++) {
+        ptr &= ~3;
+        if (pci->Pci.Read(pci, EfiPciIoWidthUint8, ptr, 4, cap)) {
+            break;
+        }
+        if ((cap[0] == PCI_CAP_VENDOR) && (cap[2] >= 16) &&
+            (pci->Pci.Read(pci, EfiPciIoWidthUint8, ptr, (cap[2] < 20) ? cap[2] : 20, cap) == 0)) {
+            uint32_t off = cap[8] | (cap[9] << 8) | (cap[10] << 16) | ((uint32_t)cap[11] << 24);
+            // the first of each kind is the one to use
+            if ((cap[3] == VCAP_COMMON) && !(found & 1)) {
+                dev->common_bar = cap[4];
+                dev->common = off;
+                found |= 1;
+            } else if ((cap[3] == VCAP_NOTIFY) && !(found & 2) && (cap[2] >= 20)) {
+                dev->notify_bar = cap[4];
+                dev->notify = off;
+                dev->notify_mult = cap[16] | (cap[17] << 8) | (cap[18] << 16) |
+                                   ((uint32_t)cap[19] << 24);
+                found |= 2;
+            } else if ((cap[3] == VCAP_DEVICE) && !(found & 4)) {
+                dev->device_bar = cap[4];
+                dev->device = off;
+                found |= 4;
+            }
+        }
+        ptr = cap[1];
+    }
+    return (found == 7) ? 0 : -1;
+}
+
+// Tell the device about buffers made available since it was last
+// told, unless it has said it is looking anyway
+static void vq_kick(vnet* dev, vqueue* q) {
+    EFI_PCI_IO* pci = dev->nic.pci;
+    uint16_t index = q->index;
+
+    if (q->unkicked == 0) {
+        return;
+    }
+    q->unkicked = 0;
+    // the new index has to be out before the flags are looked at
+    mb();
+    if (q->used->flags & VRING_USED_F_NO_NOTIFY) {
+        return;
+    }
+    q->kicks++;
+    if (dev->modern) {
+        pci->Mem.Write(pci, EfiPciIoWidthUint16, dev->notify_bar, q->notify, 1, &index);
+    } else {
+        pci->Io.Write(pci, EfiPciIoWidthUint16, 0, VL_QUEUE_NOTIFY, 1, &index);
+    }
+}
+
+static void vq_post(vqueue* q, uint16_t head) {
+    q->avail->ring[q->avail_idx & (q->size - 1)] = head;
+    q->avail_idx++;
+    // the entry has to be out before the index that covers it
+    wmb();
+    q->avail->idx = q->avail_idx;
+    q->unkicked++;
+}
+
+// Set a queue up with its rings empty, and tell the device where they
+// are.  The rings are kept from one reset of the device to the next.
+static int vq_setup(vnet* dev, vqueue* q, uint16_t index) {
+    size_t avail, used, len;
+    uint16_t size;
+    void* ring;
+
+    if (dev->modern) {
+        vnet_wr(dev, VM_QUEUE_SEL, EfiPciIoWidthUint16, index);
+        size = vnet_rd(dev, VM_QUEUE_SIZE, EfiPciIoWidthUint16);
+        if (size > VQ_SIZE) {
+            size = VQ_SIZE;
+            vnet_wr(dev, VM_QUEUE_SIZE, EfiPciIoWidthUint16, size);
+        }
+    } else {
+        vnet_wr(dev, VL_QUEUE_SEL, EfiPciIoWidthUint16, index);
+        size = vnet_rd(dev, VL_QUEUE_NUM, EfiPciIoWidthUint16);
+    }
+    if ((size < 2) || (size > VQ_MAX) || (size & (size - 1)) ||
+        (q->desc && (size != q->size))) {
+        printf("virtio: queue %d has %d entries\n", index, size);
+        return -1;
+    }
+
+    // the legacy layout, which suits either kind
+    avail = size * sizeof(vring_desc);
+    used = (avail + 6 + (size * 2) + 4095) & ~4095;
+    len = used + 6 + (size * sizeof(vring_used_elem));
+    if (q->desc == NULL) {
+        if (pcinet_alloc(&dev->nic, len, &ring, &q->dma)) {
+            printf("virtio: out of memory\n");
+            return -1;
+        }
+        q->desc = ring;
+        q->avail = (void*)((uint8_t*)ring + avail);
+        q->used = (void*)((uint8_t*)ring + used);
+        q->size = size;
+        q->index = index;
+    } else {
+        memset(q->avail, 0, 6 + (size * 2));
+        memset(q->used, 0, 6 + (size * sizeof(vring_used_elem)));
+    }
+    // polled: no interrupts wanted
+    q->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    q->avail_idx = 0;
+    q->used_idx = 0;
+    q->unkicked = 0;
+
+    if (dev->modern) {
+        vnet_wr(dev, VM_QUEUE_DESC, EfiPciIoWidthUint32, q->dma);
+        vnet_wr(dev, VM_QUEUE_DESC + 4, EfiPciIoWidthUint32, q->dma >> 32);
+        vnet_wr(dev, VM_QUEUE_AVAIL, EfiPciIoWidthUint32, q->dma + avail);
+        vnet_wr(dev, VM_QUEUE_AVAIL + 4, EfiPciIoWidthUint32, (q->dma + avail) >> 32);
+        vnet_wr(dev, VM_QUEUE_USED, EfiPciIoWidthUint32, q->dma + used);
+        vnet_wr(dev, VM_QUEUE_USED + 4, EfiPciIoWidthUint32, (q->dma + used) >> 32);
+        q->notify = dev->notify +
+                    vnet_rd(dev, VM_QUEUE_NOFF, EfiPciIoWidthUint16) * dev->notify_mult;
+        vnet_wr(dev, VM_QUEUE_ENABLE, EfiPciIoWidthUint16, 1);
+    } else {
+        vnet_wr(dev, VL_QUEUE_PFN, EfiPciIoWidthUint32, q->dma >> 12);
+    }
+    return 0;
+}
+
+static void vnet_link(vnet* dev) {
+    uint16_t status;
+
+    if (dev->features & VF_NET_STATUS) {
+        vnet_config(dev, 6, sizeof(status), &status);
+        dev->nic.mode.MediaPresent = (status & VNET_S_LINK_UP) ? TRUE : FALSE;
+    } else {
+        dev->nic.mode.MediaPresent = TRUE;
+    }
+}
+
+// Bring the device up from reset, with every receive buffer posted
+static int vnet_setup(vnet* dev) {
+    uint64_t want = VF_NET_MAC | VF_NET_STATUS;
+
+    vnet_reset(dev);
+    vnet_set_status(dev, VS_ACKNOWLEDGE);
+    vnet_set_status(dev, VS_ACKNOWLEDGE | VS_DRIVER);
+    if (dev->modern) {
+        want |= VF_VERSION_1;
+    }
+    dev->features = vnet_features(dev) & want;
+    if (dev->modern) {
+        vnet_wr(dev, VM_GFSELECT, EfiPciIoWidthUint32, 0);
+        vnet_wr(dev, VM_GF, EfiPciIoWidthUint32, dev->features);
+        vnet_wr(dev, VM_GFSELECT, EfiPciIoWidthUint32, 1);
+        vnet_wr(dev, VM_GF, EfiPciIoWidthUint32, dev->features >> 32);
+        vnet_set_status(dev, VS_ACKNOWLEDGE | VS_DRIVER | VS_FEATURES_OK);
+        if (!(dev->features & VF_VERSION_1) || !(vnet_status(dev) & VS_FEATURES_OK)) {
+            printf("virtio: features %lx refused\n", dev->features);
+            goto fail;
+        }
+    } else {
+        vnet_wr(dev, VL_GUEST_FEATURES, EfiPciIoWidthUint32, dev->features);
+    }
+    // without mergeable buffers, a legacy header lacks the buffer count
+    dev->hdr_len = dev->modern ? 12 : 10;
+
+    if (vq_setup(dev, &dev->rx, 0) || vq_setup(dev, &dev->tx, 1)) {
+        goto fail;
+    }
+    dev->rx_slots = dev->rx.size / 2;
+    if (dev->rx_slots > VNET_RX_SLOTS) {
+        dev->rx_slots = VNET_RX_SLOTS;
+    }
+    dev->tx_slots = dev->tx.size / 2;
+    if (dev->tx_slots > VNET_TX_SLOTS) {
+        dev->tx_slots = VNET_TX_SLOTS;
+    }
+    if (((dev->rx_bufs == NULL) &&
+         pcinet_alloc(&dev->nic, dev->rx_slots * VNET_BUF_SIZE, (void**)&dev->rx_bufs,
+                      &dev->rx_dma)) ||
+        ((dev->tx_hdr_mem == NULL) &&
+         pcinet_alloc(&dev->nic, dev->tx_slots * VNET_BUF_DATA, &dev->tx_hdr_mem,
+                      &dev->tx_hdrs))) {
+        printf("virtio: out of memory\n");
+        goto fail;
+    }
+
+    // receive slot n is descriptors 2n (header) and 2n+1 (frame)
+    for (unsigned n = 0; n < dev->rx_slots; n++) {
+        vring_desc* d = dev->rx.desc + (2 * n);
+        UINT64 dma = dev->rx_dma + (n * VNET_BUF_SIZE);
+        d[0].addr = dma;
+        d[0].len = dev->hdr_len;
+        d[0].flags = VRING_DESC_F_WRITE | VRING_DESC_F_NEXT;
+        d[0].next = (2 * n) + 1;
+        d[1].addr = dma + VNET_BUF_DATA;
+        d[1].len = VNET_BUF_SIZE - VNET_BUF_DATA;
+        d[1].flags = VRING_DESC_F_WRITE;
+        d[1].next = 0;
+        vq_post(&dev->rx, 2 * n);
+    }
+    // transmit slots likewise, the frame being the caller's buffer
+    dev->tx_nfree = 0;
+    for (unsigned n = 0; n < dev->tx_slots; n++) {
+        vring_desc* d = dev->tx.desc + (2 * n);
+        d[0].addr = dev->tx_hdrs + (n * VNET_BUF_DATA);
+        d[0].len = dev->hdr_len;
+        d[0].flags = VRING_DESC_F_NEXT;
+        d[0].next = (2 * n) + 1;
+        dev->tx_free[dev->tx_nfree++] = n;
+    }
+
+    vnet_set_status(dev, vnet_status(dev) | VS_DRIVER_OK);
+    vq_kick(dev, &dev->rx);
+    vnet_link(dev);
+    return 0;
+
+fail:
+    vnet_reset(dev);
+    return -1;
+}
+
+static void vnet_stop(pcinet* nic) {
+    vnet_reset((void*)nic);
+}
+
+static int vnet_rx_ready(pcinet* nic) {
+    vnet* dev = (void*)nic;
+    return dev->rx.used->idx != dev->rx.used_idx;
+}
+
+static void vnet_flush(pcinet* nic) {
+    vnet* dev = (void*)nic;
+    vq_kick(dev, &dev->rx);
+    vq_kick(dev, &dev->tx);
+}
+
+static EFI_STATUS EFIAPI vnet_initialize(EFI_SIMPLE_NETWORK* snp, UINTN rx_extra, UINTN tx_extra) {
+    vnet* dev = (void*)snp;
+
+    if (dev->nic.mode.State == EfiSimpleNetworkStopped) {
+        return EFI_NOT_STARTED;
+    }
+    if (dev->nic.mode.State == EfiSimpleNetworkInitialized) {
+        return EFI_SUCCESS;
+    }
+    if (vnet_setup(dev)) {
+        return EFI_DEVICE_ERROR;
+    }
+    dev->nic.mode.State = EfiSimpleNetworkInitialized;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI vnet_shutdown(EFI_SIMPLE_NETWORK* snp) {
+    vnet* dev = (void*)snp;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    printf("virtio: %ld frames in with %ld kicks, %ld out with %ld kicks\n",
+           dev->rx_frames, dev->rx.kicks, dev->tx_frames, dev->tx.kicks);
+    // the device must be done with every buffer before any is unmapped
+    vnet_reset(dev);
+    for (unsigned n = 0; n < dev->tx_slots; n++) {
+        if (dev->tx_buf[n]) {
+            pcinet_unmap(&dev->nic, dev->tx_map[n]);
+            dev->tx_buf[n] = NULL;
+        }
+    }
+    dev->nic.mode.State = EfiSimpleNetworkStarted;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI vnet_reset_snp(EFI_SIMPLE_NETWORK* snp, BOOLEAN verify) {
+    EFI_STATUS r;
+
+    if ((r = vnet_shutdown(snp)) != EFI_SUCCESS) {
+        return r;
+    }
+    return vnet_initialize(snp, 0, 0);
+}
+
+// Hands back one transmitted buffer per call, as netifc expects
+static EFI_STATUS EFIAPI vnet_get_status(EFI_SIMPLE_NETWORK* snp, UINT32* irq, VOID** txbuf) {
+    vnet* dev = (void*)snp;
+    vqueue* q = &dev->tx;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    vnet_flush(&dev->nic);
+    // once up, the link is taken to stay up: reading it costs an exit
+    if (!dev->nic.mode.MediaPresent) {
+        vnet_link(dev);
+    }
+    if (irq) {
+        *irq = 0;
+    }
+    if (txbuf == NULL) {
+        return EFI_SUCCESS;
+    }
+    *txbuf = NULL;
+    if (q->used->idx != q->used_idx) {
+        unsigned n;
+        rmb();
+        n = q->used->ring[q->used_idx & (q->size - 1)].id / 2;
+        q->used_idx++;
+        if ((n < dev->tx_slots) && dev->tx_buf[n]) {
+            pcinet_unmap(&dev->nic, dev->tx_map[n]);
+            *txbuf = dev->tx_buf[n];
+            dev->tx_buf[n] = NULL;
+            dev->tx_free[dev->tx_nfree++] = n;
+            if (irq) {
+                *irq = EFI_SIMPLE_NETWORK_TRANSMIT_INTERRUPT;
+            }
+        }
+    }
+    return EFI_SUCCESS;
+}
+
+// The frame goes out of the caller's buffer, which is theirs again
+// once GetStatus hands it back
+static EFI_STATUS EFIAPI vnet_transmit(EFI_SIMPLE_NETWORK* snp, UINTN hsz, UINTN bsz, VOID* buf,
+                                       EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    vnet* dev = (void*)snp;
+    vqueue* q = &dev->tx;
+    vring_desc* d;
+    EFI_STATUS r;
+    UINT64 dma;
+    unsigned n;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    if ((bsz < 14) || (bsz > (dev->nic.mode.MaxPacketSize + 14))) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    if ((r = pcinet_header(&dev->nic, hsz, bsz, buf, src, dst, proto)) != EFI_SUCCESS) {
+        return r;
+    }
+    if (dev->tx_nfree == 0) {
+        vq_kick(dev, q);
+        return EFI_NOT_READY;
+    }
+    n = dev->tx_free[dev->tx_nfree - 1];
+    if (pcinet_map(&dev->nic, buf, bsz, &dma, &dev->tx_map[n])) {
+        return EFI_DEVICE_ERROR;
+    }
+    dev->tx_nfree--;
+    dev->tx_buf[n] = buf;
+    d = q->desc + (2 * n) + 1;
+    d->addr = dma;
+    d->len = bsz;
+    d->flags = 0;
+    d->next = 0;
+    vq_post(q, 2 * n);
+    dev->tx_frames++;
+    if (q->unkicked >= TX_KICK) {
+        vq_kick(dev, q);
+    }
+    return EFI_SUCCESS;
+}
+
+// Copied from the ring into the caller's buffer, and the ring buffer
+// posted again at once
+static EFI_STATUS EFIAPI vnet_receive(EFI_SIMPLE_NETWORK* snp, UINTN* hsz, UINTN* bsz, VOID* buf,
+                                      EFI_MAC_ADDRESS* src, EFI_MAC_ADDRESS* dst, UINT16* proto) {
+    vnet* dev = (void*)snp;
+    vqueue* q = &dev->rx;
+    vring_used_elem* e;
+    uint8_t* frame;
+    unsigned n;
+    size_t len;
+
+    if (dev->nic.mode.State != EfiSimpleNetworkInitialized) {
+        return EFI_NOT_STARTED;
+    }
+    for (;;) {
+        if (q->used->idx == q->used_idx) {
+            // idle: the device can have back what was taken off the ring
+            vnet_flush(&dev->nic);
+            return EFI_NOT_READY;
+        }
+        rmb();
+        e = q->used->ring + (q->used_idx & (q->size - 1));
+        n = e->id / 2;
+        if (n >= dev->rx_slots) {
+            // not one we posted: nothing to give back
+            q->used_idx++;
+            continue;
+        }
+        len = (e->len > dev->hdr_len) ? (e->len - dev->hdr_len) : 0;
+        if ((len >= 14) && (len <= (VNET_BUF_SIZE - VNET_BUF_DATA)) && (len <= *bsz)) {
+            frame = dev->rx_bufs + (n * VNET_BUF_SIZE) + VNET_BUF_DATA;
+            memcpy(buf, frame, len);
+            pcinet_rxinfo(frame, hsz, src, dst, proto);
+            *bsz = len;
+            dev->rx_frames++;
+        } else {
+            // a runt is dropped, and so is a frame too big for the
+            // caller: left in the used ring, it would stop the rest
+            len = 0;
+        }
+        q->used_idx++;
+        vq_post(q, 2 * n);
+        if (q->unkicked >= RX_KICK) {
+            vq_kick(dev, q);
+        }
+        if (len) {
+            return EFI_SUCCESS;
+        }
+    }
+}
+
+EFI_SIMPLE_NETWORK* virtio_net_bind(EFI_HANDLE h, uint16_t vendor, uint16_t device) {
+    vnet* dev;
+    uint8_t* mac;
+
+    if ((vendor != VIRTIO_VENDOR) ||
+        ((device != VIRTIO_NET_LEGACY) && (device != VIRTIO_NET_MODERN))) {
+        return NULL;
+    }
+    if (gBS->AllocatePool(EfiLoaderData, sizeof(*dev), (void**)&dev)) {
+        return NULL;
+    }
+    memset(dev, 0, sizeof(*dev));
+    if (pcinet_claim(&dev->nic, h, "virtio")) {
+        gBS->FreePool(dev);
+        return NULL;
+    }
+    // a transitional device is driven as a modern one if it can be
+    dev->modern = (vnet_caps(dev) == 0);
+    if (!dev->modern && (device == VIRTIO_NET_MODERN)) {
+        printf("virtio: device lacks its configuration capabilities\n");
+        goto fail;
+    }
+    vnet_reset(dev);
+    if (!(vnet_features(dev) & VF_NET_MAC)) {
+        printf("virtio: device has no MAC address\n");
+        goto fail;
+    }
+    mac = dev->nic.mode.CurrentAddress.Addr;
+    vnet_config(dev, 0, 6, mac);
+    memcpy(&dev->nic.mode.PermanentAddress, &dev->nic.mode.CurrentAddress,
+           sizeof(EFI_MAC_ADDRESS));
+    printf("virtio: %s device %02x:%02x:%02x:%02x:%02x:%02x\n",
+           dev->modern ? "modern" : "legacy", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    dev->nic.snp.Initialize = vnet_initialize;
+    dev->nic.snp.Reset = vnet_reset_snp;
+    dev->nic.snp.Shutdown = vnet_shutdown;
+    dev->nic.snp.GetStatus = vnet_get_status;
+    dev->nic.snp.Transmit = vnet_transmit;
+    dev->nic.snp.Receive = vnet_receive;
+    dev->nic.rx_ready = vnet_rx_ready;
+    dev->nic.flush = vnet_flush;
+    dev->nic.reset = vnet_stop;
+    return &dev->nic.snp;
+
+fail:
+    pcinet_release(&dev->nic);
+    gBS->FreePool(dev);
+    return NULL;
+}
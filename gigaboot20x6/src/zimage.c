@@ -0,0 +1,238 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <efi.h>
+#include <efilib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lz4.h>
+#include <mp.h>
+#include <utils.h>
+#include <zimage.h>
+
+static EFI_GUID MpServicesProtocol = EFI_MP_SERVICES_PROTOCOL_GUID;
+
+// The expansion in progress.  Every processor working on it takes the
+// next chunk off it until there are none left, so a slow one (the BSP,
+// which also has the network to look after) just ends up doing fewer.
+static struct {
+    const uint8_t* chunks;
+    const uint32_t* zlen;
+    UINT64* zoff; // offset of each chunk from chunks
+    uint8_t* dst;
+    uint64_t size;
+    uint32_t chunksize;
+    uint32_t count;
+    volatile uint32_t next;   // next chunk to take
+    volatile uint32_t done;   // chunks finished
+    volatile uint32_t on_aps; // of those, how many the APs did
+    volatile uint32_t failed;
+    UINTN aps;
+    uint64_t start;
+    int active;
+    int result;
+} zi;
+
+int zimage_info(const void* data, size_t len, size_t* zlen, size_t* size) {
+    const zimage_hdr* hdr = data;
+    const uint32_t* table = (const void*)(hdr + 1);
+    uint64_t total;
+
+    if (len < sizeof(*hdr)) {
+        return -1;
+    }
+    if ((hdr->magic != ZIMAGE_MAGIC) || hdr->reserved ||
+        (hdr->chunksize < ZIMAGE_CHUNK_MIN) || (hdr->chunksize > ZIMAGE_CHUNK_MAX)) {
+        return -1;
+    }
+    // the kernel takes a 32bit ramdisk address and size
+    if ((hdr->size >> 32) ||
+        (hdr->count != ((hdr->size + hdr->chunksize - 1) / hdr->chunksize))) {
+        return -1;
+    }
+    *size = hdr->size;
+    *zlen = 0;
+    if (((len - sizeof(*hdr)) / sizeof(uint32_t)) < hdr->count) {
+        return 0;
+    }
+    total = sizeof(*hdr) + hdr->count * sizeof(uint32_t);
+    for (uint32_t n = 0; n < hdr->count; n++) {
+        uint64_t clen = hdr->size - (uint64_t)n * hdr->chunksize;
+        if (clen > hdr->chunksize) {
+            clen = hdr->chunksize;
+        }
+        if ((table[n] == 0) || (table[n] > clen)) {
+            return -1;
+        }
+        total += table[n];
+    }
+    *zlen = total;
+    return 0;
+}
+
+// Expand the next chunk, if there is one.  Returns 0 if there wasn't.
+static int zimage_take(void) {
+    uint32_t n = __sync_fetch_and_add(&zi.next, 1);
+    uint64_t off;
+    size_t len;
+
+    if (n >= zi.count) {
+        return 0;
+    }
+    off = (uint64_t)n * zi.chunksize;
+    len = ((zi.size - off) < zi.chunksize) ? (zi.size - off) : zi.chunksize;
+    if (zi.zlen[n] == len) {
+        memcpy(zi.dst + off, zi.chunks + zi.zoff[n], len);
+    } else if (lz4_decompress(zi.chunks + zi.zoff[n], zi.zlen[n], zi.dst + off, len) != (int)len) {
+        zi.failed = 1;
+    }
+    __sync_fetch_and_add(&zi.done, 1);
+    return 1;
+}
+
+// Runs on every AP: no boot services, no printf
+static VOID EFIAPI zimage_ap(VOID* arg) {
+    while (zimage_take()) {
+        __sync_fetch_and_add(&zi.on_aps, 1);
+    }
+}
+
+int zimage_start(const void* src, size_t zlen, void* dst) {
+    const zimage_hdr* hdr = src;
+    EFI_MP_SERVICES_PROTOCOL* mp;
+    EFI_EVENT ev;
+    UINTN cpus, enabled;
+    size_t total, size;
+    UINT64 off = 0;
+
+    if (zi.active || zimage_info(src, zlen, &total, &size) ||
+        (total == 0) || (total > zlen)) {
+        return -1;
+    }
+    if (gBS->AllocatePool(EfiLoaderData, (hdr->count + 1) * sizeof(UINT64),
+                          (void**)&zi.zoff)) {
+        printf("zimage: out of memory\n");
+        return -1;
+    }
+    zi.zlen = (const void*)(hdr + 1);
+    zi.chunks = (const uint8_t*)(zi.zlen + hdr->count);
+    for (uint32_t n = 0; n < hdr->count; n++) {
+        zi.zoff[n] = off;
+        off += zi.zlen[n];
+    }
+    zi.dst = dst;
+    zi.size = hdr->size;
+    zi.chunksize = hdr->chunksize;
+    zi.count = hdr->count;
+    zi.next = 0;
+    zi.done = 0;
+    zi.on_aps = 0;
+    zi.failed = 0;
+    zi.aps = 0;
+    zi.active = 1;
+
+    // measured now, if it has to be, rather than while the clock runs
+    tsc_per_ms();
+    zi.start = rdtsc();
+
+    // Set the APs going and return at once, leaving the BSP free to
+    // serve the network (and take chunks itself) until they are done.
+    // The event stays open: the firmware signals it when the APs return
+    // from zimage_ap, which may be long after we stopped caring.
+    if ((zi.count > 1) &&
+        (gBS->LocateProtocol(&MpServicesProtocol, NULL, (void**)&mp) == EFI_SUCCESS) &&
+        (mp->GetNumberOfProcessors(mp, &cpus, &enabled) == EFI_SUCCESS) && (enabled > 1) &&
+        (gBS->CreateEvent(0, 0, NULL, NULL, &ev) == EFI_SUCCESS)) {
+        if (mp->StartupAllAPs(mp, zimage_ap, FALSE, ev, 0, NULL, NULL) == EFI_SUCCESS) {
+            zi.aps = enabled - 1;
+        } else {
+            gBS->CloseEvent(ev);
+        }
+    }
+    printf("zimage: expanding %d chunks (%ld bytes) on %ld APs and the BSP\n",
+           zi.count, size, zi.aps);
+    return 0;
+}
+
+int zimage_step(void) {
+    uint64_t ms;
+
+    if (!zi.active) {
+        return zi.result ? zi.result : -1;
+    }
+    zimage_take();
+    if (zi.done < zi.count) {
+        return 0;
+    }
+    ms = (rdtsc() - zi.start) / tsc_per_ms();
+    printf("zimage: expanded %ld bytes in %ld ms (%ld MB/s), %d of %d chunks on APs\n",
+           zi.size, ms, ms ? (zi.size / 1000 / ms) : 0, zi.on_aps, zi.count);
+    // every chunk is done, so nothing reads these any more
+    gBS->FreePool(zi.zoff);
+    zi.zoff = NULL;
+    zi.active = 0;
+    zi.result = zi.failed ? -1 : 1;
+    if (zi.failed) {
+        printf("zimage: image is corrupt\n");
+    }
+    return zi.result;
+}
+
+int zimage_busy(void) {
+    return zi.active;
+}
+
+void zstream_init(zstream* zs) {
+    memset(zs, 0, sizeof(*zs));
+    zs->state = ZSTREAM_HEADER;
+}
+
+int zstream_feed(zstream* zs, const void* src, size_t len) {
+    const zimage_hdr* hdr = src;
+    const uint32_t* zlen = (const void*)(hdr + 1);
+
+    if (zs->state == ZSTREAM_HEADER) {
+        if (len < sizeof(*hdr)) {
+            return zs->state;
+        }
+        if (zimage_info(src, len, &zs->zlen, &zs->size)) {
+            return zs->state = ZSTREAM_ERROR;
+        }
+        if (zs->zlen == 0) {
+            return zs->state;
+        }
+        zs->in = sizeof(*hdr) + hdr->count * sizeof(uint32_t);
+        zs->state = ZSTREAM_DATA;
+    }
+    if ((zs->state != ZSTREAM_DATA) || (zs->dst == NULL)) {
+        return zs->state;
+    }
+    while ((zs->next < hdr->count) && ((len - zs->in) >= zlen[zs->next])) {
+        size_t off = (size_t)zs->next * hdr->chunksize;
+        size_t clen = ((zs->size - off) < hdr->chunksize) ? (zs->size - off) : hdr->chunksize;
+        const uint8_t* chunk = (const uint8_t*)src + zs->in;
+        if (zlen[zs->next] == clen) {
+            memcpy(zs->dst + off, chunk, clen);
+        } else if (lz4_decompress(chunk, zlen[zs->next], zs->dst + off, clen) != (int)clen) {
+            printf("zimage: chunk %d is corrupt\n", zs->next);
+            return zs->state = ZSTREAM_ERROR;
+        }
+        zs->in += zlen[zs->next++];
+    }
+    if (zs->next == hdr->count) {
+        zs->state = ZSTREAM_DONE;
+    }
+    return zs->state;
+}
@@ -0,0 +1,77 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Chunked compressed image (as made by mkzimage), which can be expanded
+// on many processors at once: a zimage_hdr, then the compressed length
+// of every chunk (a uint32_t each), then the chunks back to back.  A
+// chunk is chunksize bytes of the image (the last may be shorter),
+// compressed on its own in the LZ4 block format (see lz4.h), or stored
+// as is if its compressed length is the chunk's length.
+
+#define ZIMAGE_MAGIC 0x5A4B4843 // "CHKZ"
+
+#define ZIMAGE_CHUNK_MIN 4096
+#define ZIMAGE_CHUNK_MAX (16 * 1024 * 1024)
+
+typedef struct zimage_hdr_t {
+    uint32_t magic;
+    uint32_t chunksize; // image bytes per chunk
+    uint32_t count;     // chunks
+    uint32_t reserved;  // 0
+    uint64_t size;      // image bytes
+} zimage_hdr;
+
+// If the len bytes at data (which may be the start of one still being
+// received) begin a chunked image, return 0 with its expanded size in
+// *size and, once enough of it is there to tell, its own length in
+// *zlen (else 0).  Return -1 if it is not one.
+int zimage_info(const void* data, size_t len, size_t* zlen, size_t* size);
+
+// Start expanding the image at src (all zlen bytes of it) into dst,
+// which must hold its expanded size, on every application processor.
+// Returns 0 if started, -1 if the image is malformed.
+int zimage_start(const void* src, size_t zlen, void* dst);
+
+// Expand a chunk on this processor too, if any are left.  Returns 1 once
+// the whole image is expanded, 0 while it is in progress, and -1 if it
+// failed (or none was started).  Call it in between other work until it
+// stops returning 0.
+int zimage_step(void);
+
+// Nonzero while an expansion is in progress
+int zimage_busy(void);
+
+// Expands a chunked image as it is received, each chunk as soon as all
+// of it is in, into a buffer of its own
+typedef struct zstream_t {
+    uint8_t* dst; // set by the caller once the state is ZSTREAM_DATA
+    size_t size;  // expanded size, once the header is in
+    size_t zlen;  // image length, once the chunk table is in
+    size_t in;    // image bytes used so far
+    uint32_t next; // next chunk to expand
+    int state;
+} zstream;
+
+#define ZSTREAM_HEADER 0 // waiting for the header and chunk table
+#define ZSTREAM_DATA 1   // expanding chunks as they complete
+#define ZSTREAM_DONE 2
+#define ZSTREAM_ERROR -1 // not a chunked image, or a corrupt one
+
+void zstream_init(zstream* zs);
+
+// The first len bytes of the image are at src: expand any chunks that
+// completes (once dst is set).  Returns the new state.
+int zstream_feed(zstream* zs, const void* src, size_t len);
@@ -0,0 +1,444 @@
+// Copyright 2016 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Chunked images (see zimage.h) made by mkzimage, expanded the ways
+// osboot does: with zimage_start() and zimage_step(), threads standing
+// in for the application processors, and with zstream_feed() as the
+// image arrives a piece at a time.  First images of sizes either side
+// of a chunk boundary, with chunks that compress and chunks stored as
+// they are, have to come back as they went in both ways, and one with
+// a corrupt chunk has to be refused.  Then the time zimage_step() takes
+// to expand a large image with no APs and with more and more of them.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <efi.h>
+#include <mp.h>
+#include <utils.h>
+
+#include "zimage.h"
+
+// what utils.c would have provided
+EFI_BOOT_SERVICES* gBS;
+
+UINT64 tsc_per_ms(void) {
+    static UINT64 per_ms;
+
+    if (per_ms == 0) {
+        UINT64 t = rdtsc();
+        usleep(1000);
+        if ((per_ms = rdtsc() - t) == 0) {
+            per_ms = 1;
+        }
+    }
+    return per_ms;
+}
+
+static char* appname;
+static const char* mkzimage = "out/mkzimage";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The boot services zimage.c uses, and the MP services protocol, whose
+// APs are threads: StartupAllAPs starts aps of them and returns at once
+
+#define MAX_APS 64
+
+static unsigned aps;
+static pthread_t ap_threads[MAX_APS];
+static unsigned ap_running;
+
+typedef struct {
+    EFI_AP_PROCEDURE proc;
+    VOID* arg;
+} ap_start;
+
+static ap_start ap_arg;
+
+static void* ap_main(void* arg) {
+    ap_start* s = arg;
+    s->proc(s->arg);
+    return NULL;
+}
+
+static EFI_STATUS EFIAPI mp_count(struct _EFI_MP_SERVICES_PROTOCOL* mp,
+                                  UINTN* cpus, UINTN* enabled) {
+    *cpus = aps + 1;
+    *enabled = aps + 1;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mp_startup_all(struct _EFI_MP_SERVICES_PROTOCOL* mp,
+                                        EFI_AP_PROCEDURE proc, BOOLEAN single, EFI_EVENT ev,
+                                        UINTN timeout, VOID* arg, UINTN** failed) {
+    if ((aps == 0) || ap_running) {
+        return EFI_NOT_STARTED;
+    }
+    ap_arg.proc = proc;
+    ap_arg.arg = arg;
+    for (ap_running = 0; ap_running < aps; ap_running++) {
+        if (pthread_create(&ap_threads[ap_running], NULL, ap_main, &ap_arg)) {
+            break;
+        }
+    }
+    return ap_running ? EFI_SUCCESS : EFI_NOT_STARTED;
+}
+
+// Wait for the APs to return, as the firmware would before it let them
+// be started again
+static void mp_join(void) {
+    while (ap_running) {
+        pthread_join(ap_threads[--ap_running], NULL);
+    }
+}
+
+static EFI_MP_SERVICES_PROTOCOL mp = {
+    .GetNumberOfProcessors = mp_count,
+    .StartupAllAPs = mp_startup_all,
+};
+
+static EFI_STATUS EFIAPI allocate_pool(EFI_MEMORY_TYPE type, UINTN size, VOID** buf) {
+    return (*buf = malloc(size)) ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+}
+
+static EFI_STATUS EFIAPI free_pool(VOID* buf) {
+    free(buf);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI stall(UINTN us) {
+    usleep(us);
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI locate_protocol(EFI_GUID* guid, VOID* registration, VOID** ifc) {
+    *ifc = &mp;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI create_event(UINT32 type, EFI_TPL tpl, EFI_EVENT_NOTIFY notify,
+                                      VOID* ctx, EFI_EVENT* ev) {
+    static int dummy;
+    *ev = &dummy;
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI close_event(EFI_EVENT ev) {
+    return EFI_SUCCESS;
+}
+
+static EFI_BOOT_SERVICES bs = {
+    .AllocatePool = allocate_pool,
+    .FreePool = free_pool,
+    .Stall = stall,
+    .LocateProtocol = locate_protocol,
+    .CreateEvent = create_event,
+    .CloseEvent = close_event,
+};
+
+// zimage.c reports on every expansion; while set, that goes nowhere
+static void quiet(int on) {
+    static int saved = -1;
+
+    fflush(stdout);
+    if (on && (saved < 0)) {
+        saved = dup(1);
+        freopen("/dev/null", "w", stdout);
+    } else if (!on && (saved >= 0)) {
+        dup2(saved, 1);
+        close(saved);
+        saved = -1;
+    }
+}
+
+// len bytes in runs of up to 300, each either random (noise times in
+// eight) or a copy of what came before it
+static void fill(uint8_t* data, size_t len, unsigned noise) {
+    size_t n = 0;
+
+    while (n < len) {
+        size_t run = 1 + rand() % 300;
+        size_t from = n ? (rand() % n) : 0;
+        int random = (n == 0) || ((unsigned)(rand() % 8) < noise);
+        for (; run && (n < len); run--, n++) {
+            data[n] = random ? rand() : data[from++];
+        }
+    }
+}
+
+// Run len bytes at data through mkzimage in chunks of chunksize.
+// Returns the image (to be freed), with its length in *zlen, or NULL.
+static uint8_t* make(const uint8_t* data, size_t len, size_t chunksize, size_t* zlen) {
+    char in[] = "/tmp/zimagebench-in-XXXXXX";
+    char out[] = "/tmp/zimagebench-out-XXXXXX";
+    char cmd[512];
+    uint8_t* image = NULL;
+    int fdi, fdo;
+    FILE* fp;
+    long sz;
+
+    if ((fdi = mkstemp(in)) < 0) {
+        return NULL;
+    }
+    if ((fdo = mkstemp(out)) < 0) {
+        close(fdi);
+        unlink(in);
+        return NULL;
+    }
+    close(fdo);
+    if (write(fdi, data, len) != (ssize_t)len) {
+        close(fdi);
+        goto done;
+    }
+    close(fdi);
+    snprintf(cmd, sizeof(cmd), "%s -c %zu %s %s > /dev/null", mkzimage, chunksize, in, out);
+    if (system(cmd)) {
+        printf("FAIL: %s\n", cmd);
+        goto done;
+    }
+    if ((fp = fopen(out, "rb")) == NULL) {
+        goto done;
+    }
+    if ((fseek(fp, 0, SEEK_END) == 0) && ((sz = ftell(fp)) > 0) &&
+        (fseek(fp, 0, SEEK_SET) == 0) && ((image = malloc(sz)) != NULL)) {
+        if (fread(image, 1, sz, fp) == (size_t)sz) {
+            *zlen = sz;
+        } else {
+            free(image);
+            image = NULL;
+        }
+    }
+    fclose(fp);
+done:
+    unlink(in);
+    unlink(out);
+    return image;
+}
+
+// Expand the image with zimage_start() and zimage_step() on the BSP and
+// aps APs.  Returns zimage_step()'s final result.
+static int expand(const uint8_t* image, size_t zlen, uint8_t* dst, unsigned n) {
+    int r;
+
+    aps = n;
+    if (zimage_start(image, zlen, dst)) {
+        return -1;
+    }
+    while ((r = zimage_step()) == 0)
+        ;
+    mp_join();
+    return r;
+}
+
+// Expand the image with zstream_feed() as it arrives, in pieces of up
+// to step bytes, the way osboot does.  Returns the final state.
+static int stream(const uint8_t* image, size_t zlen, uint8_t* dst, size_t step) {
+    zstream zs;
+    size_t len = 0;
+    int state;
+
+    zstream_init(&zs);
+    do {
+        len += 1 + rand() % step;
+        if (len > zlen) {
+            len = zlen;
+        }
+        state = zstream_feed(&zs, image, len);
+        if ((state == ZSTREAM_DATA) && (zs.dst == NULL)) {
+            zs.dst = dst;
+            state = zstream_feed(&zs, image, len);
+        }
+    } while ((len < zlen) && (state != ZSTREAM_ERROR));
+    return state;
+}
+
+// Check that the len bytes at data come back from mkzimage both ways,
+// and that spoiling one of the compressed chunks has both refuse it.
+// Returns nonzero if not.
+static int check(const uint8_t* data, size_t len, size_t chunksize) {
+    const zimage_hdr* hdr;
+    const uint32_t* table;
+    uint8_t* image;
+    uint8_t* dst;
+    size_t zlen = 0, off, size, z;
+    int bad = 0;
+
+    if ((image = make(data, len, chunksize, &zlen)) == NULL) {
+        printf("FAIL: no image of %zu bytes in %zu byte chunks\n", len, chunksize);
+        return -1;
+    }
+    if ((dst = malloc(len)) == NULL) {
+        free(image);
+        return -1;
+    }
+    if (zimage_info(image, zlen, &z, &size) || (z != zlen) || (size != len)) {
+        printf("FAIL: %zu bytes in %zu byte chunks: bad header\n", len, chunksize);
+        bad = -1;
+        goto done;
+    }
+    for (unsigned n = 0; n <= 3; n += 3) {
+        memset(dst, 0xa5, len);
+        quiet(1);
+        if ((expand(image, zlen, dst, n) != 1) || memcmp(dst, data, len)) {
+            quiet(0);
+            printf("FAIL: %zu bytes in %zu byte chunks: didn't expand on %u APs\n",
+                   len, chunksize, n);
+            bad = -1;
+            goto done;
+        }
+        quiet(0);
+    }
+    for (size_t step = 1; step <= 65536; step *= 16) {
+        memset(dst, 0xa5, len);
+        quiet(1);
+        if ((stream(image, zlen, dst, step) != ZSTREAM_DONE) || memcmp(dst, data, len)) {
+            quiet(0);
+            printf("FAIL: %zu bytes in %zu byte chunks: didn't stream %zu bytes at a time\n",
+                   len, chunksize, step);
+            bad = -1;
+            goto done;
+        }
+        quiet(0);
+    }
+
+    // an 0xff token wants more literals than the chunk has
+    hdr = (const void*)image;
+    table = (const void*)(hdr + 1);
+    off = sizeof(*hdr) + hdr->count * sizeof(uint32_t);
+    for (uint32_t n = 0; n < hdr->count; n++) {
+        size_t clen = ((len - (size_t)n * chunksize) < chunksize) ?
+                      (len - (size_t)n * chunksize) : chunksize;
+        if (table[n] < clen) {
+            memset(image + off, 0xff, table[n]);
+            quiet(1);
+            if ((expand(image, zlen, dst, 3) != -1) ||
+                (stream(image, zlen, dst, 4096) != ZSTREAM_ERROR)) {
+                quiet(0);
+                printf("FAIL: %zu bytes in %zu byte chunks: corrupt chunk %u expanded\n",
+                       len, chunksize, n);
+                bad = -1;
+                goto done;
+            }
+            quiet(0);
+            break;
+        }
+        off += table[n];
+    }
+done:
+    free(image);
+    free(dst);
+    return bad;
+}
+
+void usage(void) {
+    fprintf(stderr,
+            "usage:   %s [ <option> ]*\n"
+            "\n"
+            "options: -m <path>  mkzimage to make the images with (default %s)\n"
+            "         -c <n>     chunk size in bytes for the timing (default 131072)\n"
+            "         -s <n>     megabytes of image to time (default 64)\n"
+            "         -p <n>     time on up to n APs (default 7, at most %d)\n",
+            appname, mkzimage, MAX_APS);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    static const size_t chunks[] = { ZIMAGE_CHUNK_MIN, 65536 };
+    size_t chunksize = 128 * 1024, total = 64, zlen = 0;
+    unsigned maxaps = 7;
+    uint8_t *data, *image, *dst;
+    uint64_t t, base = 0;
+    int bad = 0;
+
+    appname = argv[0];
+    while (argc > 1) {
+        if (argc < 3)
+            usage();
+        if (!strcmp(argv[1], "-m")) {
+            mkzimage = argv[2];
+        } else if (!strcmp(argv[1], "-c")) {
+            chunksize = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-s")) {
+            total = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-p")) {
+            maxaps = atoi(argv[2]);
+        } else {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if ((chunksize < ZIMAGE_CHUNK_MIN) || (chunksize > ZIMAGE_CHUNK_MAX) ||
+        (total < 1) || (maxaps > MAX_APS))
+        usage();
+    gBS = &bs;
+
+    srand(1);
+    total <<= 20;
+    if ((data = malloc(total > (1 << 20) ? total : (1 << 20))) == NULL) {
+        fprintf(stderr, "%s: out of memory\n", appname);
+        return 1;
+    }
+    for (size_t i = 0; (i < (sizeof(chunks) / sizeof(chunks[0]))) && !bad; i++) {
+        size_t c = chunks[i];
+        const size_t sizes[] = { 1, c - 1, c, c + 1, 3 * c + 17, (1 << 20) + 3 };
+        for (size_t j = 0; (j < (sizeof(sizes) / sizeof(sizes[0]))) && !bad; j++) {
+            // a noise of 8 has every chunk stored, of 2 most compressed
+            for (unsigned noise = 2; (noise <= 8) && !bad; noise += 6) {
+                fill(data, sizes[j], noise);
+                bad |= check(data, sizes[j], c);
+            }
+        }
+    }
+    if (bad) {
+        return 1;
+    }
+    printf("every image expanded as it went in, on the APs and as it arrived\n");
+
+    fill(data, total, 2);
+    if (((image = make(data, total, chunksize, &zlen)) == NULL) ||
+        ((dst = malloc(total)) == NULL)) {
+        fprintf(stderr, "%s: cannot make an image to time\n", appname);
+        return 1;
+    }
+    for (unsigned n = 0; n <= maxaps; n = n ? (n * 2 + 1) : 1) {
+        quiet(1);
+        t = now_ns();
+        bad = (expand(image, zlen, dst, n) != 1);
+        t = now_ns() - t;
+        quiet(0);
+        if (bad || memcmp(dst, data, total)) {
+            printf("FAIL: didn't expand on %u APs\n", n);
+            return 1;
+        }
+        if (n == 0) {
+            base = t;
+        }
+        printf("%2u APs: %zu bytes from %zu in %7.2f ms, %8.1f MB/s, %4.2fx\n",
+               n, total, zlen, t / 1e6, total / (t / 1e3), base / (double)t);
+    }
+    free(image);
+    free(dst);
+    free(data);
+    return 0;
+}
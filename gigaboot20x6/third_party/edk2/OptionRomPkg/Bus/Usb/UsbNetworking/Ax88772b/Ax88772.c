@@ -201,7 +201,8 @@ Ax88772MulticastSet (
   Start the link negotiation
 
   This routine calls ::Ax88772PhyWrite to start the PHY's link
-  negotiation.
+  negotiation.  It does not wait for the negotiation to finish:
+  ::Ax88772LinkTimer polls for that.
 
   @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
 
@@ -216,7 +217,7 @@ Ax88772NegotiateLinkStart (
 {
   UINT16 Control;
   EFI_STATUS Status;
-  int i;
+
   //
   // Set the supported capabilities.
   //
@@ -239,28 +240,6 @@ Ax88772NegotiateLinkStart (
     }
     Status = Ax88772PhyWrite ( pNicDevice, PHY_BMCR, Control );
   }
-
-  if (!EFI_ERROR(Status)) {
-    i = 0;
-    do {
-
-        if (pNicDevice->bComplete && pNicDevice->bLinkUp) {
-            pNicDevice->SimpleNetwork.Mode->MediaPresent
-               = pNicDevice->bLinkUp & pNicDevice->bComplete;
-           break;
-       }
-       else {
-            gBS->Stall(AUTONEG_DELAY);
-            Status = Ax88772NegotiateLinkComplete ( pNicDevice,
-                                            &pNicDevice->PollCount,
-                                            &pNicDevice->bComplete,
-                                            &pNicDevice->bLinkUp,
-                                            &pNicDevice->b100Mbps,
-                                            &pNicDevice->bFullDuplex );
-            i++;
-        }
-    }while(!pNicDevice->bLinkUp && i < AUTONEG_POLLCNT);
-  }
   return Status;
 }
 
@@ -483,22 +462,277 @@ Ax88772PhyWrite (
 }
 
 
+/**
+  Queue a frame to be sent
+
+  This routine copies the frame into the transmit batch behind its
+  length header, first sending the batch with ::Ax88772TxFlush if
+  the frame doesn't fit.  Frames shorter than the minimum are padded.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+  @param [in] pBuffer          The frame
+  @param [in] Length           Its length in bytes
+  @param [out] ppFrame         Where the copy of the frame went
+
+  @retval EFI_SUCCESS          The frame was queued
+  @retval other                Sending the frames queued before it failed,
+                               and neither they nor it will be sent
+
+**/
+EFI_STATUS
+Ax88772TxQueue (
+  IN NIC_DEVICE * pNicDevice,
+  IN VOID * pBuffer,
+  IN UINTN Length,
+  OUT UINT8 ** ppFrame
+  )
+{
+  UINT16 Header[ 2 ];
+  UINTN PaddedLength;
+  UINT8 * pFrame;
+  EFI_STATUS Status;
+
+  PaddedLength = Length;
+  if ( PaddedLength < MIN_ETHERNET_PKT_SIZE ) {
+    PaddedLength = MIN_ETHERNET_PKT_SIZE;
+  }
+
+  //
+  //  Leave room for the frame's header and the null header
+  //  that may have to follow it
+  //
+  if (( pNicDevice->TxBatchLength + PaddedLength + ( 2 * sizeof ( Header ))) > MAX_TX_BATCH_SIZE ) {
+    Status = Ax88772TxFlush ( pNicDevice );
+    if ( EFI_ERROR ( Status )) {
+      return Status;
+    }
+  }
+
+  pFrame = &pNicDevice->pTxBatch[ pNicDevice->TxBatchLength ];
+  Header[ 0 ] = (UINT16) PaddedLength;
+  Header[ 1 ] = (UINT16) ~PaddedLength;
+  CopyMem ( pFrame, &Header[ 0 ], sizeof ( Header ));
+  pFrame += sizeof ( Header );
+  CopyMem ( pFrame, pBuffer, Length );
+  if ( PaddedLength > Length ) {
+    ZeroMem ( &pFrame[ Length ], PaddedLength - Length );
+  }
+  pNicDevice->TxBatchLength += sizeof ( Header ) + PaddedLength;
+
+  //
+  //  A frame that ends a USB packet would be taken to end the transfer
+  //  too, so the device is given a null header after it instead
+  //
+  if ( 0 == ( pNicDevice->TxBatchLength % pNicDevice->BulkOutPacketSize )) {
+    Header[ 0 ] = 0;
+    Header[ 1 ] = 0xffff;
+    CopyMem ( &pNicDevice->pTxBatch[ pNicDevice->TxBatchLength ], &Header[ 0 ], sizeof ( Header ));
+    pNicDevice->TxBatchLength += sizeof ( Header );
+  }
+
+  //
+  //  The first frame in starts the clock on the batch
+  //
+  if ( 0 == pNicDevice->TxBatchFrames++ ) {
+    gBS->SetTimer ( pNicDevice->TxDeadline, TimerRelative, TX_FLUSH_DEADLINE );
+  }
+
+  *ppFrame = pFrame;
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Send the transmit batch
+
+  Every frame queued by ::Ax88772TxQueue goes out in a single bulk
+  out transfer.  The batch is emptied even if the transfer fails.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+  @retval EFI_SUCCESS          The frames were sent, or there were none
+  @retval other                The transfer failed and the frames were dropped
+
+**/
+EFI_STATUS
+Ax88772TxFlush (
+  IN NIC_DEVICE * pNicDevice
+  )
+{
+  EFI_USB_IO_PROTOCOL * pUsbIo;
+  EFI_STATUS Status;
+  UINTN TransferLength;
+  UINT32 TransferStatus;
+
+  if ( 0 == pNicDevice->TxBatchFrames ) {
+    return EFI_SUCCESS;
+  }
+  gBS->SetTimer ( pNicDevice->TxDeadline, TimerCancel, 0 );
+  gBS->CheckEvent ( pNicDevice->TxDeadline );
+
+  //
+  //  Work around USB bus driver bug where a timeout set by receive
+  //  succeeds but the timeout expires immediately after, causing the
+  //  transmit operation to timeout.
+  //
+  pUsbIo = pNicDevice->pUsbIo;
+  TransferLength = pNicDevice->TxBatchLength;
+  Status = pUsbIo->UsbBulkTransfer ( pUsbIo,
+                                     BULK_OUT_ENDPOINT,
+                                     pNicDevice->pTxBatch,
+                                     &TransferLength,
+                                     0xfffffffe,
+                                     &TransferStatus );
+  if ( !EFI_ERROR ( Status )) {
+    Status = TransferStatus;
+  }
+  if ( !EFI_ERROR ( Status )) {
+    pNicDevice->TxFrames += pNicDevice->TxBatchFrames;
+    pNicDevice->TxTransfers++;
+  }
+  else {
+    DEBUG ( EFI_D_ERROR, L"ERROR - Dropped %d frames, Status: %r\r\n",
+            pNicDevice->TxBatchFrames, Status );
+    if ( EFI_TIMEOUT == Status ) {
+      Status = EFI_DEVICE_ERROR;
+    }
+  }
+  pNicDevice->TxBatchLength = 0;
+  pNicDevice->TxBatchFrames = 0;
+  return Status;
+}
+
+
+/**
+  Send the transmit batch if its first frame has waited long enough
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+  @retval EFI_SUCCESS          The frames were sent, or need not be yet
+  @retval other                The transfer failed and the frames were dropped
+
+**/
+EFI_STATUS
+Ax88772TxDeadline (
+  IN NIC_DEVICE * pNicDevice
+  )
+{
+  if (( 0 != pNicDevice->TxBatchFrames )
+    && ( !EFI_ERROR ( gBS->CheckEvent ( pNicDevice->TxDeadline )))) {
+    return Ax88772TxFlush ( pNicDevice );
+  }
+  return EFI_SUCCESS;
+}
+
+
+/**
+  Take the next received frame
+
+  This routine parses the next frame header in place in the receive
+  ring.  Once the current buffer is used up, it sends the frames
+  queued to transmit and fills the next buffer with a bulk in
+  transfer.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+  @param [out] ppFrame         Where the frame is, until the receive ring
+                               comes back around to its buffer
+  @param [out] pLength         Its length in bytes
+
+  @retval EFI_SUCCESS          A frame was received
+  @retval EFI_NOT_READY        No frame was received
+
+**/
+EFI_STATUS
+Ax88772RxFrame (
+  IN NIC_DEVICE * pNicDevice,
+  OUT UINT8 ** ppFrame,
+  OUT UINTN * pLength
+  )
+{
+  RX_BUFFER * pRxBuffer;
+  EFI_USB_IO_PROTOCOL * pUsbIo;
+  EFI_STATUS Status;
+  UINTN LengthInBytes;
+  UINT32 TransferStatus;
+  UINT16 * pHeader;
+  UINTN Length;
+  UINTN Next;
+
+  pRxBuffer = &pNicDevice->RxRing[ pNicDevice->RxCurrent ];
+  if (( pRxBuffer->Offset + 4 ) > pRxBuffer->Length ) {
+    //
+    //  Nothing more is coming to send for now, and the bulk in
+    //  may wait a while: send what is queued first
+    //
+    Ax88772TxFlush ( pNicDevice );
+
+    //
+    //  Fill the next buffer, leaving the frames in the others where
+    //  they are
+    //
+    Next = ( pNicDevice->RxCurrent + 1 ) % RX_RING_SIZE;
+    LengthInBytes = MAX_BULKIN_SIZE;
+    pUsbIo = pNicDevice->pUsbIo;
+    Status = pUsbIo->UsbBulkTransfer ( pUsbIo,
+                                       USB_ENDPOINT_DIR_IN | BULK_IN_ENDPOINT,
+                                       pNicDevice->RxRing[ Next ].pData,
+                                       &LengthInBytes,
+                                       BULKIN_TIMEOUT,
+                                       &TransferStatus );
+    if ( EFI_ERROR ( Status ) || EFI_ERROR ( TransferStatus ) || ( 0 == LengthInBytes )) {
+      return EFI_NOT_READY;
+    }
+    pNicDevice->RxCurrent = Next;
+    pRxBuffer = &pNicDevice->RxRing[ Next ];
+    pRxBuffer->Length = LengthInBytes;
+    pRxBuffer->Offset = 0;
+    pNicDevice->RxTransfers++;
+  }
+
+  //
+  //  The length, and its complement, are in the low 11 bits of each
+  //  half of the header
+  //
+  pHeader = (UINT16 *) &pRxBuffer->pData[ pRxBuffer->Offset ];
+  Length = pHeader[ 0 ] & 0x7ff;
+  if (((( pHeader[ 0 ] ^ pHeader[ 1 ] ) & 0x7ff ) != 0x7ff )
+    || (( pRxBuffer->Offset + 4 + Length ) > pRxBuffer->Length )) {
+    DEBUG (D_ERROR, L"Pkt length error. BufLength = %d\n", pRxBuffer->Length);
+    pRxBuffer->Offset = pRxBuffer->Length;
+    pNicDevice->RxErrors++;
+    return EFI_NOT_READY;
+  }
+  *ppFrame = (UINT8 *) &pHeader[ 2 ];
+  *pLength = Length;
+
+  //
+  //  RXC_RH1M has the device start every header on a double word
+  //
+  pRxBuffer->Offset += 4 + (( Length + 3 ) & ~3 );
+  pNicDevice->RxFrames++;
+  return EFI_SUCCESS;
+}
+
+
 /**
   Reset the AX88772
 
   This routine uses ::Ax88772UsbCommand to reset the network
-  adapter.  This routine also uses ::Ax88772PhyWrite to reset
-  the PHY.
+  adapter and its PHY.  The reset is done in three steps, each of
+  which must be given RESET_DELAY before the next is taken.
 
   @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+  @param [in] Step             0 to select the PHY and power it down, 1 to
+                               take it out of reset, 2 to finish the reset
 
-  @retval EFI_SUCCESS          The MAC address is available.
-  @retval other                The MAC address is not valid.
+  @retval EFI_SUCCESS          The step was taken.
+  @retval other                The adapter did not accept a command.
 
 **/
 EFI_STATUS
 Ax88772Reset (
-  IN NIC_DEVICE * pNicDevice
+  IN NIC_DEVICE * pNicDevice,
+  IN UINTN Step
   )
 {
   USB_DEVICE_REQUEST SetupMsg;
@@ -507,137 +741,332 @@ Ax88772Reset (
   EFI_USB_IO_PROTOCOL *pUsbIo;
   EFI_USB_DEVICE_DESCRIPTOR Device;
 
-  pUsbIo = pNicDevice->pUsbIo;
-  Status = pUsbIo->UsbGetDeviceDescriptor ( pUsbIo, &Device );
-
-	if (EFI_ERROR(Status)) goto err;
-
   SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                           | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_PHY_ACCESS_HARDWARE;
-  SetupMsg.Value = 0;
+                       | USB_TARGET_DEVICE;
   SetupMsg.Index = 0;
   SetupMsg.Length = 0;
-  Status = Ax88772UsbCommand ( pNicDevice,
-                                &SetupMsg,
-                                NULL );
 
-  if (EFI_ERROR(Status)) goto err;
+  switch ( Step ) {
+  case 0:
+    pUsbIo = pNicDevice->pUsbIo;
+    Status = pUsbIo->UsbGetDeviceDescriptor ( pUsbIo, &Device );
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                          | USB_TARGET_DEVICE;
-      SetupMsg.Request = CMD_PHY_SELECT;
-      SetupMsg.Value = SPHY_PSEL;
-      SetupMsg.Index = 0;
-      SetupMsg.Length = 0;
-      Status = Ax88772UsbCommand ( pNicDevice,
-                                    &SetupMsg,
-                                    NULL );
+    if (EFI_ERROR(Status)) goto err;
 
-  if (EFI_ERROR(Status)) goto err;
+    SetupMsg.Request = CMD_PHY_ACCESS_HARDWARE;
+    SetupMsg.Value = 0;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                          | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_RESET;
-      SetupMsg.Value = SRR_IPRL ;
-      SetupMsg.Index = 0;
-      SetupMsg.Length = 0;
+    if (EFI_ERROR(Status)) goto err;
+
+    SetupMsg.Request = CMD_PHY_SELECT;
+    SetupMsg.Value = SPHY_PSEL;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+
+    if (EFI_ERROR(Status)) goto err;
+
+    SetupMsg.Request = CMD_RESET;
+    SetupMsg.Value = SRR_IPRL;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+
+    if (EFI_ERROR(Status)) goto err;
+
+    SetupMsg.Request = CMD_RESET;
+    SetupMsg.Value = SRR_IPPD | SRR_IPRL;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+    break;
+
+  case 1:
+    SetupMsg.Request = CMD_RESET;
+    SetupMsg.Value = SRR_IPRL;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+    break;
+
+  default:
+    SetupMsg.Request = CMD_RESET;
+    SetupMsg.Value = 0;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+
+    if (EFI_ERROR(Status)) goto err;
+
+    SetupMsg.Request = CMD_PHY_SELECT;
+    SetupMsg.Value = SPHY_PSEL;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+
+    if (EFI_ERROR(Status)) goto err;
+
+    SetupMsg.Request = CMD_RESET;
+    SetupMsg.Value = SRR_IPRL | SRR_BZ | SRR_BZTYPE;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+
+    if (EFI_ERROR(Status)) goto err;
+
+    SetupMsg.Request = CMD_RX_CONTROL_WRITE;
+    SetupMsg.Value = 0;
+    Status = Ax88772UsbCommand ( pNicDevice,
+                                 &SetupMsg,
+                                 NULL );
+
+    if (EFI_ERROR(Status)) goto err;
+
+    //
+    //  The receiver is off now, whatever it was set to before
+    //
+    pNicDevice->CurRxControl = 0;
+
+    if (pNicDevice->Flags != FLAG_TYPE_AX88772) {
+      SetupMsg.Request = CMD_RXQTC;
+      SetupMsg.Value = 0x8000;
+      SetupMsg.Index = 0x8001;
       Status = Ax88772UsbCommand ( pNicDevice,
                                    &SetupMsg,
                                    NULL );
+    }
+    break;
+  }
 
-  if (EFI_ERROR(Status)) goto err;
+err:
+  return Status;
+}
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                          | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_RESET;
-        SetupMsg.Value = SRR_IPPD | SRR_IPRL ;
-        SetupMsg.Index = 0;
-        SetupMsg.Length = 0;
-        Status = Ax88772UsbCommand ( pNicDevice,
-                                    &SetupMsg,
-                                    NULL );
 
-  gBS->Stall ( 200000 );
+/**
+  Set the link speed and duplex in the MAC
 
-  if (EFI_ERROR(Status)) goto err;
+  This routine calls ::Ax88772UsbCommand to bring the medium status
+  into line with the speed and duplex the PHY negotiated.
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                          | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_RESET;
-  SetupMsg.Value =  SRR_IPRL  ;
-  SetupMsg.Index = 0;
-  SetupMsg.Length = 0;
-  Status = Ax88772UsbCommand ( pNicDevice,
-                                &SetupMsg,
-                                NULL );
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
 
-  gBS->Stall ( 200000 );
+  @retval EFI_SUCCESS          The medium status matches the link.
+  @retval other                The medium status could not be updated.
 
-  if (EFI_ERROR(Status)) goto err;
+**/
+EFI_STATUS
+Ax88772MediumSet (
+  IN NIC_DEVICE * pNicDevice
+  )
+{
+  UINT16 MediumStatus;
+  UINT16 Mode;
+  USB_DEVICE_REQUEST SetupMsg;
+  EFI_STATUS Status;
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                          | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_RESET;
+  SetupMsg.RequestType = USB_ENDPOINT_DIR_IN
+                       | USB_REQ_TYPE_VENDOR
+                       | USB_TARGET_DEVICE;
+  SetupMsg.Request = CMD_MEDIUM_STATUS_READ;
   SetupMsg.Value = 0;
   SetupMsg.Index = 0;
-  SetupMsg.Length = 0;
+  SetupMsg.Length = sizeof ( MediumStatus );
   Status = Ax88772UsbCommand ( pNicDevice,
-                                    &SetupMsg,
-                                    NULL );
+                               &SetupMsg,
+                               &MediumStatus );
+  if ( !EFI_ERROR ( Status )) {
+    Mode = MediumStatus & ~( MS_TFC | MS_RFC | MS_FD | MS_PS );
+    if ( pNicDevice->bFullDuplex ) {
+      Mode |= MS_TFC | MS_RFC | MS_FD;
+    }
+    if ( pNicDevice->b100Mbps ) {
+      Mode |= MS_PS;
+    }
+    if ( Mode != MediumStatus ) {
+      SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
+                           | USB_TARGET_DEVICE;
+      SetupMsg.Request = CMD_MEDIUM_STATUS_WRITE;
+      SetupMsg.Value = Mode;
+      SetupMsg.Length = 0;
+      Status = Ax88772UsbCommand ( pNicDevice,
+                                   &SetupMsg,
+                                   NULL );
+    }
+  }
+  if ( EFI_ERROR ( Status )) {
+    DEBUG ( EFI_D_ERROR, L"Failed to set the medium status, Status: %r\r\n",
+            Status );
+  }
+  return Status;
+}
 
-  if (EFI_ERROR(Status)) goto err;
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                          | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_PHY_SELECT;
-  SetupMsg.Value = SPHY_PSEL;
-  SetupMsg.Index = 0;
-  SetupMsg.Length = 0;
-  Status = Ax88772UsbCommand ( pNicDevice,
-                                    &SetupMsg,
-                                    NULL );
+/**
+  Start bringing the link up
 
-  if (EFI_ERROR(Status)) goto err;
+  This routine takes the first step of the reset with ::Ax88772Reset
+  and leaves the rest, and the autonegotiation after it, to
+  ::Ax88772LinkTimer.  It returns without waiting for the link.
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                          | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_RESET;
-  SetupMsg.Value =  SRR_IPRL | SRR_BZ | SRR_BZTYPE;
-  SetupMsg.Index = 0;
-  SetupMsg.Length = 0;
-  Status = Ax88772UsbCommand ( pNicDevice,
-                                    &SetupMsg,
-                                    NULL );
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
 
-  if (EFI_ERROR(Status)) goto err;
+  @retval EFI_SUCCESS          The link is on its way up.
+  @retval other                The adapter could not be reset.
 
-  SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                        | USB_TARGET_DEVICE;
-  SetupMsg.Request = CMD_RX_CONTROL_WRITE;
-  SetupMsg.Value = 0;
-  SetupMsg.Index = 0;
-  SetupMsg.Length = 0;
-  Status = Ax88772UsbCommand ( pNicDevice,
-                                  &SetupMsg,
-                                  NULL );
+**/
+EFI_STATUS
+Ax88772LinkStart (
+  IN NIC_DEVICE * pNicDevice
+  )
+{
+  EFI_STATUS Status;
 
-  if (EFI_ERROR(Status)) goto err;
+  Ax88772LinkStop ( pNicDevice );
+  Status = Ax88772Reset ( pNicDevice, 0 );
+  if ( !EFI_ERROR ( Status )) {
+    pNicDevice->LinkState = LINK_STATE_RESET_PHY;
+    gBS->SetTimer ( pNicDevice->LinkTimer, TimerRelative, RESET_DELAY );
+  }
+  return Status;
+}
 
-  if (pNicDevice->Flags != FLAG_TYPE_AX88772) {
-        SetupMsg.RequestType = USB_REQ_TYPE_VENDOR
-                        | USB_TARGET_DEVICE;
-        SetupMsg.Request = CMD_RXQTC;
-        SetupMsg.Value = 0x8000;
-        SetupMsg.Index = 0x8001;
-        SetupMsg.Length = 0;
-        Status = Ax88772UsbCommand ( pNicDevice,
-                                  &SetupMsg,
-                                  NULL );
+
+/**
+  Stop looking after the link
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+**/
+VOID
+Ax88772LinkStop (
+  IN NIC_DEVICE * pNicDevice
+  )
+{
+  gBS->SetTimer ( pNicDevice->LinkTimer, TimerCancel, 0 );
+  pNicDevice->LinkState = LINK_STATE_STOPPED;
+  pNicDevice->bComplete = FALSE;
+  pNicDevice->bLinkUp = FALSE;
+  pNicDevice->SimpleNetwork.Mode->MediaPresent = FALSE;
+}
+
+
+/**
+  Take the next step in bringing the link up, or in watching it
+
+  This is the notify function of the link timer.  It finishes the
+  reset, starts the autonegotiation, polls it every AUTONEG_POLL_DELAY
+  until the link is up, and then checks the link every
+  LINK_CHECK_DELAY.  If the link goes down it polls again until it
+  comes back.  If the adapter fails a command it starts over with
+  a reset.
+
+  @param [in] Event            The link timer
+  @param [in] pContext         Pointer to the NIC_DEVICE structure
+
+**/
+VOID
+EFIAPI
+Ax88772LinkTimer (
+  IN EFI_EVENT Event,
+  IN VOID * pContext
+  )
+{
+  NIC_DEVICE * pNicDevice;
+  BOOLEAN bFullDuplex;
+  BOOLEAN bLinkUp;
+  BOOLEAN bSpeed100;
+  UINT64 Delay;
+  EFI_STATUS Status;
+
+  pNicDevice = (NIC_DEVICE *) pContext;
+  switch ( pNicDevice->LinkState ) {
+  case LINK_STATE_STOPPED:
+    return;
+
+  case LINK_STATE_RESET:
+    Status = Ax88772Reset ( pNicDevice, 0 );
+    pNicDevice->LinkState = LINK_STATE_RESET_PHY;
+    Delay = RESET_DELAY;
+    break;
+
+  case LINK_STATE_RESET_PHY:
+    Status = Ax88772Reset ( pNicDevice, 1 );
+    pNicDevice->LinkState = LINK_STATE_RESET_WAIT;
+    Delay = RESET_DELAY;
+    break;
+
+  case LINK_STATE_RESET_WAIT:
+    Status = Ax88772Reset ( pNicDevice, 2 );
+    if ( !EFI_ERROR ( Status )) {
+      //
+      //  Update the receive filters in the adapter
+      //
+      Status = ReceiveFilterUpdate ( &pNicDevice->SimpleNetwork );
+    }
+    if ( !EFI_ERROR ( Status )) {
+      //
+      //  Start the autonegotiation
+      //
+      Status = Ax88772NegotiateLinkStart ( pNicDevice );
+    }
+    pNicDevice->LinkState = LINK_STATE_NEGOTIATING;
+    Delay = AUTONEG_POLL_DELAY;
+    break;
+
+  default:
+    bLinkUp = (BOOLEAN)( LINK_STATE_UP == pNicDevice->LinkState );
+    bSpeed100 = pNicDevice->b100Mbps;
+    bFullDuplex = pNicDevice->bFullDuplex;
+    Status = Ax88772NegotiateLinkComplete ( pNicDevice,
+                                            &pNicDevice->PollCount,
+                                            &pNicDevice->bComplete,
+                                            &pNicDevice->bLinkUp,
+                                            &pNicDevice->b100Mbps,
+                                            &pNicDevice->bFullDuplex );
+    if ( EFI_ERROR ( Status )) {
+      break;
+    }
+    if ( pNicDevice->bComplete && pNicDevice->bLinkUp ) {
+      //
+      //  The MAC must run at the speed and duplex just negotiated
+      //
+      if (( !bLinkUp )
+        || ( bSpeed100 != pNicDevice->b100Mbps )
+        || ( bFullDuplex != pNicDevice->bFullDuplex )) {
+        Status = Ax88772MediumSet ( pNicDevice );
+        if ( EFI_ERROR ( Status )) {
+          break;
+        }
+        DEBUG (D_INFO , L"Link: Up, %d Mbps, %a duplex\r\n",
+                  pNicDevice->b100Mbps ? 100 : 10, pNicDevice->bFullDuplex ? "Full" : "Half");
+      }
+      pNicDevice->LinkState = LINK_STATE_UP;
+      Delay = LINK_CHECK_DELAY;
+    }
+    else {
+      if ( bLinkUp ) {
+        DEBUG (D_INFO , L"Link: Down\r\n");
+      }
+      pNicDevice->LinkState = LINK_STATE_NEGOTIATING;
+      Delay = AUTONEG_POLL_DELAY;
+    }
+    break;
   }
 
-err:
-  return Status;
+  if ( EFI_ERROR ( Status )) {
+    //
+    //  Start over
+    //
+    DEBUG ( EFI_D_ERROR, L"Link setup failed, resetting, Status: %r\r\n", Status );
+    pNicDevice->LinkState = LINK_STATE_RESET;
+    Delay = RESET_DELAY;
+  }
+  pNicDevice->SimpleNetwork.Mode->MediaPresent = (BOOLEAN)( LINK_STATE_UP == pNicDevice->LinkState );
+  gBS->SetTimer ( pNicDevice->LinkTimer, TimerRelative, Delay );
 }
 
 /**
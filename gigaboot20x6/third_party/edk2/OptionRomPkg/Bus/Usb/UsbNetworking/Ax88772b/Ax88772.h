@@ -21,11 +21,16 @@
 
 #include <Protocol/UsbIo.h>
 
-#define MAX_QUEUE_SIZE 50
 #define MAX_BULKIN_SIZE 16384
-#define HW_HDR_LENGTH 8
+#define RX_RING_SIZE    4         ///<  Bulk in buffers frames are taken from in place
 
-#define MAX_LINKIDLE_THRESHOLD  20000
+#define MAX_TX_BATCH_SIZE 16384   ///<  Most bytes of frames sent in one bulk out transfer
+#define MAX_TX_DONE       64      ///<  Sent buffers waiting for SN_GetStatus to recycle them
+#define TX_FLUSH_DEADLINE 10000   ///<  Longest a queued frame waits to go out, in 100ns units
+
+#define RESET_DELAY        2000000  ///<  Time the adapter is given after each reset step, in 100ns units
+#define AUTONEG_POLL_DELAY 500000   ///<  Between looks at the PHY while it negotiates, in 100ns units
+#define LINK_CHECK_DELAY   10000000 ///<  Between looks at the PHY once the link is up, in 100ns units
 
 /*
  * Exceptionally lazy way of dealing with replacing EDK2's more elaborate debug facilities. gnu-efi
@@ -97,8 +102,6 @@
 
 #define HC_DEBUG  0
 #define BULKIN_TIMEOUT  20
-#define AUTONEG_DELAY   500000
-#define AUTONEG_POLLCNT 20
 
 /**
   Verify new TPL value
@@ -300,6 +303,16 @@
 #define FLAG_TYPE_AX88772B      (1 << 2)
 #define FLAG_EEPROM_MAC         (1 << 3)  // initial mac address in eeprom
 
+//
+//  Link states, stepped through by ::Ax88772LinkTimer
+//
+#define LINK_STATE_STOPPED      0   ///<  Not initialized, the link timer is off
+#define LINK_STATE_RESET        1   ///<  About to reset the adapter
+#define LINK_STATE_RESET_PHY    2   ///<  PHY held in reset, powered down
+#define LINK_STATE_RESET_WAIT   3   ///<  PHY out of reset, settling
+#define LINK_STATE_NEGOTIATING  4   ///<  Waiting for autonegotiation to finish
+#define LINK_STATE_UP           5   ///<  Link up, checked every LINK_CHECK_DELAY
+
 //------------------------------------------------------------------------------
 //  Data Types
 //------------------------------------------------------------------------------
@@ -336,14 +349,17 @@ typedef struct _RX_TX_PACKET {
 #pragma pack()
 
 
-#pragma pack(1)
-typedef struct _RX_PKT {
-  struct _RX_PKT *pNext;
-  BOOLEAN f_Used;
-  UINT16 Length;
-  UINT8 Data [AX88772_MAX_PKT_SIZE] ;
-} RX_PKT;
-#pragma pack()
+/**
+  Receive buffer
+
+  What one bulk in transfer returned: frames, each behind a four
+  byte header and starting on a double word boundary.
+**/
+typedef struct {
+  UINT8 * pData;            ///<  MAX_BULKIN_SIZE bytes
+  UINTN Length;             ///<  Bytes received
+  UINTN Offset;             ///<  Header of the next frame to take
+} RX_BUFFER;
 
 /**
   AX88772 control structure
@@ -371,7 +387,9 @@ typedef struct {
   // Ethernet controller data
   //
   BOOLEAN bInitialized;     ///<  Controller initialized
-  VOID * pTxBuffer;         ///<  Last transmit buffer
+  VOID * pTxDone[ MAX_TX_DONE ];  ///<  Transmit buffers to recycle, oldest at TxDoneHead
+  UINTN TxDoneHead;
+  UINTN TxDoneCount;
   UINT16 PhyId;             ///<  PHY ID
 
   //
@@ -381,14 +399,26 @@ typedef struct {
   BOOLEAN bComplete;        ///<  Current state of auto-negotiation
   BOOLEAN bFullDuplex;      ///<  Current duplex
   BOOLEAN bLinkUp;          ///<  Current link state
-  UINTN  LinkIdleCnt;
   UINTN PollCount;          ///<  Number of times the autonegotiation status was polled
+  UINTN LinkState;          ///<  LINK_STATE_*
+  EFI_EVENT LinkTimer;      ///<  Calls ::Ax88772LinkTimer for the next step
   UINT16 CurRxControl;
   //
   //  Receive buffer list
   //
   RX_TX_PACKET * pRxTest;
-  RX_TX_PACKET * pTxTest;
+
+  //
+  //  Transmit batch: the frames queued by SN_Transmit, each behind its
+  //  length header, sent together in one bulk out transfer
+  //
+  UINT8 * pTxBatch;
+  UINTN TxBatchLength;      ///<  Bytes queued
+  UINTN TxBatchFrames;      ///<  Frames queued
+  EFI_EVENT TxDeadline;     ///<  Signaled once the first frame queued has waited long enough
+  UINT16 BulkOutPacketSize; ///<  Max packet size of the bulk out endpoint
+  UINT64 TxFrames;          ///<  Frames sent
+  UINT64 TxTransfers;       ///<  Bulk out transfers they took
 
   INT8 MulticastHash[8];
   EFI_MAC_ADDRESS MAC;
@@ -396,11 +426,16 @@ typedef struct {
 
   EFI_DEVICE_PATH                  *MyDevPath;
 
-  RX_PKT * QueueHead;
-  RX_PKT * pNextFill;
-  RX_PKT * pFirstFill;
-  UINTN   PktCntInQueue;
-  UINT8 * pBulkInBuff;
+  //
+  //  Receive ring: frames are taken from the current buffer until it
+  //  is used up, and the next one is filled.  A frame stays where it
+  //  is until the ring comes back around to its buffer.
+  //
+  RX_BUFFER RxRing[ RX_RING_SIZE ];
+  UINTN RxCurrent;          ///<  Buffer frames are being taken from
+  UINT64 RxFrames;          ///<  Frames received
+  UINT64 RxTransfers;       ///<  Bulk in transfers that returned any
+  UINT64 RxErrors;          ///<  Transfers with a malformed header, the rest of which was dropped
 
   INT32 Flags;
 
@@ -421,9 +456,9 @@ typedef struct {
   statistics, and the multicast-IP-to-HW MAC addresses are not reset by
   this call.
 
-  This routine calls ::Ax88772Reset to perform the adapter specific
-  reset operation.  This routine also starts the link negotiation
-  by calling ::Ax88772NegotiateLinkStart.
+  This routine calls ::Ax88772LinkStart to begin the adapter specific
+  reset operation.  The rest of it, and the link negotiation, happen
+  in the background: MediaPresent becomes TRUE once the link is up.
 
   @param [in] pSimpleNetwork    Protocol instance pointer
   @param [in] bExtendedVerification  Indicates that the driver may perform a more
@@ -445,6 +480,20 @@ SN_Reset (
   IN BOOLEAN bExtendedVerification
   );
 
+/**
+  Update the network adapter's receive filters and multicast hash
+
+  @param [in] pSimpleNetwork    Simple network mode pointer
+
+  @retval EFI_SUCCESS           This operation was successful.
+  @retval EFI_DEVICE_ERROR      The command could not be sent to the network interface.
+
+**/
+EFI_STATUS
+ReceiveFilterUpdate (
+  IN EFI_SIMPLE_NETWORK * pSimpleNetwork
+  );
+
 /**
   Initialize the simple network protocol.
 
@@ -795,24 +844,175 @@ Ax88772PhyWrite (
   IN UINT16 PhyData
   );
 
+/**
+  Queue a frame to be sent
+
+  This routine copies the frame into the transmit batch behind its
+  length header, first sending the batch with ::Ax88772TxFlush if
+  the frame doesn't fit.  Frames shorter than the minimum are padded.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+  @param [in] pBuffer          The frame
+  @param [in] Length           Its length in bytes
+  @param [out] ppFrame         Where the copy of the frame went
+
+  @retval EFI_SUCCESS          The frame was queued
+  @retval other                Sending the frames queued before it failed,
+                               and neither they nor it will be sent
+
+**/
+EFI_STATUS
+Ax88772TxQueue (
+  IN NIC_DEVICE * pNicDevice,
+  IN VOID * pBuffer,
+  IN UINTN Length,
+  OUT UINT8 ** ppFrame
+  );
+
+/**
+  Send the transmit batch
+
+  Every frame queued by ::Ax88772TxQueue goes out in a single bulk
+  out transfer.  The batch is emptied even if the transfer fails.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+  @retval EFI_SUCCESS          The frames were sent, or there were none
+  @retval other                The transfer failed and the frames were dropped
+
+**/
+EFI_STATUS
+Ax88772TxFlush (
+  IN NIC_DEVICE * pNicDevice
+  );
+
+/**
+  Send the transmit batch if its first frame has waited long enough
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+  @retval EFI_SUCCESS          The frames were sent, or need not be yet
+  @retval other                The transfer failed and the frames were dropped
+
+**/
+EFI_STATUS
+Ax88772TxDeadline (
+  IN NIC_DEVICE * pNicDevice
+  );
+
+/**
+  Take the next received frame
+
+  This routine parses the next frame header in place in the receive
+  ring.  Once the current buffer is used up, it sends the frames
+  queued to transmit and fills the next buffer with a bulk in
+  transfer.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+  @param [out] ppFrame         Where the frame is, until the receive ring
+                               comes back around to its buffer
+  @param [out] pLength         Its length in bytes
+
+  @retval EFI_SUCCESS          A frame was received
+  @retval EFI_NOT_READY        No frame was received
+  @retval other                The bulk in transfer failed
+
+**/
+EFI_STATUS
+Ax88772RxFrame (
+  IN NIC_DEVICE * pNicDevice,
+  OUT UINT8 ** ppFrame,
+  OUT UINTN * pLength
+  );
+
 /**
   Reset the AX88772
 
   This routine uses ::Ax88772UsbCommand to reset the network
-  adapter.  This routine also uses ::Ax88772PhyWrite to reset
-  the PHY.
+  adapter and its PHY.  The reset is done in three steps, each of
+  which must be given RESET_DELAY before the next is taken.
 
   @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+  @param [in] Step             0 to select the PHY and power it down, 1 to
+                               take it out of reset, 2 to finish the reset
 
-  @retval EFI_SUCCESS          The MAC address is available.
-  @retval other                The MAC address is not valid.
+  @retval EFI_SUCCESS          The step was taken.
+  @retval other                The adapter did not accept a command.
 
 **/
 EFI_STATUS
 Ax88772Reset (
+  IN NIC_DEVICE * pNicDevice,
+  IN UINTN Step
+  );
+
+/**
+  Set the link speed and duplex in the MAC
+
+  This routine calls ::Ax88772UsbCommand to bring the medium status
+  into line with the speed and duplex the PHY negotiated.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+  @retval EFI_SUCCESS          The medium status matches the link.
+  @retval other                The medium status could not be updated.
+
+**/
+EFI_STATUS
+Ax88772MediumSet (
   IN NIC_DEVICE * pNicDevice
   );
 
+/**
+  Start bringing the link up
+
+  This routine takes the first step of the reset with ::Ax88772Reset
+  and leaves the rest, and the autonegotiation after it, to
+  ::Ax88772LinkTimer.  It returns without waiting for the link.
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+  @retval EFI_SUCCESS          The link is on its way up.
+  @retval other                The adapter could not be reset.
+
+**/
+EFI_STATUS
+Ax88772LinkStart (
+  IN NIC_DEVICE * pNicDevice
+  );
+
+/**
+  Stop looking after the link
+
+  @param [in] pNicDevice       Pointer to the NIC_DEVICE structure
+
+**/
+VOID
+Ax88772LinkStop (
+  IN NIC_DEVICE * pNicDevice
+  );
+
+/**
+  Take the next step in bringing the link up, or in watching it
+
+  This is the notify function of the link timer.  It finishes the
+  reset, starts the autonegotiation, polls it every AUTONEG_POLL_DELAY
+  until the link is up, and then checks the link every
+  LINK_CHECK_DELAY.  If the link goes down it polls again until it
+  comes back.  If the adapter fails a command it starts over with
+  a reset.
+
+  @param [in] Event            The link timer
+  @param [in] pContext         Pointer to the NIC_DEVICE structure
+
+**/
+VOID
+EFIAPI
+Ax88772LinkTimer (
+  IN EFI_EVENT Event,
+  IN VOID * pContext
+  );
+
 VOID
 Ax88772ChkLink (
   IN NIC_DEVICE * pNicDevice,
@@ -1019,12 +1219,6 @@ GetControllerName (
   OUT CHAR16 ** ppControllerName
   );
 
-VOID
-FillPkt2Queue (
-  IN EFI_SIMPLE_NETWORK * pSimpleNetwork,
-  IN UINTN BufLength
-);
-
 extern EFI_BOOT_SERVICES* gBS;
 #define EFI_D_INFO D_INIT
 #define EFI_D_ERROR D_ERROR
@@ -496,22 +496,27 @@ DriverStop (
         }
         else {
             int i;
-            RX_PKT * pCurr = pNicDevice->QueueHead;
-            RX_PKT * pFree;
-
-            for ( i = 0 ; i < MAX_QUEUE_SIZE ; i++) {
-                 if ( NULL != pCurr ) {
-                    pFree = pCurr;
-                    pCurr = pCurr->pNext;
-                    gBS->FreePool (pFree);
+
+            //
+            //  Stop the link timer first, so it can't run on what is freed
+            //
+            if ( NULL != pNicDevice->LinkTimer )
+                gBS->CloseEvent (pNicDevice->LinkTimer);
+
+            for ( i = 0 ; i < RX_RING_SIZE ; i++) {
+                 if ( NULL != pNicDevice->RxRing[ i ].pData ) {
+                    gBS->FreePool (pNicDevice->RxRing[ i ].pData);
                  }
             }
 
             if ( NULL != pNicDevice->pRxTest)
 						    gBS->FreePool (pNicDevice->pRxTest);
 
-					 if ( NULL != pNicDevice->pTxTest)
-						    gBS->FreePool (pNicDevice->pTxTest);
+					 if ( NULL != pNicDevice->pTxBatch)
+						    gBS->FreePool (pNicDevice->pTxBatch);
+
+					 if ( NULL != pNicDevice->TxDeadline)
+						    gBS->CloseEvent (pNicDevice->TxDeadline);
 
            if ( NULL != pNicDevice->MyDevPath)
 					       gBS->FreePool (pNicDevice->MyDevPath);
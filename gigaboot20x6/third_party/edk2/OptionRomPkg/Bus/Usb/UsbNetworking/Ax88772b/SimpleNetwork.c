@@ -122,9 +122,6 @@ SN_GetStatus (
   EFI_SIMPLE_NETWORK_MODE * pMode;
   NIC_DEVICE * pNicDevice;
   EFI_STATUS Status;
-  BOOLEAN bFullDuplex;
-  BOOLEAN bLinkUp;
-  BOOLEAN bSpeed100;
   EFI_TPL TplPrevious;
 
   TplPrevious = gBS->RaiseTPL(TPL_CALLBACK);
@@ -137,63 +134,25 @@ SN_GetStatus (
     //
 
     pNicDevice = DEV_FROM_SIMPLE_NETWORK ( pSimpleNetwork );
-    if (( NULL != ppTxBuf ) && ( NULL != pNicDevice->pTxBuffer )) {
-     		 *ppTxBuf = pNicDevice->pTxBuffer;
-     		 pNicDevice->pTxBuffer = NULL;
-   	}
+    if ( NULL != ppTxBuf ) {
+      *ppTxBuf = NULL;
+      if ( 0 != pNicDevice->TxDoneCount ) {
+        *ppTxBuf = pNicDevice->pTxDone[ pNicDevice->TxDoneHead ];
+        pNicDevice->TxDoneHead = ( pNicDevice->TxDoneHead + 1 ) % MAX_TX_DONE;
+        pNicDevice->TxDoneCount--;
+      }
+    }
 
     //
     // Determine if interface is running
     //
     pMode = pSimpleNetwork->Mode;
     if ( EfiSimpleNetworkInitialized == pMode->State ) {
+      //
+      //  Send the frames that have waited long enough
+      //
+      Ax88772TxDeadline ( pNicDevice );
 
-      if ( pNicDevice->LinkIdleCnt > MAX_LINKIDLE_THRESHOLD) {
-
-          bLinkUp = pNicDevice->bLinkUp;
-          bSpeed100 = pNicDevice->b100Mbps;
-          bFullDuplex = pNicDevice->bFullDuplex;
-          Status = Ax88772NegotiateLinkComplete ( pNicDevice,
-                                            &pNicDevice->PollCount,
-                                            &pNicDevice->bComplete,
-                                            &pNicDevice->bLinkUp,
-                                            &pNicDevice->b100Mbps,
-                                            &pNicDevice->bFullDuplex );
-
-          //
-          // Determine if the autonegotiation is complete
-          //
-          if ( pNicDevice->bComplete ) {
-              if ( pNicDevice->bLinkUp ) {
-                  if (( bSpeed100 && ( !pNicDevice->b100Mbps ))
-                      || (( !bSpeed100 ) && pNicDevice->b100Mbps )
-                      || ( bFullDuplex && ( !pNicDevice->bFullDuplex ))
-                      || (( !bFullDuplex ) && pNicDevice->bFullDuplex )) {
-                          pNicDevice->PollCount = 0;
-                          DEBUG (D_INFO , L"Reset to establish proper link setup: %d Mbps, %a duplex\r\n",
-                                    pNicDevice->b100Mbps ? 100 : 10, pNicDevice->bFullDuplex ? "Full" : "Half");
-                          Status = SN_Reset ( &pNicDevice->SimpleNetwork, FALSE );
-                  }
-                  if (( !bLinkUp ) && pNicDevice->bLinkUp ) {
-                      //
-                      // Display the autonegotiation status
-                      //
-                      DEBUG (D_INFO , L"Link: Up, %d Mbps, %a duplex\r\n",
-                                pNicDevice->b100Mbps ? 100 : 10, pNicDevice->bFullDuplex ? "Full" : "Half");
-
-                  }
-                  pNicDevice->LinkIdleCnt = 0;
-            }
-        }
-        //
-        //  Update the link status
-        //
-        if ( bLinkUp && ( !pNicDevice->bLinkUp )) {
-            DEBUG (D_INFO , L"Link: Down\r\n");
-        }
-      }
-
-      pMode->MediaPresent = pNicDevice->bLinkUp;
       //
       // Return the interrupt status
       //
@@ -416,49 +375,6 @@ SN_NvData (
   return Status;
 }
 
-VOID
-FillPkt2Queue (
-  IN EFI_SIMPLE_NETWORK * pSimpleNetwork,
-  IN UINTN BufLength)
-{
-
-  UINT16 * pLength;
-  UINT16 * pLengthBar;
-  UINT8* pData;
-  UINT32 offset;
-  NIC_DEVICE * pNicDevice;
-
-  pNicDevice = DEV_FROM_SIMPLE_NETWORK ( pSimpleNetwork);
-  for ( offset = 0; offset < BufLength; ){
-      pLength = (UINT16*) (pNicDevice->pBulkInBuff + offset);
-      pLengthBar = (UINT16*) (pNicDevice->pBulkInBuff + offset +2);
-
-      *pLength &= 0x7ff;
-      *pLengthBar &= 0x7ff;
-      *pLengthBar |= 0xf800;
-
-      if ((*pLength ^ *pLengthBar ) != 0xFFFF) {
-          DEBUG (D_ERROR, L"Pkt length error. BufLength = %d\n", BufLength);
-          return;
-      }
-
-      if (TRUE == pNicDevice->pNextFill->f_Used) {
-        return;
-      }
-      else {
-          pData = pNicDevice->pBulkInBuff + offset + 4;
-          pNicDevice->pNextFill->f_Used = TRUE;
-          pNicDevice->pNextFill->Length = *pLength;
-          CopyMem (&pNicDevice->pNextFill->Data[0], pData, *pLength);
-
-          pNicDevice->pNextFill = pNicDevice->pNextFill->pNext;
-          offset += ((*pLength + HW_HDR_LENGTH - 1) &~3) + 1;
-          pNicDevice->PktCntInQueue++;
-      }
-
-  }
-}
-
 EFI_STATUS
 EFIAPI
 SN_Receive (
@@ -476,10 +392,8 @@ SN_Receive (
   EFI_STATUS Status;
   EFI_TPL TplPrevious;
   UINT16 Type;
-  EFI_USB_IO_PROTOCOL *pUsbIo;
-  UINTN LengthInBytes;
-  UINT32 TransferStatus;
-  RX_PKT * pFirstFill;
+  UINT8 * pFrame;
+  UINTN Length;
   TplPrevious = gBS->RaiseTPL (TPL_CALLBACK);
 
   //
@@ -495,64 +409,35 @@ SN_Receive (
     pMode = pSimpleNetwork->Mode;
     if ( EfiSimpleNetworkInitialized == pMode->State ) {
       //
-      // Update the link status
+      // The link timer keeps the link status up to date
       //
       pNicDevice = DEV_FROM_SIMPLE_NETWORK ( pSimpleNetwork );
-      pNicDevice->LinkIdleCnt++;
-      pMode->MediaPresent = pNicDevice->bLinkUp;
-
       if ( pMode->MediaPresent && pNicDevice->bComplete) {
-
-
-        if (pNicDevice->PktCntInQueue != 0 ) {
-            DEBUG (D_INFO, L"pNicDevice->PktCntInQueue = %d\n",
-                pNicDevice->PktCntInQueue);
-        }
-
-        LengthInBytes = MAX_BULKIN_SIZE;
-        if (pNicDevice->PktCntInQueue == 0 ){
-            //
-            // Attempt to do bulk in
-            //
-            SetMem (&pNicDevice->pBulkInBuff[0], 4, 0);
-            pUsbIo = pNicDevice->pUsbIo;
-            Status = pUsbIo->UsbBulkTransfer ( pUsbIo,
-                                       USB_ENDPOINT_DIR_IN | BULK_IN_ENDPOINT,
-                                       &pNicDevice->pBulkInBuff[0],
-                                       &LengthInBytes,
-                                       BULKIN_TIMEOUT,
-                                       &TransferStatus );
-
-            if (LengthInBytes != 0 && !EFI_ERROR(Status) && !EFI_ERROR(TransferStatus) ){
-                FillPkt2Queue(pSimpleNetwork, LengthInBytes);
-            }
-        }
-
-        pFirstFill = pNicDevice->pFirstFill;
-
-        if (TRUE == pFirstFill->f_Used) {
+        //
+        //  Copy the frame straight out of the receive ring
+        //
+        Status = Ax88772RxFrame ( pNicDevice, &pFrame, &Length );
+        if ( !EFI_ERROR ( Status )) {
             ETHERNET_HEADER * pHeader;
-            pNicDevice->LinkIdleCnt = 0;
-            CopyMem (pBuffer,  &pFirstFill->Data[0], pFirstFill->Length);
-            pHeader = (ETHERNET_HEADER *) &pFirstFill->Data[0];
+            pHeader = (ETHERNET_HEADER *) pFrame;
 
             DEBUG (D_INFO, L"RX: %02x-%02x-%02x-%02x-%02x-%02x "
                       "%02x-%02x-%02x-%02x-%02x-%02x  %02x-%02x  %d bytes\r\n",
-                      pFirstFill->Data[0],
-                      pFirstFill->Data[1],
-                      pFirstFill->Data[2],
-                      pFirstFill->Data[3],
-                      pFirstFill->Data[4],
-                      pFirstFill->Data[5],
-                      pFirstFill->Data[6],
-                      pFirstFill->Data[7],
-                      pFirstFill->Data[8],
-                      pFirstFill->Data[9],
-                      pFirstFill->Data[10],
-                      pFirstFill->Data[11],
-                      pFirstFill->Data[12],
-                      pFirstFill->Data[13],
-                      pFirstFill->Length);
+                      pFrame[0],
+                      pFrame[1],
+                      pFrame[2],
+                      pFrame[3],
+                      pFrame[4],
+                      pFrame[5],
+                      pFrame[6],
+                      pFrame[7],
+                      pFrame[8],
+                      pFrame[9],
+                      pFrame[10],
+                      pFrame[11],
+                      pFrame[12],
+                      pFrame[13],
+                      Length);
 
             if ( NULL != pHeaderSize ) {
               *pHeaderSize = sizeof ( *pHeader );
@@ -568,18 +453,16 @@ SN_Receive (
               Type = (UINT16)(( Type >> 8 ) | ( Type << 8 ));
               *pProtocol = Type;
             }
-            Status = EFI_SUCCESS;
-            if (*pBufferSize < pFirstFill->Length) {
+            if (*pBufferSize < Length) {
                   DEBUG (D_ERROR, L"RX: Buffer was too small");
                   Status = EFI_BUFFER_TOO_SMALL;
             }
-            *pBufferSize =  pFirstFill->Length;
-            pFirstFill->f_Used = FALSE;
-            pNicDevice->pFirstFill = pFirstFill->pNext;
-            pNicDevice->PktCntInQueue--;
+            else {
+                  CopyMem (pBuffer, pFrame, Length);
+            }
+            *pBufferSize = Length;
         }
         else {
-            pNicDevice->LinkIdleCnt++;
             Status = EFI_NOT_READY;
         }
       }
@@ -587,7 +470,6 @@ SN_Receive (
         //
         //  Link no up
         //
-        pNicDevice->LinkIdleCnt++;
         Status = EFI_NOT_READY;
       }
 
@@ -804,9 +686,9 @@ SN_ReceiveFilters (
   statistics, and the multicast-IP-to-HW MAC addresses are not reset by
   this call.
 
-  This routine calls ::Ax88772Reset to perform the adapter specific
-  reset operation.  This routine also starts the link negotiation
-  by calling ::Ax88772NegotiateLinkStart.
+  This routine calls ::Ax88772LinkStart to begin the adapter specific
+  reset operation.  The rest of it, and the link negotiation, happen
+  in the background: MediaPresent becomes TRUE once the link is up.
 
   @param [in] pSimpleNetwork    Protocol instance pointer
   @param [in] bExtendedVerification  Indicates that the driver may perform a more
@@ -844,32 +726,19 @@ SN_Reset (
     	//  Update the device state
     	//
     	pNicDevice = DEV_FROM_SIMPLE_NETWORK ( pSimpleNetwork );
-    	pNicDevice->bComplete = FALSE;
-    	pNicDevice->bLinkUp = FALSE;
     	pNicDevice->bHavePkt = FALSE;
-    	pMode = pSimpleNetwork->Mode;
-    	pMode->MediaPresent = FALSE;
 
     	//
-   		//  Reset the device
+    	//  Drop the frames not yet sent
+    	//
+    	gBS->SetTimer ( pNicDevice->TxDeadline, TimerCancel, 0 );
+    	pNicDevice->TxBatchLength = 0;
+    	pNicDevice->TxBatchFrames = 0;
+
+    	//
+   		//  Reset the device and bring the link up, in the background
     	//
-    	Status = Ax88772Reset ( pNicDevice );
-    	if ( !EFI_ERROR ( Status )) {
-     	 	//
-     	 	//  Update the receive filters in the adapter
-     	 	//
-     	 	Status = ReceiveFilterUpdate ( pSimpleNetwork );
-
-     	 	//
-     		 //  Try to get a connection to the network
-     	 	//
-     	 	if ( !EFI_ERROR ( Status )) {
-        	//
-        	//  Start the autonegotiation
-       		//
-        	Status = Ax88772NegotiateLinkStart ( pNicDevice );
-     		}
-   	 	}
+    	Status = Ax88772LinkStart ( pNicDevice );
    	}
    	else {
       if (EfiSimpleNetworkStarted == pMode->State) {
@@ -908,8 +777,10 @@ SN_Setup (
   EFI_SIMPLE_NETWORK_MODE * pMode;
   EFI_SIMPLE_NETWORK * pSimpleNetwork;
   EFI_STATUS Status;
-  RX_PKT * pCurr = NULL;
-  RX_PKT * pPrev = NULL;
+  EFI_USB_IO_PROTOCOL * pUsbIo;
+  EFI_USB_INTERFACE_DESCRIPTOR Interface;
+  EFI_USB_ENDPOINT_DESCRIPTOR Endpoint;
+  UINT8 Index;
 
   pSimpleNetwork = &pNicDevice->SimpleNetwork;
   pSimpleNetwork->Revision = EFI_SIMPLE_NETWORK_INTERFACE_REVISION;
@@ -949,10 +820,10 @@ SN_Setup (
            0xff );
   pMode->IfType = EfiNetworkInterfaceUndi;
   pMode->MacAddressChangeable = TRUE;
-  pMode->MultipleTxSupported = FALSE;
+  pMode->MultipleTxSupported = TRUE;
   pMode->MediaPresentSupported = TRUE;
   pMode->MediaPresent = FALSE;
-  pNicDevice->LinkIdleCnt = 0;
+  pNicDevice->LinkState = LINK_STATE_STOPPED;
   //
   //  Read the MAC address
   //
@@ -978,44 +849,20 @@ SN_Setup (
               &pMode->PermanentAddress,
               PXE_HWADDR_LEN_ETHER );
 
-    pNicDevice->PktCntInQueue = 0;
+    for ( i = 0 ; i < RX_RING_SIZE ; i++) {
+        Status = gBS->AllocatePool (EfiRuntimeServicesData,
+                                    MAX_BULKIN_SIZE,
+                                    (VOID **) &pNicDevice->RxRing[ i ].pData);
 
-    for ( i = 0 ; i < MAX_QUEUE_SIZE ; i++) {
-        Status = gBS->AllocatePool ( EfiRuntimeServicesData,
-                                      sizeof (RX_PKT),
-                                      (VOID **) &pCurr);
-        if ( EFI_ERROR(Status)) {
-            DEBUG (D_ERROR, L"Memory are not enough\n");
+        if (EFI_ERROR(Status)) {
+            DEBUG (D_ERROR, L"gBS->AllocatePool for RxRing error. Status = %r\n",
+                  Status);
             return Status;
         }
-        pCurr->f_Used = FALSE;
-
-        if ( i ) {
-            pPrev->pNext = pCurr;
-        }
-        else {
-            pNicDevice->QueueHead = pCurr;
-        }
-
-        if (MAX_QUEUE_SIZE - 1 == i) {
-            pCurr->pNext = pNicDevice->QueueHead;
-        }
-
-        pPrev = pCurr;
-    }
-
-    pNicDevice->pNextFill = pNicDevice->QueueHead;
-    pNicDevice->pFirstFill = pNicDevice->QueueHead;
-
-    Status = gBS->AllocatePool (EfiRuntimeServicesData,
-                                MAX_BULKIN_SIZE,
-                                (VOID **) &pNicDevice->pBulkInBuff);
-
-    if (EFI_ERROR(Status)) {
-        DEBUG (D_ERROR, L"gBS->AllocatePool for pBulkInBuff error. Status = %r\n",
-              Status);
-        return Status;
+        pNicDevice->RxRing[ i ].Length = 0;
+        pNicDevice->RxRing[ i ].Offset = 0;
     }
+    pNicDevice->RxCurrent = 0;
   }
   else {
     DEBUG (D_ERROR, L"Ax88772MacAddressGet error. Status = %r\n", Status);
@@ -1033,13 +880,63 @@ SN_Setup (
   }
 
   Status = gBS->AllocatePool ( EfiRuntimeServicesData,
-                                   sizeof ( RX_TX_PACKET ),
-                                   (VOID **) &pNicDevice->pTxTest );
+                                   MAX_TX_BATCH_SIZE,
+                                   (VOID **) &pNicDevice->pTxBatch );
+
+  if (EFI_ERROR (Status)) {
+    DEBUG (D_ERROR, L"gBS->AllocatePool:pNicDevice->pTxBatch error. Status = %r\n",
+              Status);
+	  gBS->FreePool (pNicDevice->pRxTest);
+	  return Status;
+  }
+  pNicDevice->TxBatchLength = 0;
+  pNicDevice->TxBatchFrames = 0;
+  pNicDevice->TxDoneHead = 0;
+  pNicDevice->TxDoneCount = 0;
+
+  Status = gBS->CreateEvent ( EVT_TIMER,
+                              0,
+                              NULL,
+                              NULL,
+                              &pNicDevice->TxDeadline );
+
+  if (EFI_ERROR (Status)) {
+    DEBUG (D_ERROR, L"gBS->CreateEvent:pNicDevice->TxDeadline error. Status = %r\n",
+              Status);
+	  gBS->FreePool (pNicDevice->pTxBatch);
+	  gBS->FreePool (pNicDevice->pRxTest);
+	  return Status;
+  }
+
+  Status = gBS->CreateEvent ( EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                              TPL_CALLBACK,
+                              Ax88772LinkTimer,
+                              pNicDevice,
+                              &pNicDevice->LinkTimer );
 
   if (EFI_ERROR (Status)) {
-    DEBUG (D_ERROR, L"gBS->AllocatePool:pNicDevice->pTxTest error. Status = %r\n",
+    DEBUG (D_ERROR, L"gBS->CreateEvent:pNicDevice->LinkTimer error. Status = %r\n",
               Status);
+	  gBS->CloseEvent (pNicDevice->TxDeadline);
+	  gBS->FreePool (pNicDevice->pTxBatch);
 	  gBS->FreePool (pNicDevice->pRxTest);
+	  return Status;
+  }
+
+  //
+  //  A frame ending a packet of the bulk out endpoint needs a null
+  //  header after it, so find out how big they are
+  //
+  pNicDevice->BulkOutPacketSize = 512;
+  pUsbIo = pNicDevice->pUsbIo;
+  if ( !EFI_ERROR ( pUsbIo->UsbGetInterfaceDescriptor ( pUsbIo, &Interface ))) {
+    for ( Index = 0 ; Index < Interface.NumEndpoints ; Index++ ) {
+      if (( !EFI_ERROR ( pUsbIo->UsbGetEndpointDescriptor ( pUsbIo, Index, &Endpoint )))
+        && ( BULK_OUT_ENDPOINT == Endpoint.EndpointAddress )
+        && ( 0 != Endpoint.MaxPacketSize )) {
+        pNicDevice->BulkOutPacketSize = Endpoint.MaxPacketSize;
+      }
+    }
   }
 
   return Status;
@@ -1070,7 +967,6 @@ SN_Start (
   EFI_STATUS Status;
   EFI_TPL TplPrevious;
   int i = 0;
-  RX_PKT * pCurr = NULL;
 
   TplPrevious = gBS->RaiseTPL(TPL_CALLBACK);
   //
@@ -1105,17 +1001,14 @@ SN_Start (
       SetMem(&pMode->BroadcastAddress, PXE_HWADDR_LEN_ETHER, 0xff);
       pMode->IfType = EfiNetworkInterfaceUndi;
       pMode->MacAddressChangeable = TRUE;
-      pMode->MultipleTxSupported = FALSE;
+      pMode->MultipleTxSupported = TRUE;
       pMode->MediaPresentSupported = TRUE;
       pMode->MediaPresent = FALSE;
-      pNicDevice->PktCntInQueue = 0;
-      pNicDevice->pNextFill = pNicDevice->QueueHead;
-      pNicDevice->pFirstFill = pNicDevice->QueueHead;
-      pCurr = pNicDevice->QueueHead;
-
-      for ( i = 0 ; i < MAX_QUEUE_SIZE ; i++) {
-        pCurr->f_Used = FALSE;
-        pCurr = pCurr->pNext;
+      pNicDevice->RxCurrent = 0;
+
+      for ( i = 0 ; i < RX_RING_SIZE ; i++) {
+        pNicDevice->RxRing[ i ].Length = 0;
+        pNicDevice->RxRing[ i ].Offset = 0;
       }
 
     }
@@ -1393,7 +1286,7 @@ SN_Shutdown (
   )
 {
   EFI_SIMPLE_NETWORK_MODE * pMode;
-  UINT32 RxFilter;
+  NIC_DEVICE * pNicDevice;
   EFI_STATUS Status;
   EFI_TPL TplPrevious;
 
@@ -1408,12 +1301,13 @@ SN_Shutdown (
     pMode = pSimpleNetwork->Mode;
     if ( EfiSimpleNetworkInitialized == pMode->State ) {
       //
-      // Stop the adapter
+      // Send what is queued, then stop the adapter, leaving its
+      // PHY powered down until the next Initialize
       //
-      RxFilter = pMode->ReceiveFilterSetting;
-      pMode->ReceiveFilterSetting = 0;
-      Status = SN_Reset ( pSimpleNetwork, FALSE );
-      pMode->ReceiveFilterSetting = RxFilter;
+      pNicDevice = DEV_FROM_SIMPLE_NETWORK ( pSimpleNetwork );
+      Ax88772TxFlush ( pNicDevice );
+      Ax88772LinkStop ( pNicDevice );
+      Status = Ax88772Reset ( pNicDevice, 0 );
       if ( !EFI_ERROR ( Status )) {
 
         //
@@ -1495,10 +1389,8 @@ SN_Transmit (
   ETHERNET_HEADER * pHeader;
   EFI_SIMPLE_NETWORK_MODE * pMode;
   NIC_DEVICE * pNicDevice;
-  EFI_USB_IO_PROTOCOL * pUsbIo;
   EFI_STATUS Status;
-  UINTN TransferLength;
-  UINT32 TransferStatus;
+  UINT8 * pFrame;
   UINT16 Type;
   EFI_TPL TplPrevious;
 
@@ -1524,101 +1416,75 @@ SN_Transmit (
       if (BufferSize >= pMode->MediaHeaderSize){
         if ( EfiSimpleNetworkInitialized == pMode->State ) {
           //
-          // Update the link status
+          // The link timer keeps the link status up to date
           //
           pNicDevice = DEV_FROM_SIMPLE_NETWORK ( pSimpleNetwork );
-          pMode->MediaPresent = pNicDevice->bLinkUp;
-
-          //
-          //  Release the synchronization with Ax88772Timer
-          //
           if ( pMode->MediaPresent && pNicDevice->bComplete) {
             //
-            //  Copy the packet into the USB buffer
-            //
-
-            CopyMem ( &pNicDevice->pTxTest->Data[0], pBuffer, BufferSize );
-            pNicDevice->pTxTest->Length = (UINT16) BufferSize;
-
-            //
-            //  Transmit the packet
+            //  The caller gets the buffer back from GetStatus, so there
+            //  must be room to remember it
             //
-            pHeader = (ETHERNET_HEADER *) &pNicDevice->pTxTest->Data[0];
-            if ( 0 != HeaderSize ) {
-              if ( NULL != pDestAddr ) {
-                CopyMem ( &pHeader->dest_addr, pDestAddr, PXE_HWADDR_LEN_ETHER );
-              }
-              if ( NULL != pSrcAddr ) {
-                CopyMem ( &pHeader->src_addr, pSrcAddr, PXE_HWADDR_LEN_ETHER );
-              }
-              else {
-                CopyMem ( &pHeader->src_addr, &pMode->CurrentAddress.Addr[0], PXE_HWADDR_LEN_ETHER );
-              }
-              if ( NULL != pProtocol ) {
-                Type = *pProtocol;
-              }
-              else {
-                Type = pNicDevice->pTxTest->Length;
-              }
-              Type = (UINT16)(( Type >> 8 ) | ( Type << 8 ));
-              pHeader->type = Type;
+            if ( MAX_TX_DONE == pNicDevice->TxDoneCount ) {
+              Ax88772TxFlush ( pNicDevice );
+              Status = EFI_NOT_READY;
             }
-            if ( pNicDevice->pTxTest->Length < MIN_ETHERNET_PKT_SIZE ) {
-              pNicDevice->pTxTest->Length = MIN_ETHERNET_PKT_SIZE;
-              ZeroMem ( &pNicDevice->pTxTest->Data[ BufferSize ],
-                        pNicDevice->pTxTest->Length - BufferSize );
+            else {
+              //
+              //  Copy the packet into the transmit batch
+              //
+              Status = Ax88772TxQueue ( pNicDevice, pBuffer, BufferSize, &pFrame );
             }
-
-            DEBUG (D_INFO, L"TX: %02x-%02x-%02x-%02x-%02x-%02x  %02x-%02x-%02x-%02x-%02x-%02x"
-                      "  %02x-%02x  %d bytes\r\n",
-                      pNicDevice->pTxTest->Data[0],
-                      pNicDevice->pTxTest->Data[1],
-                      pNicDevice->pTxTest->Data[2],
-                      pNicDevice->pTxTest->Data[3],
-                      pNicDevice->pTxTest->Data[4],
-                      pNicDevice->pTxTest->Data[5],
-                      pNicDevice->pTxTest->Data[6],
-                      pNicDevice->pTxTest->Data[7],
-                      pNicDevice->pTxTest->Data[8],
-                      pNicDevice->pTxTest->Data[9],
-                      pNicDevice->pTxTest->Data[10],
-                      pNicDevice->pTxTest->Data[11],
-                      pNicDevice->pTxTest->Data[12],
-                      pNicDevice->pTxTest->Data[13],
-                      pNicDevice->pTxTest->Length);
-
-            pNicDevice->pTxTest->LengthBar = ~(pNicDevice->pTxTest->Length);
-            TransferLength = sizeof ( pNicDevice->pTxTest->Length )
-                           + sizeof ( pNicDevice->pTxTest->LengthBar )
-                           + pNicDevice->pTxTest->Length;
-
-            if (TransferLength % 512 == 0 || TransferLength % 1024 == 0)
-                TransferLength +=4;
-
-            //
-            //  Work around USB bus driver bug where a timeout set by receive
-            //  succeeds but the timeout expires immediately after, causing the
-            //  transmit operation to timeout.
-            //
-            pUsbIo = pNicDevice->pUsbIo;
-            Status = pUsbIo->UsbBulkTransfer ( pUsbIo,
-                                               BULK_OUT_ENDPOINT,
-                                               &pNicDevice->pTxTest->Length,
-                                               &TransferLength,
-                                               0xfffffffe,
-                                               &TransferStatus );
             if ( !EFI_ERROR ( Status )) {
-              Status = TransferStatus;
-            }
+              //
+              //  Fill in the media header of the copy
+              //
+              pHeader = (ETHERNET_HEADER *) pFrame;
+              if ( 0 != HeaderSize ) {
+                if ( NULL != pDestAddr ) {
+                  CopyMem ( &pHeader->dest_addr, pDestAddr, PXE_HWADDR_LEN_ETHER );
+                }
+                if ( NULL != pSrcAddr ) {
+                  CopyMem ( &pHeader->src_addr, pSrcAddr, PXE_HWADDR_LEN_ETHER );
+                }
+                else {
+                  CopyMem ( &pHeader->src_addr, &pMode->CurrentAddress.Addr[0], PXE_HWADDR_LEN_ETHER );
+                }
+                if ( NULL != pProtocol ) {
+                  Type = *pProtocol;
+                }
+                else {
+                  Type = (UINT16) BufferSize;
+                }
+                Type = (UINT16)(( Type >> 8 ) | ( Type << 8 ));
+                pHeader->type = Type;
+              }
 
-            if ( !EFI_ERROR ( Status )) {
-              pNicDevice->pTxBuffer = pBuffer;
+              DEBUG (D_INFO, L"TX: %02x-%02x-%02x-%02x-%02x-%02x  %02x-%02x-%02x-%02x-%02x-%02x"
+                        "  %02x-%02x  %d bytes\r\n",
+                        pFrame[0],
+                        pFrame[1],
+                        pFrame[2],
+                        pFrame[3],
+                        pFrame[4],
+                        pFrame[5],
+                        pFrame[6],
+                        pFrame[7],
+                        pFrame[8],
+                        pFrame[9],
+                        pFrame[10],
+                        pFrame[11],
+                        pFrame[12],
+                        pFrame[13],
+                        BufferSize);
+
+              //
+              //  The frame goes out with the batch, but the caller's
+              //  buffer is already free
+              //
+              pNicDevice->pTxDone[( pNicDevice->TxDoneHead + pNicDevice->TxDoneCount ) % MAX_TX_DONE ] = pBuffer;
+              pNicDevice->TxDoneCount++;
             }
-            else {
-              if ((TransferLength != (UINTN)( pNicDevice->pTxTest->Length + 4 )) &&
-                   (TransferLength != (UINTN)(( pNicDevice->pTxTest->Length + 4 ) + 4))) {
-                DEBUG (D_INFO, L"TransferLength didn't match Packet Length\n");
-              }
+            else if ( EFI_NOT_READY != Status ) {
               //
               //  Reset the controller to fix the error
               //